@@ -2,7 +2,7 @@
 #define SMP_LIB_H
 
 /*
- * Copyright (c) 2006-2023 Douglas Gilbert.
+ * Copyright (c) 2006-2026 Douglas Gilbert.
  * All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
@@ -126,6 +126,7 @@ extern "C" {
 #define SMP_LIB_SYNTAX_ERROR 91
 #define SMP_LIB_FILE_ERROR 92
 #define SMP_LIB_RESOURCE_ERROR 93
+#define SMP_LIB_CAT_TIMEOUT 94
 #define SMP_LIB_CAT_MALFORMED 97
 #define SMP_LIB_CAT_OTHER 99
 
@@ -163,8 +164,15 @@ struct smp_req_resp {
     unsigned char * response;   /* [*o] */
     int act_response_len;       /* [o] -1 implies don't know */
     int transport_err;          /* [o] 0 implies no error */
+    int timeout_ms;             /* [i] 0 implies pass-through default */
+    int64_t deadline_ms;        /* [i] absolute, on smp_get_mono_ms() clock;
+                                       0 implies no deadline */
+    bool timed_out;             /* [o] timeout or deadline expired */
 };
 
+/* The pass-through default timeout when timeout_ms is 0 */
+#define SMP_DEF_TIMEOUT_MS 20000
+
 #if (__STDC_VERSION__ >= 199901L)  /* C99 or later */
     typedef uintptr_t smp_uintptr_t;
 #else
@@ -190,12 +198,954 @@ int smp_send_req(const struct smp_target_obj * tobj,
  * on success, else -1 . */
 int smp_initiator_close(struct smp_target_obj * tobj);
 
+/* Opens the SMP target (e.g. another expander in the same SAS domain) whose
+ * SAS address is sa, using the same pass-through as the already opened
+ * base. Pass-throughs that route by SAS address reuse base's device (and
+ * subvalue); in Linux the bsg pass-through looks for the expander with that
+ * SAS address in sysfs. Returns 0 on success, else -1 (e.g. when the
+ * pass-through cannot reach other SMP targets this way). */
+int smp_initiator_open_sa(const struct smp_target_obj * base, uint64_t sa,
+                          struct smp_target_obj * tobj, int verbose);
+
+/* <<< Optional retry of SMP requests >>> */
+
+/* When enabled, smp_send_req() re-sends a request that failed with one of
+ * the selected conditions, sleeping between attempts. The sleep starts at
+ * base_ms and doubles each attempt up to max_ms; a random amount up to
+ * half of it is subtracted (jitter). A request's deadline_ms is never
+ * exceeded. Retry is disabled (max_retries is 0) by default. */
+struct smp_retry_policy {
+    int max_retries;            /* 0 -> no retries */
+    int base_ms;                /* 0 -> SMP_RETRY_DEF_BASE_MS */
+    int max_ms;                 /* 0 -> SMP_RETRY_DEF_MAX_MS */
+    bool on_busy;               /* function result: SMP_FRES_BUSY */
+    bool on_transport_err;      /* pass-through or transport_err failure */
+    bool on_incomplete_list;    /* SMP_FRES_INCOMPLETE_DESCRIPTOR_LIST */
+};
+
+#define SMP_RETRY_DEF_BASE_MS 50
+#define SMP_RETRY_DEF_MAX_MS 2000
+
+/* Counts of what the retry logic has done in this process */
+struct smp_retry_counts {
+    uint64_t busy;              /* retries due to BUSY */
+    uint64_t transport_err;     /* retries due to transport errors */
+    uint64_t incomplete_list;   /* retries due to INCOMPLETE DESCRIPTOR LIST */
+    uint64_t recovered;         /* requests that succeeded after retrying */
+    uint64_t exhausted;         /* requests that still failed after retrying */
+};
+
+/* Sets the process wide retry policy. NULL (or max_retries 0) disables
+ * retries. If this function is not called, the SMP_UTILS_RETRY environment
+ * variable (see smp_utils(8)) is checked on the first smp_send_req(). */
+void smp_set_retry_policy(const struct smp_retry_policy * rpp);
+
+/* Copies the current retry counters into *rcp . */
+void smp_get_retry_counts(struct smp_retry_counts * rcp);
+
+/* <<< SMP request statistics >>> */
+
+/* Every request sent by smp_send_req() (each retry counts as a request) is
+ * accounted in a process wide smp_lib_stats object. Latency is measured
+ * around the pass-through call on a monotonic clock. */
+struct smp_func_stats {
+    uint64_t requests;
+    uint64_t errs;              /* any failure, including function result */
+    uint64_t lat_sum_us;        /* microseconds */
+    uint64_t lat_max_us;
+};
+
+struct smp_lib_stats {
+    uint64_t requests;
+    uint64_t fres_errs;         /* function result other than accepted */
+    uint64_t transport_errs;    /* transport_err non-zero */
+    uint64_t pt_fails;          /* pass-through (e.g. ioctl) failed */
+    uint64_t timeouts;          /* timed_out set */
+    uint64_t malformed;         /* response too short or not SMP */
+    uint64_t lat_sum_us;
+    uint64_t lat_max_us;
+    struct smp_func_stats func[256];    /* indexed by SMP function code */
+};
+
+/* Copies the current statistics into *sp . */
+void smp_get_lib_stats(struct smp_lib_stats * sp);
+
+/* Zeros the process wide statistics. */
+void smp_reset_lib_stats(void);
+
+/* Writes a readable summary of *sp (only functions that were used) to b,
+ * not exceeding b_len bytes. Returns number of bytes written excluding the
+ * trailing '\0'. If the SMP_UTILS_STATS environment variable is set (and
+ * not "0") the library writes this summary to stderr when the process
+ * exits. */
+int smp_lib_stats_str(const struct smp_lib_stats * sp, int b_len, char * b);
+
+/* <<< Frame capture >>> */
+
+/* When capture is on, smp_send_req() appends a pcapng (PCAP Next
+ * Generation) Enhanced Packet Block for every request/response pair it
+ * sends (each retry is a separate block). Each process (or capture open)
+ * starts a new pcapng section so an existing file is appended to. Each
+ * distinct device name and SAS address pair gets its own Interface
+ * Description Block: if_name is the device name, if_description is
+ * "SAS address 0x<hex>" and if_tsresol is nanoseconds. The packet time
+ * stamp is the (real time) clock when the request was sent.
+ *
+ * The link-layer type is SMP_CAPTURE_LINKTYPE (LINKTYPE_USER1). Each packet
+ * is a SMP_CAPTURE_HDR_LEN byte header (big endian fields) followed by the
+ * request frame and then the response frame, neither with its CRC:
+ *     byte 0:      version (SMP_CAPTURE_VERSION)
+ *     byte 1:      flags: SMP_CAPTURE_F_*
+ *     bytes 2-3:   request length in bytes
+ *     bytes 4-5:   response length in bytes (0 if no response)
+ *     bytes 6-7:   transport_err (clipped to 0xffff)
+ *     bytes 8-15:  latency in nanoseconds (pass-through call only)
+ *     bytes 16-23: SAS address of SMP target (0 if not given) */
+#define SMP_CAPTURE_LINKTYPE 148
+#define SMP_CAPTURE_VERSION 1
+#define SMP_CAPTURE_HDR_LEN 24
+#define SMP_CAPTURE_F_PT_FAIL 0x1       /* pass-through returned error */
+#define SMP_CAPTURE_F_TIMED_OUT 0x2
+
+/* Starts capturing into fname (created if needed, appended to if it
+ * exists), replacing any capture in progress. The SMP_UTILS_CAPTURE
+ * environment variable, if set, does the same on the first request.
+ * Returns 0 on success else -1 . */
+int smp_capture_open(const char * fname);
+
+/* Flushes and stops capture. Also called when the process exits. */
+void smp_capture_close(void);
+
+/* <<< Discovery cache >>> */
+
+/* A discovery cache holds the phy table of one expander: for each phy the
+ * DISCOVER response (the same layout as a long DISCOVER LIST descriptor)
+ * less its CRC, plus the 48 byte header of a DISCOVER LIST response. It is
+ * kept in a file in the directory named by the SMP_UTILS_DISC_CACHE
+ * environment variable; the file name comes from the expander's SAS
+ * address (if known) otherwise from the device name. A stored table is
+ * only reused when the expander change count and number of phys, taken
+ * from a fresh REPORT GENERAL response, are unchanged. A table found by
+ * device name is not served until a stored (live) DISCOVER response shows
+ * the same expander SAS address; if it differs the table is emptied. */
+#define SMP_DISC_CACHE_SLOT_LEN 124
+#define SMP_DISC_CACHE_DL_HDR_LEN 48
+
+struct smp_disc_cache;          /* opaque */
+
+/* Returns NULL if SMP_UTILS_DISC_CACHE is not set, ecc is negative, or
+ * resources are short. Otherwise returns the stored table if ecc, num_phys
+ * and ign_zg (Ignore Zone Group bit) match, else an empty table. */
+struct smp_disc_cache * smp_disc_cache_open(const char * dev_name,
+                                            uint64_t sa, int ecc,
+                                            int num_phys, bool ign_zg,
+                                            int verbose);
+
+/* Returns the number of phys the table was opened with. */
+int smp_disc_cache_num_phys(const struct smp_disc_cache * dcp);
+
+/* Returns a pointer to the cached response for phy_id, placing its length
+ * (excluding CRC) in *lenp, or NULL if that phy is not held. */
+const uint8_t * smp_disc_cache_get_phy(const struct smp_disc_cache * dcp,
+                                       int phy_id, int * lenp);
+
+/* Stores a DISCOVER response (or long descriptor) of len bytes for phy_id.
+ * Only responses with function result 0 or PHY VACANT should be stored. */
+void smp_disc_cache_put_phy(struct smp_disc_cache * dcp, int phy_id,
+                            const uint8_t * rp, int len);
+
+/* Returns the cached DISCOVER LIST response header or NULL. */
+const uint8_t * smp_disc_cache_get_dl_hdr(const struct smp_disc_cache * dcp);
+
+void smp_disc_cache_put_dl_hdr(struct smp_disc_cache * dcp,
+                               const uint8_t * hp);
+
+/* Writes the table back (atomically, via rename) if it has been changed,
+ * then frees it. Returns 0 on success else -1 . */
+int smp_disc_cache_close(struct smp_disc_cache * dcp, int verbose);
+
+/* <<< DISCOVER response decoding >>> */
+
+/* Phy attributes held in a DISCOVER response, a long (type 0) DISCOVER
+ * LIST descriptor (same layout) or a short (type 1) DISCOVER LIST
+ * descriptor, decoded in one pass by smp_decode_phy_desc(). Fields that a
+ * short descriptor, or a shorter DISCOVER response, lacks are zero (dsn is
+ * 0xff). Fields after func_res are only set when func_res is 0. */
+struct smp_phy_desc {
+    uint8_t phy_id;
+    uint8_t func_res;           /* function result, e.g. SMP_FRES_PHY_VACANT */
+    uint8_t adt;                /* attached SAS device type */
+    uint8_t att_reason;         /* attached reason */
+    uint8_t reason;
+    uint8_t neg_lrate;          /* negotiated logical link rate */
+    uint8_t neg_prate;          /* negotiated physical link rate */
+    uint8_t att_iproto;         /* attached initiator protocol bits */
+    uint8_t att_tproto;         /* attached target protocol bits, 0x80 is
+                                 * attached SATA port selector */
+    uint8_t att_phy_id;
+    uint8_t routing;            /* routing attribute */
+    uint8_t phy_cc;             /* phy change count */
+    uint8_t zoning_flags;       /* byte 60, 0x1 is zoning enabled */
+    uint8_t zone_group;
+    uint8_t prog_min_prate;     /* programmed and hardware, minimum ... */
+    uint8_t hw_min_prate;
+    uint8_t prog_max_prate;     /* ... and maximum physical link rates */
+    uint8_t hw_max_prate;
+    uint8_t conn_type;          /* connector type */
+    uint8_t dsn;                /* device slot number, 0xff: not available */
+    bool virt;                  /* virtual phy */
+    bool long_fmt;              /* DISCOVER response or long descriptor */
+    uint16_t ecc;               /* expander change count */
+    uint64_t sa;                /* SAS address (of the expander) */
+    uint64_t att_sa;            /* attached SAS address */
+    uint64_t att_dev_name;      /* attached device name */
+    uint32_t prog_phy_cap;      /* programmed phy capabilities */
+    uint32_t cur_phy_cap;       /* current phy capabilities (bytes 80-83) */
+    uint32_t att_phy_cap;       /* attached phy capabilities (bytes 84-87) */
+};
+
+#define SMP_DESC_LONG_MIN_LEN 48        /* up to routing attribute */
+#define SMP_DESC_SHORT_LEN 24
+
+/* Decodes the len bytes (excluding any CRC) at bp into *pdp. If desc_type
+ * is 0 then bp is a DISCOVER response or a long DISCOVER LIST descriptor,
+ * if it is 1 then bp is a short descriptor. Returns 0 on success, else -1
+ * if desc_type is unknown or len is too short. */
+int smp_decode_phy_desc(const uint8_t * bp, int len, int desc_type,
+                        struct smp_phy_desc * pdp);
+
+/* Sends a DISCOVER function for phy_id to top and decodes the response
+ * into *pdp. Its 'sa' field is the SAS address of the expander itself.
+ * Returns 0 on success, else -1 (including a non-zero function result,
+ * e.g. phy vacant). */
+int smp_discover_phy(const struct smp_target_obj * top, int phy_id,
+                     struct smp_phy_desc * pdp, int verbose);
+
+/* A view over a DISCOVER LIST response: nothing is copied, it just checks
+ * the header once so the descriptors can be walked without further
+ * length checks. */
+struct smp_dl_view {
+    const uint8_t * resp;
+    int sphy_id;                /* starting phy id */
+    int num_desc;               /* number of descriptors */
+    int desc_type;              /* 0: long, 1: short */
+    int desc_len;               /* in bytes */
+    int ecc;                    /* expander change count */
+};
+
+/* Sets up *vp over the DISCOVER LIST response of len bytes (excluding the
+ * CRC) at resp. Returns 0 if resp is a good response whose descriptors all
+ * fit in len, else -1 . */
+int smp_dl_view_init(struct smp_dl_view * vp, const uint8_t * resp,
+                     int len);
+
+/* Returns a pointer to descriptor k (0 to num_desc - 1) of the view. */
+static inline const uint8_t *
+smp_dl_view_desc(const struct smp_dl_view * vp, int k)
+{
+    return vp->resp + 48 + (k * vp->desc_len);
+}
+
+/* Accessors for single fields of a descriptor at dp whose type is
+ * desc_type (0 also covers a DISCOVER response). They copy nothing and do
+ * no length checks; use with smp_dl_view_desc(). */
+static inline int
+smp_desc_phy_id(const uint8_t * dp, int desc_type)
+{
+    return desc_type ? dp[0] : dp[9];
+}
+
+static inline int
+smp_desc_func_res(const uint8_t * dp, int desc_type)
+{
+    return desc_type ? dp[1] : dp[2];
+}
+
+static inline int
+smp_desc_adt(const uint8_t * dp, int desc_type)
+{
+    return (0x70 & (desc_type ? dp[2] : dp[12])) >> 4;
+}
+
+static inline int
+smp_desc_neg_lrate(const uint8_t * dp, int desc_type)
+{
+    return 0xf & (desc_type ? dp[3] : dp[13]);
+}
+
+static inline int
+smp_desc_routing(const uint8_t * dp, int desc_type)
+{
+    return 0xf & (desc_type ? dp[6] : dp[44]);
+}
+
+static inline bool
+smp_desc_virt(const uint8_t * dp, int desc_type)
+{
+    return !!(0x80 & (desc_type ? dp[6] : dp[43]));
+}
+
+static inline int
+smp_desc_att_phy_id(const uint8_t * dp, int desc_type)
+{
+    return desc_type ? dp[10] : dp[32];
+}
+
+static inline int
+smp_desc_zone_group(const uint8_t * dp, int desc_type)
+{
+    return desc_type ? dp[8] : dp[63];
+}
+
+static inline uint64_t
+smp_desc_att_sa(const uint8_t * dp, int desc_type)
+{
+    int k;
+    uint64_t sa = 0;
+
+    dp += (desc_type ? 12 : 24);
+    for (k = 0; k < 8; ++k)
+        sa = (sa << 8) | dp[k];
+    return sa;
+}
+
+
+/* <<< Fabric topology walk >>> */
+
+/* One expander phy as seen by smp_topo_walk(), from its DISCOVER response
+ * (or long DISCOVER LIST descriptor). */
+struct smp_topo_phy {
+    uint8_t phy_id;
+    uint8_t func_res;           /* 0, SMP_FRES_PHY_VACANT, or (if the phy
+                                 * was not reported) SMP_FRES_NO_PHY */
+    uint8_t adt;                /* attached SAS device type */
+    uint8_t routing;            /* routing attribute */
+    uint8_t neg_lrate;          /* negotiated logical link rate */
+    uint8_t att_phy_id;         /* attached phy identifier */
+    uint8_t att_iproto;         /* attached initiator protocols (byte 14) */
+    uint8_t att_tproto;         /* attached target protocols (byte 15) */
+    uint8_t zone_group;
+    uint8_t zoning_flags;       /* byte 60, 0x1 is zoning enabled */
+    bool virt;                  /* virtual phy */
+    uint64_t att_sa;            /* attached SAS address */
+    uint32_t cur_phy_cap;       /* current phy capabilities (bytes 80-83) */
+    uint32_t att_phy_cap;       /* attached phy capabilities (bytes 84-87) */
+    int att_exp;                /* index in smp_topo::exps of the attached
+                                 * expander, else -1 */
+};
+
+#define SMP_TOPO_RG_LEN 64
+
+struct smp_topo_exp {
+    uint64_t sa;                /* SAS address of expander */
+    int parent;                 /* index of expander it was found from, -1
+                                 * for the first */
+    int parent_phy;             /* phy identifier on parent, -1 for first */
+    int depth;                  /* hops from the first expander */
+    int ecc;                    /* expander change count */
+    int num_phys;
+    int err;                    /* 0, else SMP_LIB_* error or function
+                                 * result of REPORT GENERAL */
+    char vendor[9];             /* from REPORT MANUFACTURER INFORMATION */
+    char product[17];
+    char revision[5];
+    char device_name[SMP_MAX_DEVICE_NAME];      /* as opened */
+    int rep_gen_len;            /* bytes held in rep_gen */
+    uint8_t rep_gen[SMP_TOPO_RG_LEN];   /* REPORT GENERAL response */
+    struct smp_topo_phy * phys; /* num_phys elements */
+};
+
+struct smp_topo {
+    int num_exp;
+    struct smp_topo_exp * exps; /* breadth first order */
+};
+
+#define SMP_TOPO_DEF_MAX_EXP 256
+
+/* Walks the SAS domain breadth first, starting at the expander opened as
+ * start and following expander attached phys. Expanders are opened with
+ * smp_initiator_open_sa(). Up to num_workers (0 -> SMP_BATCH_DEF_WORKERS)
+ * requests, to any mix of expanders, are outstanding at once (see
+ * smp_batch_create()). Each expander costs a REPORT GENERAL, a REPORT
+ * MANUFACTURER INFORMATION and one DISCOVER LIST per 8 phys (or DISCOVER
+ * per phy if that fails). At most max_exp (0 -> SMP_TOPO_DEF_MAX_EXP)
+ * expanders are visited. If ign_zg is true the Ignore Zone Group bit is
+ * set. Expanders that cannot be opened or fail REPORT GENERAL are listed
+ * with 'err' set. On success places a new topology in *topopp (to be freed
+ * with smp_topo_free()) and returns 0, else returns -1 . */
+int smp_topo_walk(const struct smp_target_obj * start, int num_workers,
+                  int max_exp, bool ign_zg, struct smp_topo ** topopp,
+                  int verbose);
+
+void smp_topo_free(struct smp_topo * tp);
+
+/* <<< Phy table >>> */
+
+/* A phy table holds decoded phy attributes for any number of phys (e.g.
+ * every phy of a fabric) column-wise: one array per attribute, indexed by
+ * row. Predicate scans test a whole column and produce a bitmap with one
+ * bit per row (bit (row % 64) of word (row / 64)); bitmaps are combined
+ * with the smp_phy_bm_*() functions. Scans work 64 rows at a time over
+ * padded columns so compilers can vectorize them. */
+struct smp_phy_tbl;     /* opaque */
+
+/* Single byte columns of a phy table, for smp_phy_tbl_scan() */
+#define SMP_PTBL_COL_PHY_ID 0
+#define SMP_PTBL_COL_FUNC_RES 1
+#define SMP_PTBL_COL_ADT 2              /* attached SAS device type */
+#define SMP_PTBL_COL_ROUTING 3          /* routing attribute */
+#define SMP_PTBL_COL_NEG_LRATE 4        /* negotiated logical link rate */
+#define SMP_PTBL_COL_NEG_PRATE 5        /* negotiated physical link rate */
+#define SMP_PTBL_COL_ZONE_GROUP 6
+#define SMP_PTBL_COL_ZONING 7           /* zoning flags, 0x1: enabled */
+#define SMP_PTBL_COL_VIRT 8             /* 1 if virtual phy */
+#define SMP_PTBL_COL_ATT_PHY_ID 9
+/* Fastest rate (0x8 to 0xc, as in neg_lrate) that both the current and
+ * the attached phy capabilities include, 0 if none. Derived on insert. */
+#define SMP_PTBL_COL_CAP_RATE 10
+#define SMP_PTBL_NUM_COLS 11
+
+/* Comparisons for smp_phy_tbl_scan(): column value OP given value */
+#define SMP_PTBL_EQ 0
+#define SMP_PTBL_NE 1
+#define SMP_PTBL_LT 2
+#define SMP_PTBL_GE 3
+
+/* Returns an empty table with room for about num_rows rows (it grows as
+ * needed), or NULL if resources are short. */
+struct smp_phy_tbl * smp_phy_tbl_create(int num_rows);
+
+void smp_phy_tbl_free(struct smp_phy_tbl * tp);
+
+int smp_phy_tbl_num_rows(const struct smp_phy_tbl * tp);
+
+/* Number of 64 bit words a bitmap over the table's rows needs. Only valid
+ * until rows are next added. */
+int smp_phy_tbl_bm_words(const struct smp_phy_tbl * tp);
+
+/* Appends a row for the phy in *pdp of the expander whose SAS address is
+ * exp_sa (if 0, pdp->sa is used). Returns the new row's index or -1 if
+ * resources are short. */
+int smp_phy_tbl_add(struct smp_phy_tbl * tp, uint64_t exp_sa,
+                    const struct smp_phy_desc * pdp);
+
+/* Appends a row for each descriptor in the DISCOVER LIST view *vp.
+ * Returns the number of rows added or -1 if resources are short. */
+int smp_phy_tbl_add_dl(struct smp_phy_tbl * tp, uint64_t exp_sa,
+                       const struct smp_dl_view * vp);
+
+/* Appends a row for each phy of each expander in *topop. Returns the
+ * number of rows added or -1 if resources are short. */
+int smp_phy_tbl_add_topo(struct smp_phy_tbl * tp,
+                         const struct smp_topo * topop);
+
+/* Places the attributes held for row into *pdp (those that a table does
+ * not hold are zeroed) and returns 0, or -1 if row is out of range. */
+int smp_phy_tbl_get(const struct smp_phy_tbl * tp, int row,
+                    struct smp_phy_desc * pdp);
+
+/* Sets bit n of bm (smp_phy_tbl_bm_words() words) if column col of row n
+ * compares (op is SMP_PTBL_EQ, NE, LT or GE) with val, else clears it.
+ * Returns the number of bits set, or -1 if col or op is unknown. */
+int smp_phy_tbl_scan(const struct smp_phy_tbl * tp, int col, int op,
+                     unsigned int val, uint64_t * bm);
+
+/* As smp_phy_tbl_scan() but for rows whose attached SAS address is sa. */
+int smp_phy_tbl_scan_att_sa(const struct smp_phy_tbl * tp, uint64_t sa,
+                            uint64_t * bm);
+
+/* As smp_phy_tbl_scan() but for rows with a link up (negotiated logical
+ * link rate 1.5 Gbps or faster) at a rate below SMP_PTBL_COL_CAP_RATE. */
+int smp_phy_tbl_scan_below_cap(const struct smp_phy_tbl * tp, uint64_t * bm);
+
+/* Bitmap helpers over num_words words. smp_phy_bm_next() returns the
+ * first row at or after from whose bit is set, or -1 . */
+void smp_phy_bm_and(uint64_t * dst, const uint64_t * src, int num_words);
+void smp_phy_bm_or(uint64_t * dst, const uint64_t * src, int num_words);
+void smp_phy_bm_andnot(uint64_t * dst, const uint64_t * src, int num_words);
+int smp_phy_bm_count(const uint64_t * bm, int num_words);
+int smp_phy_bm_next(const uint64_t * bm, int num_words, int from);
+
+/* <<< Topology snapshot >>> */
+
+/* A topology snapshot file holds the result of smp_topo_walk() in fixed
+ * size big endian records so that it can be mmap()-ed and used without
+ * parsing. Layout:
+ *     header (SMP_SNAP_HDR_LEN bytes):
+ *         bytes 0-7:   magic "SMPSNAP\0"
+ *         byte 8:      version (SMP_SNAP_VERSION)
+ *         bytes 12-15: number of expander records
+ *         bytes 16-19: number of phy records
+ *         bytes 20-23: number of index entries
+ *         bytes 24-31: creation time (seconds since the epoch)
+ *         bytes 32-35, 36-39, 40-43: file offsets of the expander, phy and
+ *                      index sections
+ *         bytes 44-47: file length
+ *     expander records (SMP_SNAP_EXP_LEN bytes each, breadth first order):
+ *         bytes 0-7:   SAS address
+ *         bytes 8-9:   expander change count
+ *         byte 10:     number of phys
+ *         byte 11:     depth (hops from the first expander)
+ *         bytes 12-15: index of parent expander (0xffffffff for the first)
+ *         byte 16:     phy identifier on parent (0xff for the first)
+ *         byte 17:     error (0, else SMP_LIB_* error or function result)
+ *         bytes 20-23: index of this expander's first phy record
+ *         bytes 24-31, 32-47, 48-51: vendor, product and revision (ASCII)
+ *         bytes 56-63: content hash of its phy records (0 if unknown)
+ *         bytes 64-127: REPORT GENERAL response (zero padded)
+ *     phy records (SMP_SNAP_PHY_LEN bytes each, by expander then phy id):
+ *         bytes 0-7:   attached SAS address
+ *         bytes 8-11:  expander index
+ *         byte 12:     phy identifier
+ *         byte 13:     function result
+ *         byte 14:     attached SAS device type
+ *         byte 15:     routing attribute
+ *         byte 16:     negotiated logical link rate
+ *         byte 17:     zone group
+ *         byte 18:     zoning flags (byte 60 of DISCOVER response)
+ *         byte 19:     attached phy identifier
+ *         byte 20:     attached initiator protocols (byte 14)
+ *         byte 21:     attached target protocols (byte 15)
+ *         byte 22:     flags: 0x1 virtual phy
+ *         bytes 24-27: current phy capabilities
+ *         bytes 28-31: attached phy capabilities
+ *     index entries (SMP_SNAP_IDX_LEN bytes each, sorted by SAS address,
+ *     then expander index, then phy record index): one per expander and
+ *     one per phy with a non-zero attached SAS address
+ *         bytes 0-7:   SAS address
+ *         bytes 8-11:  expander index
+ *         bytes 12-15: phy record index (0xffffffff for the expander) */
+#define SMP_SNAP_VERSION 1
+#define SMP_SNAP_HDR_LEN 64
+#define SMP_SNAP_EXP_LEN 128
+#define SMP_SNAP_PHY_LEN 32
+#define SMP_SNAP_IDX_LEN 16
+#define SMP_SNAP_NONE 0xffffffff
+
+struct smp_snap;        /* opaque */
+
+/* Writes topop to fname (atomically, via rename). Returns 0 on success
+ * else -1 . */
+int smp_snap_write(const char * fname, const struct smp_topo * topop,
+                   int verbose);
+
+/* Returns a snapshot of topop held in memory (for smp_snap_diff() against
+ * a live walk), or NULL if resources are short. Close as usual. */
+struct smp_snap * smp_snap_from_topo(const struct smp_topo * topop);
+
+/* Maps fname read-only and checks its header and section bounds. Returns
+ * NULL if that fails. */
+struct smp_snap * smp_snap_open(const char * fname, int verbose);
+
+void smp_snap_close(struct smp_snap * sp);
+
+int smp_snap_num_exp(const struct smp_snap * sp);
+int smp_snap_num_phys(const struct smp_snap * sp);
+
+/* Return pointers into the mapping to expander record xi and phy record
+ * pi (laid out as above), or NULL if out of range. */
+const uint8_t * smp_snap_exp(const struct smp_snap * sp, int xi);
+const uint8_t * smp_snap_phy(const struct smp_snap * sp, int pi);
+
+/* Binary searches the index for sa. Returns the number of entries for sa
+ * (0 if none), placing the position of the first in *posp. */
+int smp_snap_lookup(const struct smp_snap * sp, uint64_t sa, int * posp);
+
+/* Places the expander and phy record indexes (SMP_SNAP_NONE for an
+ * expander's own entry) of index entry pos in *xip and *pip. Returns the
+ * SAS address of that entry, 0 if pos is out of range. */
+uint64_t smp_snap_idx(const struct smp_snap * sp, int pos, uint32_t * xip,
+                      uint32_t * pip);
+
+/* Decodes phy record pi into *pdp (pdp->sa is the expander's SAS
+ * address). Returns 0 on success else -1 . */
+int smp_snap_get_phy(const struct smp_snap * sp, int pi,
+                     struct smp_phy_desc * pdp);
+
+/* Bits in smp_snap_chg::what */
+#define SMP_SNAP_CHG_EXP_ADDED 0x1
+#define SMP_SNAP_CHG_EXP_REMOVED 0x2
+#define SMP_SNAP_CHG_PHY_ADDED 0x4
+#define SMP_SNAP_CHG_PHY_REMOVED 0x8
+#define SMP_SNAP_CHG_FUNC_RES 0x10      /* e.g. phy now vacant */
+#define SMP_SNAP_CHG_ATT_SA 0x20        /* attached SAS address */
+#define SMP_SNAP_CHG_ATT_PHY 0x40       /* attached phy identifier */
+#define SMP_SNAP_CHG_ADT 0x80           /* attached SAS device type */
+#define SMP_SNAP_CHG_LINK 0x100         /* negotiated logical link rate,
+                                         * includes disabled, reset
+                                         * problem, etc */
+#define SMP_SNAP_CHG_ZONE 0x200         /* zone group or zoning flags */
+#define SMP_SNAP_CHG_ROUTING 0x400
+#define SMP_SNAP_CHG_OTHER 0x800        /* protocols, virtual, or phy
+                                         * capabilities */
+
+/* One difference found by smp_snap_diff(). For expander level changes
+ * (added or removed) phy_id is -1. old_pi and new_pi are the phy record
+ * indexes in the old and new snapshots, -1 if there is none. */
+struct smp_snap_chg {
+    uint64_t exp_sa;
+    int phy_id;
+    unsigned int what;          /* SMP_SNAP_CHG_* bits */
+    int old_pi;
+    int new_pi;
+};
+
+/* Compares two snapshots, matching expanders by SAS address and phys by
+ * phy identifier. Expanders whose content hashes are equal are skipped
+ * without looking at their phys. On success places a malloc()-ed array
+ * (to be free()-d, NULL if there are no changes) in *chgpp, in the old
+ * snapshot's expander order with added expanders last, and returns the
+ * number of elements. Returns -1 if resources are short. */
+int smp_snap_diff(const struct smp_snap * old_sp,
+                  const struct smp_snap * new_sp,
+                  struct smp_snap_chg ** chgpp);
+
+/* Appends a row to the phy table for each phy record. Returns the number
+ * of rows added or -1 if resources are short. */
+int smp_phy_tbl_add_snap(struct smp_phy_tbl * tp, const struct smp_snap * sp);
+
+/* <<< sysfs discover (Linux) >>> */
+
+/* sysfs root used when SMP_UTILS_SYSFS_ROOT is not set */
+#define SMP_SYSFS_DEF_ROOT "/sys"
+
+/* routing attribute in a struct smp_phy_desc filled from sysfs */
+#define SMP_DESC_ROUTING_UNKNOWN 0xff
+
+/* Fills pda[0] to pda[max_phys - 1], indexed by phy identifier, from the
+ * SAS transport class below root/class (if root is NULL then the
+ * SMP_UTILS_SYSFS_ROOT environment variable, else SMP_SYSFS_DEF_ROOT).
+ * The expander is found by SAS address sa or, if that is 0, by the last
+ * component of top->device_name (e.g. /dev/bsg/expander-6:0). sysfs gives
+ * link rates and the attached device's SAS address, phy identifier, type
+ * and protocols; the routing attribute is SMP_DESC_ROUTING_UNKNOWN and
+ * zoning, capability and slot fields are zero (dsn is 0xff). Phys missing
+ * from sysfs have func_res SMP_FRES_PHY_VACANT. If top is non-NULL then
+ * phys with a link up but nothing attached in sysfs are fetched with a
+ * DISCOVER function. Returns the number of phys (highest phy identifier
+ * plus one) or -1 if the expander is not in sysfs. No SMP functions are
+ * sent for the others. */
+int smp_sysfs_get_phys(const char * root, const struct smp_target_obj * top,
+                       uint64_t sa, struct smp_phy_desc * pda, int max_phys,
+                       int verbose);
+
+/* <<< SAS address location index >>> */
+
+/* Where a SAS address is attached: one entry per (expander, port), where
+ * a wide port's phys all have the same attached SAS address. */
+struct smp_loc_ent {
+    uint64_t sa;                /* attached SAS address (the key) */
+    uint64_t exp_sa;            /* expander it is attached to */
+    int exp_idx;                /* expander index in topology or snapshot */
+    int phy_id;                 /* lowest phy identifier of the port */
+    int width;                  /* number of phys in the port */
+    int neg_lrate;              /* negotiated logical link rate of phy_id */
+    int adt;                    /* attached SAS device type */
+};
+
+struct smp_loc_tbl;     /* opaque, a hash index by attached SAS address */
+
+/* Build a location index over every attached phy (func_res zero, att_sa
+ * non-zero) of a topology walk or of a snapshot. Returns NULL if resources
+ * are short. */
+struct smp_loc_tbl * smp_loc_tbl_from_topo(const struct smp_topo * topop);
+struct smp_loc_tbl * smp_loc_tbl_from_snap(const struct smp_snap * sp);
+void smp_loc_tbl_free(struct smp_loc_tbl * ltp);
+
+/* Number of entries (ports) in the index, and entry k of them (sorted by
+ * SAS address). */
+int smp_loc_tbl_num(const struct smp_loc_tbl * ltp);
+const struct smp_loc_ent * smp_loc_tbl_ent(const struct smp_loc_tbl * ltp,
+                                           int k);
+
+/* Looks up sa in constant expected time. Returns the number of entries
+ * for it (more than one for an expander, or a device attached to several
+ * expanders) and places a pointer to the first in *epp; they are
+ * contiguous and in expander order. Returns 0 if sa is not attached. */
+int smp_loc_find(const struct smp_loc_tbl * ltp, uint64_t sa,
+                 const struct smp_loc_ent ** epp);
+
+/* <<< Monitor shared memory >>> */
+
+/* smp_monitord publishes the latest per-phy state of each expander it polls
+ * in a POSIX shared memory object. The layout is fixed (host byte order): a
+ * struct smp_mon_hdr followed by num_exp expander slots. Each slot has its
+ * own sequence lock: the writer makes 'seq' odd, updates the slot then
+ * makes 'seq' even again. smp_mon_read() copies a slot and retries if
+ * 'seq' was odd or changed meanwhile, so readers never block the writer
+ * (nor each other) and never send SMP functions. */
+#define SMP_MON_DEF_NAME "/smp_monitord"
+#define SMP_MON_MAGIC "SMPMON\0\0"
+#define SMP_MON_VERSION 1
+#define SMP_MON_MAX_PHYS 128
+#define SMP_MON_MAX_EV 8        /* phy events held per phy */
+
+/* struct smp_mon_phy::flags */
+#define SMP_MON_PF_ERR_LOG 0x1  /* REPORT PHY ERROR LOG counters are valid */
+#define SMP_MON_PF_EV_TRUNC 0x2 /* more than SMP_MON_MAX_EV phy events */
+
+struct smp_mon_phy {
+    uint8_t phy_id;
+    uint8_t func_res;           /* of DISCOVER (LIST), SMP_FRES_NO_PHY if
+                                 * the phy was not reported */
+    uint8_t adt;                /* attached SAS device type */
+    uint8_t neg_lrate;          /* negotiated logical link rate */
+    uint8_t routing;            /* routing attribute */
+    uint8_t att_phy_id;         /* attached phy identifier */
+    uint8_t zone_group;
+    uint8_t flags;              /* SMP_MON_PF_* */
+    uint64_t att_sa;            /* attached SAS address */
+    uint32_t inv_dword;         /* REPORT PHY ERROR LOG counters */
+    uint32_t disparity;
+    uint32_t loss_sync;
+    uint32_t reset_prob;
+    uint8_t num_ev;             /* from REPORT PHY EVENT LIST */
+    uint8_t ev_src[SMP_MON_MAX_EV];     /* phy event sources */
+    uint8_t reserved[7];
+    uint32_t ev_val[SMP_MON_MAX_EV];    /* phy events (counts or peaks) */
+};
+
+struct smp_mon_exp {
+    uint32_t seq;               /* sequence lock, odd while being updated */
+    uint32_t num_polls;         /* completed polls */
+    uint32_t num_errs;          /* polls with err set */
+    int32_t err;                /* last poll: 0, or SMP_LIB_* error or
+                                 * function result of REPORT GENERAL */
+    uint64_t sa;                /* SAS address of expander */
+    int64_t upd_ms;             /* real time (ms since the Epoch) of last
+                                 * update, 0 if never */
+    uint32_t poll_ms;           /* how long the last poll took */
+    int32_t ecc;                /* expander change count, -1 if unknown */
+    uint16_t num_phys;          /* held, at most SMP_MON_MAX_PHYS */
+    uint16_t rep_num_phys;      /* as reported by REPORT GENERAL */
+    uint32_t interval_ms;       /* poll interval */
+    char device_name[64];
+    struct smp_mon_phy phys[SMP_MON_MAX_PHYS];
+};
+
+struct smp_mon_hdr {
+    char magic[8];              /* SMP_MON_MAGIC */
+    uint32_t version;           /* SMP_MON_VERSION */
+    uint32_t exp_len;           /* sizeof(struct smp_mon_exp) */
+    uint32_t num_exp;           /* expander slots that follow */
+    int32_t pid;                /* of the writer */
+    int64_t start_ms;           /* real time the writer started */
+    uint8_t reserved[32];
+};
+
+struct smp_mon;         /* opaque */
+
+/* The shared memory object name used is name, or if that is NULL the
+ * SMP_UTILS_MON_SHM environment variable, else SMP_MON_DEF_NAME.
+ * smp_mon_create() (re)creates it with num_exp empty slots for writing;
+ * smp_mon_open() maps an existing one read only. Both return NULL on
+ * failure. */
+struct smp_mon * smp_mon_create(const char * name, int num_exp,
+                                int verbose);
+struct smp_mon * smp_mon_open(const char * name, int verbose);
+
+/* Unmaps the object. If unlink_it is true the name is removed as well
+ * (readers that still have it mapped are not affected). */
+void smp_mon_close(struct smp_mon * mp, bool unlink_it);
+
+const struct smp_mon_hdr * smp_mon_get_hdr(const struct smp_mon * mp);
+
+/* Copies src (only its first src->num_phys phys) into slot xi, under the
+ * slot's sequence lock. Only one thread or process may write a slot. */
+void smp_mon_publish(struct smp_mon * mp, int xi,
+                     const struct smp_mon_exp * src);
+
+/* Places a consistent copy of slot xi in *dst; phys beyond dst->num_phys
+ * are not copied. Returns 0 on success, or -1 if xi is out of range or no
+ * consistent copy was obtained after many tries. */
+int smp_mon_read(const struct smp_mon * mp, int xi, struct smp_mon_exp * dst);
+
+/* Writes the num_exp expanders in xa (e.g. copies from smp_mon_read()) to
+ * fname in OpenMetrics text format: per expander its poll status and
+ * expander change count; per phy the negotiated link rate, REPORT PHY
+ * ERROR LOG counters and phy events (labelled with source and name). The
+ * file is written under a temporary name then renamed, so a Prometheus
+ * textfile collector never sees it half written. If fname is "-" it goes
+ * to stdout. Returns 0 on success, else -1 . */
+int smp_mon_write_om(const char * fname,
+                     const struct smp_mon_exp * const * xa, int num_exp,
+                     int verbose);
+
+/* <<< Counter time series store >>> */
+
+/* A time series file holds, for any number of series, (time, value)
+ * samples of a counter. A series is keyed by expander SAS address, phy
+ * identifier and source: a phy event source (0 to 0xff) or one of the
+ * REPORT PHY ERROR LOG counters (SMP_TS_SRC_ERR_LOG + 0 to 3). Samples go
+ * in fixed size chunks each holding one series: the first time and value
+ * in the chunk header, then per sample the delta of the time delta and
+ * the value delta, both zigzag encoded varints. A regularly sampled,
+ * slowly changing counter costs two or three bytes a sample. A chunk
+ * index sorted by key then time follows the last chunk so a reader only
+ * decodes the chunks of one series that overlap the wanted time range; if
+ * the index is missing (e.g. writer was killed) it is rebuilt from the
+ * chunk headers. Layout (big endian fields):
+ *     header: 8 byte magic "SMPTSER", byte 8: version, bytes 12-15: chunk
+ *         length, bytes 16-23: creation time (ms); 64 bytes in all
+ *     chunks: each SMP_TS_CHUNK_HDR_LEN bytes of header (bytes 0-3: magic
+ *         "SMTC", 4-5: used length, 6-7: number of samples, 8-15: SAS
+ *         address, 16: phy identifier, 18-19: source, 24-31: first time,
+ *         32-39: last time, 40-47: first value) then the encoded samples
+ *     index: 8 byte magic "SMPTSIDX", 4 byte count, 4 reserved bytes, then
+ *         SMP_TS_IDX_LEN bytes per chunk (SAS address, phy identifier, 1
+ *         reserved byte, source, chunk number, first time, last time)
+ *     footer: 8 byte offset of index then 8 byte magic "SMPTSEND"
+ * Times are milliseconds since the Epoch. */
+#define SMP_TS_VERSION 1
+#define SMP_TS_HDR_LEN 64
+#define SMP_TS_CHUNK_HDR_LEN 48
+#define SMP_TS_IDX_LEN 32
+#define SMP_TS_DEF_CHUNK_LEN 1024
+
+/* sources above the 8 bit phy event sources */
+#define SMP_TS_SRC_ERR_LOG 0x100        /* + 0: invalid dword count, + 1:
+                                         * running disparity error count,
+                                         * + 2: loss of dword sync count,
+                                         * + 3: phy reset problem count */
+#define SMP_TS_ANY -1                   /* wildcard for smp_ts_scan() */
+
+struct smp_ts;          /* opaque */
+
+/* Opens fname. If for_write is true it is created if need be, and locked
+ * so only one writer has it at a time. Returns NULL on failure. */
+struct smp_ts * smp_ts_open(const char * fname, bool for_write,
+                            int verbose);
+
+/* Appends a sample to series (sa, phy_id, src). Samples of a series should
+ * be appended in time order. Returns 0 on success, else -1 . */
+int smp_ts_append(struct smp_ts * tsp, uint64_t sa, int phy_id, int src,
+                  int64_t t_ms, uint64_t val);
+
+/* Writes partly filled chunks and the chunk index. A long running writer
+ * should call this after each round of samples. Returns 0 or -1 . */
+int smp_ts_flush(struct smp_ts * tsp);
+
+/* Flushes (if opened for writing) then closes. Returns 0 or -1 . */
+int smp_ts_close(struct smp_ts * tsp);
+
+int smp_ts_num_chunks(const struct smp_ts * tsp);
+
+/* Called for each sample found, in key then time order. A non-zero return
+ * stops the scan. */
+typedef int (*smp_ts_cb_t)(uint64_t sa, int phy_id, int src, int64_t t_ms,
+                           uint64_t val, void * cb_arg);
+
+/* Scans samples with from_ms <= time <= to_ms of the series matching sa,
+ * phy_id and src, any of which may be SMP_TS_ANY (sa: 0). Only chunks the
+ * index places in range are read. tsp should be opened for reading.
+ * Returns the number of samples passed to cb, or -1 on a read error. */
+int smp_ts_scan(struct smp_ts * tsp, uint64_t sa, int phy_id, int src,
+                int64_t from_ms, int64_t to_ms, smp_ts_cb_t cb,
+                void * cb_arg);
+
+/* Returns milliseconds on a monotonic clock with an arbitrary origin. Used
+ * for the deadline_ms field of struct smp_req_resp . */
+int64_t smp_get_mono_ms(void);
+
+/* Returns the timeout (in milliseconds) a pass-through should use for
+ * rresp: its timeout_ms field (or def_ms if that is 0) clipped to what
+ * remains before its deadline_ms field. Returns 0 if the deadline has
+ * already passed, in which case rresp->timed_out is set and the request
+ * should not be sent. */
+int smp_req_eff_timeout_ms(struct smp_req_resp * rresp, int def_ms);
+
+
+/* <<< Batched (asynchronous) SMP requests >>> */
+
+/* One element of a batch: a request/response object and the SMP target it
+ * is sent to. Elements in the same batch may refer to different targets
+ * (e.g. several expanders behind one HBA). The caller owns each element
+ * (and the buffers it points to) until it has been reaped or passed to the
+ * completion callback. */
+struct smp_batch_elem {
+    const struct smp_target_obj * tobj; /* [i] target, already opened */
+    struct smp_req_resp * rresp;        /* [i] as given to smp_send_req() */
+    void * user_p;                      /* [i] opaque, for the caller */
+    int res;                            /* [o] smp_send_req() return value */
+    bool done;                          /* [o] true after completion */
+    struct smp_batch_elem * next_p;     /* library private */
+};
+
+/* Called once for each completed element, from a worker thread. */
+typedef void (*smp_batch_cb_t)(struct smp_batch_elem * bep, void * cb_arg);
+
+struct smp_batch;       /* opaque */
+
+#define SMP_BATCH_DEF_WORKERS 4
+#define SMP_BATCH_MAX_WORKERS 64
+
+/* Creates a batch context with num_workers worker threads (0 -> use
+ * SMP_BATCH_DEF_WORKERS). Each worker issues one request at a time using
+ * the file descriptor held in that element's target object; the
+ * pass-throughs used by smp_send_req() accept concurrent requests on the
+ * same descriptor. If cb is non-NULL then it is called for each completed
+ * element, otherwise completed elements are queued for smp_batch_reap().
+ * If threads are not available then requests are sent synchronously by
+ * smp_batch_submit(). Returns NULL on failure. */
+struct smp_batch * smp_batch_create(int num_workers, smp_batch_cb_t cb,
+                                    void * cb_arg, int verbose);
+
+/* Queues bep for sending. Returns 0 on success, else -1 . */
+int smp_batch_submit(struct smp_batch * bp, struct smp_batch_elem * bep);
+
+/* Returns the oldest completed element not yet reaped. If none are ready
+ * and wait is true then blocks until one completes. Returns NULL if wait
+ * is false and nothing is ready, or if nothing is outstanding. */
+struct smp_batch_elem * smp_batch_reap(struct smp_batch * bp, bool wait);
+
+/* Like smp_batch_reap() but, if none are ready, waits at most wait_ms
+ * milliseconds (0 -> does not wait) for one to complete. */
+struct smp_batch_elem * smp_batch_reap_ms(struct smp_batch * bp,
+                                          int wait_ms);
+
+/* Takes the elements still queued (i.e. not yet given to a worker) off the
+ * submission queue and completes them with res -1, without sending them.
+ * Requests already being sent are not affected. Returns the number of
+ * elements cancelled. */
+int smp_batch_cancel(struct smp_batch * bp);
+
+/* Returns the number of elements submitted but not yet reaped (or passed
+ * to the completion callback). */
+int smp_batch_outstanding(struct smp_batch * bp);
+
+/* Waits for outstanding requests to complete, stops the workers and frees
+ * the context. Completed elements that were not reaped are marked done. */
+void smp_batch_destroy(struct smp_batch * bp);
+
+/* Sets an absolute deadline (on the smp_get_mono_ms() clock) for all
+ * requests in the batch; 0 removes it. A submitted element whose rresp has
+ * no deadline_ms of its own inherits this one; elements still queued when
+ * it passes complete with res -1 and rresp->timed_out set, without being
+ * sent. */
+void smp_batch_set_deadline(struct smp_batch * bp, int64_t deadline_ms);
+
+/* Returns the milliseconds remaining before the batch deadline (0 if it
+ * has passed), or -1 if no deadline is set. */
+int smp_batch_remaining_ms(struct smp_batch * bp);
+
+/* Convenience wrapper: sends the num elements in arr using num_workers
+ * worker threads and waits for all of them to complete. Returns the number
+ * of elements whose smp_send_req() failed (i.e. 'res' is non-zero), or -1
+ * if the batch could not be set up. */
+int smp_send_req_batch(struct smp_batch_elem * arr, int num, int num_workers,
+                       int verbose);
+
 /* Given an SMP function response code in func_res, places the associated
  * string (most likely an error if func_res > 0) in the area pointed to
  * by buffer. That string will not exceed buff_len bytes. Returns buff
  * as its result. */
 char * smp_get_func_res_str(int func_res, int buff_len, char * buff);
 
+/* Places the name of the SMP function whose code is func_code in buff
+ * (e.g. "DISCOVER LIST"), not exceeding buff_len bytes. Unknown codes yield
+ * "function 0x<hh>". Returns buff. */
+char * smp_get_func_name_str(int func_code, int buff_len, char * buff);
+
 /* Returns the request length in dwords associated with func_code in SAS-1.
  * The dword count excludes the 4 byte header and the 4 byte CRC (i.e.
  * eight bytes or two dwords). Returns -2 for no default (e.g. functions
@@ -243,6 +1193,37 @@ char * smp_get_phy_pwr_cond_str(int phy_pwr_cond, int buff_len, char * buff);
 char * smp_get_pwr_dis_signal_str(int pwr_dis_signal,
                                   int buff_len, char * buff);
 
+/* Returns pointer to a (programmed or hardware) physical link rate string
+ * for the 4 bit value in val. If prog is true then 0 yields "not
+ * programmable". Pointer value returned is same as 'buff'. */
+char * smp_get_plink_rate(int val, bool prog, int buff_len, char * buff);
+
+/* Returns pointer to a (attached) reason string for the 4 bit value in
+ * val. Pointer value returned is same as 'buff'. */
+char * smp_get_reason(int val, int buff_len, char * buff);
+
+/* Returns pointer to a negotiated (logical or physical) link rate string
+ * for the 4 bit value in val. Pointer value returned is same as 'buff'. */
+char * smp_get_neg_xxx_link_rate(int val, int buff_len, char * buff);
+
+/* Places the name of phy event source pes (e.g. "Invalid word count") in
+ * buff, not exceeding buff_len bytes. Sources without a name yield
+ * "reserved [0x<hh>]" or "vendor specific [0x<hh>]". Returns buff. */
+char * smp_get_pes_str(int pes, int buff_len, char * buff);
+
+/* Decodes the phy capabilities (e.g. bytes 76 to 87 of a DISCOVER
+ * response) in p_cap into lines, each starting with 4 spaces and ending
+ * with a newline. If long_names is true the link rate follows each G1 to
+ * G5 name. About 200 bytes suffice. Returns buff. */
+char * smp_get_phy_cap_str(unsigned int p_cap, bool long_names, int buff_len,
+                           char * buff);
+
+/* Returns 0 if att_cap is not more capable (speed-wise) than my_cap. If
+ * att_cap can do G5 (22.5 Gbps) and my_cap can't, returns 12 (0xc). If
+ * att_cap can do G4 (12 Gbps) and my_cap can't, returns 11 (0xb). If
+ * att_cap can do G3 (6 Gbps) and my_cap can't, returns 10 (0xa). */
+int smp_att_phy_more_capable(unsigned int my_cap, unsigned int att_cap);
+
 const char * smp_lib_version();
 
 struct smp_val_name {
@@ -25,6 +25,7 @@
 #include "mpi_sas.h"
 
 #include "smp_aac_io.h"
+#include "smp_usdt.h"
 
 #include "aacraid.h"
 
@@ -171,7 +172,11 @@ send_req_aac(int fd, int subvalue, const unsigned char * target_sa,
     unsigned int bytesToSave    = 0;
     unsigned int aSmpCmdRespLen = 0;
     unsigned int aSmpCmdRespOff = 0;
+    uint64_t t0;
 
+    SMP_PROBE3(aac__entry, SMP_USDT_FUNC(rresp), rresp->request_len,
+               rresp->max_response_len);
+    t0 = SMP_USDT_START_US(aac__return);
     if (target_sa) { ; }                /* suppress unused warning */
     if (verbose) { ; }                  /* suppress unused warning */
     for(aSmpCmdReqOff = 0 ; aSmpCmdReqOff <(unsigned int) rresp->request_len - CRC_LEN;) {
@@ -214,6 +219,11 @@ send_req_aac(int fd, int subvalue, const unsigned char * target_sa,
 
         memcpy(aFib->data,aSmpPassThruReq,SIZE_SMP_PASS_THRU_REQ);
 
+        /* no per-FIB timeout, so only the deadline can be honoured */
+        if (0 == smp_req_eff_timeout_ms(rresp, SMP_DEF_TIMEOUT_MS)) {
+            fprintf(stderr,"send_req_aac: deadline passed, request not sent\n");
+            goto err_out;
+        }
         if( ioctl (fd,FSACTL_SENDFIB,aFib) !=0) {
             fprintf(stderr,"send_req_aac: Request FSACTL_SENDFIB ioctl failed - %s",safe_strerror(errno));
             goto err_out;
@@ -244,6 +254,7 @@ if((aSmpResult->header.status != SMP_PASS_THRU_SUCCESS)
       fprintf(stderr,"send_req_aac: Request Firmware Busy\n ");
       break;
     case SMP_PASS_THRU_TIMEOUT:
+      rresp->timed_out = true;
       fprintf(stderr,"send_req_aac: Request Firmware Timeout\n ");
       break;
     case SMP_PASS_THRU_PARM_INVALID:
@@ -310,6 +321,10 @@ if((aSmpResult->header.status != SMP_PASS_THRU_SUCCESS)
 
     memcpy(aFib->data,aSmpPassThruRes,SIZE_SMP_PASS_THRU_RES);
 
+    if (0 == smp_req_eff_timeout_ms(rresp, SMP_DEF_TIMEOUT_MS)) {
+        fprintf(stderr,"send_req_aac: deadline passed reading response\n");
+        goto err_out;
+    }
     if( ioctl (fd,FSACTL_SENDFIB,aFib) !=0){
         fprintf(stderr,"send_req_aac: Result FSACTL_SENDFIB ioctl failed  - %s",safe_strerror(errno));
         goto err_out;
@@ -327,6 +342,7 @@ if((aSmpResult->header.status != SMP_PASS_THRU_SUCCESS)) {
       fprintf(stderr,"send_req_aac: Result Firmware Busy\n ");
        break;
      case SMP_PASS_THRU_TIMEOUT:
+       rresp->timed_out = true;
        fprintf(stderr,"send_req_aac: Result Firmware Timeout\n ");
        break;
      case SMP_PASS_THRU_PARM_INVALID:
@@ -343,6 +359,9 @@ if((aSmpResult->header.status != SMP_PASS_THRU_SUCCESS)) {
 }
 
 err_out:
+    SMP_PROBE5(aac__return, SMP_USDT_FUNC(rresp), ret,
+               (0 == ret) ? SMP_USDT_FRES(rresp) : -1,
+               rresp->act_response_len, SMP_USDT_LAT_US(t0));
 
     if(aSmpPassThruReq)
         free(aSmpPassThruReq);
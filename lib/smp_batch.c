@@ -0,0 +1,433 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Batched SMP requests. A small pool of worker threads takes elements from
+ * a submission queue, calls smp_send_req() for each and places the element
+ * on a completion queue (or hands it to the caller's callback). This lets
+ * the SMP latency of several requests (typically to different expanders
+ * behind the same HBA) overlap. Both queues are singly linked lists
+ * threaded through the callers' smp_batch_elem objects, so no allocation
+ * is done per request. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include "smp_lib.h"
+#include "sg_pr2serr.h"
+
+
+struct smp_batch {
+    struct smp_batch_elem * sub_head;   /* submission queue */
+    struct smp_batch_elem * sub_tail;
+    struct smp_batch_elem * cmpl_head;  /* completion queue */
+    struct smp_batch_elem * cmpl_tail;
+    smp_batch_cb_t cb;
+    void * cb_arg;
+    int outstanding;    /* submitted, not yet reaped (or called back) */
+    int num_workers;    /* number of threads actually started */
+    int verbose;
+    bool shutdown;
+    int64_t deadline_ms;        /* 0 -> none */
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t mtx;
+    pthread_cond_t sub_cv;      /* signalled when something is submitted */
+    pthread_cond_t cmpl_cv;     /* signalled when something completes */
+    pthread_t workers[SMP_BATCH_MAX_WORKERS];
+#endif
+};
+
+
+static void
+elem_append(struct smp_batch_elem ** headpp, struct smp_batch_elem ** tailpp,
+            struct smp_batch_elem * bep)
+{
+    bep->next_p = NULL;
+    if (*tailpp)
+        (*tailpp)->next_p = bep;
+    else
+        *headpp = bep;
+    *tailpp = bep;
+}
+
+static struct smp_batch_elem *
+elem_pop(struct smp_batch_elem ** headpp, struct smp_batch_elem ** tailpp)
+{
+    struct smp_batch_elem * bep = *headpp;
+
+    if (bep) {
+        *headpp = bep->next_p;
+        if (NULL == *headpp)
+            *tailpp = NULL;
+        bep->next_p = NULL;
+    }
+    return bep;
+}
+
+#ifdef HAVE_PTHREAD_H
+
+static void *
+worker_thread(void * vp)
+{
+    struct smp_batch * bp = (struct smp_batch *)vp;
+    struct smp_batch_elem * bep;
+
+    pthread_mutex_lock(&bp->mtx);
+    while (true) {
+        while ((NULL == bp->sub_head) && (! bp->shutdown))
+            pthread_cond_wait(&bp->sub_cv, &bp->mtx);
+        bep = elem_pop(&bp->sub_head, &bp->sub_tail);
+        if (NULL == bep)        /* shutdown and nothing left to do */
+            break;
+        pthread_mutex_unlock(&bp->mtx);
+
+        bep->res = smp_send_req(bep->tobj, bep->rresp, bp->verbose);
+
+        pthread_mutex_lock(&bp->mtx);
+        bep->done = true;
+        if (bp->cb) {
+            pthread_mutex_unlock(&bp->mtx);
+            bp->cb(bep, bp->cb_arg);
+            pthread_mutex_lock(&bp->mtx);
+            --bp->outstanding;
+        } else
+            elem_append(&bp->cmpl_head, &bp->cmpl_tail, bep);
+        pthread_cond_broadcast(&bp->cmpl_cv);
+    }
+    pthread_mutex_unlock(&bp->mtx);
+    return NULL;
+}
+
+#endif  /* HAVE_PTHREAD_H */
+
+struct smp_batch *
+smp_batch_create(int num_workers, smp_batch_cb_t cb, void * cb_arg,
+                 int verbose)
+{
+    struct smp_batch * bp;
+
+    if (num_workers <= 0)
+        num_workers = SMP_BATCH_DEF_WORKERS;
+    else if (num_workers > SMP_BATCH_MAX_WORKERS)
+        num_workers = SMP_BATCH_MAX_WORKERS;
+    bp = (struct smp_batch *)calloc(1, sizeof(struct smp_batch));
+    if (NULL == bp) {
+        pr2ws("%s: out of memory\n", __func__);
+        return NULL;
+    }
+    bp->cb = cb;
+    bp->cb_arg = cb_arg;
+    bp->verbose = verbose;
+#ifdef HAVE_PTHREAD_H
+    {
+        int k, err;
+
+        pthread_mutex_init(&bp->mtx, NULL);
+        pthread_cond_init(&bp->sub_cv, NULL);
+        pthread_cond_init(&bp->cmpl_cv, NULL);
+        for (k = 0; k < num_workers; ++k) {
+            err = pthread_create(bp->workers + k, NULL, worker_thread, bp);
+            if (err) {
+                pr2ws("%s: pthread_create() failed: %s\n", __func__,
+                      safe_strerror(err));
+                break;
+            }
+        }
+        bp->num_workers = k;
+        if (0 == k) {
+            pthread_cond_destroy(&bp->cmpl_cv);
+            pthread_cond_destroy(&bp->sub_cv);
+            pthread_mutex_destroy(&bp->mtx);
+            free(bp);
+            return NULL;
+        }
+        if (verbose > 3)
+            pr2ws("%s: started %d worker threads\n", __func__, k);
+    }
+#else
+    if (verbose > 3)
+        pr2ws("%s: no thread support, requests will be sent "
+              "synchronously\n", __func__);
+#endif
+    return bp;
+}
+
+int
+smp_batch_submit(struct smp_batch * bp, struct smp_batch_elem * bep)
+{
+    if ((NULL == bp) || (NULL == bep) || (NULL == bep->tobj) ||
+        (NULL == bep->rresp))
+        return -1;
+    bep->res = 0;
+    bep->done = false;
+    bep->rresp->timed_out = false;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&bp->mtx);
+    /* the pass-throughs check the deadline just before sending so an
+     * element still queued when it passes fails without being sent */
+    if (bp->deadline_ms && (0 == bep->rresp->deadline_ms))
+        bep->rresp->deadline_ms = bp->deadline_ms;
+    if (bp->shutdown) {
+        pthread_mutex_unlock(&bp->mtx);
+        return -1;
+    }
+    ++bp->outstanding;
+    elem_append(&bp->sub_head, &bp->sub_tail, bep);
+    pthread_cond_signal(&bp->sub_cv);
+    pthread_mutex_unlock(&bp->mtx);
+#else
+    if (bp->deadline_ms && (0 == bep->rresp->deadline_ms))
+        bep->rresp->deadline_ms = bp->deadline_ms;
+    bep->res = smp_send_req(bep->tobj, bep->rresp, bp->verbose);
+    bep->done = true;
+    if (bp->cb)
+        bp->cb(bep, bp->cb_arg);
+    else {
+        ++bp->outstanding;
+        elem_append(&bp->cmpl_head, &bp->cmpl_tail, bep);
+    }
+#endif
+    return 0;
+}
+
+struct smp_batch_elem *
+smp_batch_reap(struct smp_batch * bp, bool wait)
+{
+    struct smp_batch_elem * bep;
+
+    if (NULL == bp)
+        return NULL;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&bp->mtx);
+    while (wait && (NULL == bp->cmpl_head) && (bp->outstanding > 0) &&
+           (NULL == bp->cb))
+        pthread_cond_wait(&bp->cmpl_cv, &bp->mtx);
+    bep = elem_pop(&bp->cmpl_head, &bp->cmpl_tail);
+    if (bep)
+        --bp->outstanding;
+    pthread_mutex_unlock(&bp->mtx);
+#else
+    if (wait) { ; }     /* nothing to wait for, all done at submit */
+    bep = elem_pop(&bp->cmpl_head, &bp->cmpl_tail);
+    if (bep)
+        --bp->outstanding;
+#endif
+    return bep;
+}
+
+struct smp_batch_elem *
+smp_batch_reap_ms(struct smp_batch * bp, int wait_ms)
+{
+    struct smp_batch_elem * bep;
+
+    if (NULL == bp)
+        return NULL;
+#ifdef HAVE_PTHREAD_H
+    {
+        int err = 0;
+        struct timespec ts;
+
+        pthread_mutex_lock(&bp->mtx);
+        if ((wait_ms > 0) && (NULL == bp->cmpl_head) &&
+            (bp->outstanding > 0) && (NULL == bp->cb)) {
+            /* cmpl_cv uses the default (realtime) clock */
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += wait_ms / 1000;
+            ts.tv_nsec += (long)(wait_ms % 1000) * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ++ts.tv_sec;
+                ts.tv_nsec -= 1000000000L;
+            }
+            while ((0 == err) && (NULL == bp->cmpl_head) &&
+                   (bp->outstanding > 0))
+                err = pthread_cond_timedwait(&bp->cmpl_cv, &bp->mtx, &ts);
+        }
+        bep = elem_pop(&bp->cmpl_head, &bp->cmpl_tail);
+        if (bep)
+            --bp->outstanding;
+        pthread_mutex_unlock(&bp->mtx);
+    }
+#else
+    if (wait_ms) { ; }  /* nothing to wait for, all done at submit */
+    bep = elem_pop(&bp->cmpl_head, &bp->cmpl_tail);
+    if (bep)
+        --bp->outstanding;
+#endif
+    return bep;
+}
+
+int
+smp_batch_cancel(struct smp_batch * bp)
+{
+    int n = 0;
+
+    if (NULL == bp)
+        return 0;
+#ifdef HAVE_PTHREAD_H
+    {
+        struct smp_batch_elem * bep;
+
+        pthread_mutex_lock(&bp->mtx);
+        while ((bep = elem_pop(&bp->sub_head, &bp->sub_tail))) {
+            bep->res = -1;
+            bep->done = true;
+            ++n;
+            if (bp->cb) {
+                pthread_mutex_unlock(&bp->mtx);
+                bp->cb(bep, bp->cb_arg);
+                pthread_mutex_lock(&bp->mtx);
+                --bp->outstanding;
+            } else
+                elem_append(&bp->cmpl_head, &bp->cmpl_tail, bep);
+        }
+        if (n)
+            pthread_cond_broadcast(&bp->cmpl_cv);
+        pthread_mutex_unlock(&bp->mtx);
+    }
+#endif  /* without threads nothing is queued, all sent at submit */
+    return n;
+}
+
+int
+smp_batch_outstanding(struct smp_batch * bp)
+{
+    int n;
+
+    if (NULL == bp)
+        return 0;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&bp->mtx);
+    n = bp->outstanding;
+    pthread_mutex_unlock(&bp->mtx);
+#else
+    n = bp->outstanding;
+#endif
+    return n;
+}
+
+void
+smp_batch_set_deadline(struct smp_batch * bp, int64_t deadline_ms)
+{
+    if (NULL == bp)
+        return;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&bp->mtx);
+    bp->deadline_ms = deadline_ms;
+    pthread_mutex_unlock(&bp->mtx);
+#else
+    bp->deadline_ms = deadline_ms;
+#endif
+}
+
+int
+smp_batch_remaining_ms(struct smp_batch * bp)
+{
+    int64_t dl, rem;
+
+    if (NULL == bp)
+        return -1;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&bp->mtx);
+    dl = bp->deadline_ms;
+    pthread_mutex_unlock(&bp->mtx);
+#else
+    dl = bp->deadline_ms;
+#endif
+    if (0 == dl)
+        return -1;
+    rem = dl - smp_get_mono_ms();
+    if (rem <= 0)
+        return 0;
+    return (rem > INT32_MAX) ? INT32_MAX : (int)rem;
+}
+
+void
+smp_batch_destroy(struct smp_batch * bp)
+{
+    if (NULL == bp)
+        return;
+#ifdef HAVE_PTHREAD_H
+    {
+        int k;
+
+        /* workers drain the submission queue before they see shutdown */
+        pthread_mutex_lock(&bp->mtx);
+        bp->shutdown = true;
+        pthread_cond_broadcast(&bp->sub_cv);
+        pthread_mutex_unlock(&bp->mtx);
+        for (k = 0; k < bp->num_workers; ++k)
+            pthread_join(bp->workers[k], NULL);
+        pthread_cond_destroy(&bp->cmpl_cv);
+        pthread_cond_destroy(&bp->sub_cv);
+        pthread_mutex_destroy(&bp->mtx);
+    }
+#endif
+    free(bp);
+}
+
+int
+smp_send_req_batch(struct smp_batch_elem * arr, int num, int num_workers,
+                   int verbose)
+{
+    int k;
+    int num_bad = 0;
+    struct smp_batch * bp;
+
+    if ((NULL == arr) || (num < 0))
+        return -1;
+    if (0 == num)
+        return 0;
+    if (num_workers > num)
+        num_workers = num;
+    bp = smp_batch_create(num_workers, NULL, NULL, verbose);
+    if (NULL == bp)
+        return -1;
+    for (k = 0; k < num; ++k) {
+        if (smp_batch_submit(bp, arr + k)) {
+            arr[k].res = -1;
+            arr[k].done = true;
+        }
+    }
+    while (smp_batch_reap(bp, true))
+        ;
+    smp_batch_destroy(bp);
+    for (k = 0; k < num; ++k) {
+        if (arr[k].res)
+            ++num_bad;
+    }
+    return num_bad;
+}
@@ -0,0 +1,399 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pcapng capture of the SMP frames sent by smp_send_req(). Blocks are
+ * built in a memory buffer which is written out when it fills, when the
+ * capture is closed and when the process exits; so the cost per request
+ * is a couple of memcpy()s under a mutex. The file layout is described
+ * with SMP_CAPTURE_LINKTYPE in smp_lib.h . */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#define __STDC_FORMAT_MACROS 1
+#include <inttypes.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include "smp_lib.h"
+#include "sg_unaligned.h"
+#include "sg_pr2serr.h"
+#include "smp_capture.h"
+
+#define CAPTURE_ENVVAR "SMP_UTILS_CAPTURE"
+#define CAP_BUF_LEN (64 * 1024)
+#define CAP_MAX_IFS 256         /* later device/SAS address pairs share 0 */
+
+/* pcapng block types and option codes */
+#define PCAPNG_SHB 0x0a0d0d0a
+#define PCAPNG_IDB 0x1
+#define PCAPNG_EPB 0x6
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_OPT_ENDOFOPT 0
+#define PCAPNG_SHB_USERAPPL 4
+#define PCAPNG_IF_NAME 2
+#define PCAPNG_IF_DESCRIPTION 3
+#define PCAPNG_IF_TSRESOL 9
+
+struct cap_if {
+    char name[SMP_MAX_DEVICE_NAME];
+    uint64_t sa;
+};
+
+static int cap_fd = -1;
+static volatile bool cap_on;
+static bool cap_env_checked;
+static bool cap_atexit_set;
+static uint8_t * cap_buf;
+static int cap_used;
+static struct cap_if * cap_ifs;
+static int cap_num_ifs;
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t cap_mtx = PTHREAD_MUTEX_INITIALIZER;
+#define CAP_LOCK() pthread_mutex_lock(&cap_mtx)
+#define CAP_UNLOCK() pthread_mutex_unlock(&cap_mtx)
+#else
+#define CAP_LOCK()
+#define CAP_UNLOCK()
+#endif
+
+
+static int
+pad4(int n)
+{
+    return (n + 3) & ~3;
+}
+
+/* pcapng fields are in the byte order of the writer */
+static void
+put_u16(uint8_t * p, uint16_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static void
+put_u32(uint8_t * p, uint32_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+/* Appends option (code, len, value) padded to 4 bytes; returns its size */
+static int
+put_opt(uint8_t * p, uint16_t code, const void * vp, int len)
+{
+    put_u16(p, code);
+    put_u16(p + 2, (uint16_t)len);
+    if (len > 0) {
+        memcpy(p + 4, vp, len);
+        memset(p + 4 + len, 0, pad4(len) - len);
+    }
+    return 4 + pad4(len);
+}
+
+/* Call with lock held. Returns false (and stops capture) on error. */
+static bool
+cap_flush(void)
+{
+    int k, res;
+
+    for (k = 0; k < cap_used; k += res) {
+        res = write(cap_fd, cap_buf + k, cap_used - k);
+        if (res < 0) {
+            if (EINTR == errno) {
+                res = 0;
+                continue;
+            }
+            pr2ws("smp_utils capture: write failed: %s, capture "
+                  "stopped\n", strerror(errno));
+            close(cap_fd);
+            cap_fd = -1;
+            cap_on = false;
+            cap_used = 0;
+            return false;
+        }
+    }
+    cap_used = 0;
+    return true;
+}
+
+/* Call with lock held. Returns space for a block of blk_len bytes in the
+ * buffer, flushing first if needed, or NULL. */
+static uint8_t *
+cap_reserve(int blk_len)
+{
+    if ((cap_used + blk_len) > CAP_BUF_LEN) {
+        if (! cap_flush())
+            return NULL;
+    }
+    if (blk_len > CAP_BUF_LEN)
+        return NULL;
+    cap_used += blk_len;
+    return cap_buf + cap_used - blk_len;
+}
+
+/* Section Header Block, starts each capture */
+static bool
+cap_put_shb(void)
+{
+    static const char * appl = "smp_utils";
+    int len = 28 + 4 + pad4(strlen(appl)) + 4;
+    int n;
+    uint8_t * p = cap_reserve(len);
+
+    if (NULL == p)
+        return false;
+    put_u32(p, PCAPNG_SHB);
+    put_u32(p + 4, len);
+    put_u32(p + 8, PCAPNG_BYTE_ORDER_MAGIC);
+    put_u16(p + 12, 1);         /* major version */
+    put_u16(p + 14, 0);         /* minor version */
+    memset(p + 16, 0xff, 8);    /* section length: not given */
+    n = 24;
+    n += put_opt(p + n, PCAPNG_SHB_USERAPPL, appl, strlen(appl));
+    n += put_opt(p + n, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+    put_u32(p + n, len);
+    return true;
+}
+
+/* Returns the interface id for (name, sa), adding an Interface Description
+ * Block if it is new, or -1 on error. Call with lock held. */
+static int
+cap_get_if(const char * name, uint64_t sa)
+{
+    int k, n, len, name_len, desc_len;
+    uint8_t tsresol = 9;        /* 10^-9 seconds */
+    uint8_t * p;
+    char desc[40];
+
+    for (k = 0; k < cap_num_ifs; ++k) {
+        if ((sa == cap_ifs[k].sa) && (0 == strcmp(name, cap_ifs[k].name)))
+            return k;
+    }
+    if (cap_num_ifs >= CAP_MAX_IFS)
+        return 0;
+    name_len = strlen(name);
+    desc_len = snprintf(desc, sizeof(desc), "SAS address 0x%" PRIx64, sa);
+    len = 20 + (4 + pad4(name_len)) + (4 + pad4(desc_len)) + (4 + 4) + 4;
+    p = cap_reserve(len);
+    if (NULL == p)
+        return -1;
+    put_u32(p, PCAPNG_IDB);
+    put_u32(p + 4, len);
+    put_u16(p + 8, SMP_CAPTURE_LINKTYPE);
+    put_u16(p + 10, 0);
+    put_u32(p + 12, 0);         /* snaplen: no limit */
+    n = 16;
+    n += put_opt(p + n, PCAPNG_IF_NAME, name, name_len);
+    n += put_opt(p + n, PCAPNG_IF_DESCRIPTION, desc, desc_len);
+    n += put_opt(p + n, PCAPNG_IF_TSRESOL, &tsresol, 1);
+    n += put_opt(p + n, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+    put_u32(p + n, len);
+    snprintf(cap_ifs[cap_num_ifs].name, sizeof(cap_ifs[0].name), "%s",
+             name);
+    cap_ifs[cap_num_ifs].sa = sa;
+    return cap_num_ifs++;
+}
+
+/* Call with lock held */
+static void
+cap_close(void)
+{
+    if (cap_fd >= 0) {
+        cap_flush();
+        if (cap_fd >= 0)
+            close(cap_fd);
+    }
+    cap_fd = -1;
+    cap_on = false;
+    free(cap_buf);
+    cap_buf = NULL;
+    free(cap_ifs);
+    cap_ifs = NULL;
+    cap_num_ifs = 0;
+    cap_used = 0;
+}
+
+void
+smp_capture_close(void)
+{
+    CAP_LOCK();
+    cap_close();
+    CAP_UNLOCK();
+}
+
+static void
+cap_at_exit(void)
+{
+    smp_capture_close();
+}
+
+int
+smp_capture_open(const char * fname)
+{
+    int ret = -1;
+
+    if ((NULL == fname) || ('\0' == fname[0]))
+        return -1;
+    CAP_LOCK();
+    cap_env_checked = true;     /* explicit open beats the env var */
+    cap_close();
+    cap_buf = (uint8_t *)malloc(CAP_BUF_LEN);
+    cap_ifs = (struct cap_if *)calloc(CAP_MAX_IFS, sizeof(struct cap_if));
+    if ((NULL == cap_buf) || (NULL == cap_ifs))
+        goto fini;
+    cap_fd = open(fname, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (cap_fd < 0) {
+        pr2ws("smp_utils capture: unable to open %s: %s\n", fname,
+              strerror(errno));
+        goto fini;
+    }
+    if (! cap_put_shb())
+        goto fini;
+    if (! cap_atexit_set) {
+        cap_atexit_set = true;
+        atexit(cap_at_exit);
+    }
+    cap_on = true;
+    ret = 0;
+fini:
+    if (ret)
+        cap_close();
+    CAP_UNLOCK();
+    return ret;
+}
+
+bool
+smp_capture_active(void)
+{
+    const char * cp;
+
+    if (! cap_env_checked) {
+        CAP_LOCK();
+        if (cap_env_checked) {
+            CAP_UNLOCK();
+            return cap_on;
+        }
+        cap_env_checked = true;
+        CAP_UNLOCK();
+        cp = getenv(CAPTURE_ENVVAR);
+        if (cp && cp[0])
+            smp_capture_open(cp);
+    }
+    return cap_on;
+}
+
+/* Length of the response frame excluding CRC, as far as can be told */
+static int
+cap_resp_len(const struct smp_req_resp * rresp, int res)
+{
+    int len, dlen;
+    const uint8_t * rp = rresp->response;
+
+    if (res || (NULL == rp) || (rresp->max_response_len < 4) ||
+        ((rresp->act_response_len >= 0) && (rresp->act_response_len < 4)))
+        return 0;
+    dlen = rp[3];
+    if ((0 == dlen) && (0 == rp[2])) {
+        dlen = smp_get_func_def_resp_len(rp[1]);
+        if (dlen < 0)
+            dlen = 0;
+    }
+    len = 4 + (4 * dlen);
+    if (len > (rresp->max_response_len - 4))
+        len = rresp->max_response_len - 4;
+    if ((rresp->act_response_len >= 0) && (len > rresp->act_response_len))
+        len = rresp->act_response_len;
+    return (len < 4) ? 4 : len;
+}
+
+void
+smp_capture_rec(const struct smp_target_obj * tobj,
+                const struct smp_req_resp * rresp, int res,
+                uint64_t ts_ns, uint64_t lat_ns)
+{
+    int id, len, req_len, resp_len, pkt_len;
+    uint8_t * p;
+    uint8_t * hp;
+
+    if ((NULL == tobj) || (NULL == rresp) || (NULL == rresp->request))
+        return;
+    req_len = rresp->request_len - 4;
+    if (req_len < 2)
+        req_len = rresp->request_len;
+    if (req_len > 1024)
+        req_len = 1024;
+    resp_len = cap_resp_len(rresp, res);
+    pkt_len = SMP_CAPTURE_HDR_LEN + req_len + resp_len;
+    len = 28 + pad4(pkt_len) + 4;
+
+    CAP_LOCK();
+    if (! cap_on)
+        goto fini;
+    id = cap_get_if(tobj->device_name, tobj->sas_addr64);
+    if (id < 0)
+        goto fini;
+    p = cap_reserve(len);
+    if (NULL == p)
+        goto fini;
+    put_u32(p, PCAPNG_EPB);
+    put_u32(p + 4, len);
+    put_u32(p + 8, id);
+    put_u32(p + 12, (uint32_t)(ts_ns >> 32));
+    put_u32(p + 16, (uint32_t)ts_ns);
+    put_u32(p + 20, pkt_len);   /* captured length */
+    put_u32(p + 24, pkt_len);   /* original length */
+    hp = p + 28;
+    hp[0] = SMP_CAPTURE_VERSION;
+    hp[1] = (res ? SMP_CAPTURE_F_PT_FAIL : 0) |
+            (rresp->timed_out ? SMP_CAPTURE_F_TIMED_OUT : 0);
+    sg_put_unaligned_be16(req_len, hp + 2);
+    sg_put_unaligned_be16(resp_len, hp + 4);
+    sg_put_unaligned_be16((rresp->transport_err > 0xffff) ? 0xffff :
+                          (uint16_t)rresp->transport_err, hp + 6);
+    sg_put_unaligned_be64(lat_ns, hp + 8);
+    sg_put_unaligned_be64(tobj->sas_addr64, hp + 16);
+    memcpy(hp + SMP_CAPTURE_HDR_LEN, rresp->request, req_len);
+    if (resp_len > 0)
+        memcpy(hp + SMP_CAPTURE_HDR_LEN + req_len, rresp->response,
+               resp_len);
+    memset(hp + pkt_len, 0, pad4(pkt_len) - pkt_len);
+    put_u32(p + len - 4, len);
+fini:
+    CAP_UNLOCK();
+}
@@ -0,0 +1,21 @@
+#ifndef SMP_CAPTURE_H
+#define SMP_CAPTURE_H
+
+#include <stdbool.h>
+
+#include "smp_lib.h"
+
+/* Library internal side of the pcapng frame capture (see smp_lib.h). */
+
+/* Checks the SMP_UTILS_CAPTURE environment variable (once) and returns
+ * true if capture is on. Cheap enough to call for every request. */
+bool smp_capture_active(void);
+
+/* Appends one request/response pair. res is the pass-through return
+ * value, ts_ns the real time clock when the request was sent and lat_ns
+ * the time taken by the pass-through call. */
+void smp_capture_rec(const struct smp_target_obj * tobj,
+                     const struct smp_req_resp * rresp, int res,
+                     uint64_t ts_ns, uint64_t lat_ns);
+
+#endif
@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Persistent per-expander discovery cache, see the "Discovery cache"
+ * section of smp_lib.h . File layout (big endian fields):
+ *     bytes 0-7:    magic "SMPDCACH"
+ *     byte 8:       version (DC_VERSION)
+ *     byte 9:       flags: DC_F_*
+ *     bytes 10-11:  expander change count
+ *     bytes 12-13:  number of phys
+ *     bytes 14-15:  slot length (SMP_DISC_CACHE_SLOT_LEN)
+ *     bytes 16-23:  SAS address given to smp_disc_cache_open() (or 0)
+ *     bytes 24-31:  expander SAS address from the stored responses (or 0)
+ *     bytes 32-63:  reserved
+ *     then SMP_DISC_CACHE_DL_HDR_LEN bytes of DISCOVER LIST header, then
+ *     for each phy: 2 byte response length (0 -> not held), 2 reserved
+ *     bytes and a slot holding the response. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#define __STDC_FORMAT_MACROS 1
+#include <inttypes.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "smp_lib.h"
+#include "sg_unaligned.h"
+#include "sg_pr2serr.h"
+
+#define DC_ENVVAR "SMP_UTILS_DISC_CACHE"
+#define DC_MAGIC "SMPDCACH"
+#define DC_VERSION 2
+#define DC_HDR_LEN 64
+#define DC_REC_LEN (4 + SMP_DISC_CACHE_SLOT_LEN)
+#define DC_MAX_PHYS 256
+
+#define DC_F_DL_HDR 0x1         /* DISCOVER LIST header held */
+#define DC_F_IGN_ZG 0x2         /* filled with Ignore Zone Group bit set */
+
+struct smp_disc_cache {
+    bool dirty;
+    bool unverified;            /* loaded by device name, SAS addr unseen */
+    bool dl_hdr_live;           /* DISCOVER LIST header put since open */
+    int verbose;
+    uint8_t * img;              /* file image, DC_HDR_LEN bytes onward */
+    int img_len;
+    int num_phys;
+    char fname[SMP_MAX_DEVICE_NAME + 64];
+};
+
+
+static int
+dc_img_len(int num_phys)
+{
+    return DC_HDR_LEN + SMP_DISC_CACHE_DL_HDR_LEN + (num_phys * DC_REC_LEN);
+}
+
+static uint8_t *
+dc_rec(const struct smp_disc_cache * dcp, int phy_id)
+{
+    return dcp->img + DC_HDR_LEN + SMP_DISC_CACHE_DL_HDR_LEN +
+           (phy_id * DC_REC_LEN);
+}
+
+/* Builds the cache file name from sa, or if that is 0, from dev_name with
+ * characters that are awkward in file names replaced by '_' . */
+static void
+dc_make_fname(const char * dir, const char * dev_name, uint64_t sa,
+              char * b, int blen)
+{
+    int k, n;
+    char c;
+
+    if (sa) {
+        snprintf(b, blen, "%s/%016" PRIx64 ".dc", dir, sa);
+        return;
+    }
+    n = snprintf(b, blen, "%s/dev", dir);
+    for (k = 0; dev_name[k] && (n < (blen - 4)); ++k, ++n) {
+        c = dev_name[k];
+        if (! (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) ||
+               ((c >= '0') && (c <= '9')) || ('-' == c) || ('.' == c)))
+            c = '_';
+        b[n] = c;
+    }
+    snprintf(b + n, blen - n, ".dc");
+}
+
+/* Reads the file image into dcp->img if it matches. Returns true if so. */
+static bool
+dc_load(struct smp_disc_cache * dcp, uint64_t sa, int ecc, uint8_t flags)
+{
+    int fd, n;
+    uint8_t * bp = dcp->img;
+
+    fd = open(dcp->fname, O_RDONLY);
+    if (fd < 0)
+        return false;
+    n = read(fd, bp, dcp->img_len);
+    close(fd);
+    if (n != dcp->img_len) {
+        if (dcp->verbose > 1)
+            pr2serr("%s: %s: short or unreadable\n", __func__, dcp->fname);
+        return false;
+    }
+    if ((0 != memcmp(bp, DC_MAGIC, 8)) || (DC_VERSION != bp[8]) ||
+        ((int)sg_get_unaligned_be16(bp + 12) != dcp->num_phys) ||
+        (SMP_DISC_CACHE_SLOT_LEN != sg_get_unaligned_be16(bp + 14)) ||
+        (sg_get_unaligned_be64(bp + 16) != sa)) {
+        if (dcp->verbose)
+            pr2serr("%s: %s: not a matching cache file, ignored\n",
+                    __func__, dcp->fname);
+        return false;
+    }
+    if (((int)sg_get_unaligned_be16(bp + 10) != ecc) ||
+        ((bp[9] & DC_F_IGN_ZG) != (flags & DC_F_IGN_ZG))) {
+        if (dcp->verbose)
+            pr2serr("%s: expander change count was %u, now %d; stale\n",
+                    __func__, sg_get_unaligned_be16(bp + 10), ecc);
+        return false;
+    }
+    return true;
+}
+
+struct smp_disc_cache *
+smp_disc_cache_open(const char * dev_name, uint64_t sa, int ecc,
+                    int num_phys, bool ign_zg, int verbose)
+{
+    const char * dir;
+    uint8_t flags = ign_zg ? DC_F_IGN_ZG : 0;
+    struct smp_disc_cache * dcp;
+
+    dir = getenv(DC_ENVVAR);
+    if ((NULL == dir) || ('\0' == dir[0]) || (ecc < 0) || (num_phys <= 0) ||
+        (num_phys > DC_MAX_PHYS))
+        return NULL;
+    dcp = (struct smp_disc_cache *)calloc(1, sizeof(*dcp));
+    if (NULL == dcp)
+        return NULL;
+    dcp->verbose = verbose;
+    dcp->num_phys = num_phys;
+    dcp->img_len = dc_img_len(num_phys);
+    dcp->img = (uint8_t *)calloc(1, dcp->img_len);
+    if (NULL == dcp->img) {
+        free(dcp);
+        return NULL;
+    }
+    dc_make_fname(dir, dev_name ? dev_name : "", sa, dcp->fname,
+                  sizeof(dcp->fname));
+    if (dc_load(dcp, sa, ecc, flags)) {
+        if (verbose > 1)
+            pr2serr("%s: using %s, expander change count %d\n", __func__,
+                    dcp->fname, ecc);
+        /* device names are reused and change counts restart after a
+         * reset, so a table keyed by device name is only served once a
+         * live response shows it is from the same expander */
+        dcp->unverified = (0 == sa);
+        return dcp;
+    }
+    memset(dcp->img, 0, dcp->img_len);
+    memcpy(dcp->img, DC_MAGIC, 8);
+    dcp->img[8] = DC_VERSION;
+    dcp->img[9] = flags;
+    sg_put_unaligned_be16((uint16_t)ecc, dcp->img + 10);
+    sg_put_unaligned_be16((uint16_t)num_phys, dcp->img + 12);
+    sg_put_unaligned_be16(SMP_DISC_CACHE_SLOT_LEN, dcp->img + 14);
+    sg_put_unaligned_be64(sa, dcp->img + 16);
+    return dcp;
+}
+
+int
+smp_disc_cache_num_phys(const struct smp_disc_cache * dcp)
+{
+    return dcp ? dcp->num_phys : 0;
+}
+
+const uint8_t *
+smp_disc_cache_get_phy(const struct smp_disc_cache * dcp, int phy_id,
+                       int * lenp)
+{
+    int len;
+    const uint8_t * rp;
+
+    if ((NULL == dcp) || dcp->unverified || (phy_id < 0) ||
+        (phy_id >= dcp->num_phys))
+        return NULL;
+    rp = dc_rec(dcp, phy_id);
+    len = sg_get_unaligned_be16(rp);
+    if (0 == len)
+        return NULL;
+    if (lenp)
+        *lenp = len;
+    return rp + 4;
+}
+
+/* Checks the expander SAS address in a live DISCOVER response (bytes 16
+ * to 23) against the one the table was built from. An unverified table
+ * from another expander is emptied. */
+static void
+dc_check_sa(struct smp_disc_cache * dcp, const uint8_t * rp, int len)
+{
+    uint64_t rsa, tsa;
+    uint8_t * bp;
+
+    if ((len < 24) || (0 != rp[2]))
+        return;
+    rsa = sg_get_unaligned_be64(rp + 16);
+    if (0 == rsa)
+        return;
+    tsa = sg_get_unaligned_be64(dcp->img + 24);
+    if (dcp->unverified) {
+        dcp->unverified = false;
+        if (rsa == tsa) {
+            if (dcp->verbose > 1)
+                pr2serr("%s: %s: expander SAS address matches\n", __func__,
+                        dcp->fname);
+            return;
+        }
+        if (dcp->verbose)
+            pr2serr("%s: %s: held expander 0x%" PRIx64 ", now 0x%" PRIx64
+                    "; discarded\n", __func__, dcp->fname, tsa, rsa);
+        bp = dcp->img + DC_HDR_LEN;
+        if (dcp->dl_hdr_live)
+            bp += SMP_DISC_CACHE_DL_HDR_LEN;
+        else
+            dcp->img[9] &= ~DC_F_DL_HDR;
+        memset(bp, 0, dcp->img_len - (bp - dcp->img));
+        tsa = 0;
+    }
+    if (0 == tsa) {
+        sg_put_unaligned_be64(rsa, dcp->img + 24);
+        dcp->dirty = true;
+    }
+}
+
+void
+smp_disc_cache_put_phy(struct smp_disc_cache * dcp, int phy_id,
+                       const uint8_t * rp, int len)
+{
+    uint8_t * bp;
+
+    if ((NULL == dcp) || (phy_id < 0) || (phy_id >= dcp->num_phys) ||
+        (len < 4))
+        return;
+    dc_check_sa(dcp, rp, len);
+    if (len > SMP_DISC_CACHE_SLOT_LEN)
+        len = SMP_DISC_CACHE_SLOT_LEN;
+    bp = dc_rec(dcp, phy_id);
+    if (((int)sg_get_unaligned_be16(bp) == len) &&
+        (0 == memcmp(bp + 4, rp, len)))
+        return;
+    memset(bp, 0, DC_REC_LEN);
+    sg_put_unaligned_be16((uint16_t)len, bp);
+    memcpy(bp + 4, rp, len);
+    dcp->dirty = true;
+}
+
+const uint8_t *
+smp_disc_cache_get_dl_hdr(const struct smp_disc_cache * dcp)
+{
+    if ((NULL == dcp) || dcp->unverified ||
+        (0 == (dcp->img[9] & DC_F_DL_HDR)))
+        return NULL;
+    return dcp->img + DC_HDR_LEN;
+}
+
+void
+smp_disc_cache_put_dl_hdr(struct smp_disc_cache * dcp, const uint8_t * hp)
+{
+    uint8_t * bp;
+
+    if (NULL == dcp)
+        return;
+    dcp->dl_hdr_live = true;
+    bp = dcp->img + DC_HDR_LEN;
+    if ((dcp->img[9] & DC_F_DL_HDR) &&
+        (0 == memcmp(bp, hp, SMP_DISC_CACHE_DL_HDR_LEN)))
+        return;
+    memcpy(bp, hp, SMP_DISC_CACHE_DL_HDR_LEN);
+    dcp->img[9] |= DC_F_DL_HDR;
+    dcp->dirty = true;
+}
+
+int
+smp_disc_cache_close(struct smp_disc_cache * dcp, int verbose)
+{
+    int fd, n;
+    int ret = 0;
+    char tmp_fn[sizeof(dcp->fname) + 16];
+
+    if (NULL == dcp)
+        return 0;
+    if (dcp->dirty) {
+        /* write a temporary file then rename so readers see whole files */
+        snprintf(tmp_fn, sizeof(tmp_fn), "%s.%d", dcp->fname,
+                 (int)getpid());
+        fd = open(tmp_fn, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            if (verbose)
+                pr2serr("%s: unable to create %s: %s\n", __func__, tmp_fn,
+                        safe_strerror(errno));
+            ret = -1;
+            goto fini;
+        }
+        n = write(fd, dcp->img, dcp->img_len);
+        if (n != dcp->img_len) {
+            if (verbose)
+                pr2serr("%s: write to %s failed\n", __func__, tmp_fn);
+            close(fd);
+            unlink(tmp_fn);
+            ret = -1;
+            goto fini;
+        }
+        close(fd);
+        if (rename(tmp_fn, dcp->fname) < 0) {
+            if (verbose)
+                pr2serr("%s: rename to %s failed: %s\n", __func__,
+                        dcp->fname, safe_strerror(errno));
+            unlink(tmp_fn);
+            ret = -1;
+        } else if (verbose > 1)
+            pr2serr("%s: wrote %s\n", __func__, dcp->fname);
+    }
+fini:
+    free(dcp->img);
+    free(dcp);
+    return ret;
+}
@@ -0,0 +1,1532 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Software expander emulator. The "device name" given with
+ * '--interface=emu' is a description file listing one or more expanders,
+ * their phys, what is attached to each phy, route table entries, zoning
+ * state and phy event counters. SMP requests are answered from that model
+ * with frames laid out as a SAS-2.1 expander would, so the utilities (and
+ * changes to them) can be exercised and timed without an expander. State
+ * changed by configure functions lasts until the target is closed.
+ *
+ * Description file syntax (one statement per line, '#' starts a comment):
+ *     expander SAS_ADDR [ATTR=VAL ...]
+ *     phy ID [ATTR=VAL ...]            applies to the last expander
+ *     route PHY_ID INDEX SAS_ADDR [disabled]
+ *     zperm SRC_ZG DST_ZG[,DST_ZG...]  permission is made symmetric
+ * See emu_exp_attrs[] and parse_phy() for the attributes. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#define __STDC_FORMAT_MACROS 1
+#include <inttypes.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include "smp_lib.h"
+#include "sg_unaligned.h"
+#include "smp_emu.h"
+
+#define EMU_MAX_PHYS 254
+#define EMU_MAX_PHY_EVENTS 16
+#define EMU_MAX_ROUTE_INDEXES 4096
+#define EMU_LINE_LEN 1024
+#define EMU_RESP_LEN 1032       /* largest SMP frame (1028) rounded up */
+
+#define EMU_DEF_RATE 0xb        /* 12 Gbps */
+#define EMU_HW_MIN_RATE 0x8     /* 1.5 Gbps */
+#define EMU_HW_MAX_RATE 0xb
+
+/* attached device types */
+#define EMU_ADT_NONE 0
+#define EMU_ADT_END 1
+#define EMU_ADT_EXP 2
+#define EMU_ADT_FANOUT 3
+
+/* protocol bits in DISCOVER response bytes 14 and 15 */
+#define EMU_PROTO_SSP 0x8
+#define EMU_PROTO_STP 0x4
+#define EMU_PROTO_SMP 0x2
+#define EMU_PROTO_SATA 0x1
+
+/* phy event sources that hold a peak value (cleared by CONFIGURE PHY
+ * EVENT with the CLEAR PEAKS bit set) */
+#define EMU_PEAK_SRC_FIRST 0x2b
+#define EMU_PEAK_SRC_LAST 0x2e
+
+struct emu_event {
+    uint8_t src;
+    uint32_t val;
+    uint32_t inc;               /* added to val after each report */
+    uint32_t thresh;
+};
+
+struct emu_route {
+    uint64_t sa;
+    bool disabled;
+};
+
+struct emu_phy {
+    bool vacant;
+    bool virt;
+    bool disabled;
+    bool iz;                    /* inside ZPSDS */
+    uint8_t adt;
+    uint8_t rate;               /* negotiated logical link rate */
+    uint8_t iproto;
+    uint8_t tproto;
+    uint8_t routing;            /* 0: direct, 1: subtractive, 2: table */
+    uint8_t zg;
+    uint8_t aphy;
+    uint8_t change_count;
+    uint64_t att_sa;
+    uint64_t att_dev_name;
+    uint32_t errs[4];           /* in REPORT PHY ERROR LOG order */
+    int num_ev;
+    struct emu_event ev[EMU_MAX_PHY_EVENTS];
+    int num_rt;
+    struct emu_route * rt;      /* route_indexes entries, table routing */
+};
+
+struct emu_exp {
+    uint64_t sa;
+    char vendor[9];
+    char product[17];
+    char revision[5];
+    int change_count;
+    int num_phys;
+    int route_indexes;
+    int latency_us;             /* added to every response */
+    int dl_max;                 /* DISCOVER LIST descriptor cap, 0: none */
+    bool t2t;
+    bool zoning_sup;
+    bool zoning_en;
+    bool zone_locked;
+    bool zg256;                 /* 256 zone groups, else 128 */
+    struct emu_phy * phy;       /* num_phys entries */
+    uint8_t (* zperm)[32];      /* [src_zg][...], bit (dst_zg % 8) of byte
+                                 * (31 - (dst_zg / 8)) */
+};
+
+struct smp_emu {
+    int num_exps;
+    struct emu_exp * exps;
+    struct emu_exp * tgt;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t mtx;
+#endif
+};
+
+#ifdef HAVE_PTHREAD_H
+#define EMU_LOCK(ep) pthread_mutex_lock(&(ep)->mtx)
+#define EMU_UNLOCK(ep) pthread_mutex_unlock(&(ep)->mtx)
+#else
+#define EMU_LOCK(ep)
+#define EMU_UNLOCK(ep)
+#endif
+
+struct emu_name_val {
+    const char * name;
+    int val;
+};
+
+static struct emu_name_val emu_rate_arr[] = {
+    {"1.5", 0x8},
+    {"3", 0x9},
+    {"6", 0xa},
+    {"12", 0xb},
+    {"22.5", 0xc},
+    {NULL, 0},
+};
+
+static struct emu_name_val emu_routing_arr[] = {
+    {"direct", 0},
+    {"subtractive", 1},
+    {"table", 2},
+    {NULL, 0},
+};
+
+static struct emu_name_val emu_proto_arr[] = {
+    {"ssp", EMU_PROTO_SSP},
+    {"stp", EMU_PROTO_STP},
+    {"smp", EMU_PROTO_SMP},
+    {"sata", EMU_PROTO_SATA},
+    {NULL, 0},
+};
+
+/* Shortest request frame (excluding CRC) of each function, from SPL. For
+ * those of variable length it is the length with no descriptors. */
+static struct emu_func_len {
+    int func;
+    int min_len;
+} emu_req_len_arr[] = {
+    {SMP_FN_REPORT_GENERAL, 4},
+    {SMP_FN_REPORT_MANUFACTURER, 4},
+    {SMP_FN_REPORT_SELF_CONFIG, 8},
+    {SMP_FN_REPORT_ZONE_PERMISSION_TBL, 8},
+    {SMP_FN_REPORT_ZONE_MANAGER_PASS, 8},
+    {SMP_FN_REPORT_BROADCAST, 8},
+    {SMP_FN_DISCOVER, 12},
+    {SMP_FN_REPORT_PHY_ERR_LOG, 12},
+    {SMP_FN_REPORT_PHY_SATA, 12},
+    {SMP_FN_REPORT_ROUTE_INFO, 12},
+    {SMP_FN_REPORT_PHY_EVENT, 12},
+    {SMP_FN_DISCOVER_LIST, 28},
+    {SMP_FN_REPORT_PHY_EVENT_LIST, 8},
+    {SMP_FN_REPORT_EXP_ROUTE_TBL_LIST, 28},
+    {SMP_FN_CONFIG_GENERAL, 16},
+    {SMP_FN_ENABLE_DISABLE_ZONING, 12},
+    {SMP_FN_ZONED_BROADCAST, 8},
+    {SMP_FN_ZONE_LOCK, 40},
+    {SMP_FN_ZONE_ACTIVATE, 8},
+    {SMP_FN_ZONE_UNLOCK, 8},
+    {SMP_FN_CONFIG_ZONE_MANAGER_PASS, 72},
+    {SMP_FN_CONFIG_ZONE_PHY_INFO, 8},
+    {SMP_FN_CONFIG_ZONE_PERMISSION_TBL, 16},
+    {SMP_FN_CONFIG_ROUTE_INFO, 40},
+    {SMP_FN_PHY_CONTROL, 40},
+    {SMP_FN_PHY_TEST_FUNCTION, 40},
+    {SMP_FN_CONFIG_PHY_EVENT, 12},
+    {-1, 0},
+};
+
+
+static int
+emu_lookup(const struct emu_name_val * arr, const char * name)
+{
+    for ( ; arr->name; ++arr) {
+        if (0 == strcmp(arr->name, name))
+            return arr->val;
+    }
+    return -1;
+}
+
+/* Returns true and places the (non-negative) number in *vp if s decodes */
+static bool
+emu_num(const char * s, uint64_t * vp)
+{
+    int64_t ll = smp_get_llnum_nomult(s);
+
+    if (ll < 0)
+        return false;
+    *vp = (uint64_t)ll;
+    return true;
+}
+
+/* Decodes a list like "ssp,stp" into protocol bits, or a number */
+static int
+emu_protos(char * s)
+{
+    int res, v = 0;
+    uint64_t u;
+    char * cp;
+    char * savep = NULL;
+
+    if (emu_num(s, &u))
+        return (u < 0x100) ? (int)u : -1;
+    for (cp = strtok_r(s, ",", &savep); cp;
+         cp = strtok_r(NULL, ",", &savep)) {
+        res = emu_lookup(emu_proto_arr, cp);
+        if (res < 0)
+            return -1;
+        v |= res;
+    }
+    return v;
+}
+
+/* "SRC:VAL[:INC[:THRESH]]" entries separated by commas */
+static bool
+emu_events(struct emu_phy * pp, char * s)
+{
+    int k;
+    uint64_t u[4];
+    char * cp;
+    char * fp;
+    char * savep = NULL;
+    char * fsavep;
+    struct emu_event * evp;
+
+    for (cp = strtok_r(s, ",", &savep); cp;
+         cp = strtok_r(NULL, ",", &savep)) {
+        memset(u, 0, sizeof(u));
+        fsavep = NULL;
+        for (k = 0, fp = strtok_r(cp, ":", &fsavep); fp && (k < 4);
+             ++k, fp = strtok_r(NULL, ":", &fsavep)) {
+            if (! emu_num(fp, u + k))
+                return false;
+        }
+        if ((k < 2) || fp || (u[0] > 0xff))
+            return false;
+        if (pp->num_ev >= EMU_MAX_PHY_EVENTS)
+            return false;
+        evp = pp->ev + pp->num_ev++;
+        evp->src = (uint8_t)u[0];
+        evp->val = (uint32_t)u[1];
+        evp->inc = (uint32_t)u[2];
+        evp->thresh = (uint32_t)u[3];
+    }
+    return true;
+}
+
+static void
+emu_set_zperm(struct emu_exp * xp, int src, int dst, bool on)
+{
+    uint8_t * bp = xp->zperm[src] + 31 - (dst / 8);
+
+    if (on)
+        *bp |= (1 << (dst % 8));
+    else
+        *bp &= ~(1 << (dst % 8));
+}
+
+static bool
+emu_phy_grow(struct emu_exp * xp, int num_phys)
+{
+    struct emu_phy * pp;
+
+    if (num_phys <= xp->num_phys)
+        return true;
+    pp = (struct emu_phy *)realloc(xp->phy, num_phys * sizeof(*pp));
+    if (NULL == pp)
+        return false;
+    memset(pp + xp->num_phys, 0, (num_phys - xp->num_phys) * sizeof(*pp));
+    xp->phy = pp;
+    xp->num_phys = num_phys;
+    return true;
+}
+
+static bool
+emu_rt_grow(struct emu_phy * pp, int n)
+{
+    struct emu_route * rp;
+
+    if (n <= pp->num_rt)
+        return true;
+    rp = (struct emu_route *)realloc(pp->rt, n * sizeof(*rp));
+    if (NULL == rp)
+        return false;
+    memset(rp + pp->num_rt, 0, (n - pp->num_rt) * sizeof(*rp));
+    pp->rt = rp;
+    pp->num_rt = n;
+    return true;
+}
+
+/* Splits "name=value" in place; returns value or NULL if no '=' */
+static char *
+emu_attr(char * tok)
+{
+    char * cp = strchr(tok, '=');
+
+    if (NULL == cp)
+        return NULL;
+    *cp = '\0';
+    return cp + 1;
+}
+
+/* A repeated SAS address adds attributes to the earlier expander which
+ * then becomes the current one (*xpp). */
+static const char *
+parse_expander(struct smp_emu * ep, char ** toks, int ntoks,
+               struct emu_exp ** xpp)
+{
+    int k;
+    uint64_t u;
+    char * vp;
+    struct emu_exp * xp;
+
+    if ((ntoks < 2) || (! emu_num(toks[1], &u)))
+        return "expected: expander SAS_ADDR [ATTR=VAL ...]";
+    for (k = 0, xp = NULL; k < ep->num_exps; ++k) {
+        if (u == ep->exps[k].sa) {
+            xp = ep->exps + k;
+            break;
+        }
+    }
+    if (NULL == xp) {
+        xp = (struct emu_exp *)realloc(ep->exps,
+                                       (ep->num_exps + 1) * sizeof(*xp));
+        if (NULL == xp)
+            return "out of memory";
+        ep->exps = xp;
+        xp += ep->num_exps++;
+        memset(xp, 0, sizeof(*xp));
+        xp->sa = u;
+        strcpy(xp->vendor, "SMPUTILS");
+        strcpy(xp->product, "EMULATED EXP");
+        strcpy(xp->revision, "0100");
+        xp->zperm = (uint8_t (*)[32])calloc(256, 32);
+        if (NULL == xp->zperm)
+            return "out of memory";
+        /* SAS-2 default: zone group 1 may access all (and all access 1) */
+        for (k = 0; k < 256; ++k) {
+            emu_set_zperm(xp, 1, k, true);
+            emu_set_zperm(xp, k, 1, true);
+        }
+    }
+    *xpp = xp;
+    for (k = 2; k < ntoks; ++k) {
+        vp = emu_attr(toks[k]);
+        if (NULL == vp)
+            return "expander attributes are ATTR=VAL";
+        if (0 == strcmp("vendor", toks[k]))
+            snprintf(xp->vendor, sizeof(xp->vendor), "%s", vp);
+        else if (0 == strcmp("product", toks[k]))
+            snprintf(xp->product, sizeof(xp->product), "%s", vp);
+        else if (0 == strcmp("revision", toks[k]))
+            snprintf(xp->revision, sizeof(xp->revision), "%s", vp);
+        else if (0 == strcmp("phys", toks[k])) {
+            if ((! emu_num(vp, &u)) || (u > EMU_MAX_PHYS))
+                return "bad phys= value";
+            if (! emu_phy_grow(xp, (int)u))
+                return "out of memory";
+        } else if (0 == strcmp("change_count", toks[k])) {
+            if ((! emu_num(vp, &u)) || (u > 0xffff))
+                return "bad change_count= value";
+            xp->change_count = (int)u;
+        } else if (0 == strcmp("route_indexes", toks[k])) {
+            if ((! emu_num(vp, &u)) || (u > EMU_MAX_ROUTE_INDEXES))
+                return "bad route_indexes= value";
+            xp->route_indexes = (int)u;
+        } else if (0 == strcmp("latency_us", toks[k])) {
+            if ((! emu_num(vp, &u)) || (u > 10000000))
+                return "bad latency_us= value";
+            xp->latency_us = (int)u;
+        } else if (0 == strcmp("dl_max", toks[k])) {
+            if ((! emu_num(vp, &u)) || (u > 0xff))
+                return "bad dl_max= value";
+            xp->dl_max = (int)u;
+        } else if (0 == strcmp("t2t", toks[k]))
+            xp->t2t = ('0' != vp[0]);
+        else if (0 == strcmp("zoning", toks[k])) {
+            /* off, supported or enabled */
+            xp->zoning_sup = (0 != strcmp("off", vp));
+            xp->zoning_en = (0 == strcmp("enabled", vp));
+        } else if (0 == strcmp("zone_groups", toks[k]))
+            xp->zg256 = (0 == strcmp("256", vp));
+        else
+            return "unknown expander attribute";
+    }
+    return NULL;
+}
+
+static const char *
+parse_phy(struct emu_exp * xp, char ** toks, int ntoks)
+{
+    bool type_given = false;
+    int k, res, id;
+    uint64_t u;
+    char * vp;
+    struct emu_phy * pp;
+
+    if (NULL == xp)
+        return "phy before any expander";
+    if ((ntoks < 2) || (! emu_num(toks[1], &u)) || (u >= EMU_MAX_PHYS))
+        return "expected: phy ID [ATTR=VAL ...]";
+    id = (int)u;
+    if (! emu_phy_grow(xp, id + 1))
+        return "out of memory";
+    pp = xp->phy + id;
+    for (k = 2; k < ntoks; ++k) {
+        vp = emu_attr(toks[k]);
+        if (NULL == vp) {
+            if (0 == strcmp("vacant", toks[k]))
+                pp->vacant = true;
+            else if (0 == strcmp("virtual", toks[k]))
+                pp->virt = true;
+            else if (0 == strcmp("disabled", toks[k]))
+                pp->disabled = true;
+            else if (0 == strcmp("iz", toks[k]))
+                pp->iz = true;
+            else
+                return "unknown phy flag";
+            continue;
+        }
+        if (0 == strcmp("type", toks[k])) {
+            type_given = true;
+            /* protocols follow the type unless given explicitly */
+            if (0 == strcmp("none", vp))
+                pp->adt = EMU_ADT_NONE;
+            else if (0 == strcmp("end", vp) || 0 == strcmp("ssp", vp)) {
+                pp->adt = EMU_ADT_END;
+                pp->tproto = EMU_PROTO_SSP;
+            } else if (0 == strcmp("sata", vp)) {
+                pp->adt = EMU_ADT_END;
+                pp->tproto = EMU_PROTO_SATA;
+            } else if (0 == strcmp("host", vp)) {
+                pp->adt = EMU_ADT_END;
+                pp->iproto = EMU_PROTO_SSP | EMU_PROTO_STP | EMU_PROTO_SMP;
+            } else if (0 == strcmp("exp", vp) || 0 == strcmp("fanout", vp)) {
+                pp->adt = ('e' == vp[0]) ? EMU_ADT_EXP : EMU_ADT_FANOUT;
+                pp->iproto = EMU_PROTO_SMP;
+                pp->tproto = EMU_PROTO_SMP;
+            } else
+                return "type= is none, end, sata, host, exp or fanout";
+        } else if (0 == strcmp("sas", toks[k])) {
+            if (! emu_num(vp, &pp->att_sa))
+                return "bad sas= value";
+        } else if (0 == strcmp("dev_name", toks[k])) {
+            if (! emu_num(vp, &pp->att_dev_name))
+                return "bad dev_name= value";
+        } else if (0 == strcmp("aphy", toks[k])) {
+            if ((! emu_num(vp, &u)) || (u > 0xff))
+                return "bad aphy= value";
+            pp->aphy = (uint8_t)u;
+        } else if (0 == strcmp("rate", toks[k])) {
+            res = emu_lookup(emu_rate_arr, vp);
+            if ((res < 0) && emu_num(vp, &u) && (u < 0x10))
+                res = (int)u;
+            if (res < 0)
+                return "rate= is 1.5, 3, 6, 12, 22.5 or a code";
+            pp->rate = (uint8_t)res;
+        } else if (0 == strcmp("iproto", toks[k])) {
+            res = emu_protos(vp);
+            if (res < 0)
+                return "bad iproto= value";
+            pp->iproto = (uint8_t)res;
+        } else if (0 == strcmp("tproto", toks[k])) {
+            res = emu_protos(vp);
+            if (res < 0)
+                return "bad tproto= value";
+            pp->tproto = (uint8_t)res;
+        } else if (0 == strcmp("routing", toks[k])) {
+            res = emu_lookup(emu_routing_arr, vp);
+            if (res < 0)
+                return "routing= is direct, subtractive or table";
+            pp->routing = (uint8_t)res;
+        } else if (0 == strcmp("zg", toks[k])) {
+            if ((! emu_num(vp, &u)) || (u > 0xff))
+                return "bad zg= value";
+            pp->zg = (uint8_t)u;
+        } else if (0 == strcmp("change_count", toks[k])) {
+            if ((! emu_num(vp, &u)) || (u > 0xff))
+                return "bad change_count= value";
+            pp->change_count = (uint8_t)u;
+        } else if (0 == strcmp("errs", toks[k])) {
+            char * cp;
+            char * savep = NULL;
+            int j;
+
+            for (j = 0, cp = strtok_r(vp, ",", &savep); cp && (j < 4);
+                 ++j, cp = strtok_r(NULL, ",", &savep)) {
+                if ((! emu_num(cp, &u)) || (u > 0xffffffff))
+                    return "bad errs= value";
+                pp->errs[j] = (uint32_t)u;
+            }
+        } else if (0 == strcmp("events", toks[k])) {
+            if (! emu_events(pp, vp))
+                return "events= is SRC:VAL[:INC[:THRESH]],...";
+        } else
+            return "unknown phy attribute";
+    }
+    if (type_given && (EMU_ADT_NONE != pp->adt) && (0 == pp->rate))
+        pp->rate = EMU_DEF_RATE;
+    return NULL;
+}
+
+static const char *
+parse_route(struct emu_exp * xp, char ** toks, int ntoks)
+{
+    uint64_t id, ind, sa;
+    struct emu_phy * pp;
+
+    if (NULL == xp)
+        return "route before any expander";
+    if ((ntoks < 4) || (ntoks > 5) || (! emu_num(toks[1], &id)) ||
+        (! emu_num(toks[2], &ind)) || (! emu_num(toks[3], &sa)) ||
+        ((5 == ntoks) && strcmp("disabled", toks[4])))
+        return "expected: route PHY_ID INDEX SAS_ADDR [disabled]";
+    if ((id >= (uint64_t)xp->num_phys) || (ind >= EMU_MAX_ROUTE_INDEXES))
+        return "route phy or index out of range";
+    pp = xp->phy + id;
+    if (ind >= (uint64_t)xp->route_indexes)
+        xp->route_indexes = (int)ind + 1;
+    if (! emu_rt_grow(pp, xp->route_indexes))
+        return "out of memory";
+    pp->rt[ind].sa = sa;
+    pp->rt[ind].disabled = (5 == ntoks);
+    return NULL;
+}
+
+static const char *
+parse_zperm(struct emu_exp * xp, char ** toks, int ntoks)
+{
+    uint64_t src, dst;
+    char * cp;
+    char * savep = NULL;
+
+    if (NULL == xp)
+        return "zperm before any expander";
+    if ((3 != ntoks) || (! emu_num(toks[1], &src)) || (src > 0xff))
+        return "expected: zperm SRC_ZG DST_ZG[,DST_ZG...]";
+    for (cp = strtok_r(toks[2], ",", &savep); cp;
+         cp = strtok_r(NULL, ",", &savep)) {
+        if ((! emu_num(cp, &dst)) || (dst > 0xff))
+            return "bad zone group";
+        emu_set_zperm(xp, (int)src, (int)dst, true);
+        emu_set_zperm(xp, (int)dst, (int)src, true);
+    }
+    return NULL;
+}
+
+static void
+emu_free(struct smp_emu * ep)
+{
+    int k, j;
+    struct emu_exp * xp;
+
+    for (k = 0; k < ep->num_exps; ++k) {
+        xp = ep->exps + k;
+        for (j = 0; j < xp->num_phys; ++j)
+            free(xp->phy[j].rt);
+        free(xp->phy);
+        free(xp->zperm);
+    }
+    free(ep->exps);
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_destroy(&ep->mtx);
+#endif
+    free(ep);
+}
+
+/* Fills in what a description file leaves implicit: route table space on
+ * table routing phys and, for a phy attached to another expander in the
+ * same file, that expander's side of the link. */
+static bool
+emu_finish(struct smp_emu * ep)
+{
+    int k, j, m;
+    struct emu_exp * xp;
+    struct emu_exp * oxp;
+    struct emu_phy * pp;
+
+    for (k = 0; k < ep->num_exps; ++k) {
+        xp = ep->exps + k;
+        for (j = 0; j < xp->num_phys; ++j) {
+            pp = xp->phy + j;
+            if (((2 == pp->routing) || pp->rt) &&
+                (! emu_rt_grow(pp, xp->route_indexes)))
+                return false;
+            if (pp->rt && (2 != pp->routing))
+                pp->routing = 2;
+            if ((EMU_ADT_EXP != pp->adt) && (EMU_ADT_FANOUT != pp->adt))
+                continue;
+            for (m = 0; m < ep->num_exps; ++m) {
+                oxp = ep->exps + m;
+                if ((m == k) || (oxp->sa != pp->att_sa) ||
+                    (pp->aphy >= oxp->num_phys))
+                    continue;
+                if (EMU_ADT_NONE == oxp->phy[pp->aphy].adt) {
+                    oxp->phy[pp->aphy].adt = EMU_ADT_EXP;
+                    oxp->phy[pp->aphy].iproto = EMU_PROTO_SMP;
+                    oxp->phy[pp->aphy].tproto = EMU_PROTO_SMP;
+                    oxp->phy[pp->aphy].att_sa = xp->sa;
+                    oxp->phy[pp->aphy].aphy = (uint8_t)j;
+                    oxp->phy[pp->aphy].rate = pp->rate;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+int
+open_emu_device(const char * desc_name, uint64_t sa, void ** vpp,
+                int verbose)
+{
+    int k, ntoks, lnum;
+    const char * errp = NULL;
+    char * cp;
+    char * savep;
+    char * toks[64];
+    char line[EMU_LINE_LEN];
+    struct smp_emu * ep;
+    struct emu_exp * xp = NULL;
+    FILE * fp;
+
+    fp = fopen(desc_name, "r");
+    if (NULL == fp) {
+        if (verbose)
+            perror("open_emu_device: fopen() failed");
+        return -1;
+    }
+    ep = (struct smp_emu *)calloc(1, sizeof(*ep));
+    if (NULL == ep) {
+        fclose(fp);
+        return -1;
+    }
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&ep->mtx, NULL);
+#endif
+    for (lnum = 1; fgets(line, sizeof(line), fp); ++lnum) {
+        cp = strchr(line, '#');
+        if (cp)
+            *cp = '\0';
+        savep = NULL;
+        for (ntoks = 0, cp = strtok_r(line, " \t\r\n", &savep);
+             cp && (ntoks < (int)(sizeof(toks) / sizeof(toks[0])));
+             cp = strtok_r(NULL, " \t\r\n", &savep))
+            toks[ntoks++] = cp;
+        if (0 == ntoks)
+            continue;
+        if (0 == strcmp("expander", toks[0])) {
+            xp = NULL;
+            errp = parse_expander(ep, toks, ntoks, &xp);
+        } else if (0 == strcmp("phy", toks[0]))
+            errp = parse_phy(xp, toks, ntoks);
+        else if (0 == strcmp("route", toks[0]))
+            errp = parse_route(xp, toks, ntoks);
+        else if (0 == strcmp("zperm", toks[0]))
+            errp = parse_zperm(xp, toks, ntoks);
+        else
+            errp = "unknown statement";
+        if (errp)
+            break;
+    }
+    fclose(fp);
+    if (errp) {
+        fprintf(stderr, "%s:%d: %s\n", desc_name, lnum, errp);
+        goto err_out;
+    }
+    if (0 == ep->num_exps) {
+        fprintf(stderr, "%s: no expander in description\n", desc_name);
+        goto err_out;
+    }
+    if (! emu_finish(ep))
+        goto err_out;
+    if (0 == sa)
+        ep->tgt = ep->exps;
+    for (k = 0; (NULL == ep->tgt) && (k < ep->num_exps); ++k) {
+        if (sa == ep->exps[k].sa)
+            ep->tgt = ep->exps + k;
+    }
+    if (NULL == ep->tgt) {
+        fprintf(stderr, "%s: no expander with SAS address 0x%" PRIx64 "\n",
+                desc_name, sa);
+        goto err_out;
+    }
+    if (verbose > 2)
+        fprintf(stderr, "open_emu_device: %d expander(s), target 0x%" PRIx64
+                " has %d phys\n", ep->num_exps, ep->tgt->sa,
+                ep->tgt->num_phys);
+    *vpp = ep;
+    return 0;
+
+err_out:
+    emu_free(ep);
+    return -1;
+}
+
+int
+close_emu_device(void * vp)
+{
+    if (NULL == vp)
+        return -1;
+    emu_free((struct smp_emu *)vp);
+    return 0;
+}
+
+/* The response functions below are given the request (rq) and a zeroed
+ * response buffer (rp) whose first four bytes are already set. They return
+ * the response length in bytes (excluding CRC) or a negated function
+ * result. */
+
+static int
+emu_rep_general(struct emu_exp * xp, const uint8_t * rq, uint8_t * rp)
+{
+    (void)rq;
+    rp[3] = 0x11;
+    sg_put_unaligned_be16(xp->change_count, rp + 4);
+    sg_put_unaligned_be16(xp->route_indexes, rp + 6);
+    rp[8] = 0x80;               /* long response */
+    rp[9] = xp->num_phys;
+    if (xp->t2t)
+        rp[10] |= 0x80;
+    if (xp->route_indexes)
+        rp[10] |= 0x1;          /* externally configurable route table */
+    sg_put_unaligned_be64(xp->sa & ~(uint64_t)0x3f, rp + 12);
+    if (xp->zoning_sup)
+        rp[36] |= 0x2;
+    if (xp->zoning_en)
+        rp[36] |= 0x1;
+    if (xp->zone_locked)
+        rp[36] |= 0x10;
+    if (xp->zg256)
+        rp[36] |= 0x40;         /* number of zone groups: 256 */
+    return 72;
+}
+
+static int
+emu_rep_manufacturer(struct emu_exp * xp, const uint8_t * rq, uint8_t * rp)
+{
+    (void)rq;
+    rp[3] = 0xe;
+    sg_put_unaligned_be16(xp->change_count, rp + 4);
+    rp[8] = 0x1;                /* SAS-1.1 format */
+    memset(rp + 12, ' ', 28);
+    memcpy(rp + 12, xp->vendor, strlen(xp->vendor));
+    memcpy(rp + 20, xp->product, strlen(xp->product));
+    memcpy(rp + 36, xp->revision, strlen(xp->revision));
+    return 60;
+}
+
+/* Space for the response in bytes (excluding CRC), reduced to the
+ * ALLOCATED RESPONSE LENGTH (in dwords) field of the request if set */
+static int
+emu_alloc_len(const uint8_t * rq, int max_len)
+{
+    if (rq[2] && ((4 * rq[2] + 4) < max_len))
+        return 4 * rq[2] + 4;
+    return max_len;
+}
+
+/* Returns the phy or NULL after setting *fresp */
+static struct emu_phy *
+emu_get_phy(struct emu_exp * xp, int id, int * fresp)
+{
+    if (id >= xp->num_phys) {
+        *fresp = SMP_FRES_NO_PHY;
+        return NULL;
+    }
+    if (xp->phy[id].vacant) {
+        *fresp = SMP_FRES_PHY_VACANT;
+        return NULL;
+    }
+    return xp->phy + id;
+}
+
+static uint8_t
+emu_neg_rate(const struct emu_phy * pp)
+{
+    if (pp->disabled)
+        return 0x1;             /* phy disabled */
+    return (EMU_ADT_NONE == pp->adt) ? 0 : pp->rate;
+}
+
+/* DISCOVER response body from byte 4 onward; also the long DISCOVER LIST
+ * descriptor. */
+static void
+emu_fill_discover(struct emu_exp * xp, int id, uint8_t * rp)
+{
+    struct emu_phy * pp = xp->phy + id;
+    bool att = (EMU_ADT_NONE != pp->adt) && (! pp->disabled);
+
+    sg_put_unaligned_be16(xp->change_count, rp + 4);
+    rp[9] = id;
+    if (att) {
+        rp[12] = (pp->adt & 0x7) << 4;
+        rp[14] = pp->iproto;
+        rp[15] = pp->tproto;
+        sg_put_unaligned_be64(pp->att_sa, rp + 24);
+        rp[32] = pp->aphy;
+        sg_put_unaligned_be64(pp->att_dev_name, rp + 52);
+    }
+    rp[13] = emu_neg_rate(pp);
+    sg_put_unaligned_be64(xp->sa, rp + 16);
+    rp[40] = (EMU_HW_MIN_RATE << 4) | EMU_HW_MIN_RATE;
+    rp[41] = (EMU_HW_MAX_RATE << 4) | EMU_HW_MAX_RATE;
+    rp[42] = pp->change_count;
+    if (pp->virt)
+        rp[43] |= 0x80;
+    rp[44] = pp->routing;
+    if (xp->zoning_en)
+        rp[60] |= 0x1;
+    if (pp->iz)
+        rp[60] |= 0x2 | 0x20;
+    rp[63] = pp->zg;
+    rp[94] = att ? pp->rate : rp[13];
+    rp[109] = 0xff;             /* slot group number: not available */
+}
+
+static int
+emu_discover(struct emu_exp * xp, const uint8_t * rq, uint8_t * rp)
+{
+    int fres;
+
+    if (NULL == emu_get_phy(xp, rq[9], &fres))
+        return -fres;
+    rp[3] = 0x1e;
+    emu_fill_discover(xp, rq[9], rp);
+    return 124;
+}
+
+/* SAS-2 phy filter of DISCOVER LIST */
+static bool
+emu_dl_match(const struct emu_phy * pp, int filter)
+{
+    if (pp->vacant)
+        return 0 == filter;     /* reported with PHY VACANT result */
+    switch (filter) {
+    case 0:
+        return true;
+    case 1:
+        return (EMU_ADT_EXP == pp->adt) || (EMU_ADT_FANOUT == pp->adt);
+    case 2:
+        return EMU_ADT_NONE != pp->adt;
+    case 3:
+        return EMU_ADT_END == pp->adt;
+    default:
+        return false;
+    }
+}
+
+static int
+emu_discover_list(struct emu_exp * xp, const uint8_t * rq, uint8_t * rp,
+                  int max_len)
+{
+    int n, desc_len, max_desc, off, id, filter;
+    uint8_t d[124];
+    uint8_t * dp;
+    const struct emu_phy * pp;
+
+    filter = rq[10] & 0xf;
+    if (filter > 3)
+        return -SMP_FRES_UNKNOWN_PHY_FILTER;
+    if ((rq[11] & 0xf) > 1)
+        return -SMP_FRES_UNKNOWN_DESCRIPTOR_TYPE;
+    desc_len = (rq[11] & 0xf) ? 24 : 120;
+    max_desc = rq[9];
+    n = (emu_alloc_len(rq, max_len) - 48) / desc_len;
+    if (max_desc > n)
+        max_desc = (n > 0) ? n : 0;
+    if ((xp->dl_max > 0) && (max_desc > xp->dl_max))
+        max_desc = xp->dl_max;
+    sg_put_unaligned_be16(xp->change_count, rp + 4);
+    rp[8] = rq[8];
+    rp[10] = rq[10] & 0xf;
+    rp[11] = rq[11] & 0xf;
+    rp[12] = desc_len / 4;
+    if (xp->zoning_sup)
+        rp[16] |= 0x80;
+    if (xp->zoning_en)
+        rp[16] |= 0x40;
+    if (xp->route_indexes)
+        rp[16] |= 0x1;
+    for (n = 0, id = rq[8], off = 48; (id < xp->num_phys) && (n < max_desc);
+         ++id) {
+        pp = xp->phy + id;
+        if (! emu_dl_match(pp, filter))
+            continue;
+        dp = rp + off;
+        if (pp->vacant) {
+            memset(dp, 0, desc_len);
+            if (120 == desc_len) {
+                dp[2] = SMP_FRES_PHY_VACANT;
+                dp[9] = id;
+            } else {
+                dp[0] = id;
+                dp[1] = SMP_FRES_PHY_VACANT;
+            }
+        } else if (120 == desc_len) {
+            memset(d, 0, sizeof(d));
+            emu_fill_discover(xp, id, d);
+            memcpy(dp, d, desc_len);
+            dp[0] = 0;
+            dp[1] = 0;
+            dp[2] = SMP_FRES_FUNCTION_ACCEPTED;
+            dp[3] = (desc_len - 4) / 4;
+        } else {
+            dp[0] = id;
+            dp[2] = (EMU_ADT_NONE == pp->adt || pp->disabled) ? 0 :
+                    ((pp->adt & 0x7) << 4);
+            dp[3] = emu_neg_rate(pp);
+            if (dp[2]) {
+                dp[4] = pp->iproto;
+                dp[5] = pp->tproto;
+                dp[10] = pp->aphy;
+                sg_put_unaligned_be64(pp->att_sa, dp + 12);
+            }
+            dp[6] = (pp->virt ? 0x80 : 0) | pp->routing;
+            dp[7] = dp[2] ? pp->rate : dp[3];
+            dp[8] = pp->zg;
+            dp[9] = pp->iz ? 0x22 : 0;
+            dp[11] = pp->change_count;
+        }
+        off += desc_len;
+        ++n;
+    }
+    rp[9] = n;
+    rp[3] = (off - 4) / 4;
+    return off;
+}
+
+static int
+emu_rep_phy_err_log(struct emu_exp * xp, const uint8_t * rq, uint8_t * rp)
+{
+    int k, fres;
+    struct emu_phy * pp = emu_get_phy(xp, rq[9], &fres);
+
+    if (NULL == pp)
+        return -fres;
+    rp[3] = 6;
+    sg_put_unaligned_be16(xp->change_count, rp + 4);
+    rp[9] = rq[9];
+    for (k = 0; k < 4; ++k)
+        sg_put_unaligned_be32(pp->errs[k], rp + 12 + (4 * k));
+    return 28;
+}
+
+static int
+emu_rep_phy_sata(struct emu_exp * xp, const uint8_t * rq, uint8_t * rp)
+{
+    int fres;
+    struct emu_phy * pp = emu_get_phy(xp, rq[9], &fres);
+
+    if (NULL == pp)
+        return -fres;
+    if (! (pp->tproto & EMU_PROTO_SATA))
+        return -SMP_FRES_NO_SATA_SUPPORT;
+    rp[3] = 0xd;
+    sg_put_unaligned_be16(xp->change_count, rp + 4);
+    rp[9] = rq[9];
+    sg_put_unaligned_be64(pp->att_sa, rp + 16);
+    return 56;
+}
+
+static int
+emu_rep_route_info(struct emu_exp * xp, const uint8_t * rq, uint8_t * rp)
+{
+    int ind, fres;
+    struct emu_phy * pp = emu_get_phy(xp, rq[9], &fres);
+
+    if (NULL == pp)
+        return -fres;
+    ind = sg_get_unaligned_be16(rq + 6);
+    if ((NULL == pp->rt) || (ind >= xp->route_indexes))
+        return -SMP_FRES_NO_INDEX;
+    rp[3] = 9;
+    sg_put_unaligned_be16(xp->change_count, rp + 4);
+    sg_put_unaligned_be16(ind, rp + 6);
+    rp[9] = rq[9];
+    if (pp->rt[ind].disabled)
+        rp[12] = 0x80;
+    sg_put_unaligned_be64(pp->rt[ind].sa, rp + 16);
+    return 40;
+}
+
+/* Reports then advances the counters (the val field of a peak source is
+ * the peak so far). */
+static void
+emu_put_event(struct emu_event * evp, uint8_t * dp)
+{
+    dp[3] = evp->src;
+    sg_put_unaligned_be32(evp->val, dp + 4);
+    sg_put_unaligned_be32(evp->thresh, dp + 8);
+    evp->val += evp->inc;
+}
+
+static int
+emu_rep_phy_event(struct emu_exp * xp, const uint8_t * rq, uint8_t * rp)
+{
+    int k, fres;
+    struct emu_phy * pp = emu_get_phy(xp, rq[9], &fres);
+
+    if (NULL == pp)
+        return -fres;
+    sg_put_unaligned_be16(xp->change_count, rp + 4);
+    rp[9] = rq[9];
+    rp[14] = 3;
+    rp[15] = pp->num_ev;
+    for (k = 0; k < pp->num_ev; ++k)
+        emu_put_event(pp->ev + k, rp + 16 + (12 * k));
+    rp[3] = (12 + (12 * pp->num_ev)) / 4;
+    return 16 + (12 * pp->num_ev);
+}
+
+/* Descriptors are numbered from 1 across all phys in phy id order */
+static int
+emu_rep_phy_event_list(struct emu_exp * xp, const uint8_t * rq, uint8_t * rp,
+                       int max_len)
+{
+    int ind, start, first, last, n, max_desc, id, k;
+    struct emu_phy * pp;
+    uint8_t * dp;
+
+    start = sg_get_unaligned_be16(rq + 6);
+    if (0 == start)
+        start = 1;
+    max_desc = (emu_alloc_len(rq, max_len) - 16) / 12;
+    if (max_desc > 0xff)
+        max_desc = 0xff;
+    sg_put_unaligned_be16(xp->change_count, rp + 4);
+    rp[10] = 3;
+    first = 0;
+    last = 0;
+    for (n = 0, ind = 1, id = 0; id < xp->num_phys; ++id) {
+        pp = xp->phy + id;
+        if (pp->vacant)
+            continue;
+        for (k = 0; k < pp->num_ev; ++k, ++ind) {
+            if ((ind < start) || (n >= max_desc))
+                continue;
+            if (0 == first)
+                first = ind;
+            last = ind;
+            dp = rp + 16 + (12 * n++);
+            dp[2] = id;
+            emu_put_event(pp->ev + k, dp);
+        }
+    }
+    sg_put_unaligned_be16(first, rp + 6);
+    sg_put_unaligned_be16(last, rp + 8);
+    rp[15] = n;
+    rp[3] = (12 + (12 * n)) / 4;
+    return 16 + (12 * n);
+}
+
+static int
+emu_rep_exp_route_tbl(struct emu_exp * xp, const uint8_t * rq, uint8_t * rp,
+                      int max_len)
+{
+    int id, ind, n, max_desc, start, sphy, first, last, off;
+    int bit, pos;
+    uint64_t sa;
+    struct emu_phy * pp;
+
+    if (0 == xp->route_indexes)
+        return -SMP_FRES_UNKNOWN_FUNCTION;
+    max_desc = sg_get_unaligned_be16(rq + 8);
+    start = sg_get_unaligned_be16(rq + 10);
+    sphy = rq[19];
+    n = (emu_alloc_len(rq, max_len) - 32) / 16;
+    if ((0 == max_desc) || (max_desc > n))
+        max_desc = n;
+    sg_put_unaligned_be16(xp->change_count, rp + 4);
+    sg_put_unaligned_be16(xp->change_count, rp + 6);
+    if (xp->zoning_en)
+        rp[8] |= 0x1;
+    rp[10] = 4;
+    rp[19] = sphy;
+    first = start;
+    last = start;
+    /* one descriptor per routed SAS address index that is in use on at
+     * least one phy at or above the starting phy id */
+    for (n = 0, off = 32, ind = start;
+         (ind < xp->route_indexes) && (n < max_desc); ++ind) {
+        sa = 0;
+        for (id = sphy; id < xp->num_phys; ++id) {
+            pp = xp->phy + id;
+            if (pp->rt && (! pp->rt[ind].disabled) && pp->rt[ind].sa) {
+                sa = pp->rt[ind].sa;
+                break;
+            }
+        }
+        if (0 == sa)
+            continue;
+        sg_put_unaligned_be64(sa, rp + off);
+        for (id = sphy; (id < xp->num_phys) && (id < sphy + 48); ++id) {
+            pp = xp->phy + id;
+            if (pp->rt && (! pp->rt[ind].disabled) &&
+                (sa == pp->rt[ind].sa)) {
+                bit = id - sphy;
+                pos = off + 8 + 5 - (bit / 8);
+                rp[pos] |= (1 << (bit % 8));
+            }
+        }
+        if (0 == n)
+            first = ind;
+        last = ind;
+        off += 16;
+        ++n;
+    }
+    rp[11] = n;
+    sg_put_unaligned_be16(first, rp + 12);
+    sg_put_unaligned_be16(last, rp + 14);
+    rp[3] = (off - 4) / 4;
+    return off;
+}
+
+static int
+emu_rep_zone_perm_tbl(struct emu_exp * xp, const uint8_t * rq, uint8_t * rp,
+                      int max_len)
+{
+    int k, n, start, max_desc, desc_len, num_zg;
+
+    if (! xp->zoning_sup)
+        return -SMP_FRES_UNKNOWN_FUNCTION;
+    num_zg = xp->zg256 ? 256 : 128;
+    desc_len = xp->zg256 ? 32 : 16;
+    start = rq[6];
+    max_desc = rq[7];
+    n = (emu_alloc_len(rq, max_len) - 16) / desc_len;
+    if (max_desc > n)
+        max_desc = n;
+    if (max_desc > (xp->zg256 ? 31 : 63))
+        max_desc = xp->zg256 ? 31 : 63;
+    if (start >= num_zg)
+        return -SMP_FRES_ZONE_GROUP_OUT_OF_RANGE;
+    sg_put_unaligned_be16(xp->change_count, rp + 4);
+    rp[6] = (xp->zone_locked ? 0x80 : 0) | (rq[4] & 0x3);
+    rp[7] = xp->zg256 ? 0x40 : 0;
+    rp[13] = desc_len / 4;
+    rp[14] = start;
+    for (k = 0; (k < max_desc) && ((start + k) < num_zg); ++k)
+        memcpy(rp + 16 + (k * desc_len),
+               xp->zperm[start + k] + 32 - desc_len, desc_len);
+    rp[15] = k;
+    rp[3] = (12 + (k * desc_len)) / 4;
+    return 16 + (k * desc_len);
+}
+
+static int
+emu_chk_ecc(struct emu_exp * xp, const uint8_t * rq)
+{
+    int ecc = sg_get_unaligned_be16(rq + 4);
+
+    if (ecc && (ecc != xp->change_count))
+        return -SMP_FRES_INVALID_EXP_CHANGE_COUNT;
+    return 0;
+}
+
+static void
+emu_changed(struct emu_exp * xp)
+{
+    if (++xp->change_count > 0xffff)
+        xp->change_count = 1;   /* 0 means "do not check" in requests */
+}
+
+static int
+emu_conf_zone_perm_tbl(struct emu_exp * xp, const uint8_t * rq, int rq_len)
+{
+    int k, n, start, desc_len, num_zg;
+
+    if (! xp->zoning_sup)
+        return -SMP_FRES_UNKNOWN_FUNCTION;
+    if (emu_chk_ecc(xp, rq))
+        return -SMP_FRES_INVALID_EXP_CHANGE_COUNT;
+    num_zg = xp->zg256 ? 256 : 128;
+    desc_len = rq[9] * 4;
+    if ((desc_len != (xp->zg256 ? 32 : 16)) || (!! (rq[8] & 0x40) !=
+                                                xp->zg256))
+        return -SMP_FRES_INVALID_FIELD_IN_REQUEST;
+    start = rq[6];
+    n = rq[7];
+    if ((16 + (n * desc_len)) > rq_len)
+        return -SMP_FRES_INVALID_REQUEST_LEN;
+    if ((start + n) > num_zg)
+        return -SMP_FRES_ZONE_GROUP_OUT_OF_RANGE;
+    for (k = 0; k < n; ++k)
+        memcpy(xp->zperm[start + k] + 32 - desc_len,
+               rq + 16 + (k * desc_len), desc_len);
+    emu_changed(xp);
+    return 0;
+}
+
+static int
+emu_conf_route_info(struct emu_exp * xp, const uint8_t * rq)
+{
+    int ind, fres;
+    struct emu_phy * pp = emu_get_phy(xp, rq[9], &fres);
+
+    if (NULL == pp)
+        return -fres;
+    if (emu_chk_ecc(xp, rq))
+        return -SMP_FRES_INVALID_EXP_CHANGE_COUNT;
+    ind = sg_get_unaligned_be16(rq + 6);
+    if ((NULL == pp->rt) || (ind >= xp->route_indexes))
+        return -SMP_FRES_NO_INDEX;
+    pp->rt[ind].disabled = !! (rq[12] & 0x80);
+    pp->rt[ind].sa = sg_get_unaligned_be64(rq + 16);
+    emu_changed(xp);
+    return 0;
+}
+
+static int
+emu_phy_control(struct emu_exp * xp, const uint8_t * rq)
+{
+    int fres;
+    struct emu_phy * pp = emu_get_phy(xp, rq[9], &fres);
+
+    if (NULL == pp)
+        return -fres;
+    if (emu_chk_ecc(xp, rq))
+        return -SMP_FRES_INVALID_EXP_CHANGE_COUNT;
+    switch (rq[10]) {
+    case 0:                     /* nop */
+        return 0;
+    case 1:                     /* link reset */
+    case 2:                     /* hard reset */
+        pp->disabled = false;
+        break;
+    case 3:                     /* disable */
+        pp->disabled = true;
+        break;
+    case 5:                     /* clear error log */
+        memset(pp->errs, 0, sizeof(pp->errs));
+        return 0;
+    case 6:                     /* clear affiliation */
+    case 7:                     /* transmit SATA port selection signal */
+    case 8:                     /* clear STP I_T nexus loss */
+        return 0;
+    case 9:                     /* set attached device name */
+        pp->att_dev_name = sg_get_unaligned_be64(rq + 24);
+        return 0;
+    default:
+        return -SMP_FRES_UNKNOWN_PHY_OP;
+    }
+    ++pp->change_count;
+    emu_changed(xp);
+    return 0;
+}
+
+static int
+emu_conf_phy_event(struct emu_exp * xp, const uint8_t * rq, int rq_len)
+{
+    int k, j, n, fres;
+    uint8_t src;
+    const uint8_t * dp;
+    struct emu_phy * pp = emu_get_phy(xp, rq[9], &fres);
+
+    if (NULL == pp)
+        return -fres;
+    if (emu_chk_ecc(xp, rq))
+        return -SMP_FRES_INVALID_EXP_CHANGE_COUNT;
+    n = rq[11];
+    if ((n && (2 != rq[10])) || ((12 + (8 * n)) > rq_len))
+        return -SMP_FRES_INVALID_REQUEST_LEN;
+    if (rq[6] & 0x1) {          /* clear peaks */
+        for (k = 0; k < pp->num_ev; ++k) {
+            if ((pp->ev[k].src >= EMU_PEAK_SRC_FIRST) &&
+                (pp->ev[k].src <= EMU_PEAK_SRC_LAST))
+                pp->ev[k].val = 0;
+        }
+    }
+    for (k = 0, dp = rq + 12; k < n; ++k, dp += 8) {
+        src = dp[3];
+        for (j = 0; j < pp->num_ev; ++j) {
+            if (src == pp->ev[j].src)
+                break;
+        }
+        if (j >= pp->num_ev) {
+            if (0 == src)       /* no event */
+                continue;
+            if (pp->num_ev >= EMU_MAX_PHY_EVENTS)
+                return -SMP_FRES_UNKNOWN_PHY_EVENT_SRC;
+            memset(pp->ev + j, 0, sizeof(pp->ev[0]));
+            pp->ev[j].src = src;
+            ++pp->num_ev;
+        }
+        pp->ev[j].thresh = sg_get_unaligned_be32(dp + 4);
+    }
+    emu_changed(xp);
+    return 0;
+}
+
+static int
+emu_ena_dis_zoning(struct emu_exp * xp, const uint8_t * rq)
+{
+    if (! xp->zoning_sup)
+        return -SMP_FRES_UNKNOWN_FUNCTION;
+    if (emu_chk_ecc(xp, rq))
+        return -SMP_FRES_INVALID_EXP_CHANGE_COUNT;
+    switch (rq[8] & 0x3) {
+    case 0:
+        return 0;
+    case 1:
+        xp->zoning_en = true;
+        break;
+    case 2:
+        xp->zoning_en = false;
+        break;
+    default:
+        return -SMP_FRES_UNKNOWN_EN_DIS_ZONING_VAL;
+    }
+    emu_changed(xp);
+    return 0;
+}
+
+/* Fixed length responses with nothing modelled beyond the header */
+static int
+emu_fixed(struct emu_exp * xp, uint8_t * rp, int dwords)
+{
+    rp[3] = dwords;
+    if (dwords)
+        sg_put_unaligned_be16(xp->change_count, rp + 4);
+    return 4 + (4 * dwords);
+}
+
+static int
+emu_dispatch(struct emu_exp * xp, const uint8_t * rq, int rq_len,
+             uint8_t * rp, int max_len)
+{
+    const struct emu_func_len * flp;
+
+    /* decoders below read fields up to the function's minimum length */
+    for (flp = emu_req_len_arr; flp->func >= 0; ++flp) {
+        if (rq[1] == flp->func) {
+            if (rq_len < flp->min_len)
+                return -SMP_FRES_INVALID_REQUEST_LEN;
+            break;
+        }
+    }
+    switch (rq[1]) {
+    case SMP_FN_REPORT_GENERAL:
+        return emu_rep_general(xp, rq, rp);
+    case SMP_FN_REPORT_MANUFACTURER:
+        return emu_rep_manufacturer(xp, rq, rp);
+    case SMP_FN_REPORT_SELF_CONFIG:
+        emu_fixed(xp, rp, 4);
+        rp[12] = 4;             /* descriptor length, no descriptors */
+        return 20;
+    case SMP_FN_REPORT_ZONE_PERMISSION_TBL:
+        return emu_rep_zone_perm_tbl(xp, rq, rp, max_len);
+    case SMP_FN_REPORT_ZONE_MANAGER_PASS:
+        if (! xp->zoning_sup)
+            return -SMP_FRES_UNKNOWN_FUNCTION;
+        rp[6] = rq[4] & 0x3;
+        return emu_fixed(xp, rp, 9);
+    case SMP_FN_REPORT_BROADCAST:
+        emu_fixed(xp, rp, 2);
+        rp[6] = rq[4] & 0xf;
+        rp[10] = 2;             /* descriptor length, no descriptors */
+        return 12;
+    case SMP_FN_DISCOVER:
+        return emu_discover(xp, rq, rp);
+    case SMP_FN_REPORT_PHY_ERR_LOG:
+        return emu_rep_phy_err_log(xp, rq, rp);
+    case SMP_FN_REPORT_PHY_SATA:
+        return emu_rep_phy_sata(xp, rq, rp);
+    case SMP_FN_REPORT_ROUTE_INFO:
+        return emu_rep_route_info(xp, rq, rp);
+    case SMP_FN_REPORT_PHY_EVENT:
+        return emu_rep_phy_event(xp, rq, rp);
+    case SMP_FN_DISCOVER_LIST:
+        return emu_discover_list(xp, rq, rp, max_len);
+    case SMP_FN_REPORT_PHY_EVENT_LIST:
+        return emu_rep_phy_event_list(xp, rq, rp, max_len);
+    case SMP_FN_REPORT_EXP_ROUTE_TBL_LIST:
+        return emu_rep_exp_route_tbl(xp, rq, rp, max_len);
+    case SMP_FN_CONFIG_GENERAL:
+        return emu_chk_ecc(xp, rq);
+    case SMP_FN_ENABLE_DISABLE_ZONING:
+        return emu_ena_dis_zoning(xp, rq);
+    case SMP_FN_ZONED_BROADCAST:
+    case SMP_FN_CONFIG_ZONE_MANAGER_PASS:
+    case SMP_FN_CONFIG_ZONE_PHY_INFO:
+        if (! xp->zoning_sup)
+            return -SMP_FRES_UNKNOWN_FUNCTION;
+        return emu_chk_ecc(xp, rq);
+    case SMP_FN_ZONE_LOCK:
+        if (! xp->zoning_sup)
+            return -SMP_FRES_UNKNOWN_FUNCTION;
+        if (emu_chk_ecc(xp, rq))
+            return -SMP_FRES_INVALID_EXP_CHANGE_COUNT;
+        xp->zone_locked = true;
+        emu_fixed(xp, rp, 3);
+        sg_put_unaligned_be64(xp->sa, rp + 8);  /* active zone manager */
+        return 16;
+    case SMP_FN_ZONE_ACTIVATE:
+    case SMP_FN_ZONE_UNLOCK:
+        if (! xp->zoning_sup)
+            return -SMP_FRES_UNKNOWN_FUNCTION;
+        if (emu_chk_ecc(xp, rq))
+            return -SMP_FRES_INVALID_EXP_CHANGE_COUNT;
+        if (SMP_FN_ZONE_UNLOCK == rq[1])
+            xp->zone_locked = false;
+        return 0;
+    case SMP_FN_CONFIG_ZONE_PERMISSION_TBL:
+        return emu_conf_zone_perm_tbl(xp, rq, rq_len);
+    case SMP_FN_CONFIG_ROUTE_INFO:
+        return emu_conf_route_info(xp, rq);
+    case SMP_FN_PHY_CONTROL:
+        return emu_phy_control(xp, rq);
+    case SMP_FN_PHY_TEST_FUNCTION:
+        if (rq[9] >= xp->num_phys)
+            return -SMP_FRES_NO_PHY;
+        return emu_chk_ecc(xp, rq);
+    case SMP_FN_CONFIG_PHY_EVENT:
+        return emu_conf_phy_event(xp, rq, rq_len);
+    default:
+        return -SMP_FRES_UNKNOWN_FUNCTION;
+    }
+}
+
+int
+send_req_emu(void * vp, struct smp_req_resp * rresp, int verbose)
+{
+    int res, len, rq_len;
+    struct smp_emu * ep = (struct smp_emu *)vp;
+    uint8_t * rq = rresp->request;
+    uint8_t rp[EMU_RESP_LEN];
+    struct timespec ts;
+
+    if ((NULL == ep) || (NULL == rq) || (rresp->request_len < 8) ||
+        (NULL == rresp->response) || (rresp->max_response_len < 4)) {
+        if (verbose)
+            fprintf(stderr, "send_req_emu: bad request\n");
+        return -1;
+    }
+    if (smp_req_eff_timeout_ms(rresp, SMP_DEF_TIMEOUT_MS) <= 0) {
+        if (verbose)
+            fprintf(stderr, "send_req_emu: deadline passed, request not "
+                    "sent\n");
+        return -1;
+    }
+    rq_len = rresp->request_len - 4;    /* exclude CRC */
+    memset(rp, 0, sizeof(rp));
+    rp[0] = SMP_FRAME_TYPE_RESP;
+    rp[1] = rq[1];
+    len = rresp->max_response_len - 4;  /* room excluding CRC */
+    if (len > (int)sizeof(rp) - 4)
+        len = (int)sizeof(rp) - 4;
+    if (SMP_FRAME_TYPE_REQ != rq[0])
+        res = -SMP_FRES_UNKNOWN_FUNCTION;
+    else {
+        EMU_LOCK(ep);
+        res = emu_dispatch(ep->tgt, rq, rq_len, rp, len);
+        if (ep->tgt->latency_us > 0) {
+            ts.tv_sec = ep->tgt->latency_us / 1000000;
+            ts.tv_nsec = (ep->tgt->latency_us % 1000000) * 1000;
+        } else
+            ts.tv_sec = -1;
+        EMU_UNLOCK(ep);
+        if (ts.tv_sec >= 0)
+            nanosleep(&ts, NULL);
+    }
+    if (res <= 0) {             /* function result only, or no payload */
+        memset(rp + 2, 0, sizeof(rp) - 2);
+        rp[2] = (uint8_t)(-res);
+        res = 4;
+    }
+    res += 4;                   /* CRC (left as zeros) */
+    if (res > rresp->max_response_len)
+        res = rresp->max_response_len;
+    memcpy(rresp->response, rp, res);
+    rresp->act_response_len = res;
+    if (verbose > 3)
+        fprintf(stderr, "send_req_emu: function=0x%x result=0x%x "
+                "act_response_len=%d\n", rq[1], rp[2], res);
+    return 0;
+}
@@ -0,0 +1,20 @@
+#ifndef SMP_EMU_H
+#define SMP_EMU_H
+
+#include "smp_lib.h"
+
+/* Software expander emulator. The "device name" is a description file
+ * (see examples/emu_2exp.txt) and the SMP target is the expander in that
+ * file whose SAS address is sa (or the first one if sa is 0). */
+
+/* Returns 0 on success with *vpp pointing to the emulator state, else -1 */
+int open_emu_device(const char * desc_name, uint64_t sa, void ** vpp,
+                    int verbose);
+
+int close_emu_device(void * vp);
+
+/* Answers the request in rresp from the emulator state in vp. Returns 0
+ * on success else -1 . */
+int send_req_emu(void * vp, struct smp_req_resp * rresp, int verbose);
+
+#endif
@@ -47,8 +47,10 @@
 #endif
 #include "smp_lib.h"
 #include "sg_unaligned.h"
+#include "smp_pt.h"
 
 #define I_CAM 1
+#define DEF_CAM_TIMEOUT_MS 5000
 
 struct tobj_cam_t {
     struct cam_device * cam_dev;
@@ -105,12 +107,12 @@ smp_initiator_open(const char * device_name, int subvalue,
 }
 
 int
-smp_send_req(const struct smp_target_obj * tobj, struct smp_req_resp * rresp,
-             int verbose)
+smp_pt_send_req(const struct smp_target_obj * tobj,
+                struct smp_req_resp * rresp, int verbose)
 {
     union ccb *ccb;
     struct tobj_cam_t * tcp;
-    int retval, emsk;
+    int retval, emsk, to;
     int flags = 0;
 
     if ((NULL == tobj) || (0 == tobj->opened) || (NULL == tobj->vp)) {
@@ -123,6 +125,13 @@ smp_send_req(const struct smp_target_obj * tobj, struct smp_req_resp * rresp,
                 tobj->interface_selector);
         return -1;
     }
+    to = smp_req_eff_timeout_ms(rresp, DEF_CAM_TIMEOUT_MS);
+    if (to <= 0) {
+        if (verbose)
+            fprintf(stderr, "smp_send_req(cam): deadline passed, request "
+                    "not sent\n");
+        return -1;
+    }
     tcp = (struct tobj_cam_t *)tobj->vp;
     if (! (ccb = cam_getccb(tcp->cam_dev))) {
         fprintf(stderr, "cam_getccb: failed\n");
@@ -143,7 +152,7 @@ smp_send_req(const struct smp_target_obj * tobj, struct smp_req_resp * rresp,
                    /*smp_request_len*/ rresp->request_len - 4,
                    /*smp_response*/ rresp->response,
                    /*smp_response_len*/ rresp->max_response_len,
-                   /*timeout*/ 5000);   /* milliseconds ? */
+                   /*timeout*/ to);     /* milliseconds */
 
     ccb->smpio.flags = SMP_FLAG_NONE;
 
@@ -151,6 +160,8 @@ smp_send_req(const struct smp_target_obj * tobj, struct smp_req_resp * rresp,
     if (((retval = cam_send_ccb(tcp->cam_dev, ccb)) < 0) ||
         ((((emsk = (ccb->ccb_h.status & CAM_STATUS_MASK))) != CAM_REQ_CMP) &&
          (emsk != CAM_SMP_STATUS_ERROR))) {
+        if (CAM_CMD_TIMEOUT == emsk)
+            rresp->timed_out = true;
         cam_error_print(tcp->cam_dev, ccb, CAM_ESF_ALL, CAM_EPF_ALL, stderr);
         cam_freeccb(ccb);
         return -1;
@@ -188,3 +199,16 @@ smp_initiator_close(struct smp_target_obj * tobj)
     tobj->opened = 0;
     return 0;
 }
+
+/* Not supported by this pass-through: each SES device reaches the
+ * one expander it is paired with. */
+int
+smp_initiator_open_sa(const struct smp_target_obj * base, uint64_t sa,
+                      struct smp_target_obj * tobj, int verbose)
+{
+    if (base && sa && tobj) { ; }       /* unused, suppress warning */
+    if (verbose)
+        fprintf(stderr, "smp_initiator_open_sa: not supported, give each "
+                "SMP target's device explicitly\n");
+    return -1;
+}
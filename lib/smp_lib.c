@@ -29,6 +29,7 @@
 #include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
 #define __STDC_FORMAT_MACROS 1
 #include <inttypes.h>
 
@@ -37,7 +38,7 @@
 #include "sg_pr2serr.h"
 
 
-static const char * version_str = "1.31 20230201";    /* spl-5 rev 8 */
+static const char * version_str = "1.32 20261016";    /* spl-5 rev 8 */
 
 /* Assume original SAS implementations were based on SAS-1.1 . In SAS-2
  * and later, SMP responses should contain an accurate "response length"
@@ -223,6 +224,57 @@ smp_get_func_res_str(int func_res, int buff_len, char * buff)
     return buff;
 }
 
+static struct smp_val_name smp_func_names[] =
+{
+    {SMP_FN_REPORT_GENERAL, "REPORT GENERAL"},
+    {SMP_FN_REPORT_MANUFACTURER, "REPORT MANUFACTURER INFORMATION"},
+    {SMP_FN_READ_GPIO_REG, "READ GPIO REGISTER"},
+    {SMP_FN_REPORT_SELF_CONFIG, "REPORT SELF-CONFIGURATION STATUS"},
+    {SMP_FN_REPORT_ZONE_PERMISSION_TBL, "REPORT ZONE PERMISSION TABLE"},
+    {SMP_FN_REPORT_ZONE_MANAGER_PASS, "REPORT ZONE MANAGER PASSWORD"},
+    {SMP_FN_REPORT_BROADCAST, "REPORT BROADCAST"},
+    {SMP_FN_READ_GPIO_REG_ENH, "READ GPIO REGISTER ENHANCED"},
+    {SMP_FN_DISCOVER, "DISCOVER"},
+    {SMP_FN_REPORT_PHY_ERR_LOG, "REPORT PHY ERROR LOG"},
+    {SMP_FN_REPORT_PHY_SATA, "REPORT PHY SATA"},
+    {SMP_FN_REPORT_ROUTE_INFO, "REPORT ROUTE INFORMATION"},
+    {SMP_FN_REPORT_PHY_EVENT, "REPORT PHY EVENT"},
+    {SMP_FN_DISCOVER_LIST, "DISCOVER LIST"},
+    {SMP_FN_REPORT_PHY_EVENT_LIST, "REPORT PHY EVENT LIST"},
+    {SMP_FN_REPORT_EXP_ROUTE_TBL_LIST, "REPORT EXPANDER ROUTE TABLE LIST"},
+    {SMP_FN_CONFIG_GENERAL, "CONFIGURE GENERAL"},
+    {SMP_FN_ENABLE_DISABLE_ZONING, "ENABLE DISABLE ZONING"},
+    {SMP_FN_WRITE_GPIO_REG, "WRITE GPIO REGISTER"},
+    {SMP_FN_WRITE_GPIO_REG_ENH, "WRITE GPIO REGISTER ENHANCED"},
+    {SMP_FN_ZONED_BROADCAST, "ZONED BROADCAST"},
+    {SMP_FN_ZONE_LOCK, "ZONE LOCK"},
+    {SMP_FN_ZONE_ACTIVATE, "ZONE ACTIVATE"},
+    {SMP_FN_ZONE_UNLOCK, "ZONE UNLOCK"},
+    {SMP_FN_CONFIG_ZONE_MANAGER_PASS, "CONFIGURE ZONE MANAGER PASSWORD"},
+    {SMP_FN_CONFIG_ZONE_PHY_INFO, "CONFIGURE ZONE PHY INFORMATION"},
+    {SMP_FN_CONFIG_ZONE_PERMISSION_TBL, "CONFIGURE ZONE PERMISSION TABLE"},
+    {SMP_FN_CONFIG_ROUTE_INFO, "CONFIGURE ROUTE INFORMATION"},
+    {SMP_FN_PHY_CONTROL, "PHY CONTROL"},
+    {SMP_FN_PHY_TEST_FUNCTION, "PHY TEST FUNCTION"},
+    {SMP_FN_CONFIG_PHY_EVENT, "CONFIGURE PHY EVENT"},
+    {0x0, NULL},
+};
+
+char *
+smp_get_func_name_str(int func_code, int buff_len, char * buff)
+{
+    struct smp_val_name * vnp;
+
+    for (vnp = smp_func_names; vnp->name; ++vnp) {
+        if (func_code == vnp->value) {
+            snprintf(buff, buff_len, "%s", vnp->name);
+            return buff;
+        }
+    }
+    snprintf(buff, buff_len, "function 0x%x", func_code);
+    return buff;
+}
+
 /* spl5r04.pdf says a valid SAS address can be NAA-5 or NAA-3 (locally
  * assigned). It prefers NAA-5. */
 bool
@@ -498,6 +550,259 @@ smp_get_pwr_dis_signal_str(int pwr_dis_signal, int buff_len, char * buff)
     return buff;
 }
 
+/* Returns pointer to a (programmed or hardware) physical link rate string
+ * for the 4 bit value in val. If prog is true then 0 yields "not
+ * programmable". Pointer value returned is same as 'buff'. */
+char *
+smp_get_plink_rate(int val, bool prog, int buff_len, char * buff)
+{
+    if ((NULL == buff) || (buff_len < 1))
+        return buff;
+    switch (val) {
+    case 8:
+        snprintf(buff, buff_len, "1.5 Gbps");
+        return buff;
+    case 9:
+        snprintf(buff, buff_len, "3 Gbps");
+        return buff;
+    case 0xa:
+        snprintf(buff, buff_len, "6 Gbps");
+        return buff;
+    case 0xb:
+        snprintf(buff, buff_len, "12 Gbps");
+        return buff;
+    case 0xc:
+        snprintf(buff, buff_len, "22.5 Gbps");
+        return buff;
+    default:
+        break;
+    }
+    if (prog && (0 == val))
+        snprintf(buff, buff_len, "not programmable");
+    else
+        snprintf(buff, buff_len, "reserved [%d]", val);
+    return buff;
+}
+
+/* Returns pointer to a (attached) reason string for the 4 bit value in
+ * val. Pointer value returned is same as 'buff'. */
+char *
+smp_get_reason(int val, int buff_len, char * buff)
+{
+    if ((NULL == buff) || (buff_len < 1))
+        return buff;
+    switch (val) {
+    case 0: snprintf(buff, buff_len, "unknown"); break;
+    case 1: snprintf(buff, buff_len, "power on"); break;
+    case 2: snprintf(buff, buff_len, "hard reset");
+         break;
+    case 3: snprintf(buff, buff_len, "SMP phy control requested");
+         break;
+    case 4: snprintf(buff, buff_len, "loss of dword synchronization"); break;
+    case 5:     /* hardware muxing made obsolete in spl5r01 */
+        snprintf(buff, buff_len, "error in multiplexing (MUX) sequence");
+        break;
+    case 6: snprintf(buff, buff_len, "I_T nexus loss timeout STP/SATA");
+        break;
+    case 7: snprintf(buff, buff_len, "break timeout timer expired"); break;
+    case 8: snprintf(buff, buff_len, "phy test function stopped"); break;
+    case 9: snprintf(buff, buff_len, "expander reduced functionality");
+        break;
+    default: snprintf(buff, buff_len, "reserved [%d]", val); break;
+    }
+    return buff;
+}
+
+/* Returns pointer to a negotiated (logical or physical) link rate string
+ * for the 4 bit value in val. Pointer value returned is same as 'buff'. */
+char *
+smp_get_neg_xxx_link_rate(int val, int buff_len, char * buff)
+{
+    if ((NULL == buff) || (buff_len < 1))
+        return buff;
+    switch (val) {
+    case 0: snprintf(buff, buff_len, "phy enabled; unknown"); break;
+    case 1: snprintf(buff, buff_len, "phy disabled"); break;
+    case 2: snprintf(buff, buff_len, "phy enabled; speed negotiation failed");
+        break;
+    case 3: snprintf(buff, buff_len, "phy enabled; SATA spinup hold state");
+        break;
+    case 4: snprintf(buff, buff_len, "phy enabled; port selector"); break;
+    case 5: snprintf(buff, buff_len, "phy enabled; reset in progress");
+        break;
+    case 6: snprintf(buff, buff_len, "phy enabled; unsupported phy "
+                     "attached");
+        break;
+    case 8: snprintf(buff, buff_len, "phy enabled, 1.5 Gbps"); break;
+    case 9: snprintf(buff, buff_len, "phy enabled, 3 Gbps"); break;
+    case 0xa: snprintf(buff, buff_len, "phy enabled, 6 Gbps"); break;
+    case 0xb: snprintf(buff, buff_len, "phy enabled, 12 Gbps"); break;
+    case 0xc: snprintf(buff, buff_len, "phy enabled, 22.5 Gbps"); break;
+    default: snprintf(buff, buff_len, "reserved [%d]", val); break;
+    }
+    return buff;
+}
+
+/* Phy event source names, a copy of the pes_name_arr table in
+ * smp_rep_phy_event_list.c (smp_rep_phy_event.c and smp_conf_phy_event.c
+ * have their own) */
+static struct smp_val_name smp_pes_names[] =
+{
+    {0x0, "No event"},
+    /* Phy layer-based phy events (0x1 to 0x1F) */
+    {0x1, "Invalid word count"},
+    {0x2, "Running disparity error count"},
+    {0x3, "Loss of dword synchronization count"},
+    {0x4, "Phy reset problem count"},
+    {0x5, "Elasticity buffer overflow count"},
+    {0x6, "Received ERROR count"},
+    {0x7, "Invalid SPL packet count"},
+    {0x8, "Loss of SPL packet synchronization count"},
+    /* SAS arbitration-based phy events (0x20 to 0x3F) */
+    {0x20, "Received address frame error count"},
+    {0x21, "Transmitted abandon-class OPEN_REJECT count"},
+    {0x22, "Received abandon-class OPEN_REJECT count"},
+    {0x23, "Transmitted retry-class OPEN_REJECT count"},
+    {0x24, "Received retry-class OPEN_REJECT count"},
+    {0x25, "Received AIP (WAITING ON PARTIAL) count"},
+    {0x26, "Received AIP (WAITING ON CONNECTION) count"},
+    {0x27, "Transmitted BREAK count"},
+    {0x28, "Received BREAK count"},
+    {0x29, "Break timeout count"},
+    {0x2a, "Connection count"},
+    {0x2b, "Peak transmitted pathway blocked count"},   /*PVD */
+    {0x2c, "Peak transmitted arbitration wait time"},   /*PVD */
+    {0x2d, "Peak arbitration time"},                    /*PVD */
+    {0x2e, "Peak connection time"},                     /*PVD */
+    {0x2f, "Persistent connection count"},
+    /* SSP related phy events (0x40 to 0x4F) */
+    {0x40, "Transmitted SSP frame count"},
+    {0x41, "Received SSP frame count"},
+    {0x42, "Transmitted SSP frame error count"},
+    {0x43, "Received SSP frame error count"},
+    {0x44, "Transmitted CREDIT_BLOCKED count"},
+    {0x45, "Received CREDIT_BLOCKED count"},
+    /* SATA related phy events (0x50 to 0x5F) */
+    {0x50, "Transmitted SATA frame count"},
+    {0x51, "Received SATA frame count"},
+    {0x52, "SATA flow control buffer overflow count"},
+    /* SMP related phy events (0x60 to 0x6F) */
+    {0x60, "Transmitted SMP frame count"},
+    {0x61, "Received SMP frame count"},
+    {0x63, "Received SMP frame error count"},
+    /* Reserved 0x70 to 0xCF) */
+    /* Vendor specific 0xD0 to 0xFF) */
+    {0x0, NULL},
+};
+
+/* Places the name of phy event source pes in buff, or "reserved [0x<hh>]"
+ * or "vendor specific [0x<hh>]" if it has none. Returns buff. */
+char *
+smp_get_pes_str(int pes, int buff_len, char * buff)
+{
+    const struct smp_val_name * vnp;
+
+    if ((NULL == buff) || (buff_len < 1))
+        return buff;
+    for (vnp = smp_pes_names; vnp->name; ++vnp) {
+        if (pes == vnp->value) {
+            snprintf(buff, buff_len, "%s", vnp->name);
+            return buff;
+        }
+    }
+    snprintf(buff, buff_len, "%s [0x%x]", (pes >= 0xd0) ?
+             "vendor specific" : "reserved", pes);
+    return buff;
+}
+
+static const char * g_name[] = {"G1", "G2", "G3", "G4", "G5"};
+static const char * g_name_long[] =
+        {"G1 (1.5 Gbps)", "G2 (3 Gbps)", "G3 (6 Gbps)", "G4 (12 Gbps)",
+         "G5 (22.5 Gbps)"};
+
+/* Taken from spl5r02 SNW-3 table 70 on page 199. Note that the "Requested
+ * logical link rate" field became obsolete in spl5r01 when multiplexing
+ * was removed. Decodes the phy capabilities in p_cap into lines each
+ * starting with 4 spaces and ending with a newline. If long_names is true
+ * the link rate follows each G1 to G5 name. Returns buff. */
+char *
+smp_get_phy_cap_str(unsigned int p_cap, bool long_names, int buff_len,
+                    char * buff)
+{
+    bool prev_nl;
+    int k, skip, n;
+    unsigned int g15_val, g;
+    const char * cp;
+
+    if ((NULL == buff) || (buff_len < 1))
+        return buff;
+    n = scnpr(buff, buff_len, "    Tx SSC type: %d, Requested interleaved "
+              "SPL: %d, [Req logical lr: 0x%x]\n", ((p_cap >> 30) & 0x1),
+              (p_cap >> 28) & 0x3, (p_cap >> 24) & 0xf);
+    prev_nl = true;
+    g15_val = (p_cap >> 14) & 0x3ff;
+    for (skip = 0, k = 4; k >= 0; --k) {
+        cp = long_names ? g_name_long[4 - k] : g_name[4 - k];
+        g = (g15_val >> (k * 2)) & 0x3;
+        switch (g) {
+        case 0:
+            ++skip;
+            break;
+        case 1:
+            n += scnpr(buff + n, buff_len - n, "    %s: with SSC", cp);
+            prev_nl = false;
+            break;
+        case 2:
+            n += scnpr(buff + n, buff_len - n, "    %s: without SSC", cp);
+            prev_nl = false;
+            break;
+        case 3:
+        default:
+            n += scnpr(buff + n, buff_len - n, "    %s: with/without SSC",
+                       cp);
+            prev_nl = false;
+            break;
+        }
+        if ((3 == k) && (0 == skip)) {
+            n += scnpr(buff + n, buff_len - n, "\n");
+            skip = 2;
+            prev_nl = true;
+        }
+        if ((1 == k) && (skip < 2)) {
+            n += scnpr(buff + n, buff_len - n, "\n");
+            prev_nl = true;
+        }
+    }
+    if (! prev_nl)
+        n += scnpr(buff + n, buff_len - n, "\n");
+    scnpr(buff + n, buff_len - n, "    Extended coefficient settings: %d\n",
+          (p_cap >> 1) & 0x1);
+    return buff;
+}
+
+/* Returns 0 if att_cap is not more capable (speed-wise) than my_cap. If
+ * att_cap can do G5 (22.5 Gbps) and my_cap can't, returns 12 (0xc). If
+ * att_cap can do G4 (12 Gbps) and my_cap can't, returns 11 (0xb). If
+ * att_cap can do G3 (6 Gbps) and my_cap can't, returns 10 (0xa). Stops
+ * at this point and returns 0. */
+int
+smp_att_phy_more_capable(unsigned int my_cap, unsigned int att_cap)
+{
+    int k;
+    unsigned int my_g1_g5_val, att_g1_g5_val, my_g, att_g;
+    unsigned int g_res = 0xc;
+
+    my_g1_g5_val = (my_cap >> 14) & 0x3ff;
+    att_g1_g5_val = (att_cap >> 14) & 0x3ff;
+    for (k = 0; k < 3; ++k, --g_res) {
+        my_g = (my_g1_g5_val >> (k * 2)) & 0x3;
+        att_g = (att_g1_g5_val >> (k * 2)) & 0x3;
+        if (att_g && (0 == my_g))
+            return g_res;
+    }
+    return 0;
+}
+
 /* safe_strerror() contributed by Clayton Weaver <cgweav at email dot com>
    Allows for situation in which strerror() is given a wild value (or the
    C library is incomplete) and returns NULL. Still not thread safe.
@@ -1181,6 +1486,34 @@ pr2ws(const char * fmt, ...)
     return n;
 }
 
+int64_t
+smp_get_mono_ms(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts))
+        return 0;
+    return ((int64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+int
+smp_req_eff_timeout_ms(struct smp_req_resp * rresp, int def_ms)
+{
+    int to = (rresp->timeout_ms > 0) ? rresp->timeout_ms : def_ms;
+    int64_t rem;
+
+    if (rresp->deadline_ms > 0) {
+        rem = rresp->deadline_ms - smp_get_mono_ms();
+        if (rem <= 0) {
+            rresp->timed_out = true;
+            return 0;
+        }
+        if (rem < to)
+            to = (int)rem;
+    }
+    return to;
+}
+
 const char *
 smp_lib_version()
 {
@@ -46,6 +46,7 @@
 #ifndef major
 #include <sys/types.h>
 #endif
+#include <errno.h>
 #include <scsi/sg.h>
 
 #ifdef HAVE_CONFIG_H
@@ -53,6 +54,7 @@
 #endif
 
 #include "smp_lin_bsg.h"
+#include "smp_usdt.h"
 
 #ifndef HAVE_LINUX_BSG_H
 
@@ -107,7 +109,11 @@ send_req_lin_bsg(int fd, int subvalue, struct smp_req_resp * rresp,
 
 #include <linux/bsg.h>
 
-#define DEF_TIMEOUT_MS 20000    /* 20 seconds */
+#define DEF_TIMEOUT_MS SMP_DEF_TIMEOUT_MS       /* 20 seconds */
+
+/* Linux SCSI mid-level codes seen when a bsg request times out */
+#define LIN_DID_TIME_OUT 0x3
+#define LIN_DRIVER_TIMEOUT 0x6
 
 
 /* Returns 1 if bsg dev_name else 0 . */
@@ -284,9 +290,17 @@ send_req_lin_bsg(int fd, int subvalue, struct smp_req_resp * rresp,
 {
     struct sg_io_v4 hdr;
     unsigned char cmd[16];      /* unused */
-    int res;
+    int res, to;
+    uint64_t t0;
 
     ++subvalue; /* suppress warning */
+    to = smp_req_eff_timeout_ms(rresp, DEF_TIMEOUT_MS);
+    if (to <= 0) {
+        if (verbose)
+            fprintf(stderr, "send_req_lin_bsg: deadline passed, request "
+                    "not sent\n");
+        return -1;
+    }
 
     memset(&hdr, 0, sizeof(hdr));
     memset(cmd, 0, sizeof(cmd));
@@ -304,20 +318,29 @@ send_req_lin_bsg(int fd, int subvalue, struct smp_req_resp * rresp,
     hdr.din_xfer_len = rresp->max_response_len;
     hdr.din_xferp = (uintptr_t) rresp->response;
 
-    hdr.timeout = DEF_TIMEOUT_MS;
+    hdr.timeout = to;
 
     if (verbose > 3)
         fprintf(stderr, "send_req_lin_bsg: dout_xfer_len=%u, din_xfer_len="
                 "%u, timeout=%u ms\n", hdr.dout_xfer_len, hdr.din_xfer_len,
                 hdr.timeout);
 
+    SMP_PROBE3(bsg__entry, SMP_USDT_FUNC(rresp), rresp->request_len,
+               rresp->max_response_len);
+    t0 = SMP_USDT_START_US(bsg__return);
     res = ioctl(fd, SG_IO, &hdr);
     if (res) {
+        if (ETIMEDOUT == errno)
+            rresp->timed_out = true;
+        SMP_PROBE5(bsg__return, SMP_USDT_FUNC(rresp), -1, -1, -1,
+                   SMP_USDT_LAT_US(t0));
         perror("send_req_lin_bsg: SG_IO ioctl");
         return -1;
     }
     res = hdr.din_xfer_len - hdr.din_resid;
     rresp->act_response_len = res;
+    SMP_PROBE5(bsg__return, SMP_USDT_FUNC(rresp), 0, SMP_USDT_FRES(rresp),
+               res, SMP_USDT_LAT_US(t0));
     /* was: rresp->act_response_len = -1; */
     if (verbose > 3) {
         fprintf(stderr, "send_req_lin_bsg: driver_status=%u, transport_status="
@@ -334,6 +357,9 @@ send_req_lin_bsg(int fd, int subvalue, struct smp_req_resp * rresp,
                        (res > 0) ? res : (int)hdr.din_xfer_len, 1);
         }
     }
+    if ((LIN_DRIVER_TIMEOUT == (hdr.driver_status & 0xf)) ||
+        (LIN_DID_TIME_OUT == hdr.transport_status))
+        rresp->timed_out = true;
     if (hdr.driver_status)
         rresp->transport_err = hdr.driver_status;
     else if (hdr.transport_status)
@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Device name resolver cache for the Linux pass-throughs. Maps a user
+ * supplied (absolute) device name to the interface selector that accepted
+ * it and to a device node that can be opened directly, together with that
+ * node's major:minor numbers. A hit lets smp_initiator_open() skip the
+ * chk_*_device() probing and, for /sys/class/bsg names, the sysfs read plus
+ * the temporary mknod()/unlink() done by open_lin_bsg_device().
+ *
+ * The in-process table is always used. If the SMP_UTILS_DEV_CACHE
+ * environment variable names a writable directory then the table is also
+ * loaded from, and appended to, a file in that directory so that it
+ * survives across invocations. Persistent device nodes for bsg devices
+ * without a /dev/bsg entry are made in that directory as well, named by
+ * major:minor. Every hit is re-validated with fstat() after open(). */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include "smp_lib.h"
+#include "smp_lin_dcache.h"
+
+#define DCACHE_ENVVAR "SMP_UTILS_DEV_CACHE"
+#define DCACHE_FNAME "smp_dev_cache"
+#define DCACHE_MAX_ENTS 64
+#define DCACHE_NAME_LEN 256     /* same as SMP_MAX_DEVICE_NAME */
+#define DCACHE_NODE_LEN 512
+
+struct dcache_ent {
+    char name[DCACHE_NAME_LEN];
+    char node[DCACHE_NODE_LEN];
+    unsigned int maj;
+    unsigned int min;
+    unsigned long name_ino;     /* st_ino of a /sys name, else 0 */
+    int sel;
+    unsigned int age;
+};
+
+static struct dcache_ent dcache_arr[DCACHE_MAX_ENTS];
+static int dcache_num;
+static unsigned int dcache_clock;
+static bool dcache_loaded;
+static char dcache_dir[DCACHE_NODE_LEN - 32];
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t dcache_mtx = PTHREAD_MUTEX_INITIALIZER;
+#define DCACHE_LOCK() pthread_mutex_lock(&dcache_mtx)
+#define DCACHE_UNLOCK() pthread_mutex_unlock(&dcache_mtx)
+#else
+#define DCACHE_LOCK()
+#define DCACHE_UNLOCK()
+#endif
+
+
+/* Only absolute names without white space are cached; relative names
+ * would need the current working directory as part of the key. */
+static bool
+cacheable_name(const char * dev_name)
+{
+    int len = (int)strlen(dev_name);
+
+    if (('/' != dev_name[0]) || (len >= DCACHE_NAME_LEN))
+        return false;
+    return (NULL == strpbrk(dev_name, " \t\n"));
+}
+
+static struct dcache_ent *
+find_ent(const char * dev_name)
+{
+    int k;
+
+    for (k = 0; k < dcache_num; ++k) {
+        if (0 == strcmp(dev_name, dcache_arr[k].name))
+            return dcache_arr + k;
+    }
+    return NULL;
+}
+
+/* Adds or replaces the entry for ep->name, evicting the least recently
+ * used entry when the table is full. */
+static void
+insert_ent(const struct dcache_ent * ep)
+{
+    int k, oldest;
+    struct dcache_ent * dp = find_ent(ep->name);
+
+    if (NULL == dp) {
+        if (dcache_num < DCACHE_MAX_ENTS)
+            dp = dcache_arr + dcache_num++;
+        else {
+            for (k = 1, oldest = 0; k < DCACHE_MAX_ENTS; ++k) {
+                if (dcache_arr[k].age < dcache_arr[oldest].age)
+                    oldest = k;
+            }
+            dp = dcache_arr + oldest;
+        }
+    }
+    *dp = *ep;
+    dp->age = ++dcache_clock;
+}
+
+/* Line format: "<maj>:<min> <sel> <name_ino> <node> <name>" */
+static void
+load_file(int verbose)
+{
+    int num_lines = 0;
+    const char * cp;
+    FILE * fp;
+    struct dcache_ent ent;
+    char b[DCACHE_NAME_LEN + DCACHE_NODE_LEN + 64];
+    char fname[DCACHE_NODE_LEN];
+    struct stat st;
+
+    dcache_loaded = true;
+    cp = getenv(DCACHE_ENVVAR);
+    if ((NULL == cp) || ('/' != cp[0]))
+        return;
+    if ((stat(cp, &st) < 0) || (! S_ISDIR(st.st_mode))) {
+        if (verbose)
+            fprintf(stderr, "%s: %s=%s is not a directory, ignored\n",
+                    __func__, DCACHE_ENVVAR, cp);
+        return;
+    }
+    snprintf(dcache_dir, sizeof(dcache_dir), "%s", cp);
+    snprintf(fname, sizeof(fname), "%s/%s", dcache_dir, DCACHE_FNAME);
+    fp = fopen(fname, "r");
+    if (NULL == fp)
+        return;
+    while (fgets(b, sizeof(b), fp)) {
+        memset(&ent, 0, sizeof(ent));
+        if (6 != sscanf(b, "%u:%u %d %lu %511s %255s", &ent.maj, &ent.min,
+                        &ent.sel, &ent.name_ino, ent.node, ent.name))
+            continue;
+        insert_ent(&ent);
+        ++num_lines;
+    }
+    fclose(fp);
+    if (verbose > 3)
+        fprintf(stderr, "%s: %d entries from %s\n", __func__, dcache_num,
+                fname);
+    if (num_lines > (2 * DCACHE_MAX_ENTS)) {
+        /* compact: rewrite from the in-process table, replace atomically */
+        char tname[DCACHE_NODE_LEN + 16];
+        int k;
+
+        snprintf(tname, sizeof(tname), "%s.%d", fname, (int)getpid());
+        fp = fopen(tname, "w");
+        if (NULL == fp)
+            return;
+        for (k = 0; k < dcache_num; ++k)
+            fprintf(fp, "%u:%u %d %lu %s %s\n", dcache_arr[k].maj,
+                    dcache_arr[k].min, dcache_arr[k].sel,
+                    dcache_arr[k].name_ino, dcache_arr[k].node,
+                    dcache_arr[k].name);
+        if (fclose(fp) || rename(tname, fname))
+            unlink(tname);
+    }
+}
+
+static void
+append_file(const struct dcache_ent * ep)
+{
+    int fd, n;
+    char b[DCACHE_NAME_LEN + DCACHE_NODE_LEN + 64];
+    char fname[DCACHE_NODE_LEN];
+
+    if ('\0' == dcache_dir[0])
+        return;
+    snprintf(fname, sizeof(fname), "%s/%s", dcache_dir, DCACHE_FNAME);
+    n = snprintf(b, sizeof(b), "%u:%u %d %lu %s %s\n", ep->maj, ep->min,
+                 ep->sel, ep->name_ino, ep->node, ep->name);
+    if ((n <= 0) || (n >= (int)sizeof(b)))
+        return;
+    fd = open(fname, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+        return;
+    /* a single write() with O_APPEND keeps concurrent writers' lines whole */
+    if (write(fd, b, n) < 0) { ; }
+    close(fd);
+}
+
+/* For a /sys/class/bsg/<name> device find a device node that can be kept:
+ * /dev/bsg/<name> if it matches, else one made in the cache directory.
+ * Returns true and fills nodep on success. */
+static bool
+persistent_bsg_node(const char * sysfs_name, dev_t rdev, char * nodep,
+                    int node_len, int verbose)
+{
+    const char * cp = strrchr(sysfs_name, '/');
+    struct stat st;
+
+    if ((NULL == cp) || ('\0' == *(cp + 1)))
+        return false;
+    snprintf(nodep, node_len, "/dev/bsg/%s", cp + 1);
+    if ((0 == stat(nodep, &st)) && S_ISCHR(st.st_mode) &&
+        (st.st_rdev == rdev))
+        return true;
+    if ('\0' == dcache_dir[0])
+        return false;
+    snprintf(nodep, node_len, "%s/bsg_%u_%u", dcache_dir, major(rdev),
+             minor(rdev));
+    if (0 == stat(nodep, &st)) {
+        if (S_ISCHR(st.st_mode) && (st.st_rdev == rdev))
+            return true;
+        unlink(nodep);
+    }
+    if (mknod(nodep, S_IFCHR | S_IRUSR | S_IWUSR, rdev)) {
+        if (verbose > 2)
+            fprintf(stderr, "%s: mknod(%s) failed: %s\n", __func__, nodep,
+                    safe_strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool
+smp_lin_dcache_get(const char * dev_name, int sel, char * nodep,
+                   int node_len, int * selp, int verbose)
+{
+    bool ok = false;
+    struct dcache_ent * dp;
+    struct stat st;
+
+    if (! cacheable_name(dev_name))
+        return false;
+    DCACHE_LOCK();
+    if (! dcache_loaded)
+        load_file(verbose);
+    dp = find_ent(dev_name);
+    if (dp && ((0 == sel) || (sel == dp->sel))) {
+        if (dp->name_ino) {
+            /* sysfs entries are re-created (new inode) on hot-plug */
+            if ((0 == stat(dev_name, &st)) &&
+                ((unsigned long)st.st_ino == dp->name_ino))
+                ok = true;
+        } else
+            ok = true;
+        if (ok) {
+            snprintf(nodep, node_len, "%s", dp->node);
+            *selp = dp->sel;
+            dp->age = ++dcache_clock;
+        }
+    }
+    DCACHE_UNLOCK();
+    if (verbose > 3)
+        fprintf(stderr, "%s: %s %s\n", __func__, dev_name,
+                (ok ? "hit" : "miss"));
+    return ok;
+}
+
+bool
+smp_lin_dcache_check_fd(const char * dev_name, int fd)
+{
+    bool ok = false;
+    struct dcache_ent * dp;
+    struct stat st;
+
+    if (fstat(fd, &st) < 0)
+        return false;
+    DCACHE_LOCK();
+    dp = find_ent(dev_name);
+    if (dp && S_ISCHR(st.st_mode) && (major(st.st_rdev) == dp->maj) &&
+        (minor(st.st_rdev) == dp->min))
+        ok = true;
+    DCACHE_UNLOCK();
+    return ok;
+}
+
+void
+smp_lin_dcache_put(const char * dev_name, int sel, int fd, int verbose)
+{
+    struct dcache_ent ent;
+    struct stat st;
+
+    if ((! cacheable_name(dev_name)) || (fstat(fd, &st) < 0) ||
+        (! S_ISCHR(st.st_mode)))
+        return;
+    memset(&ent, 0, sizeof(ent));
+    snprintf(ent.name, sizeof(ent.name), "%s", dev_name);
+    ent.maj = major(st.st_rdev);
+    ent.min = minor(st.st_rdev);
+    ent.sel = sel;
+    DCACHE_LOCK();
+    if (! dcache_loaded)
+        load_file(verbose);
+    if (0 == strncmp(dev_name, "/sys/", 5)) {
+        struct stat name_st;
+
+        if ((stat(dev_name, &name_st) < 0) ||
+            (! persistent_bsg_node(dev_name, st.st_rdev, ent.node,
+                                   sizeof(ent.node), verbose)))
+            goto fini;
+        ent.name_ino = (unsigned long)name_st.st_ino;
+    } else
+        snprintf(ent.node, sizeof(ent.node), "%s", dev_name);
+    insert_ent(&ent);
+    append_file(&ent);
+    if (verbose > 3)
+        fprintf(stderr, "%s: %s -> %s [%u:%u]\n", __func__, dev_name,
+                ent.node, ent.maj, ent.min);
+fini:
+    DCACHE_UNLOCK();
+}
+
+void
+smp_lin_dcache_drop(const char * dev_name)
+{
+    struct dcache_ent * dp;
+
+    DCACHE_LOCK();
+    dp = find_ent(dev_name);
+    if (dp) {
+        /* poison rather than remove; the file copy is superseded by the
+         * next put() of the same name */
+        dp->name[0] = '\0';
+        dp->age = 0;
+    }
+    DCACHE_UNLOCK();
+}
@@ -0,0 +1,25 @@
+#ifndef SMP_LIN_DCACHE_H
+#define SMP_LIN_DCACHE_H
+
+#include <stdbool.h>
+
+#include "smp_lib.h"
+
+/* Device name resolver cache used by smp_initiator_open() on Linux. */
+
+/* If dev_name is cached (for interface selector sel, or any if sel is 0)
+ * then places the device node to open in nodep, the selector in *selp and
+ * returns true. Otherwise returns false. */
+bool smp_lin_dcache_get(const char * dev_name, int sel, char * nodep,
+                        int node_len, int * selp, int verbose);
+
+/* Returns true if fd refers to the major:minor cached for dev_name. */
+bool smp_lin_dcache_check_fd(const char * dev_name, int fd);
+
+/* Records that dev_name was opened as fd using interface selector sel. */
+void smp_lin_dcache_put(const char * dev_name, int sel, int fd, int verbose);
+
+/* Forgets dev_name (e.g. after a stale hit). */
+void smp_lin_dcache_drop(const char * dev_name);
+
+#endif
@@ -28,6 +28,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -38,11 +40,58 @@
 #include "smp_aac_io.h"
 #include "smp_mptctl_io.h"
 #include "smp_lin_bsg.h"
+#include "smp_lin_dcache.h"
+#include "smp_emu.h"
+#include "smp_replay.h"
+#include "smp_pt.h"
 
 
 #define I_MPT 2
 #define I_SGV4 4
 #define I_AAC  6
+#define I_EMU  8
+#define I_REPLAY 10
+
+
+/* Uses a device resolver cache hit (if any) to open device_name without
+ * probing. Returns 0 on success (tobj filled), else -1 . */
+static int
+open_from_dcache(const char * device_name, int subvalue,
+                 struct smp_target_obj * tobj, int verbose)
+{
+    int sel, fd;
+    char node[512];
+
+    if (! smp_lin_dcache_get(device_name, tobj->interface_selector, node,
+                             sizeof(node), &sel, verbose))
+        return -1;
+    if (I_SGV4 == sel)
+        fd = open_lin_bsg_device(node, verbose);
+    else if (I_MPT == sel)
+        fd = open_mpt_device(node, verbose);
+    else
+        fd = -1;
+    if (fd >= 0) {
+        if (smp_lin_dcache_check_fd(device_name, fd)) {
+            tobj->interface_selector = sel;
+            if (I_MPT == sel)
+                tobj->vp = alloc_mpt_ctx();
+            tobj->fd = fd;
+            tobj->subvalue = subvalue;
+            tobj->opened = 1;
+            return 0;
+        }
+        if (I_MPT == sel)
+            close_mpt_device(fd);
+        else
+            close_lin_bsg_device(fd);
+    }
+    if (verbose > 2)
+        fprintf(stderr, "%s: stale entry for %s dropped\n", __func__,
+                device_name);
+    smp_lin_dcache_drop(device_name);
+    return -1;
+}
 
 int
 smp_initiator_open(const char * device_name, int subvalue,
@@ -51,6 +100,7 @@ smp_initiator_open(const char * device_name, int subvalue,
 {
     int force = 0;
     int res;
+    bool replay_lat = false;
     int len = device_name ? (strlen(device_name) + 1) : 0;
     char * cp;
 
@@ -71,6 +121,10 @@ smp_initiator_open(const char * device_name, int subvalue,
         else if ((0 == strncmp("sgv4", i_params, 2)) ||
                  (0 == strncmp("bsg", i_params, 3)))
             tobj->interface_selector = I_SGV4;
+        else if (0 == strncmp("emu", i_params, 3))
+            tobj->interface_selector = I_EMU;
+        else if (0 == strncmp("rep", i_params, 3))
+            tobj->interface_selector = I_REPLAY;
         else if (0 == strncmp("for", i_params, 3))
             force = 1;
         else if (verbose > 3)
@@ -80,8 +134,31 @@ smp_initiator_open(const char * device_name, int subvalue,
             if ((tobj->interface_selector > 0) &&
                 (0 == strncmp("for", cp + 1, 3)))
                 force = 1;
+            else if ((I_REPLAY == tobj->interface_selector) &&
+                     (0 == strncmp("lat", cp + 1, 3)))
+                replay_lat = true;
         }
     }
+    if (I_EMU == tobj->interface_selector) {
+        if (open_emu_device(device_name, sa, &tobj->vp, verbose))
+            goto err_out;
+        tobj->fd = -1;
+        tobj->subvalue = subvalue;
+        tobj->opened = 1;
+        return 0;
+    }
+    if (I_REPLAY == tobj->interface_selector) {
+        if (open_replay_device(device_name, sa, replay_lat, &tobj->vp,
+                               verbose))
+            goto err_out;
+        tobj->fd = -1;
+        tobj->subvalue = subvalue;
+        tobj->opened = 1;
+        return 0;
+    }
+    if ((! force) && (0 == open_from_dcache(device_name, subvalue, tobj,
+                                            verbose)))
+        return 0;
     if ((I_SGV4 == tobj->interface_selector) ||
         (0 == tobj->interface_selector)) {
         res = chk_lin_bsg_device(device_name, verbose);
@@ -94,6 +171,8 @@ smp_initiator_open(const char * device_name, int subvalue,
             res = open_lin_bsg_device(device_name, verbose);
             if (res < 0)
                 goto err_out;
+            if (! force)
+                smp_lin_dcache_put(device_name, I_SGV4, res, verbose);
             tobj->fd = res;
             tobj->subvalue = subvalue;
             tobj->opened = 1;
@@ -113,6 +192,9 @@ smp_initiator_open(const char * device_name, int subvalue,
             res = open_mpt_device(device_name, verbose);
             if (res < 0)
                 goto err_out;
+            if (! force)
+                smp_lin_dcache_put(device_name, I_MPT, res, verbose);
+            tobj->vp = alloc_mpt_ctx();    /* NULL is tolerated */
             tobj->fd = res;
             tobj->subvalue = subvalue;
             tobj->opened = 1;
@@ -148,8 +230,8 @@ err_out:
 }
 
 int
-smp_send_req(const struct smp_target_obj * tobj,
-             struct smp_req_resp * rresp, int verbose)
+smp_pt_send_req(const struct smp_target_obj * tobj,
+                struct smp_req_resp * rresp, int verbose)
 {
     if ((NULL == tobj) || (0 == tobj->opened)) {
         if (verbose > 2)
@@ -160,10 +242,14 @@ smp_send_req(const struct smp_target_obj * tobj,
         return send_req_lin_bsg(tobj->fd, tobj->subvalue, rresp, verbose);
     else if (I_MPT == tobj->interface_selector)
         return send_req_mpt(tobj->fd, tobj->subvalue, tobj->sas_addr64,
-                            rresp, verbose);
+                            tobj->vp, rresp, verbose);
     else if (I_AAC == tobj->interface_selector)
         return send_req_aac(tobj->fd, tobj->subvalue, tobj->sas_addr,
                             rresp, verbose);
+    else if (I_EMU == tobj->interface_selector)
+        return send_req_emu(tobj->vp, rresp, verbose);
+    else if (I_REPLAY == tobj->interface_selector)
+        return send_req_replay(tobj->vp, rresp, verbose);
     else {
         if (verbose)
             fprintf(stderr, "smp_send_req: no transport??\n");
@@ -184,13 +270,106 @@ smp_initiator_close(struct smp_target_obj * tobj)
         res = close_mpt_device(tobj->fd);
         if (res < 0)
             fprintf(stderr, "close_mpt_device: failed\n");
+        free_mpt_ctx(tobj->vp);
+        tobj->vp = NULL;
     }else if(I_AAC == tobj->interface_selector){
         res = close_aac_device(tobj->fd);
         if (res < 0)
             fprintf(stderr,"close_aac_device: failed\n");
+    } else if (I_EMU == tobj->interface_selector) {
+        close_emu_device(tobj->vp);
+        tobj->vp = NULL;
+    } else if (I_REPLAY == tobj->interface_selector) {
+        close_replay_device(tobj->vp);
+        tobj->vp = NULL;
     }
 
 
     tobj->opened = 0;
     return 0;
 }
+
+/* Looks for the SAS expander whose SAS address is sa in sysfs and places
+ * the name of its bsg device in b. Returns 0 if found, else -1 . */
+static int
+find_bsg_expander(uint64_t sa, char * b, int blen, int verbose)
+{
+    int ret = -1;
+    unsigned long long ull;
+    const char * dir_nm = "/sys/class/sas_device";
+    char nm[512];
+    char line[64];
+    DIR * dp;
+    FILE * fp;
+    struct dirent * dep;
+    struct stat st;
+
+    dp = opendir(dir_nm);
+    if (NULL == dp) {
+        if (verbose)
+            fprintf(stderr, "%s: unable to open %s\n", __func__, dir_nm);
+        return -1;
+    }
+    while ((dep = readdir(dp))) {
+        if (0 != strncmp(dep->d_name, "expander-", 9))
+            continue;
+        snprintf(nm, sizeof(nm), "%s/%s/sas_address", dir_nm, dep->d_name);
+        fp = fopen(nm, "r");
+        if (NULL == fp)
+            continue;
+        ull = 0;
+        if (fgets(line, sizeof(line), fp))
+            ull = strtoull(line, NULL, 16);
+        fclose(fp);
+        if ((uint64_t)ull != sa)
+            continue;
+        if (snprintf(b, blen, "/dev/bsg/%s", dep->d_name) >= blen)
+            break;
+        /* no node in /dev, let bsg code use sysfs */
+        if ((stat(b, &st) < 0) &&
+            (snprintf(b, blen, "/sys/class/bsg/%s", dep->d_name) >= blen))
+            break;
+        ret = 0;
+        break;
+    }
+    closedir(dp);
+    if (ret && verbose)
+        fprintf(stderr, "%s: no expander with SAS address 0x%llx in %s\n",
+                __func__, (unsigned long long)sa, dir_nm);
+    return ret;
+}
+
+int
+smp_initiator_open_sa(const struct smp_target_obj * base, uint64_t sa,
+                      struct smp_target_obj * tobj, int verbose)
+{
+    const char * ip;
+    char b[SMP_MAX_DEVICE_NAME];
+
+    if ((NULL == base) || (0 == base->opened) || (NULL == tobj))
+        return -1;
+    switch (base->interface_selector) {
+    case I_SGV4:
+        /* each bsg expander device reaches one SMP target */
+        if (find_bsg_expander(sa, b, sizeof(b), verbose))
+            return -1;
+        return smp_initiator_open(b, 0, "bsg", sa, tobj, verbose);
+    case I_MPT:
+        ip = "mpt";
+        break;
+    case I_AAC:
+        ip = "aac";
+        break;
+    case I_EMU:
+        ip = "emu";
+        break;
+    case I_REPLAY:
+        /* each handle honours the base's ",latency" option */
+        ip = replay_with_latency(base->vp) ? "rep,latency" : "rep";
+        break;
+    default:
+        return -1;
+    }
+    return smp_initiator_open(base->device_name, base->subvalue, ip, sa,
+                              tobj, verbose);
+}
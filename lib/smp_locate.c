@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* SAS address location index. Ports are collected from a topology walk
+ * or a snapshot into an array sorted by attached SAS address; an open
+ * addressing hash table maps each address to its first entry. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "smp_lib.h"
+#include "sg_unaligned.h"
+
+struct smp_loc_tbl {
+    int num;                    /* entries in use */
+    int max;                    /* entries allocated */
+    struct smp_loc_ent * ents;
+    int shift;                  /* 64 - log2(number of slots) */
+    uint32_t mask;              /* number of slots - 1 */
+    uint32_t * slots;           /* entry index + 1, 0 is empty */
+};
+
+
+static uint32_t
+loc_hash(const struct smp_loc_tbl * ltp, uint64_t sa)
+{
+    return (uint32_t)((sa * 0x9e3779b97f4a7c15ULL) >> ltp->shift);
+}
+
+/* Adds a phy to the port of expander exp_idx (whose entries start at
+ * first) attached to att_sa, else appends a new entry. */
+static int
+loc_add(struct smp_loc_tbl * ltp, int first, int exp_idx, uint64_t exp_sa,
+        int phy_id, uint64_t att_sa, int neg_lrate, int adt)
+{
+    int k;
+    struct smp_loc_ent * ep;
+
+    for (k = first; k < ltp->num; ++k) {
+        ep = ltp->ents + k;
+        if (att_sa == ep->sa) {
+            ++ep->width;
+            return 0;
+        }
+    }
+    if (ltp->num >= ltp->max) {
+        ltp->max = ltp->max ? (ltp->max * 2) : 256;
+        ep = (struct smp_loc_ent *)realloc(ltp->ents,
+                                           ltp->max * sizeof(*ep));
+        if (NULL == ep)
+            return -1;
+        ltp->ents = ep;
+    }
+    ep = ltp->ents + ltp->num++;
+    ep->sa = att_sa;
+    ep->exp_sa = exp_sa;
+    ep->exp_idx = exp_idx;
+    ep->phy_id = phy_id;
+    ep->width = 1;
+    ep->neg_lrate = neg_lrate;
+    ep->adt = adt;
+    return 0;
+}
+
+static int
+loc_ent_cmp(const void * a, const void * b)
+{
+    const struct smp_loc_ent * lp = (const struct smp_loc_ent *)a;
+    const struct smp_loc_ent * rp = (const struct smp_loc_ent *)b;
+
+    if (lp->sa != rp->sa)
+        return (lp->sa < rp->sa) ? -1 : 1;
+    if (lp->exp_idx != rp->exp_idx)
+        return (lp->exp_idx < rp->exp_idx) ? -1 : 1;
+    return (lp->phy_id < rp->phy_id) ? -1 : (lp->phy_id > rp->phy_id);
+}
+
+/* Sorts the entries and builds the hash table, with at least twice as
+ * many slots as distinct addresses. Returns 0 on success else -1 . */
+static int
+loc_index(struct smp_loc_tbl * ltp)
+{
+    int k, bits;
+    uint32_t h;
+
+    if (ltp->num > 1)
+        qsort(ltp->ents, ltp->num, sizeof(ltp->ents[0]), loc_ent_cmp);
+    for (bits = 4; (1 << bits) < (2 * ltp->num); ++bits)
+        ;
+    ltp->shift = 64 - bits;
+    ltp->mask = (1U << bits) - 1;
+    ltp->slots = (uint32_t *)calloc(1U << bits, sizeof(uint32_t));
+    if (NULL == ltp->slots)
+        return -1;
+    for (k = 0; k < ltp->num; ++k) {
+        if ((k > 0) && (ltp->ents[k].sa == ltp->ents[k - 1].sa))
+            continue;
+        for (h = loc_hash(ltp, ltp->ents[k].sa); ltp->slots[h];
+             h = (h + 1) & ltp->mask)
+            ;
+        ltp->slots[h] = k + 1;
+    }
+    return 0;
+}
+
+struct smp_loc_tbl *
+smp_loc_tbl_from_topo(const struct smp_topo * topop)
+{
+    int k, j, first;
+    const struct smp_topo_exp * xp;
+    const struct smp_topo_phy * pp;
+    struct smp_loc_tbl * ltp;
+
+    ltp = (struct smp_loc_tbl *)calloc(1, sizeof(*ltp));
+    if (NULL == ltp)
+        return NULL;
+    for (k = 0; k < topop->num_exp; ++k) {
+        xp = topop->exps + k;
+        first = ltp->num;
+        for (j = 0; j < xp->num_phys; ++j) {
+            pp = xp->phys + j;
+            if (pp->func_res || (0 == pp->att_sa))
+                continue;
+            if (loc_add(ltp, first, k, xp->sa, j, pp->att_sa,
+                        pp->neg_lrate, pp->adt))
+                goto err_out;
+        }
+    }
+    if (loc_index(ltp))
+        goto err_out;
+    return ltp;
+
+err_out:
+    smp_loc_tbl_free(ltp);
+    return NULL;
+}
+
+struct smp_loc_tbl *
+smp_loc_tbl_from_snap(const struct smp_snap * sp)
+{
+    int k, j, n, first, pi;
+    const uint8_t * xp;
+    struct smp_phy_desc pd;
+    struct smp_loc_tbl * ltp;
+
+    ltp = (struct smp_loc_tbl *)calloc(1, sizeof(*ltp));
+    if (NULL == ltp)
+        return NULL;
+    n = smp_snap_num_exp(sp);
+    for (k = 0; k < n; ++k) {
+        xp = smp_snap_exp(sp, k);
+        pi = sg_get_unaligned_be32(xp + 20);
+        first = ltp->num;
+        for (j = xp[10]; j > 0; --j, ++pi) {
+            if (smp_snap_get_phy(sp, pi, &pd))
+                goto err_out;
+            if (pd.func_res || (0 == pd.att_sa))
+                continue;
+            if (loc_add(ltp, first, k, pd.sa, pd.phy_id, pd.att_sa,
+                        pd.neg_lrate, pd.adt))
+                goto err_out;
+        }
+    }
+    if (loc_index(ltp))
+        goto err_out;
+    return ltp;
+
+err_out:
+    smp_loc_tbl_free(ltp);
+    return NULL;
+}
+
+void
+smp_loc_tbl_free(struct smp_loc_tbl * ltp)
+{
+    if (NULL == ltp)
+        return;
+    free(ltp->slots);
+    free(ltp->ents);
+    free(ltp);
+}
+
+int
+smp_loc_tbl_num(const struct smp_loc_tbl * ltp)
+{
+    return ltp->num;
+}
+
+const struct smp_loc_ent *
+smp_loc_tbl_ent(const struct smp_loc_tbl * ltp, int k)
+{
+    return ((k >= 0) && (k < ltp->num)) ? (ltp->ents + k) : NULL;
+}
+
+int
+smp_loc_find(const struct smp_loc_tbl * ltp, uint64_t sa,
+             const struct smp_loc_ent ** epp)
+{
+    int k, n;
+    uint32_t h;
+
+    for (h = loc_hash(ltp, sa); ltp->slots[h]; h = (h + 1) & ltp->mask) {
+        k = ltp->slots[h] - 1;
+        if (ltp->ents[k].sa != sa)
+            continue;
+        for (n = 1; ((k + n) < ltp->num) && (ltp->ents[k + n].sa == sa); ++n)
+            ;
+        if (epp)
+            *epp = ltp->ents + k;
+        return n;
+    }
+    return 0;
+}
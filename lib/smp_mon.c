@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Shared memory published by smp_monitord, see the "Monitor shared memory"
+ * section of smp_lib.h . Each expander slot has a sequence lock; the
+ * compiler's __atomic builtins provide the ordering. The writer copies a
+ * slot it has built privately, so the window in which readers must retry
+ * is one memcpy() long. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "smp_lib.h"
+#include "sg_pr2serr.h"
+
+#define MON_ENVVAR "SMP_UTILS_MON_SHM"
+#define MON_READ_TRIES 1000
+
+struct smp_mon {
+    bool writable;
+    void * img;                 /* mapping of whole object */
+    size_t img_len;
+    int num_exp;
+    char name[256];
+};
+
+
+static const char *
+mon_name(const char * name)
+{
+    if (name && name[0])
+        return name;
+    name = getenv(MON_ENVVAR);
+    return (name && name[0]) ? name : SMP_MON_DEF_NAME;
+}
+
+static struct smp_mon_exp *
+mon_slot(const struct smp_mon * mp, int xi)
+{
+    return (struct smp_mon_exp *)((uint8_t *)mp->img +
+                                  sizeof(struct smp_mon_hdr)) + xi;
+}
+
+static size_t
+mon_copy_len(int num_phys)
+{
+    if (num_phys > SMP_MON_MAX_PHYS)
+        num_phys = SMP_MON_MAX_PHYS;
+    else if (num_phys < 0)
+        num_phys = 0;
+    return offsetof(struct smp_mon_exp, phys) +
+           (num_phys * sizeof(struct smp_mon_phy));
+}
+
+struct smp_mon *
+smp_mon_create(const char * name, int num_exp, int verbose)
+{
+    int fd;
+    size_t len;
+    void * p;
+    struct timespec ts;
+    struct smp_mon * mp;
+    struct smp_mon_hdr * hp;
+
+    if (num_exp < 1)
+        return NULL;
+    name = mon_name(name);
+    len = sizeof(struct smp_mon_hdr) +
+          ((size_t)num_exp * sizeof(struct smp_mon_exp));
+    /* a new object so readers of a previous one keep a consistent view */
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        if (verbose)
+            pr2serr("%s: shm_open(%s) failed: %s\n", __func__, name,
+                    safe_strerror(errno));
+        return NULL;
+    }
+    if (ftruncate(fd, len) < 0) {
+        if (verbose)
+            pr2serr("%s: ftruncate(%s) failed: %s\n", __func__, name,
+                    safe_strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == p) {
+        if (verbose)
+            pr2serr("%s: mmap of %s failed: %s\n", __func__, name,
+                    safe_strerror(errno));
+        shm_unlink(name);
+        return NULL;
+    }
+    mp = (struct smp_mon *)calloc(1, sizeof(*mp));
+    if (NULL == mp) {
+        munmap(p, len);
+        shm_unlink(name);
+        return NULL;
+    }
+    mp->writable = true;
+    mp->img = p;
+    mp->img_len = len;
+    mp->num_exp = num_exp;
+    snprintf(mp->name, sizeof(mp->name), "%s", name);
+    /* ftruncate() zero filled the slots: seq 0, nothing held */
+    hp = (struct smp_mon_hdr *)p;
+    hp->version = SMP_MON_VERSION;
+    hp->exp_len = sizeof(struct smp_mon_exp);
+    hp->num_exp = num_exp;
+    hp->pid = (int32_t)getpid();
+    if (0 == clock_gettime(CLOCK_REALTIME, &ts))
+        hp->start_ms = ((int64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+    /* magic last, a reader that sees it sees the rest of the header */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(hp->magic, SMP_MON_MAGIC, sizeof(hp->magic));
+    return mp;
+}
+
+struct smp_mon *
+smp_mon_open(const char * name, int verbose)
+{
+    int fd;
+    void * p;
+    struct stat st;
+    struct smp_mon * mp;
+    const struct smp_mon_hdr * hp;
+
+    name = mon_name(name);
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        if (verbose)
+            pr2serr("%s: shm_open(%s) failed: %s\n", __func__, name,
+                    safe_strerror(errno));
+        return NULL;
+    }
+    if ((fstat(fd, &st) < 0) ||
+        (st.st_size < (off_t)sizeof(struct smp_mon_hdr))) {
+        if (verbose)
+            pr2serr("%s: %s: too short\n", __func__, name);
+        close(fd);
+        return NULL;
+    }
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == p) {
+        if (verbose)
+            pr2serr("%s: mmap of %s failed: %s\n", __func__, name,
+                    safe_strerror(errno));
+        return NULL;
+    }
+    hp = (const struct smp_mon_hdr *)p;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if ((0 != memcmp(hp->magic, SMP_MON_MAGIC, sizeof(hp->magic))) ||
+        (SMP_MON_VERSION != hp->version) ||
+        (sizeof(struct smp_mon_exp) != hp->exp_len) ||
+        ((size_t)st.st_size < sizeof(struct smp_mon_hdr) +
+                             ((size_t)hp->num_exp * hp->exp_len))) {
+        if (verbose)
+            pr2serr("%s: %s: not a monitor object, or another version\n",
+                    __func__, name);
+        munmap(p, st.st_size);
+        return NULL;
+    }
+    mp = (struct smp_mon *)calloc(1, sizeof(*mp));
+    if (NULL == mp) {
+        munmap(p, st.st_size);
+        return NULL;
+    }
+    mp->img = p;
+    mp->img_len = st.st_size;
+    mp->num_exp = hp->num_exp;
+    snprintf(mp->name, sizeof(mp->name), "%s", name);
+    return mp;
+}
+
+void
+smp_mon_close(struct smp_mon * mp, bool unlink_it)
+{
+    if (NULL == mp)
+        return;
+    munmap(mp->img, mp->img_len);
+    if (unlink_it)
+        shm_unlink(mp->name);
+    free(mp);
+}
+
+const struct smp_mon_hdr *
+smp_mon_get_hdr(const struct smp_mon * mp)
+{
+    return mp ? (const struct smp_mon_hdr *)mp->img : NULL;
+}
+
+void
+smp_mon_publish(struct smp_mon * mp, int xi, const struct smp_mon_exp * src)
+{
+    uint32_t seq;
+    struct smp_mon_exp * xp;
+
+    if ((NULL == mp) || (! mp->writable) || (xi < 0) ||
+        (xi >= mp->num_exp))
+        return;
+    xp = mon_slot(mp, xi);
+    seq = __atomic_load_n(&xp->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&xp->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    /* all but the sequence number */
+    memcpy((uint8_t *)xp + sizeof(xp->seq), (const uint8_t *)src +
+           sizeof(src->seq), mon_copy_len(src->num_phys) - sizeof(xp->seq));
+    __atomic_store_n(&xp->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+int
+smp_mon_read(const struct smp_mon * mp, int xi, struct smp_mon_exp * dst)
+{
+    int k;
+    uint32_t s1, s2;
+    const struct smp_mon_exp * xp;
+    size_t n;
+
+    if ((NULL == mp) || (xi < 0) || (xi >= mp->num_exp) || (NULL == dst))
+        return -1;
+    xp = mon_slot(mp, xi);
+    for (k = 0; k < MON_READ_TRIES; ++k) {
+        s1 = __atomic_load_n(&xp->seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1) {
+            sched_yield();
+            continue;
+        }
+        n = offsetof(struct smp_mon_exp, phys);
+        memcpy(dst, xp, n);
+        /* num_phys may be torn here, it is bounded and checked below */
+        memcpy(dst->phys, xp->phys,
+               mon_copy_len(dst->num_phys) - n);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&xp->seq, __ATOMIC_RELAXED);
+        if (s1 == s2) {
+            if (dst->num_phys > SMP_MON_MAX_PHYS)
+                dst->num_phys = SMP_MON_MAX_PHYS;
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,487 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Renders smp_monitord expander slots in OpenMetrics text format, for a
+ * Prometheus node exporter textfile collector. Each metric family must be
+ * contiguous so every family is a pass over all expanders. Output goes
+ * through one fixed buffer with hand rolled number formatting: nothing is
+ * allocated per series and 20,000 series take a few milliseconds. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "smp_lib.h"
+#include "sg_pr2serr.h"
+
+#define OM_BUF_LEN (64 * 1024)
+#define OM_NAME_LEN 48
+
+struct om_out {
+    int fd;
+    int len;
+    bool err;
+    const struct smp_mon_exp * const * xa;
+    int num_exp;
+    bool * dup;         /* same device and SAS address as an earlier slot */
+    char pes_name[256][OM_NAME_LEN];    /* "" until first needed */
+    char b[OM_BUF_LEN];
+};
+
+/* kinds of per phy family */
+enum om_phy_kind {
+    OM_LRATE, OM_LRATE_BPS, OM_INV_DWORD, OM_DISPARITY, OM_LOSS_SYNC,
+    OM_RESET_PROB, OM_EVENTS, OM_EV_PEAK,
+};
+
+struct om_family {
+    const char * name;
+    const char * type;
+    enum om_phy_kind kind;
+    const char * help;
+};
+
+static const struct om_family om_phy_fams[] = {
+    {"smp_phy_negotiated_link_rate", "gauge", OM_LRATE,
+     "Negotiated logical link rate field of DISCOVER; 8 and above is a "
+     "speed"},
+    {"smp_phy_link_rate_bits_per_second", "gauge", OM_LRATE_BPS,
+     "Negotiated logical link rate, 0 if the link is not up"},
+    {"smp_phy_invalid_dwords", "counter", OM_INV_DWORD,
+     "Invalid dword count from REPORT PHY ERROR LOG"},
+    {"smp_phy_running_disparity_errors", "counter", OM_DISPARITY,
+     "Running disparity error count from REPORT PHY ERROR LOG"},
+    {"smp_phy_loss_of_dword_syncs", "counter", OM_LOSS_SYNC,
+     "Loss of dword synchronization count from REPORT PHY ERROR LOG"},
+    {"smp_phy_reset_problems", "counter", OM_RESET_PROB,
+     "Phy reset problem count from REPORT PHY ERROR LOG"},
+    {"smp_phy_events", "counter", OM_EVENTS,
+     "Phy event count from REPORT PHY EVENT LIST"},
+    {"smp_phy_event_peak", "gauge", OM_EV_PEAK,
+     "Peak value detector phy event from REPORT PHY EVENT LIST"},
+};
+
+
+static void
+om_flush(struct om_out * oop)
+{
+    int k, n;
+
+    for (k = 0; (k < oop->len) && (! oop->err); k += n) {
+        n = write(oop->fd, oop->b + k, oop->len - k);
+        if (n < 0) {
+            if (EINTR == errno) {
+                n = 0;
+                continue;
+            }
+            oop->err = true;
+        }
+    }
+    oop->len = 0;
+}
+
+static void
+om_put(struct om_out * oop, const char * cp, int n)
+{
+    if ((oop->len + n) > OM_BUF_LEN)
+        om_flush(oop);
+    memcpy(oop->b + oop->len, cp, n);   /* n is always small */
+    oop->len += n;
+}
+
+static void
+om_puts(struct om_out * oop, const char * cp)
+{
+    om_put(oop, cp, strlen(cp));
+}
+
+static void
+om_put_u64(struct om_out * oop, uint64_t v)
+{
+    int k = 20;
+    char b[20];
+
+    do {
+        b[--k] = '0' + (v % 10);
+        v /= 10;
+    } while (v);
+    om_put(oop, b + k, 20 - k);
+}
+
+/* device and sas_address labels, plus phy label if phy_id >= 0. Until
+ * an expander's SAS address is known it is 0, so the device is needed to
+ * keep the series of such expanders apart. */
+static void
+om_put_labels(struct om_out * oop, const struct smp_mon_exp * xp,
+              int phy_id)
+{
+    int k;
+    char c;
+    char b[40];
+    static const char * hex = "0123456789abcdef";
+
+    om_put(oop, "{device=\"", 9);
+    for (k = 0; k < (int)sizeof(xp->device_name); ++k) {
+        c = xp->device_name[k];
+        if ('\0' == c)
+            break;
+        if (('"' == c) || ('\\' == c))
+            om_put(oop, "\\", 1);
+        if ('\n' == c)
+            om_put(oop, "\\n", 2);
+        else
+            om_put(oop, &c, 1);
+    }
+    memcpy(b, "\",sas_address=\"0x", 17);
+    for (k = 0; k < 16; ++k)
+        b[17 + k] = hex[(xp->sa >> (60 - (4 * k))) & 0xf];
+    b[33] = '"';
+    om_put(oop, b, 34);
+    if (phy_id >= 0) {
+        om_put(oop, ",phy=\"", 6);
+        om_put_u64(oop, phy_id);
+        om_put(oop, "\"", 1);
+    }
+}
+
+static void
+om_family(struct om_out * oop, const char * name, const char * type,
+          const char * help)
+{
+    om_puts(oop, "# TYPE ");
+    om_puts(oop, name);
+    om_put(oop, " ", 1);
+    om_puts(oop, type);
+    om_puts(oop, "\n# HELP ");
+    om_puts(oop, name);
+    om_put(oop, " ", 1);
+    om_puts(oop, help);
+    om_put(oop, "\n", 1);
+}
+
+/* Starts a sample line: name, then "_total" for a counter, then labels
+ * less the closing brace. */
+static void
+om_sample(struct om_out * oop, const char * name, bool counter,
+          const struct smp_mon_exp * xp, int phy_id)
+{
+    om_puts(oop, name);
+    if (counter)
+        om_put(oop, "_total", 6);
+    om_put_labels(oop, xp, phy_id);
+}
+
+static void
+om_value(struct om_out * oop, uint64_t v)
+{
+    om_put(oop, "} ", 2);
+    om_put_u64(oop, v);
+    om_put(oop, "\n", 1);
+}
+
+/* Milliseconds as seconds with 3 decimal places */
+static void
+om_value_ms(struct om_out * oop, uint64_t ms)
+{
+    char b[4];
+
+    om_put(oop, "} ", 2);
+    om_put_u64(oop, ms / 1000);
+    b[0] = '.';
+    b[1] = '0' + ((ms / 100) % 10);
+    b[2] = '0' + ((ms / 10) % 10);
+    b[3] = '0' + (ms % 10);
+    om_put(oop, b, 4);
+    om_put(oop, "\n", 1);
+}
+
+static uint64_t
+lrate_bps(int neg_lrate)
+{
+    switch (neg_lrate) {
+    case 8: return 1500000000ULL;
+    case 9: return 3000000000ULL;
+    case 0xa: return 6000000000ULL;
+    case 0xb: return 12000000000ULL;
+    case 0xc: return 22500000000ULL;
+    default: return 0;
+    }
+}
+
+static void
+om_expanders(struct om_out * oop)
+{
+    int k;
+    const struct smp_mon_exp * xp;
+
+    om_family(oop, "smp_expander_up", "gauge",
+              "1 if the last poll of the expander succeeded");
+    for (k = 0; k < oop->num_exp; ++k) {
+        if (oop->dup[k])
+            continue;
+        xp = oop->xa[k];
+        om_sample(oop, "smp_expander_up", false, xp, -1);
+        om_value(oop, (xp->upd_ms && (0 == xp->err)) ? 1 : 0);
+    }
+    om_family(oop, "smp_expander_polls", "counter",
+              "Completed polls of the expander");
+    for (k = 0; k < oop->num_exp; ++k) {
+        if (oop->dup[k])
+            continue;
+        xp = oop->xa[k];
+        om_sample(oop, "smp_expander_polls", true, xp, -1);
+        om_value(oop, xp->num_polls);
+    }
+    om_family(oop, "smp_expander_poll_errors", "counter",
+              "Polls of the expander that failed");
+    for (k = 0; k < oop->num_exp; ++k) {
+        if (oop->dup[k])
+            continue;
+        xp = oop->xa[k];
+        om_sample(oop, "smp_expander_poll_errors", true, xp, -1);
+        om_value(oop, xp->num_errs);
+    }
+    om_family(oop, "smp_expander_last_poll_timestamp_seconds", "gauge",
+              "When the last poll of the expander completed");
+    for (k = 0; k < oop->num_exp; ++k) {
+        if (oop->dup[k])
+            continue;
+        xp = oop->xa[k];
+        if (xp->upd_ms <= 0)
+            continue;
+        om_sample(oop, "smp_expander_last_poll_timestamp_seconds", false,
+                  xp, -1);
+        om_value_ms(oop, xp->upd_ms);
+    }
+    om_family(oop, "smp_expander_poll_duration_seconds", "gauge",
+              "How long the last poll of the expander took");
+    for (k = 0; k < oop->num_exp; ++k) {
+        if (oop->dup[k])
+            continue;
+        xp = oop->xa[k];
+        if (xp->upd_ms <= 0)
+            continue;
+        om_sample(oop, "smp_expander_poll_duration_seconds", false, xp,
+                  -1);
+        om_value_ms(oop, xp->poll_ms);
+    }
+    om_family(oop, "smp_expander_change_count", "gauge",
+              "Expander change count from REPORT GENERAL");
+    for (k = 0; k < oop->num_exp; ++k) {
+        if (oop->dup[k])
+            continue;
+        xp = oop->xa[k];
+        if ((xp->upd_ms <= 0) || (xp->ecc < 0))
+            continue;
+        om_sample(oop, "smp_expander_change_count", false, xp, -1);
+        om_value(oop, xp->ecc);
+    }
+}
+
+static bool
+is_pvd_source(int pes)
+{
+    return (pes >= 0x2b) && (pes <= 0x2e);
+}
+
+/* source and name labels of a phy event, then the value */
+static void
+om_event(struct om_out * oop, int pes, uint32_t val)
+{
+    char b[24];
+    char * np = oop->pes_name[pes];
+    static const char * hex = "0123456789abcdef";
+
+    if ('\0' == np[0])
+        smp_get_pes_str(pes, OM_NAME_LEN, np);
+    memcpy(b, ",source=\"0x", 11);
+    b[11] = hex[(pes >> 4) & 0xf];
+    b[12] = hex[pes & 0xf];
+    memcpy(b + 13, "\",name=\"", 8);
+    om_put(oop, b, 21);
+    om_puts(oop, np);   /* the names have no '"' nor '\' to escape */
+    om_put(oop, "\"", 1);
+    om_value(oop, val);
+}
+
+static void
+om_phys(struct om_out * oop, const struct om_family * fp)
+{
+    bool counter = ('c' == fp->type[0]);
+    int k, j, e;
+    uint64_t v;
+    const struct smp_mon_exp * xp;
+    const struct smp_mon_phy * pp;
+
+    om_family(oop, fp->name, fp->type, fp->help);
+    for (k = 0; k < oop->num_exp; ++k) {
+        if (oop->dup[k])
+            continue;
+        xp = oop->xa[k];
+        for (j = 0; j < xp->num_phys; ++j) {
+            pp = xp->phys + j;
+            if (pp->func_res)
+                continue;
+            switch (fp->kind) {
+            case OM_LRATE:
+            case OM_LRATE_BPS:
+                v = (OM_LRATE == fp->kind) ? pp->neg_lrate :
+                                             lrate_bps(pp->neg_lrate);
+                break;
+            case OM_INV_DWORD:
+                v = pp->inv_dword;
+                break;
+            case OM_DISPARITY:
+                v = pp->disparity;
+                break;
+            case OM_LOSS_SYNC:
+                v = pp->loss_sync;
+                break;
+            case OM_RESET_PROB:
+                v = pp->reset_prob;
+                break;
+            default:
+                for (e = 0; e < pp->num_ev; ++e) {
+                    if ((0 == pp->ev_src[e]) ||
+                        (is_pvd_source(pp->ev_src[e]) !=
+                         (OM_EV_PEAK == fp->kind)))
+                        continue;
+                    om_sample(oop, fp->name, counter, xp, pp->phy_id);
+                    om_event(oop, pp->ev_src[e], pp->ev_val[e]);
+                }
+                continue;
+            }
+            if ((fp->kind >= OM_INV_DWORD) &&
+                (0 == (pp->flags & SMP_MON_PF_ERR_LOG)))
+                continue;
+            om_sample(oop, fp->name, counter, xp, pp->phy_id);
+            om_value(oop, v);
+        }
+    }
+}
+
+static void
+om_render(struct om_out * oop)
+{
+    int k;
+
+    om_expanders(oop);
+    for (k = 0; k < (int)(sizeof(om_phy_fams) / sizeof(om_phy_fams[0]));
+         ++k)
+        om_phys(oop, om_phy_fams + k);
+    om_puts(oop, "# EOF\n");
+    om_flush(oop);
+}
+
+int
+smp_mon_write_om(const char * fname, const struct smp_mon_exp * const * xa,
+                 int num_exp, int verbose)
+{
+    int res = -1;
+    int n, k;
+    struct om_out * oop;
+    char * tmp_fn = NULL;
+
+    oop = (struct om_out *)malloc(sizeof(*oop));
+    if (NULL == oop)
+        return -1;
+    oop->len = 0;
+    oop->err = false;
+    oop->xa = xa;
+    oop->num_exp = num_exp;
+    /* series must be unique or a parser rejects the whole file, so an
+     * expander given twice is only written once */
+    oop->dup = (bool *)calloc((num_exp > 0) ? num_exp : 1, sizeof(bool));
+    if (NULL == oop->dup) {
+        free(oop);
+        return -1;
+    }
+    for (n = 1; n < num_exp; ++n) {
+        for (k = 0; k < n; ++k) {
+            if ((xa[k]->sa == xa[n]->sa) &&
+                (0 == strncmp(xa[k]->device_name, xa[n]->device_name,
+                              sizeof(xa[n]->device_name)))) {
+                oop->dup[n] = true;
+                break;
+            }
+        }
+    }
+    for (n = 0; n < 256; ++n)
+        oop->pes_name[n][0] = '\0';
+    if (0 == strcmp(fname, "-")) {
+        oop->fd = STDOUT_FILENO;
+        om_render(oop);
+        res = oop->err ? -1 : 0;
+        goto fini;
+    }
+    /* write a temporary file in the same directory then rename() it over
+     * fname, so a collector never reads a partial file. The temporary
+     * name does not end in ".prom" so the collector ignores it. */
+    n = strlen(fname) + 8;
+    tmp_fn = (char *)malloc(n);
+    if (NULL == tmp_fn)
+        goto fini;
+    snprintf(tmp_fn, n, "%s.XXXXXX", fname);
+    oop->fd = mkstemp(tmp_fn);
+    if (oop->fd < 0) {
+        if (verbose)
+            pr2serr("%s: unable to create %s: %s\n", __func__, tmp_fn,
+                    safe_strerror(errno));
+        goto fini;
+    }
+    fchmod(oop->fd, 0644);      /* mkstemp() gives 0600 */
+    om_render(oop);
+    if ((close(oop->fd) < 0) || oop->err) {
+        if (verbose)
+            pr2serr("%s: error writing %s\n", __func__, tmp_fn);
+        unlink(tmp_fn);
+        goto fini;
+    }
+    if (rename(tmp_fn, fname) < 0) {
+        if (verbose)
+            pr2serr("%s: unable to rename %s to %s: %s\n", __func__, tmp_fn,
+                    fname, safe_strerror(errno));
+        unlink(tmp_fn);
+        goto fini;
+    }
+    res = 0;
+fini:
+    free(tmp_fn);
+    free(oop->dup);
+    free(oop);
+    return res;
+}
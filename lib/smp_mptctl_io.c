@@ -33,12 +33,18 @@
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 #include "mpi_type.h"
 #include "mpi.h"
 #include "mpi_sas.h"
 
 #include "smp_mptctl_glue.h"
 #include "smp_mptctl_io.h"
+#include "smp_usdt.h"
 
 #include "mptctl.h"
 
@@ -54,6 +60,30 @@ typedef struct mpt_ioctl_command mpiIoctlBlk_t;
 
 static int mptcommand = (int)MPTCOMMAND;
 
+/* Each handle opened on this interface owns one of these for its lifetime
+ * so send_req_mpt() does not allocate. The message frame has room for
+ * either two SGEs or an immediate request payload. */
+#define MPT_REPLY_LEN 1200
+#define MPT_IMM_MAX_REQ 64      /* immediate request bytes (no CRC) */
+#define MPT_IMM_MAX_RESP 100    /* immediate response bytes in reply frame */
+#define MPT_MF_LEN (offsetof(SmpPassthroughRequest_t, SGL) + MPT_IMM_MAX_REQ)
+
+struct mpt_ctx {
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t mtx;
+#endif
+    mpiIoctlBlk_t * blk;        /* followed by MPT_MF_LEN bytes of MF */
+    char reply[MPT_REPLY_LEN];
+};
+
+#ifdef HAVE_PTHREAD_H
+#define MPT_CTX_TRYLOCK(cp) pthread_mutex_trylock(&(cp)->mtx)
+#define MPT_CTX_UNLOCK(cp) pthread_mutex_unlock(&(cp)->mtx)
+#else
+#define MPT_CTX_TRYLOCK(cp) 0
+#define MPT_CTX_UNLOCK(cp)
+#endif
+
 
 /* Part of interface to upper level. */
 int
@@ -117,6 +147,42 @@ close_mpt_device(int fd)
     return close(fd);
 }
 
+/* Part of interface to upper level. */
+void *
+alloc_mpt_ctx(void)
+{
+    struct mpt_ctx * cp;
+
+    cp = (struct mpt_ctx *)calloc(1, sizeof(struct mpt_ctx));
+    if (NULL == cp)
+        return NULL;
+    cp->blk = (mpiIoctlBlk_t *)calloc(1, sizeof(mpiIoctlBlk_t) +
+                                      MPT_MF_LEN);
+    if (NULL == cp->blk) {
+        free(cp);
+        return NULL;
+    }
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&cp->mtx, NULL);
+#endif
+    return cp;
+}
+
+/* Part of interface to upper level. */
+void
+free_mpt_ctx(void * ctx)
+{
+    struct mpt_ctx * cp = (struct mpt_ctx *)ctx;
+
+    if (NULL == cp)
+        return;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_destroy(&cp->mtx);
+#endif
+    free(cp->blk);
+    free(cp);
+}
+
 
 /*****************************************************************
  *                                                               *
@@ -184,19 +250,25 @@ issueMptCommand(int fd, int ioc_num, mpiIoctlBlk_t *mpiBlkPtr)
         return status;
 }
 
-/* Part of interface to upper level. */
-int
-send_req_mpt(int fd, int subvalue, uint64_t target_sa,
-             struct smp_req_resp * rresp, int verbose)
+/* Sends rresp using the ioctl block and reply frame in cp. Responses
+ * small enough to fit in the reply frame use the immediate payload form
+ * (mptctl, MPI 1.x, only); others are transferred directly into the
+ * caller's response buffer. */
+static int
+send_req_mpt_ctx(int fd, int subvalue, uint64_t target_sa,
+                 struct mpt_ctx * cp, struct smp_req_resp * rresp,
+                 int verbose)
 {
-        mpiIoctlBlk_t * mpiBlkPtr = NULL;
+        mpiIoctlBlk_t * mpiBlkPtr = cp->blk;
         pSmpPassthroughRequest_t smpReq;
         pSmpPassthroughReply_t smpReply;
-        uint numBytes;
+        const unsigned char * rdp;
         int  status;
-        char reply_m[1200];
         u16     ioc_stat;
+        int to, req_len, len;
         int ret = -1;
+        bool imm;
+        uint64_t t0;
 
         if (verbose && (0 == target_sa)) {
                 fprintf(stderr, "The MPT interface typically needs SAS "
@@ -204,52 +276,72 @@ send_req_mpt(int fd, int subvalue, uint64_t target_sa,
                 fprintf(stderr, "A '--sa=SAS_ADDR' command line option "
                         "may be required. See man page.\n");
         }
+        req_len = rresp->request_len - 4;
+        imm = ((int)MPTCOMMAND == mptcommand) &&
+              (req_len <= MPT_IMM_MAX_REQ) &&
+              ((rresp->max_response_len - 4) <= MPT_IMM_MAX_RESP);
         if (verbose > 2) {
                 fprintf(stderr, "%s: subvalue=%d  ", __func__, subvalue);
                 fprintf(stderr, "SAS address=0x%" PRIx64 "\n", target_sa);
                 if (verbose > 4)
-                        fprintf(stderr, "    mptctl two scatter gather list "
-                                "interface\n");
+                        fprintf(stderr, "    mptctl %s interface\n", imm ?
+                                "immediate payload" :
+                                "two scatter gather list");
         }
-        numBytes = offsetof(SmpPassthroughRequest_t, SGL) +
-                   (2 * sizeof(SGESimple64_t));
-        mpiBlkPtr = (mpiIoctlBlk_t *)malloc(sizeof(mpiIoctlBlk_t) + numBytes);
-        if (mpiBlkPtr == NULL)
-                goto err_out;
-        memset(mpiBlkPtr, 0, sizeof(mpiIoctlBlk_t) + numBytes);
-        mpiBlkPtr->replyFrameBufPtr = reply_m;
-        memset(mpiBlkPtr->replyFrameBufPtr, 0, sizeof(reply_m));
-        mpiBlkPtr->maxReplyBytes = sizeof(reply_m);
+        to = smp_req_eff_timeout_ms(rresp, SMP_DEF_TIMEOUT_MS);
+        if (to <= 0) {
+                if (verbose)
+                        fprintf(stderr, "%s: deadline passed, request not "
+                                "sent\n", __func__);
+                return -1;
+        }
+        memset(mpiBlkPtr, 0, sizeof(mpiIoctlBlk_t) + MPT_MF_LEN);
+        mpiBlkPtr->replyFrameBufPtr = cp->reply;
+        /* only the fixed part of the reply frame is examined */
+        memset(cp->reply, 0, offsetof(SmpPassthroughReply_t, ResponseData));
+        mpiBlkPtr->maxReplyBytes = sizeof(cp->reply);
+        /* mptctl timeout is in seconds, round up */
+        mpiBlkPtr->timeout = (to + 999) / 1000;
         smpReq = (pSmpPassthroughRequest_t)mpiBlkPtr->MF;
-        mpiBlkPtr->dataSgeOffset = offsetof(SmpPassthroughRequest_t, SGL) / 4;
         smpReply = (pSmpPassthroughReply_t)mpiBlkPtr->replyFrameBufPtr;
 
-        /* send smp request */
-        mpiBlkPtr->dataOutSize = rresp->request_len - 4;
-        mpiBlkPtr->dataOutBufPtr = (char *)rresp->request;
-        mpiBlkPtr->dataInSize = rresp->max_response_len + 4;
-        mpiBlkPtr->dataInBufPtr = (char *)malloc(mpiBlkPtr->dataInSize);
-        if(mpiBlkPtr->dataInBufPtr == NULL)
-                goto err_out;
-        memset(mpiBlkPtr->dataInBufPtr, 0, mpiBlkPtr->dataInSize);
-
         /* Populate the SMP Request
          */
 
         /* PassthroughFlags
          * Bit7: 0=two SGLs 1=Payload returned in Reply
          */
-        /* >>> memo LSI: bug fix on following line's 3rd argument (thanks
-         * to clang compiler) */
-        memset(smpReq, 0, sizeof(*smpReq));
-
-        smpReq->RequestDataLength = rresp->request_len - 4; // <<<<<<<<<<<< ??
+        smpReq->RequestDataLength = req_len;
         smpReq->Function = MPI_FUNCTION_SMP_PASSTHROUGH;
 	memcpy(&smpReq->SASAddress, &target_sa, 8);
+        if (imm) {
+                smpReq->PassthroughFlags = MPI_SMP_PT_REQ_PT_FLAGS_IMMEDIATE;
+                memcpy(&smpReq->SGL, rresp->request, req_len);
+                mpiBlkPtr->dataSgeOffset =
+                        (offsetof(SmpPassthroughRequest_t, SGL) + req_len +
+                         3) / 4;
+        } else {
+                mpiBlkPtr->dataSgeOffset =
+                        offsetof(SmpPassthroughRequest_t, SGL) / 4;
+                mpiBlkPtr->dataOutSize = req_len;
+                mpiBlkPtr->dataOutBufPtr = (char *)rresp->request;
+                mpiBlkPtr->dataInSize = rresp->max_response_len;
+                mpiBlkPtr->dataInBufPtr = (char *)rresp->response;
+        }
 
+        SMP_PROBE3(mpt__entry, SMP_USDT_FUNC(rresp), rresp->request_len,
+                   rresp->max_response_len);
+        t0 = SMP_USDT_START_US(mpt__return);
         status = issueMptCommand(fd, subvalue, mpiBlkPtr);
+        rdp = imm ? (const unsigned char *)smpReply->ResponseData :
+                    rresp->response;
+        SMP_PROBE5(mpt__return, SMP_USDT_FUNC(rresp), status,
+                   ((0 == status) && (SMP_FRAME_TYPE_RESP == rdp[0])) ?
+                   (int)rdp[2] : -1, -1, SMP_USDT_LAT_US(t0));
 
         if (status != 0) {
+                if (ETIMEDOUT == errno)
+                        rresp->timed_out = true;
                 fprintf(stderr, "ioctl failed\n");
                 goto err_out;
         }
@@ -257,6 +349,9 @@ send_req_mpt(int fd, int subvalue, uint64_t target_sa,
         ioc_stat = smpReply->IOCStatus & MPI_IOCSTATUS_MASK;
         if ((ioc_stat != MPI_IOCSTATUS_SUCCESS) ||
             (smpReply->SASStatus != MPI_SASSTATUS_SUCCESS)) {
+                if (MPI_SASSTATUS_INITIATOR_RESPONSE_TIMEOUT ==
+                    smpReply->SASStatus)
+                        rresp->timed_out = true;
                 if (verbose) {
                         switch(smpReply->SASStatus) {
                         case MPI_SASSTATUS_UNKNOWN_ERROR:
@@ -333,16 +428,47 @@ send_req_mpt(int fd, int subvalue, uint64_t target_sa,
         } else
                 ret = 0;
 
-        memcpy(rresp->response, mpiBlkPtr->dataInBufPtr,
-               rresp->max_response_len);
-        rresp->act_response_len = -1;
+        if (imm) {
+                len = smpReply->ResponseDataLength;
+                if (len > (int)(sizeof(cp->reply) -
+                                offsetof(SmpPassthroughReply_t,
+                                         ResponseData)))
+                        len = sizeof(cp->reply) -
+                              offsetof(SmpPassthroughReply_t, ResponseData);
+                if (len > rresp->max_response_len)
+                        len = rresp->max_response_len;
+                memcpy(rresp->response, smpReply->ResponseData, len);
+                rresp->act_response_len = len;
+        } else  /* response placed directly in caller's buffer */
+                rresp->act_response_len = -1;
 
 err_out:
-        if (mpiBlkPtr) {
-                if (mpiBlkPtr->dataInBufPtr)
-                        free(mpiBlkPtr->dataInBufPtr);
-                free(mpiBlkPtr);
+        return ret;
+}
+
+/* Part of interface to upper level. ctx is from alloc_mpt_ctx(); if it is
+ * NULL, or in use by another thread, a temporary one is used. */
+int
+send_req_mpt(int fd, int subvalue, uint64_t target_sa, void * ctx,
+             struct smp_req_resp * rresp, int verbose)
+{
+        int ret;
+        struct mpt_ctx * cp = (struct mpt_ctx *)ctx;
+        struct mpt_ctx * tmp_cp = NULL;
+
+        if (cp && (0 != MPT_CTX_TRYLOCK(cp)))
+                cp = NULL;
+        if (NULL == cp) {
+                tmp_cp = (struct mpt_ctx *)alloc_mpt_ctx();
+                if (NULL == tmp_cp)
+                        return -1;
+                cp = tmp_cp;
         }
+        ret = send_req_mpt_ctx(fd, subvalue, target_sa, cp, rresp, verbose);
+        if (tmp_cp)
+                free_mpt_ctx(tmp_cp);
+        else
+                MPT_CTX_UNLOCK(cp);
         return ret;
 }
 
@@ -11,7 +11,12 @@ extern int open_mpt_device(const char * dev_name, int verbose);
 
 extern int close_mpt_device(int fd);
 
-extern int send_req_mpt(int fd, int subvalue, uint64_t target_sa,
+/* Per handle ioctl block and reply frame, reused by send_req_mpt() */
+extern void * alloc_mpt_ctx(void);
+
+extern void free_mpt_ctx(void * ctx);
+
+extern int send_req_mpt(int fd, int subvalue, uint64_t target_sa, void * ctx,
                         struct smp_req_resp * rresp, int verbose);
 
 #endif
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Decoding of DISCOVER responses and DISCOVER LIST descriptors, see the
+ * "DISCOVER response decoding" section of smp_lib.h . */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "smp_lib.h"
+#include "sg_unaligned.h"
+
+
+int
+smp_decode_phy_desc(const uint8_t * bp, int len, int desc_type,
+                    struct smp_phy_desc * pdp)
+{
+    memset(pdp, 0, sizeof(*pdp));
+    pdp->dsn = 0xff;
+    if (1 == desc_type) {       /* short (abridged) descriptor */
+        if (len < SMP_DESC_SHORT_LEN)
+            return -1;
+        pdp->phy_id = bp[0];
+        pdp->func_res = bp[1];
+        if (pdp->func_res)
+            return 0;
+        pdp->adt = (0x70 & bp[2]) >> 4;
+        pdp->att_reason = 0xf & bp[2];
+        pdp->neg_lrate = 0xf & bp[3];
+        pdp->att_iproto = bp[4];
+        pdp->att_tproto = bp[5];
+        pdp->virt = !!(0x80 & bp[6]);
+        pdp->routing = 0xf & bp[6];
+        pdp->reason = (0xf0 & bp[7]) >> 4;
+        pdp->neg_prate = 0xf & bp[7];
+        pdp->zone_group = bp[8];
+        pdp->zoning_flags = bp[9];
+        pdp->att_phy_id = bp[10];
+        pdp->phy_cc = bp[11];
+        pdp->att_sa = sg_get_unaligned_be64(bp + 12);
+        return 0;
+    } else if (0 != desc_type)
+        return -1;
+    if (len < 12)
+        return -1;
+    pdp->long_fmt = true;
+    pdp->phy_id = bp[9];
+    pdp->func_res = bp[2];
+    if (pdp->func_res)
+        return 0;
+    if (len < SMP_DESC_LONG_MIN_LEN)
+        return -1;
+    pdp->ecc = sg_get_unaligned_be16(bp + 4);
+    pdp->adt = (0x70 & bp[12]) >> 4;
+    pdp->att_reason = 0xf & bp[12];
+    pdp->neg_lrate = 0xf & bp[13];
+    pdp->att_iproto = bp[14];
+    pdp->att_tproto = bp[15];
+    pdp->sa = sg_get_unaligned_be64(bp + 16);
+    pdp->att_sa = sg_get_unaligned_be64(bp + 24);
+    pdp->att_phy_id = bp[32];
+    pdp->prog_min_prate = (bp[40] >> 4) & 0xf;
+    pdp->hw_min_prate = bp[40] & 0xf;
+    pdp->prog_max_prate = (bp[41] >> 4) & 0xf;
+    pdp->hw_max_prate = bp[41] & 0xf;
+    pdp->phy_cc = bp[42];
+    pdp->virt = !!(0x80 & bp[43]);
+    pdp->routing = 0xf & bp[44];
+    pdp->conn_type = 0x7f & bp[45];
+    if (len < 60)
+        return 0;
+    pdp->att_dev_name = sg_get_unaligned_be64(bp + 52);
+    if (len < 64)
+        return 0;
+    pdp->zoning_flags = bp[60];
+    pdp->zone_group = bp[63];
+    if (len < 88)
+        return 0;
+    pdp->prog_phy_cap = sg_get_unaligned_be32(bp + 76);
+    pdp->cur_phy_cap = sg_get_unaligned_be32(bp + 80);
+    pdp->att_phy_cap = sg_get_unaligned_be32(bp + 84);
+    if (len < 96)
+        return 0;
+    pdp->reason = (0xf0 & bp[94]) >> 4;
+    pdp->neg_prate = 0xf & bp[94];
+    if (len > 108)
+        pdp->dsn = bp[108];
+    return 0;
+}
+
+int
+smp_dl_view_init(struct smp_dl_view * vp, const uint8_t * resp, int len)
+{
+    memset(vp, 0, sizeof(*vp));
+    if ((len < 48) || (SMP_FRAME_TYPE_RESP != resp[0]) ||
+        (SMP_FN_DISCOVER_LIST != resp[1]) || resp[2])
+        return -1;
+    vp->resp = resp;
+    vp->sphy_id = resp[8];
+    vp->num_desc = resp[9];
+    vp->desc_type = resp[11] & 0xf;
+    vp->desc_len = resp[12] * 4;
+    vp->ecc = sg_get_unaligned_be16(resp + 4);
+    if (((0 == vp->desc_type) && (vp->desc_len < SMP_DESC_LONG_MIN_LEN)) ||
+        ((1 == vp->desc_type) && (vp->desc_len < SMP_DESC_SHORT_LEN)) ||
+        (vp->desc_type > 1) ||
+        ((48 + (vp->num_desc * vp->desc_len)) > len)) {
+        vp->num_desc = 0;
+        return -1;
+    }
+    return 0;
+}
+
+int
+smp_discover_phy(const struct smp_target_obj * top, int phy_id,
+                 struct smp_phy_desc * pdp, int verbose)
+{
+    int len;
+    uint8_t req[16];
+    uint8_t resp[128];
+    struct smp_req_resp rr;
+    struct smp_phy_desc pd;
+
+    memset(req, 0, sizeof(req));
+    req[0] = SMP_FRAME_TYPE_REQ;
+    req[1] = SMP_FN_DISCOVER;
+    req[2] = (sizeof(resp) - 8) / 4;    /* allocated response length */
+    req[3] = 2;
+    req[9] = phy_id;
+    memset(resp, 0, sizeof(resp));
+    memset(&rr, 0, sizeof(rr));
+    rr.request_len = sizeof(req);
+    rr.request = req;
+    rr.max_response_len = sizeof(resp);
+    rr.response = resp;
+    if (smp_send_req(top, &rr, verbose) || rr.transport_err ||
+        (SMP_FRAME_TYPE_RESP != resp[0]) || (req[1] != resp[1]) || resp[2])
+        return -1;
+    len = 4 + (resp[3] * 4);
+    if ((rr.act_response_len >= 0) && (len > rr.act_response_len))
+        len = rr.act_response_len;
+    if (len > (int)(sizeof(resp) - 4))
+        len = sizeof(resp) - 4;
+    if (smp_decode_phy_desc(resp, len, 0, &pd))
+        return -1;
+    *pdp = pd;
+    return 0;
+}
@@ -0,0 +1,504 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Column-wise phy table, see the "Phy table" section of smp_lib.h . Each
+ * column is allocated to a multiple of 64 rows with the padding zeroed, so
+ * a scan handles whole 64 row blocks without a tail loop and the last
+ * bitmap word is masked afterwards. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "smp_lib.h"
+
+#define PT_BLK 64
+#define PT_MIN_ROWS 256
+
+struct smp_phy_tbl {
+    int num_rows;
+    int max_rows;               /* allocated, multiple of PT_BLK */
+    uint8_t * col[SMP_PTBL_NUM_COLS];
+    uint64_t * exp_sa;
+    uint64_t * att_sa;
+    uint32_t * cur_cap;
+    uint32_t * att_cap;
+};
+
+
+static void *
+pt_grow(void * p, int old_n, int new_n, int elem_sz)
+{
+    uint8_t * np = (uint8_t *)realloc(p, (size_t)new_n * elem_sz);
+
+    if (np)
+        memset(np + ((size_t)old_n * elem_sz), 0,
+               (size_t)(new_n - old_n) * elem_sz);
+    return np;
+}
+
+/* Makes room for at least num_rows rows. Returns 0 or -1 . */
+static int
+pt_reserve(struct smp_phy_tbl * tp, int num_rows)
+{
+    int k, n;
+    void * p;
+
+    if (num_rows <= tp->max_rows)
+        return 0;
+    n = tp->max_rows ? tp->max_rows : PT_MIN_ROWS;
+    while (n < num_rows)
+        n *= 2;
+    n = (n + PT_BLK - 1) & ~(PT_BLK - 1);
+    for (k = 0; k < SMP_PTBL_NUM_COLS; ++k) {
+        if (NULL == (p = pt_grow(tp->col[k], tp->max_rows, n, 1)))
+            return -1;
+        tp->col[k] = (uint8_t *)p;
+    }
+    if (NULL == (p = pt_grow(tp->exp_sa, tp->max_rows, n, 8)))
+        return -1;
+    tp->exp_sa = (uint64_t *)p;
+    if (NULL == (p = pt_grow(tp->att_sa, tp->max_rows, n, 8)))
+        return -1;
+    tp->att_sa = (uint64_t *)p;
+    if (NULL == (p = pt_grow(tp->cur_cap, tp->max_rows, n, 4)))
+        return -1;
+    tp->cur_cap = (uint32_t *)p;
+    if (NULL == (p = pt_grow(tp->att_cap, tp->max_rows, n, 4)))
+        return -1;
+    tp->att_cap = (uint32_t *)p;
+    tp->max_rows = n;
+    return 0;
+}
+
+/* Fastest rate in both capability words: G5 (0xc) down to G1 (0x8) are
+ * 2 bit fields starting at bit 14 (G5) and moving up. Returns 0 if none. */
+static int
+pt_cap_rate(uint32_t my_cap, uint32_t att_cap)
+{
+    int k;
+
+    for (k = 0; k < 5; ++k) {
+        if ((0x3 & (my_cap >> (14 + (2 * k)))) &&
+            (0x3 & (att_cap >> (14 + (2 * k)))))
+            return 0xc - k;
+    }
+    return 0;
+}
+
+struct smp_phy_tbl *
+smp_phy_tbl_create(int num_rows)
+{
+    struct smp_phy_tbl * tp;
+
+    tp = (struct smp_phy_tbl *)calloc(1, sizeof(*tp));
+    if (NULL == tp)
+        return NULL;
+    if (pt_reserve(tp, (num_rows > 0) ? num_rows : 1)) {
+        smp_phy_tbl_free(tp);
+        return NULL;
+    }
+    return tp;
+}
+
+void
+smp_phy_tbl_free(struct smp_phy_tbl * tp)
+{
+    int k;
+
+    if (NULL == tp)
+        return;
+    for (k = 0; k < SMP_PTBL_NUM_COLS; ++k)
+        free(tp->col[k]);
+    free(tp->exp_sa);
+    free(tp->att_sa);
+    free(tp->cur_cap);
+    free(tp->att_cap);
+    free(tp);
+}
+
+int
+smp_phy_tbl_num_rows(const struct smp_phy_tbl * tp)
+{
+    return tp->num_rows;
+}
+
+int
+smp_phy_tbl_bm_words(const struct smp_phy_tbl * tp)
+{
+    return (tp->num_rows + PT_BLK - 1) / PT_BLK;
+}
+
+int
+smp_phy_tbl_add(struct smp_phy_tbl * tp, uint64_t exp_sa,
+                const struct smp_phy_desc * pdp)
+{
+    int r = tp->num_rows;
+
+    if (pt_reserve(tp, r + 1))
+        return -1;
+    tp->col[SMP_PTBL_COL_PHY_ID][r] = pdp->phy_id;
+    tp->col[SMP_PTBL_COL_FUNC_RES][r] = pdp->func_res;
+    tp->col[SMP_PTBL_COL_ADT][r] = pdp->adt;
+    tp->col[SMP_PTBL_COL_ROUTING][r] = pdp->routing;
+    tp->col[SMP_PTBL_COL_NEG_LRATE][r] = pdp->neg_lrate;
+    tp->col[SMP_PTBL_COL_NEG_PRATE][r] = pdp->neg_prate;
+    tp->col[SMP_PTBL_COL_ZONE_GROUP][r] = pdp->zone_group;
+    tp->col[SMP_PTBL_COL_ZONING][r] = pdp->zoning_flags;
+    tp->col[SMP_PTBL_COL_VIRT][r] = pdp->virt;
+    tp->col[SMP_PTBL_COL_ATT_PHY_ID][r] = pdp->att_phy_id;
+    tp->col[SMP_PTBL_COL_CAP_RATE][r] = pt_cap_rate(pdp->cur_phy_cap,
+                                                    pdp->att_phy_cap);
+    tp->exp_sa[r] = exp_sa ? exp_sa : pdp->sa;
+    tp->att_sa[r] = pdp->att_sa;
+    tp->cur_cap[r] = pdp->cur_phy_cap;
+    tp->att_cap[r] = pdp->att_phy_cap;
+    tp->num_rows = r + 1;
+    return r;
+}
+
+int
+smp_phy_tbl_add_dl(struct smp_phy_tbl * tp, uint64_t exp_sa,
+                   const struct smp_dl_view * vp)
+{
+    int k, n;
+    struct smp_phy_desc pd;
+
+    if (pt_reserve(tp, tp->num_rows + vp->num_desc))
+        return -1;
+    for (k = 0, n = 0; k < vp->num_desc; ++k) {
+        if (smp_decode_phy_desc(smp_dl_view_desc(vp, k), vp->desc_len,
+                                vp->desc_type, &pd))
+            continue;
+        smp_phy_tbl_add(tp, exp_sa, &pd);
+        ++n;
+    }
+    return n;
+}
+
+int
+smp_phy_tbl_add_topo(struct smp_phy_tbl * tp, const struct smp_topo * topop)
+{
+    int k, j, n;
+    const struct smp_topo_exp * xp;
+    const struct smp_topo_phy * pp;
+    struct smp_phy_desc pd;
+
+    for (n = 0, k = 0; k < topop->num_exp; ++k)
+        n += topop->exps[k].num_phys;
+    if (pt_reserve(tp, tp->num_rows + n))
+        return -1;
+    for (n = 0, k = 0; k < topop->num_exp; ++k) {
+        xp = topop->exps + k;
+        for (j = 0; j < xp->num_phys; ++j, ++n) {
+            pp = xp->phys + j;
+            memset(&pd, 0, sizeof(pd));
+            pd.phy_id = pp->phy_id;
+            pd.func_res = pp->func_res;
+            pd.adt = pp->adt;
+            pd.routing = pp->routing;
+            pd.neg_lrate = pp->neg_lrate;
+            pd.att_phy_id = pp->att_phy_id;
+            pd.att_iproto = pp->att_iproto;
+            pd.att_tproto = pp->att_tproto;
+            pd.zone_group = pp->zone_group;
+            pd.zoning_flags = pp->zoning_flags;
+            pd.virt = pp->virt;
+            pd.att_sa = pp->att_sa;
+            pd.cur_phy_cap = pp->cur_phy_cap;
+            pd.att_phy_cap = pp->att_phy_cap;
+            smp_phy_tbl_add(tp, xp->sa, &pd);
+        }
+    }
+    return n;
+}
+
+int
+smp_phy_tbl_get(const struct smp_phy_tbl * tp, int row,
+                struct smp_phy_desc * pdp)
+{
+    memset(pdp, 0, sizeof(*pdp));
+    if ((row < 0) || (row >= tp->num_rows))
+        return -1;
+    pdp->phy_id = tp->col[SMP_PTBL_COL_PHY_ID][row];
+    pdp->func_res = tp->col[SMP_PTBL_COL_FUNC_RES][row];
+    pdp->adt = tp->col[SMP_PTBL_COL_ADT][row];
+    pdp->routing = tp->col[SMP_PTBL_COL_ROUTING][row];
+    pdp->neg_lrate = tp->col[SMP_PTBL_COL_NEG_LRATE][row];
+    pdp->neg_prate = tp->col[SMP_PTBL_COL_NEG_PRATE][row];
+    pdp->zone_group = tp->col[SMP_PTBL_COL_ZONE_GROUP][row];
+    pdp->zoning_flags = tp->col[SMP_PTBL_COL_ZONING][row];
+    pdp->virt = !! tp->col[SMP_PTBL_COL_VIRT][row];
+    pdp->att_phy_id = tp->col[SMP_PTBL_COL_ATT_PHY_ID][row];
+    pdp->dsn = 0xff;
+    pdp->sa = tp->exp_sa[row];
+    pdp->att_sa = tp->att_sa[row];
+    pdp->cur_phy_cap = tp->cur_cap[row];
+    pdp->att_phy_cap = tp->att_cap[row];
+    return 0;
+}
+
+/* Clears the bits past the last row and returns the number of bits set. */
+static int
+pt_finish(const struct smp_phy_tbl * tp, uint64_t * bm)
+{
+    int nw = smp_phy_tbl_bm_words(tp);
+    int rem = tp->num_rows % PT_BLK;
+
+    if (rem)
+        bm[nw - 1] &= ((uint64_t)1 << rem) - 1;
+    return smp_phy_bm_count(bm, nw);
+}
+
+/* Packs 64 bytes, each 0 or 1, into a word: bit k from t[k]. Eight at a
+ * time, by a multiply that moves byte k of a (little endian) word to bit
+ * 56 + k; the partial products never overlap so there are no carries. */
+static uint64_t
+pt_pack(const uint8_t * t)
+{
+    int j;
+    uint64_t x;
+    uint64_t m = 0;
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    for (j = 0; j < PT_BLK; j += 8) {
+        memcpy(&x, t + j, 8);
+        m |= ((x * 0x0102040810204080ULL) >> 56) << j;
+    }
+#else
+    for (j = 0; j < PT_BLK; ++j) {
+        x = t[j];
+        m |= x << j;
+    }
+#endif
+    return m;
+}
+
+/* Each 64 row block is compared into a byte array by a loop with no
+ * branches and a fixed trip count, which compilers vectorize, and is then
+ * packed into a bitmap word. */
+#if defined(__GNUC__)
+#define PT_RESTRICT __restrict
+#else
+#define PT_RESTRICT
+#endif
+
+typedef void (*pt_cmp_t)(const uint8_t * PT_RESTRICT cp, uint8_t v,
+                         uint8_t * PT_RESTRICT t);
+
+static void
+pt_cmp_eq(const uint8_t * PT_RESTRICT cp, uint8_t v, uint8_t * PT_RESTRICT t)
+{
+    int k;
+
+    for (k = 0; k < PT_BLK; ++k)
+        t[k] = (cp[k] == v);
+}
+
+static void
+pt_cmp_ne(const uint8_t * PT_RESTRICT cp, uint8_t v, uint8_t * PT_RESTRICT t)
+{
+    int k;
+
+    for (k = 0; k < PT_BLK; ++k)
+        t[k] = (cp[k] != v);
+}
+
+static void
+pt_cmp_lt(const uint8_t * PT_RESTRICT cp, uint8_t v, uint8_t * PT_RESTRICT t)
+{
+    int k;
+
+    for (k = 0; k < PT_BLK; ++k)
+        t[k] = (cp[k] < v);
+}
+
+static void
+pt_cmp_ge(const uint8_t * PT_RESTRICT cp, uint8_t v, uint8_t * PT_RESTRICT t)
+{
+    int k;
+
+    for (k = 0; k < PT_BLK; ++k)
+        t[k] = (cp[k] >= v);
+}
+
+/* indexed by SMP_PTBL_EQ, NE, LT and GE */
+static const pt_cmp_t pt_cmp_arr[] = {pt_cmp_eq, pt_cmp_ne, pt_cmp_lt,
+                                      pt_cmp_ge};
+
+int
+smp_phy_tbl_scan(const struct smp_phy_tbl * tp, int col, int op,
+                 unsigned int val, uint64_t * bm)
+{
+    int w;
+    int nw = smp_phy_tbl_bm_words(tp);
+    const uint8_t * cp;
+    pt_cmp_t fn;
+    uint8_t t[PT_BLK];
+
+    if ((col < 0) || (col >= SMP_PTBL_NUM_COLS) || (op < SMP_PTBL_EQ) ||
+        (op > SMP_PTBL_GE))
+        return -1;
+    if (val > 0xff) {   /* beyond any byte value, so all rows or none */
+        memset(bm, ((SMP_PTBL_NE == op) || (SMP_PTBL_LT == op)) ? 0xff : 0,
+               nw * sizeof(uint64_t));
+        return pt_finish(tp, bm);
+    }
+    fn = pt_cmp_arr[op];
+    for (w = 0, cp = tp->col[col]; w < nw; ++w, cp += PT_BLK) {
+        fn(cp, (uint8_t)val, t);
+        bm[w] = pt_pack(t);
+    }
+    return pt_finish(tp, bm);
+}
+
+static void
+pt_cmp_below(const uint8_t * PT_RESTRICT neg, const uint8_t * PT_RESTRICT cap,
+             uint8_t * PT_RESTRICT t)
+{
+    int k;
+
+    for (k = 0; k < PT_BLK; ++k)
+        t[k] = (neg[k] >= 8) & (neg[k] < cap[k]);
+}
+
+int
+smp_phy_tbl_scan_below_cap(const struct smp_phy_tbl * tp, uint64_t * bm)
+{
+    int w;
+    int nw = smp_phy_tbl_bm_words(tp);
+    uint8_t t[PT_BLK];
+
+    for (w = 0; w < nw; ++w) {
+        pt_cmp_below(tp->col[SMP_PTBL_COL_NEG_LRATE] + (w * PT_BLK),
+                     tp->col[SMP_PTBL_COL_CAP_RATE] + (w * PT_BLK), t);
+        bm[w] = pt_pack(t);
+    }
+    return pt_finish(tp, bm);
+}
+
+static void
+pt_cmp_sa(const uint64_t * PT_RESTRICT sp, uint64_t sa,
+          uint8_t * PT_RESTRICT t)
+{
+    int k;
+
+    for (k = 0; k < PT_BLK; ++k)
+        t[k] = (sp[k] == sa);
+}
+
+int
+smp_phy_tbl_scan_att_sa(const struct smp_phy_tbl * tp, uint64_t sa,
+                        uint64_t * bm)
+{
+    int w;
+    int nw = smp_phy_tbl_bm_words(tp);
+    uint8_t t[PT_BLK];
+
+    for (w = 0; w < nw; ++w) {
+        pt_cmp_sa(tp->att_sa + (w * PT_BLK), sa, t);
+        bm[w] = pt_pack(t);
+    }
+    return pt_finish(tp, bm);
+}
+
+void
+smp_phy_bm_and(uint64_t * dst, const uint64_t * src, int num_words)
+{
+    int k;
+
+    for (k = 0; k < num_words; ++k)
+        dst[k] &= src[k];
+}
+
+void
+smp_phy_bm_or(uint64_t * dst, const uint64_t * src, int num_words)
+{
+    int k;
+
+    for (k = 0; k < num_words; ++k)
+        dst[k] |= src[k];
+}
+
+void
+smp_phy_bm_andnot(uint64_t * dst, const uint64_t * src, int num_words)
+{
+    int k;
+
+    for (k = 0; k < num_words; ++k)
+        dst[k] &= ~src[k];
+}
+
+static int
+pt_popcount(uint64_t v)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(v);
+#else
+    int n;
+
+    for (n = 0; v; ++n)
+        v &= v - 1;
+    return n;
+#endif
+}
+
+int
+smp_phy_bm_count(const uint64_t * bm, int num_words)
+{
+    int k, n;
+
+    for (n = 0, k = 0; k < num_words; ++k)
+        n += pt_popcount(bm[k]);
+    return n;
+}
+
+int
+smp_phy_bm_next(const uint64_t * bm, int num_words, int from)
+{
+    int w, b;
+    uint64_t v;
+
+    if (from < 0)
+        from = 0;
+    for (w = from / PT_BLK; w < num_words; ++w) {
+        v = bm[w];
+        if (w == (from / PT_BLK))
+            v &= ~(uint64_t)0 << (from % PT_BLK);
+        if (0 == v)
+            continue;
+        for (b = 0; 0 == (v & ((uint64_t)1 << b)); ++b)
+            ;
+        return (w * PT_BLK) + b;
+    }
+    return -1;
+}
@@ -0,0 +1,15 @@
+#ifndef SMP_PT_H
+#define SMP_PT_H
+
+#include "smp_lib.h"
+
+/* Interface between the OS independent smp_send_req() in smp_req.c and
+ * the per-OS pass-through selection code (e.g. smp_lin_sel.c). */
+
+/* Sends one SMP request (no retries) on the pass-through that
+ * smp_initiator_open() selected for tobj. Same return value as
+ * smp_send_req(). */
+int smp_pt_send_req(const struct smp_target_obj * tobj,
+                    struct smp_req_resp * rresp, int verbose);
+
+#endif
@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Replay transport. Loads a pcapng file written by the frame capture
+ * (SMP_UTILS_CAPTURE) and answers each request with the response that was
+ * recorded for an identical request (same SMP target SAS address and
+ * same request bytes, so the same function code). When an identical
+ * request was recorded more than once (e.g. by a utility polling phy event
+ * counters) the recordings are served in the order they were captured and
+ * the last one is repeated after that. Failures that were captured
+ * (pass-through errors, transport errors and timeouts) are reproduced. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#define __STDC_FORMAT_MACROS 1
+#include <inttypes.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include "smp_lib.h"
+#include "sg_unaligned.h"
+#include "smp_replay.h"
+
+#define REPLAY_HASH_SIZE 1024   /* power of 2 */
+#define REPLAY_MAX_FILE (1024 * 1024 * 1024)
+
+/* pcapng, as written by smp_capture.c */
+#define PCAPNG_SHB 0x0a0d0d0a
+#define PCAPNG_IDB 0x1
+#define PCAPNG_EPB 0x6
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_MAX_IFS 256
+
+struct replay_rec {
+    const uint8_t * req;        /* points into file image */
+    const uint8_t * resp;
+    int req_len;
+    int resp_len;
+    int flags;                  /* SMP_CAPTURE_F_* */
+    int transport_err;
+    uint64_t lat_ns;
+    struct replay_rec * next;   /* next recording of same request */
+};
+
+/* One per distinct (SAS address, request) */
+struct replay_key {
+    uint64_t sa;
+    uint32_t hash;
+    struct replay_rec * first;
+    struct replay_rec * last;
+    struct replay_rec * cursor; /* next to serve */
+    struct replay_key * chain;
+};
+
+struct smp_replay {
+    uint8_t * img;              /* whole file */
+    uint64_t sa;                /* SMP target */
+    bool with_latency;
+    int num_recs;
+    struct replay_rec * recs;
+    struct replay_key * keys;
+    struct replay_key * bucket[REPLAY_HASH_SIZE];
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t mtx;
+#endif
+};
+
+#ifdef HAVE_PTHREAD_H
+#define REPLAY_LOCK(rp) pthread_mutex_lock(&(rp)->mtx)
+#define REPLAY_UNLOCK(rp) pthread_mutex_unlock(&(rp)->mtx)
+#else
+#define REPLAY_LOCK(rp)
+#define REPLAY_UNLOCK(rp)
+#endif
+
+
+/* FNV-1a over the SAS address and request bytes */
+static uint32_t
+replay_hash(uint64_t sa, const uint8_t * req, int req_len)
+{
+    int k;
+    uint32_t h = 2166136261U;
+
+    for (k = 0; k < 8; ++k, sa >>= 8) {
+        h ^= (uint8_t)sa;
+        h *= 16777619U;
+    }
+    for (k = 0; k < req_len; ++k) {
+        h ^= req[k];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static struct replay_key *
+replay_find(struct smp_replay * rpp, uint64_t sa, const uint8_t * req,
+            int req_len, uint32_t h)
+{
+    struct replay_key * kp;
+
+    for (kp = rpp->bucket[h & (REPLAY_HASH_SIZE - 1)]; kp; kp = kp->chain) {
+        if ((h == kp->hash) && (sa == kp->sa) &&
+            (req_len == kp->first->req_len) &&
+            (0 == memcmp(req, kp->first->req, req_len)))
+            return kp;
+    }
+    return NULL;
+}
+
+static uint32_t
+get_u32(const uint8_t * p, bool swap)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    if (swap)
+        v = ((v >> 24) & 0xff) | ((v >> 8) & 0xff00) |
+            ((v << 8) & 0xff0000) | (v << 24);
+    return v;
+}
+
+static uint16_t
+get_u16(const uint8_t * p, bool swap)
+{
+    uint16_t v;
+
+    memcpy(&v, p, sizeof(v));
+    if (swap)
+        v = (uint16_t)((v >> 8) | (v << 8));
+    return v;
+}
+
+/* Reads the whole file into memory. Returns its length or -1 . */
+static int64_t
+replay_load(const char * cap_name, uint8_t ** imgp, int verbose)
+{
+    int64_t len;
+    size_t n;
+    struct stat st;
+    FILE * fp;
+
+    fp = fopen(cap_name, "rb");
+    if (NULL == fp) {
+        if (verbose)
+            perror("open_replay_device: fopen() failed");
+        return -1;
+    }
+    if (fstat(fileno(fp), &st) || (st.st_size < 28) ||
+        (st.st_size > REPLAY_MAX_FILE)) {
+        fprintf(stderr, "%s: not a capture file (size)\n", cap_name);
+        fclose(fp);
+        return -1;
+    }
+    len = st.st_size;
+    *imgp = (uint8_t *)malloc(len);
+    if (NULL == *imgp) {
+        fclose(fp);
+        return -1;
+    }
+    n = fread(*imgp, 1, len, fp);
+    fclose(fp);
+    if ((int64_t)n != len) {
+        free(*imgp);
+        *imgp = NULL;
+        return -1;
+    }
+    return len;
+}
+
+/* Walks the pcapng blocks. If recs is non-NULL fills it (and sas) from
+ * each SMP capture packet, otherwise only counts them. Returns the number
+ * of packets or -1 if the file is malformed. */
+static int
+replay_walk(const uint8_t * img, int64_t img_len, struct replay_rec * recs,
+            uint64_t * sas)
+{
+    bool swap = false;
+    bool ours[PCAPNG_MAX_IFS];
+    int num_ifs = 0;
+    int n = 0;
+    uint32_t type, blen, iid, clen;
+    int64_t off;
+    const uint8_t * bp;
+    const uint8_t * hp;
+    struct replay_rec * rp;
+
+    memset(ours, 0, sizeof(ours));
+    for (off = 0; (off + 12) <= img_len; off += blen) {
+        bp = img + off;
+        type = get_u32(bp, false);
+        if (PCAPNG_SHB == type) {
+            /* byte order can change at each section */
+            if (PCAPNG_BYTE_ORDER_MAGIC == get_u32(bp + 8, false))
+                swap = false;
+            else if (PCAPNG_BYTE_ORDER_MAGIC == get_u32(bp + 8, true))
+                swap = true;
+            else
+                return -1;
+            num_ifs = 0;
+        } else if (0 == off)
+            return -1;
+        else
+            type = get_u32(bp, swap);
+        blen = get_u32(bp + 4, swap);
+        if ((blen < 12) || (blen & 3) || ((off + blen) > img_len))
+            return -1;
+        if (PCAPNG_IDB == type) {
+            if (num_ifs < PCAPNG_MAX_IFS)
+                ours[num_ifs] = (SMP_CAPTURE_LINKTYPE ==
+                                 get_u16(bp + 8, swap));
+            ++num_ifs;
+        } else if ((PCAPNG_EPB == type) && (blen >= 32)) {
+            iid = get_u32(bp + 8, swap);
+            clen = get_u32(bp + 20, swap);
+            if ((iid >= PCAPNG_MAX_IFS) || (! ours[iid]) ||
+                (clen < SMP_CAPTURE_HDR_LEN) || ((28 + clen + 4) > blen))
+                continue;
+            hp = bp + 28;
+            if ((SMP_CAPTURE_VERSION != hp[0]) ||
+                ((uint32_t)(SMP_CAPTURE_HDR_LEN +
+                            sg_get_unaligned_be16(hp + 2) +
+                            sg_get_unaligned_be16(hp + 4)) > clen))
+                continue;
+            if (recs) {
+                rp = recs + n;
+                rp->flags = hp[1];
+                rp->req_len = sg_get_unaligned_be16(hp + 2);
+                rp->resp_len = sg_get_unaligned_be16(hp + 4);
+                rp->transport_err = sg_get_unaligned_be16(hp + 6);
+                rp->lat_ns = sg_get_unaligned_be64(hp + 8);
+                sas[n] = sg_get_unaligned_be64(hp + 16);
+                rp->req = hp + SMP_CAPTURE_HDR_LEN;
+                rp->resp = rp->req + rp->req_len;
+            }
+            ++n;
+        }
+    }
+    return n;
+}
+
+static void
+replay_free(struct smp_replay * rpp)
+{
+    free(rpp->img);
+    free(rpp->recs);
+    free(rpp->keys);
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_destroy(&rpp->mtx);
+#endif
+    free(rpp);
+}
+
+int
+open_replay_device(const char * cap_name, uint64_t sa, bool with_latency,
+                   void ** vpp, int verbose)
+{
+    int k, n, num_keys;
+    int64_t img_len;
+    uint32_t h;
+    uint64_t * sas = NULL;
+    struct smp_replay * rpp;
+    struct replay_rec * rp;
+    struct replay_key * kp;
+
+    rpp = (struct smp_replay *)calloc(1, sizeof(*rpp));
+    if (NULL == rpp)
+        return -1;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&rpp->mtx, NULL);
+#endif
+    img_len = replay_load(cap_name, &rpp->img, verbose);
+    if (img_len < 0)
+        goto err_out;
+    n = replay_walk(rpp->img, img_len, NULL, NULL);
+    if (n <= 0) {
+        fprintf(stderr, "%s: %s\n", cap_name, (n < 0) ?
+                "not a pcapng file or malformed" : "no SMP frames captured");
+        goto err_out;
+    }
+    rpp->recs = (struct replay_rec *)calloc(n, sizeof(struct replay_rec));
+    rpp->keys = (struct replay_key *)calloc(n, sizeof(struct replay_key));
+    sas = (uint64_t *)calloc(n, sizeof(uint64_t));
+    if ((NULL == rpp->recs) || (NULL == rpp->keys) || (NULL == sas))
+        goto err_out;
+    replay_walk(rpp->img, img_len, rpp->recs, sas);
+    rpp->num_recs = n;
+    rpp->sa = sa ? sa : sas[0];
+    rpp->with_latency = with_latency;
+    for (k = 0, num_keys = 0; k < n; ++k) {
+        rp = rpp->recs + k;
+        h = replay_hash(sas[k], rp->req, rp->req_len);
+        kp = replay_find(rpp, sas[k], rp->req, rp->req_len, h);
+        if (kp) {
+            kp->last->next = rp;
+            kp->last = rp;
+            continue;
+        }
+        kp = rpp->keys + num_keys++;
+        kp->sa = sas[k];
+        kp->hash = h;
+        kp->first = rp;
+        kp->last = rp;
+        kp->cursor = rp;
+        kp->chain = rpp->bucket[h & (REPLAY_HASH_SIZE - 1)];
+        rpp->bucket[h & (REPLAY_HASH_SIZE - 1)] = kp;
+    }
+    if (verbose > 2)
+        fprintf(stderr, "open_replay_device: %d frames, %d distinct "
+                "requests, target SAS address 0x%" PRIx64 "\n", n, num_keys,
+                rpp->sa);
+    free(sas);
+    *vpp = rpp;
+    return 0;
+
+err_out:
+    free(sas);
+    replay_free(rpp);
+    return -1;
+}
+
+int
+close_replay_device(void * vp)
+{
+    if (NULL == vp)
+        return -1;
+    replay_free((struct smp_replay *)vp);
+    return 0;
+}
+
+bool
+replay_with_latency(const void * vp)
+{
+    return vp ? ((const struct smp_replay *)vp)->with_latency : false;
+}
+
+int
+send_req_replay(void * vp, struct smp_req_resp * rresp, int verbose)
+{
+    int req_len, len;
+    struct smp_replay * rpp = (struct smp_replay *)vp;
+    struct replay_key * kp;
+    struct replay_rec * rp;
+    struct timespec ts;
+
+    if ((NULL == rpp) || (NULL == rresp->request) ||
+        (rresp->request_len < 2))
+        return -1;
+    if (smp_req_eff_timeout_ms(rresp, SMP_DEF_TIMEOUT_MS) <= 0) {
+        if (verbose)
+            fprintf(stderr, "send_req_replay: deadline passed, request "
+                    "not sent\n");
+        return -1;
+    }
+    req_len = rresp->request_len - 4;   /* captured without CRC */
+    if (req_len < 2)
+        req_len = rresp->request_len;
+    REPLAY_LOCK(rpp);
+    kp = replay_find(rpp, rpp->sa, rresp->request, req_len,
+                     replay_hash(rpp->sa, rresp->request, req_len));
+    rp = NULL;
+    if (kp) {
+        rp = kp->cursor;
+        if (rp->next)
+            kp->cursor = rp->next;
+    }
+    REPLAY_UNLOCK(rpp);
+    if (NULL == rp) {
+        if (verbose)
+            fprintf(stderr, "send_req_replay: no recorded response for "
+                    "function 0x%x (request length %d)\n",
+                    rresp->request[1], req_len);
+        return -1;
+    }
+    if (rpp->with_latency && rp->lat_ns) {
+        ts.tv_sec = rp->lat_ns / 1000000000;
+        ts.tv_nsec = rp->lat_ns % 1000000000;
+        while ((nanosleep(&ts, &ts) < 0) && (EINTR == errno))
+            ;
+    }
+    if (rp->flags & SMP_CAPTURE_F_TIMED_OUT)
+        rresp->timed_out = true;
+    if (rp->flags & SMP_CAPTURE_F_PT_FAIL)
+        return -1;
+    rresp->transport_err = rp->transport_err;
+    len = rresp->response ? rp->resp_len : 0;
+    if (len > rresp->max_response_len)
+        len = rresp->max_response_len;
+    if (len > 0)
+        memcpy(rresp->response, rp->resp, len);
+    /* captured without CRC, count it so lengths match a real transport */
+    if ((len > 0) && ((len + 4) <= rresp->max_response_len)) {
+        memset(rresp->response + len, 0, 4);
+        len += 4;
+    }
+    rresp->act_response_len = len;
+    if (verbose > 3)
+        fprintf(stderr, "send_req_replay: function=0x%x, "
+                "act_response_len=%d\n", rresp->request[1], len);
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef SMP_REPLAY_H
+#define SMP_REPLAY_H
+
+#include <stdbool.h>
+
+#include "smp_lib.h"
+
+/* Replay of a pcapng capture (see smp_capture_open() in smp_lib.h). The
+ * "device name" is the capture file and requests are answered with the
+ * recorded responses for the SMP target whose SAS address is sa (or the
+ * first one in the capture if sa is 0). */
+
+/* Returns 0 on success with *vpp pointing to the replay state, else -1 .
+ * If with_latency is true each response is delayed by the latency that
+ * was recorded with it. */
+int open_replay_device(const char * cap_name, uint64_t sa, bool with_latency,
+                       void ** vpp, int verbose);
+
+int close_replay_device(void * vp);
+
+/* Returns true if the replay state in vp was opened with_latency. */
+bool replay_with_latency(const void * vp);
+
+/* Answers the request in rresp from the next recorded response to an
+ * identical request. Returns 0 on success else -1 (also when there is no
+ * such recording). */
+int send_req_replay(void * vp, struct smp_req_resp * rresp, int verbose);
+
+#endif
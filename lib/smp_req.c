@@ -0,0 +1,451 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* OS independent front end of smp_send_req(). The per-OS code (e.g.
+ * smp_lin_sel.c) provides smp_pt_send_req() which sends a single request
+ * on the selected pass-through; this file adds what is common to all
+ * pass-throughs: the optional retry with backoff, the request statistics
+ * and the frame capture. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#define __STDC_FORMAT_MACROS 1
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include "smp_lib.h"
+#include "sg_pr2serr.h"
+#include "smp_pt.h"
+#include "smp_capture.h"
+#include "smp_usdt.h"
+
+#define RETRY_ENVVAR "SMP_UTILS_RETRY"
+#define STATS_ENVVAR "SMP_UTILS_STATS"
+
+static struct smp_retry_policy retry_pol;
+static struct smp_retry_counts retry_cnts;
+static bool retry_pol_set;
+static struct smp_lib_stats lib_stats;
+static bool first_req_done;
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t req_mtx = PTHREAD_MUTEX_INITIALIZER;
+#define REQ_LOCK() pthread_mutex_lock(&req_mtx)
+#define REQ_UNLOCK() pthread_mutex_unlock(&req_mtx)
+#else
+#define REQ_LOCK()
+#define REQ_UNLOCK()
+#endif
+
+#ifdef SMP_UTILS_USDT
+/* one per probe, tracers bump these while attached (see smp_usdt.h) */
+SMP_USDT_SEMA(send_req__entry);
+SMP_USDT_SEMA(send_req__return);
+SMP_USDT_SEMA(bsg__entry);
+SMP_USDT_SEMA(bsg__return);
+SMP_USDT_SEMA(mpt__entry);
+SMP_USDT_SEMA(mpt__return);
+SMP_USDT_SEMA(aac__entry);
+SMP_USDT_SEMA(aac__return);
+#endif
+
+enum retry_cause {
+    RC_NONE = 0,
+    RC_BUSY,
+    RC_TRANSPORT,
+    RC_INCOMPLETE,
+};
+
+
+void
+smp_set_retry_policy(const struct smp_retry_policy * rpp)
+{
+    REQ_LOCK();
+    if (rpp)
+        retry_pol = *rpp;
+    else
+        memset(&retry_pol, 0, sizeof(retry_pol));
+    if (retry_pol.max_retries < 0)
+        retry_pol.max_retries = 0;
+    if (retry_pol.base_ms <= 0)
+        retry_pol.base_ms = SMP_RETRY_DEF_BASE_MS;
+    if (retry_pol.max_ms <= 0)
+        retry_pol.max_ms = SMP_RETRY_DEF_MAX_MS;
+    if (retry_pol.max_ms < retry_pol.base_ms)
+        retry_pol.max_ms = retry_pol.base_ms;
+    retry_pol_set = true;
+    REQ_UNLOCK();
+}
+
+void
+smp_get_retry_counts(struct smp_retry_counts * rcp)
+{
+    if (NULL == rcp)
+        return;
+    REQ_LOCK();
+    *rcp = retry_cnts;
+    REQ_UNLOCK();
+}
+
+void
+smp_get_lib_stats(struct smp_lib_stats * sp)
+{
+    if (NULL == sp)
+        return;
+    REQ_LOCK();
+    *sp = lib_stats;
+    REQ_UNLOCK();
+}
+
+void
+smp_reset_lib_stats(void)
+{
+    REQ_LOCK();
+    memset(&lib_stats, 0, sizeof(lib_stats));
+    REQ_UNLOCK();
+}
+
+static uint64_t
+mean_us(uint64_t sum, uint64_t n)
+{
+    return n ? ((sum + (n / 2)) / n) : 0;
+}
+
+int
+smp_lib_stats_str(const struct smp_lib_stats * sp, int b_len, char * b)
+{
+    int k;
+    int n = 0;
+    const struct smp_func_stats * fsp;
+    char name[64];
+
+    if ((NULL == sp) || (NULL == b) || (b_len < 1))
+        return 0;
+    b[0] = '\0';
+    n += sg_scnpr(b + n, b_len - n, "SMP request statistics:\n");
+    n += sg_scnpr(b + n, b_len - n, "  requests: %" PRIu64 "\n",
+                  sp->requests);
+    n += sg_scnpr(b + n, b_len - n, "  errors: function result: %" PRIu64
+                  ", transport: %" PRIu64 ", pass-through: %" PRIu64 "\n",
+                  sp->fres_errs, sp->transport_errs, sp->pt_fails);
+    n += sg_scnpr(b + n, b_len - n, "          timeout: %" PRIu64
+                  ", malformed response: %" PRIu64 "\n", sp->timeouts,
+                  sp->malformed);
+    n += sg_scnpr(b + n, b_len - n, "  latency: total %" PRIu64 " us, mean %"
+                  PRIu64 " us, max %" PRIu64 " us\n", sp->lat_sum_us,
+                  mean_us(sp->lat_sum_us, sp->requests), sp->lat_max_us);
+    for (k = 0; k < 256; ++k) {
+        fsp = sp->func + k;
+        if (0 == fsp->requests)
+            continue;
+        smp_get_func_name_str(k, sizeof(name), name);
+        n += sg_scnpr(b + n, b_len - n, "  0x%02x %s:\n", k, name);
+        n += sg_scnpr(b + n, b_len - n, "      requests: %" PRIu64
+                      ", errors: %" PRIu64 ", latency: mean %" PRIu64
+                      " us, max %" PRIu64 " us\n", fsp->requests, fsp->errs,
+                      mean_us(fsp->lat_sum_us, fsp->requests),
+                      fsp->lat_max_us);
+    }
+    return n;
+}
+
+static void
+stats_at_exit(void)
+{
+    struct smp_lib_stats * sp;
+    char * b;
+    int b_len = 8192;
+
+    sp = (struct smp_lib_stats *)malloc(sizeof(*sp));
+    b = (char *)malloc(b_len);
+    if (sp && b) {
+        smp_get_lib_stats(sp);
+        smp_lib_stats_str(sp, b_len, b);
+        pr2ws("%s", b);
+    }
+    free(b);
+    free(sp);
+}
+
+static uint64_t
+clock_ns(clockid_t clk)
+{
+    struct timespec ts;
+
+    if (clock_gettime(clk, &ts))
+        return 0;
+    return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/* SMP_UTILS_RETRY=N[,BASE_MS[,MAX_MS]] enables retry on all conditions */
+static void
+retry_pol_from_env(void)
+{
+    int k, n;
+    int v[3] = {0, 0, 0};
+    const char * cp = getenv(RETRY_ENVVAR);
+    struct smp_retry_policy rp;
+
+    memset(&rp, 0, sizeof(rp));
+    for (k = 0; cp && (k < 3); ++k) {
+        n = smp_get_num_nomult(cp);
+        if (n < 0) {
+            pr2ws("%s=%s: unable to decode, ignored\n", RETRY_ENVVAR,
+                  getenv(RETRY_ENVVAR));
+            return;
+        }
+        v[k] = n;
+        cp = strchr(cp, ',');
+        if (cp)
+            ++cp;
+    }
+    rp.max_retries = v[0];
+    rp.base_ms = v[1];
+    rp.max_ms = v[2];
+    rp.on_busy = true;
+    rp.on_transport_err = true;
+    rp.on_incomplete_list = true;
+    smp_set_retry_policy(&rp);
+}
+
+/* Decides if a completed attempt (res is pass-through return value) is
+ * one the current policy retries. */
+static enum retry_cause
+retry_cause(int res, const struct smp_req_resp * rresp,
+            const struct smp_retry_policy * pp)
+{
+    int len = rresp->act_response_len;
+
+    if (res || rresp->transport_err)   /* deadline checked by caller */
+        return pp->on_transport_err ? RC_TRANSPORT : RC_NONE;
+    if ((len >= 0) && (len < 3))
+        return RC_NONE;
+    if (SMP_FRAME_TYPE_RESP != rresp->response[0])
+        return RC_NONE;
+    if (pp->on_busy && (SMP_FRES_BUSY == rresp->response[2]))
+        return RC_BUSY;
+    if (pp->on_incomplete_list &&
+        (SMP_FRES_INCOMPLETE_DESCRIPTOR_LIST == rresp->response[2]))
+        return RC_INCOMPLETE;
+    return RC_NONE;
+}
+
+/* Returns the sleep before retry number 'attempt' (origin 0): the capped
+ * exponential value less a random amount up to half of it. */
+static int
+backoff_ms(const struct smp_retry_policy * pp, int attempt, unsigned int * seedp)
+{
+    int64_t ms = pp->base_ms;
+    int half;
+
+    while ((attempt-- > 0) && (ms < pp->max_ms))
+        ms <<= 1;
+    if (ms > pp->max_ms)
+        ms = pp->max_ms;
+    half = (int)(ms / 2);
+    if (half > 0)
+        ms -= rand_r(seedp) % (half + 1);
+    return (int)ms;
+}
+
+static void
+sleep_ms(int ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    while (nanosleep(&ts, &ts) < 0)
+        ;
+}
+
+/* Sends one request via the pass-through and accounts for it. */
+static int
+send_one(const struct smp_target_obj * tobj, struct smp_req_resp * rresp,
+         int verbose)
+{
+    int res, len, func;
+    bool bad, cap;
+    uint64_t t0, lat_ns, lat, ts_ns;
+    struct smp_func_stats * fsp;
+
+    if ((NULL == rresp) || (NULL == rresp->request) ||
+        (rresp->request_len < 2))
+        return smp_pt_send_req(tobj, rresp, verbose);
+    func = rresp->request[1];
+    cap = smp_capture_active();
+    ts_ns = cap ? clock_ns(CLOCK_REALTIME) : 0;
+    t0 = clock_ns(CLOCK_MONOTONIC);
+    res = smp_pt_send_req(tobj, rresp, verbose);
+    lat_ns = clock_ns(CLOCK_MONOTONIC) - t0;
+    lat = lat_ns / 1000;
+    len = rresp->act_response_len;
+    if (cap)
+        smp_capture_rec(tobj, rresp, res, ts_ns, lat_ns);
+
+    REQ_LOCK();
+    fsp = lib_stats.func + func;
+    bad = false;
+    ++lib_stats.requests;
+    ++fsp->requests;
+    lib_stats.lat_sum_us += lat;
+    fsp->lat_sum_us += lat;
+    if (lat > lib_stats.lat_max_us)
+        lib_stats.lat_max_us = lat;
+    if (lat > fsp->lat_max_us)
+        fsp->lat_max_us = lat;
+    if (rresp->timed_out) {
+        ++lib_stats.timeouts;
+        bad = true;
+    }
+    if (res) {
+        ++lib_stats.pt_fails;
+        bad = true;
+    } else if (rresp->transport_err) {
+        ++lib_stats.transport_errs;
+        bad = true;
+    } else if (((len >= 0) && (len < 4)) || (NULL == rresp->response) ||
+               (SMP_FRAME_TYPE_RESP != rresp->response[0])) {
+        ++lib_stats.malformed;
+        bad = true;
+    } else if (SMP_FRES_FUNCTION_ACCEPTED != rresp->response[2]) {
+        ++lib_stats.fres_errs;
+        bad = true;
+    }
+    if (bad)
+        ++fsp->errs;
+    REQ_UNLOCK();
+    return res;
+}
+
+static int
+send_with_retry(const struct smp_target_obj * tobj,
+                struct smp_req_resp * rresp, int verbose)
+{
+    int res, k, ms;
+    int64_t rem;
+    unsigned int seed;
+    enum retry_cause rc;
+    struct smp_retry_policy pol;
+
+    REQ_LOCK();
+    if (! retry_pol_set) {
+        REQ_UNLOCK();
+        retry_pol_from_env();
+        REQ_LOCK();
+    }
+    pol = retry_pol;
+    REQ_UNLOCK();
+
+    res = send_one(tobj, rresp, verbose);
+    if ((NULL == tobj) || (0 == tobj->opened) || (NULL == rresp) ||
+        (pol.max_retries <= 0))
+        return res;
+
+    seed = (unsigned int)smp_get_mono_ms() ^ (unsigned int)getpid() ^
+           (unsigned int)(smp_uintptr_t)rresp;
+    for (k = 0; k < pol.max_retries; ++k) {
+        rc = retry_cause(res, rresp, &pol);
+        if (RC_NONE == rc)
+            break;
+        ms = backoff_ms(&pol, k, &seed);
+        if (rresp->deadline_ms > 0) {
+            rem = rresp->deadline_ms - smp_get_mono_ms();
+            if (rem <= ms)
+                break;          /* no time for another attempt */
+        }
+        REQ_LOCK();
+        if (RC_BUSY == rc)
+            ++retry_cnts.busy;
+        else if (RC_TRANSPORT == rc)
+            ++retry_cnts.transport_err;
+        else
+            ++retry_cnts.incomplete_list;
+        REQ_UNLOCK();
+        if (verbose)
+            pr2ws("smp_send_req: %s, retry %d of %d in %d ms\n",
+                  (RC_BUSY == rc) ? "busy" : ((RC_TRANSPORT == rc) ?
+                  "transport error" : "incomplete descriptor list"),
+                  k + 1, pol.max_retries, ms);
+        sleep_ms(ms);
+        rresp->act_response_len = 0;
+        rresp->transport_err = 0;
+        rresp->timed_out = false;
+        if (rresp->response && (rresp->max_response_len >= 4))
+            memset(rresp->response, 0, 4);
+        res = send_one(tobj, rresp, verbose);
+    }
+    if (k > 0) {
+        REQ_LOCK();
+        if (RC_NONE == retry_cause(res, rresp, &pol))
+            ++retry_cnts.recovered;
+        else
+            ++retry_cnts.exhausted;
+        REQ_UNLOCK();
+    }
+    return res;
+}
+
+int
+smp_send_req(const struct smp_target_obj * tobj,
+             struct smp_req_resp * rresp, int verbose)
+{
+    int res;
+    const char * cp;
+    uint64_t t0;
+
+    REQ_LOCK();
+    if (! first_req_done) {
+        first_req_done = true;
+        cp = getenv(STATS_ENVVAR);
+        if (cp && strcmp(cp, "0"))
+            atexit(stats_at_exit);
+    }
+    REQ_UNLOCK();
+
+    if (NULL == rresp)
+        return smp_pt_send_req(tobj, rresp, verbose);
+    SMP_PROBE3(send_req__entry, SMP_USDT_FUNC(rresp), rresp->request_len,
+               rresp->max_response_len);
+    t0 = SMP_USDT_START_US(send_req__return);
+    res = send_with_retry(tobj, rresp, verbose);
+    SMP_PROBE5(send_req__return, SMP_USDT_FUNC(rresp), res,
+               SMP_USDT_FRES(rresp), rresp->act_response_len,
+               SMP_USDT_LAT_US(t0));
+    return res;
+}
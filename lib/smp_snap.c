@@ -0,0 +1,613 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Topology snapshot files, see the "Topology snapshot" section of
+ * smp_lib.h for the layout. A snapshot is built in memory, written to a
+ * temporary file and renamed; readers map the whole file read-only. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "smp_lib.h"
+#include "sg_unaligned.h"
+#include "sg_pr2serr.h"
+
+#define SN_MAGIC "SMPSNAP"      /* 8 bytes with trailing NUL */
+
+struct smp_snap {
+    bool mapped;                /* else img is on the heap */
+    const uint8_t * img;        /* mapping of whole file */
+    size_t img_len;
+    int num_exp;
+    int num_phys;
+    int num_idx;
+    const uint8_t * exp_p;
+    const uint8_t * phy_p;
+    const uint8_t * idx_p;
+};
+
+
+/* FNV-1a over a phy record less its expander index (bytes 8-11), which
+ * depends on walk order rather than on the phy. */
+static uint64_t
+sn_phy_hash(const uint8_t * bp, uint64_t h)
+{
+    int k;
+
+    for (k = 0; k < SMP_SNAP_PHY_LEN; ++k) {
+        if ((k >= 8) && (k < 12))
+            continue;
+        h = (h ^ bp[k]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static int
+sn_idx_cmp(const void * a, const void * b)
+{
+    const uint8_t * ap = (const uint8_t *)a;
+    const uint8_t * bp = (const uint8_t *)b;
+
+    /* big endian fields, so byte order is numeric order */
+    return memcmp(ap, bp, SMP_SNAP_IDX_LEN);
+}
+
+static void
+sn_put_idx(uint8_t * bp, uint64_t sa, uint32_t xi, uint32_t pi)
+{
+    sg_put_unaligned_be64(sa, bp);
+    sg_put_unaligned_be32(xi, bp + 8);
+    sg_put_unaligned_be32(pi, bp + 12);
+}
+
+/* Builds the file image of topop, placing its length in *lenp. Returns
+ * NULL if resources are short. */
+static uint8_t *
+sn_build(const struct smp_topo * topop, size_t * lenp)
+{
+    int k, j, n_phys, n_idx, pi, ii;
+    size_t exp_off, phy_off, idx_off, len;
+    uint8_t * img;
+    uint8_t * bp;
+    uint8_t * ebp;
+    uint64_t h;
+    const struct smp_topo_exp * xp;
+    const struct smp_topo_phy * pp;
+
+    for (n_phys = 0, n_idx = 0, k = 0; k < topop->num_exp; ++k) {
+        xp = topop->exps + k;
+        n_phys += xp->num_phys;
+        ++n_idx;
+        for (j = 0; j < xp->num_phys; ++j) {
+            if (xp->phys[j].att_sa)
+                ++n_idx;
+        }
+    }
+    exp_off = SMP_SNAP_HDR_LEN;
+    phy_off = exp_off + ((size_t)topop->num_exp * SMP_SNAP_EXP_LEN);
+    idx_off = phy_off + ((size_t)n_phys * SMP_SNAP_PHY_LEN);
+    len = idx_off + ((size_t)n_idx * SMP_SNAP_IDX_LEN);
+    img = (uint8_t *)calloc(1, len);
+    if (NULL == img)
+        return NULL;
+    memcpy(img, SN_MAGIC, 8);
+    img[8] = SMP_SNAP_VERSION;
+    sg_put_unaligned_be32((uint32_t)topop->num_exp, img + 12);
+    sg_put_unaligned_be32((uint32_t)n_phys, img + 16);
+    sg_put_unaligned_be32((uint32_t)n_idx, img + 20);
+    sg_put_unaligned_be64((uint64_t)time(NULL), img + 24);
+    sg_put_unaligned_be32((uint32_t)exp_off, img + 32);
+    sg_put_unaligned_be32((uint32_t)phy_off, img + 36);
+    sg_put_unaligned_be32((uint32_t)idx_off, img + 40);
+    sg_put_unaligned_be32((uint32_t)len, img + 44);
+
+    for (pi = 0, ii = 0, k = 0; k < topop->num_exp; ++k) {
+        xp = topop->exps + k;
+        ebp = img + exp_off + ((size_t)k * SMP_SNAP_EXP_LEN);
+        bp = ebp;
+        sg_put_unaligned_be64(xp->sa, bp);
+        sg_put_unaligned_be16((uint16_t)xp->ecc, bp + 8);
+        bp[10] = (uint8_t)xp->num_phys;
+        bp[11] = (uint8_t)xp->depth;
+        sg_put_unaligned_be32((xp->parent < 0) ? SMP_SNAP_NONE :
+                              (uint32_t)xp->parent, bp + 12);
+        bp[16] = (xp->parent_phy < 0) ? 0xff : (uint8_t)xp->parent_phy;
+        bp[17] = (uint8_t)xp->err;
+        sg_put_unaligned_be32((uint32_t)pi, bp + 20);
+        memcpy(bp + 24, xp->vendor, strlen(xp->vendor));
+        memcpy(bp + 32, xp->product, strlen(xp->product));
+        memcpy(bp + 48, xp->revision, strlen(xp->revision));
+        memcpy(bp + 64, xp->rep_gen, xp->rep_gen_len);
+        sn_put_idx(img + idx_off + ((size_t)ii++ * SMP_SNAP_IDX_LEN),
+                   xp->sa, k, SMP_SNAP_NONE);
+        h = 0xcbf29ce484222325ULL ^ (uint64_t)xp->num_phys;
+        h = (h ^ (uint8_t)xp->err) * 0x100000001b3ULL;
+        for (j = 0; j < xp->num_phys; ++j, ++pi) {
+            pp = xp->phys + j;
+            bp = img + phy_off + ((size_t)pi * SMP_SNAP_PHY_LEN);
+            sg_put_unaligned_be64(pp->att_sa, bp);
+            sg_put_unaligned_be32((uint32_t)k, bp + 8);
+            bp[12] = pp->phy_id;
+            bp[13] = pp->func_res;
+            bp[14] = pp->adt;
+            bp[15] = pp->routing;
+            bp[16] = pp->neg_lrate;
+            bp[17] = pp->zone_group;
+            bp[18] = pp->zoning_flags;
+            bp[19] = pp->att_phy_id;
+            bp[20] = pp->att_iproto;
+            bp[21] = pp->att_tproto;
+            bp[22] = pp->virt ? 0x1 : 0;
+            sg_put_unaligned_be32(pp->cur_phy_cap, bp + 24);
+            sg_put_unaligned_be32(pp->att_phy_cap, bp + 28);
+            h = sn_phy_hash(bp, h);
+            if (pp->att_sa)
+                sn_put_idx(img + idx_off +
+                           ((size_t)ii++ * SMP_SNAP_IDX_LEN), pp->att_sa, k,
+                           pi);
+        }
+        sg_put_unaligned_be64(h ? h : 1, ebp + 56);
+    }
+    qsort(img + idx_off, n_idx, SMP_SNAP_IDX_LEN, sn_idx_cmp);
+    *lenp = len;
+    return img;
+}
+
+int
+smp_snap_write(const char * fname, const struct smp_topo * topop,
+               int verbose)
+{
+    int fd;
+    int ret = 0;
+    size_t len;
+    ssize_t n;
+    uint8_t * img;
+    char tmp_fn[SMP_MAX_DEVICE_NAME + 64];
+
+    img = sn_build(topop, &len);
+    if (NULL == img) {
+        if (verbose)
+            pr2serr("%s: heap allocation problem\n", __func__);
+        return -1;
+    }
+    /* write a temporary file then rename so readers see whole files */
+    snprintf(tmp_fn, sizeof(tmp_fn), "%s.%d", fname, (int)getpid());
+    fd = open(tmp_fn, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        if (verbose)
+            pr2serr("%s: unable to create %s: %s\n", __func__, tmp_fn,
+                    safe_strerror(errno));
+        ret = -1;
+        goto fini;
+    }
+    n = write(fd, img, len);
+    close(fd);
+    if ((n < 0) || ((size_t)n != len)) {
+        if (verbose)
+            pr2serr("%s: write to %s failed\n", __func__, tmp_fn);
+        unlink(tmp_fn);
+        ret = -1;
+        goto fini;
+    }
+    if (rename(tmp_fn, fname) < 0) {
+        if (verbose)
+            pr2serr("%s: rename to %s failed: %s\n", __func__, fname,
+                    safe_strerror(errno));
+        unlink(tmp_fn);
+        ret = -1;
+    } else if (verbose > 1)
+        pr2serr("%s: wrote %s, %u bytes\n", __func__, fname,
+                (unsigned int)len);
+fini:
+    free(img);
+    return ret;
+}
+
+/* Checks the image at bp, len bytes, and sets up *sp over it. Returns 0
+ * if it is a good snapshot else -1 . */
+static int
+sn_init(struct smp_snap * sp, const uint8_t * bp, size_t len)
+{
+    uint32_t exp_off, phy_off, idx_off;
+    uint64_t n;
+
+    sp->img = bp;
+    sp->img_len = len;
+    if (len < SMP_SNAP_HDR_LEN)
+        return -1;
+    sp->num_exp = sg_get_unaligned_be32(bp + 12);
+    sp->num_phys = sg_get_unaligned_be32(bp + 16);
+    sp->num_idx = sg_get_unaligned_be32(bp + 20);
+    exp_off = sg_get_unaligned_be32(bp + 32);
+    phy_off = sg_get_unaligned_be32(bp + 36);
+    idx_off = sg_get_unaligned_be32(bp + 40);
+    n = sg_get_unaligned_be32(bp + 44);
+    if ((0 != memcmp(bp, SN_MAGIC, 8)) || (SMP_SNAP_VERSION != bp[8]) ||
+        (n != len) || (sp->num_exp < 0) || (sp->num_phys < 0) ||
+        (sp->num_idx < 0) ||
+        ((exp_off + ((uint64_t)sp->num_exp * SMP_SNAP_EXP_LEN)) > n) ||
+        ((phy_off + ((uint64_t)sp->num_phys * SMP_SNAP_PHY_LEN)) > n) ||
+        ((idx_off + ((uint64_t)sp->num_idx * SMP_SNAP_IDX_LEN)) > n))
+        return -1;
+    sp->exp_p = bp + exp_off;
+    sp->phy_p = bp + phy_off;
+    sp->idx_p = bp + idx_off;
+    return 0;
+}
+
+struct smp_snap *
+smp_snap_open(const char * fname, int verbose)
+{
+    int fd;
+    void * p;
+    struct stat st;
+    struct smp_snap * sp;
+
+    fd = open(fname, O_RDONLY);
+    if (fd < 0) {
+        if (verbose)
+            pr2serr("%s: unable to open %s: %s\n", __func__, fname,
+                    safe_strerror(errno));
+        return NULL;
+    }
+    if ((fstat(fd, &st) < 0) || (st.st_size < SMP_SNAP_HDR_LEN)) {
+        if (verbose)
+            pr2serr("%s: %s: too short\n", __func__, fname);
+        close(fd);
+        return NULL;
+    }
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == p) {
+        if (verbose)
+            pr2serr("%s: mmap of %s failed: %s\n", __func__, fname,
+                    safe_strerror(errno));
+        return NULL;
+    }
+    sp = (struct smp_snap *)calloc(1, sizeof(*sp));
+    if (NULL == sp) {
+        munmap(p, st.st_size);
+        return NULL;
+    }
+    sp->mapped = true;
+    if (sn_init(sp, (const uint8_t *)p, st.st_size)) {
+        if (verbose)
+            pr2serr("%s: %s: not a snapshot file or truncated\n", __func__,
+                    fname);
+        smp_snap_close(sp);
+        return NULL;
+    }
+    return sp;
+}
+
+struct smp_snap *
+smp_snap_from_topo(const struct smp_topo * topop)
+{
+    size_t len;
+    uint8_t * img;
+    struct smp_snap * sp;
+
+    sp = (struct smp_snap *)calloc(1, sizeof(*sp));
+    if (NULL == sp)
+        return NULL;
+    img = sn_build(topop, &len);
+    if ((NULL == img) || sn_init(sp, img, len)) {
+        free(img);
+        free(sp);
+        return NULL;
+    }
+    return sp;
+}
+
+void
+smp_snap_close(struct smp_snap * sp)
+{
+    if (NULL == sp)
+        return;
+    if (sp->mapped)
+        munmap((void *)sp->img, sp->img_len);
+    else
+        free((void *)sp->img);
+    free(sp);
+}
+
+int
+smp_snap_num_exp(const struct smp_snap * sp)
+{
+    return sp->num_exp;
+}
+
+int
+smp_snap_num_phys(const struct smp_snap * sp)
+{
+    return sp->num_phys;
+}
+
+const uint8_t *
+smp_snap_exp(const struct smp_snap * sp, int xi)
+{
+    if ((xi < 0) || (xi >= sp->num_exp))
+        return NULL;
+    return sp->exp_p + ((size_t)xi * SMP_SNAP_EXP_LEN);
+}
+
+const uint8_t *
+smp_snap_phy(const struct smp_snap * sp, int pi)
+{
+    if ((pi < 0) || (pi >= sp->num_phys))
+        return NULL;
+    return sp->phy_p + ((size_t)pi * SMP_SNAP_PHY_LEN);
+}
+
+int
+smp_snap_lookup(const struct smp_snap * sp, uint64_t sa, int * posp)
+{
+    int lo, hi, mid, n;
+    const uint8_t * ip = sp->idx_p;
+
+    /* find first entry not less than sa */
+    for (lo = 0, hi = sp->num_idx; lo < hi; ) {
+        mid = lo + ((hi - lo) / 2);
+        if (sg_get_unaligned_be64(ip + ((size_t)mid * SMP_SNAP_IDX_LEN)) < sa)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (n = 0; ((lo + n) < sp->num_idx) &&
+                (sa == sg_get_unaligned_be64(ip + ((size_t)(lo + n) *
+                                                   SMP_SNAP_IDX_LEN))); ++n)
+        ;
+    if (posp)
+        *posp = lo;
+    return n;
+}
+
+uint64_t
+smp_snap_idx(const struct smp_snap * sp, int pos, uint32_t * xip,
+             uint32_t * pip)
+{
+    const uint8_t * bp;
+
+    if ((pos < 0) || (pos >= sp->num_idx))
+        return 0;
+    bp = sp->idx_p + ((size_t)pos * SMP_SNAP_IDX_LEN);
+    if (xip)
+        *xip = sg_get_unaligned_be32(bp + 8);
+    if (pip)
+        *pip = sg_get_unaligned_be32(bp + 12);
+    return sg_get_unaligned_be64(bp);
+}
+
+int
+smp_snap_get_phy(const struct smp_snap * sp, int pi,
+                 struct smp_phy_desc * pdp)
+{
+    const uint8_t * bp = smp_snap_phy(sp, pi);
+    const uint8_t * xp;
+
+    memset(pdp, 0, sizeof(*pdp));
+    pdp->dsn = 0xff;
+    if (NULL == bp)
+        return -1;
+    xp = smp_snap_exp(sp, sg_get_unaligned_be32(bp + 8));
+    if (xp) {
+        pdp->sa = sg_get_unaligned_be64(xp);
+        pdp->ecc = sg_get_unaligned_be16(xp + 8);
+    }
+    pdp->long_fmt = true;
+    pdp->att_sa = sg_get_unaligned_be64(bp);
+    pdp->phy_id = bp[12];
+    pdp->func_res = bp[13];
+    pdp->adt = bp[14];
+    pdp->routing = bp[15];
+    pdp->neg_lrate = bp[16];
+    pdp->zone_group = bp[17];
+    pdp->zoning_flags = bp[18];
+    pdp->att_phy_id = bp[19];
+    pdp->att_iproto = bp[20];
+    pdp->att_tproto = bp[21];
+    pdp->virt = !!(0x1 & bp[22]);
+    pdp->cur_phy_cap = sg_get_unaligned_be32(bp + 24);
+    pdp->att_phy_cap = sg_get_unaligned_be32(bp + 28);
+    return 0;
+}
+
+int
+smp_phy_tbl_add_snap(struct smp_phy_tbl * tp, const struct smp_snap * sp)
+{
+    int k;
+    struct smp_phy_desc pd;
+
+    for (k = 0; k < sp->num_phys; ++k) {
+        smp_snap_get_phy(sp, k, &pd);
+        if (smp_phy_tbl_add(tp, 0, &pd) < 0)
+            return -1;
+    }
+    return k;
+}
+
+/* Returns the index of the expander with SAS address sa, or -1 . */
+static int
+sn_find_exp(const struct smp_snap * sp, uint64_t sa)
+{
+    int k, n, pos;
+    uint32_t xi, pi;
+
+    n = smp_snap_lookup(sp, sa, &pos);
+    for (k = 0; k < n; ++k) {
+        smp_snap_idx(sp, pos + k, &xi, &pi);
+        if (SMP_SNAP_NONE == pi)
+            return (int)xi;
+    }
+    return -1;
+}
+
+/* Returns SMP_SNAP_CHG_* bits for the differences between phy records. */
+static unsigned int
+sn_phy_diff(const uint8_t * op, const uint8_t * np)
+{
+    unsigned int what = 0;
+
+    if (op[13] != np[13])
+        what |= SMP_SNAP_CHG_FUNC_RES;
+    if (0 != memcmp(op, np, 8))
+        what |= SMP_SNAP_CHG_ATT_SA;
+    if (op[19] != np[19])
+        what |= SMP_SNAP_CHG_ATT_PHY;
+    if (op[14] != np[14])
+        what |= SMP_SNAP_CHG_ADT;
+    if (op[16] != np[16])
+        what |= SMP_SNAP_CHG_LINK;
+    if ((op[17] != np[17]) || (op[18] != np[18]))
+        what |= SMP_SNAP_CHG_ZONE;
+    if (op[15] != np[15])
+        what |= SMP_SNAP_CHG_ROUTING;
+    if ((op[20] != np[20]) || (op[21] != np[21]) || (op[22] != np[22]) ||
+        (0 != memcmp(op + 24, np + 24, 8)))
+        what |= SMP_SNAP_CHG_OTHER;
+    return what;
+}
+
+struct sn_chg_arr {
+    int num;
+    int max;
+    struct smp_snap_chg * arr;
+};
+
+static int
+sn_add_chg(struct sn_chg_arr * cap, uint64_t exp_sa, int phy_id,
+           unsigned int what, int old_pi, int new_pi)
+{
+    struct smp_snap_chg * cp;
+
+    if (cap->num >= cap->max) {
+        cap->max = cap->max ? (cap->max * 2) : 64;
+        cp = (struct smp_snap_chg *)realloc(cap->arr,
+                                            cap->max * sizeof(*cp));
+        if (NULL == cp)
+            return -1;
+        cap->arr = cp;
+    }
+    cp = cap->arr + cap->num++;
+    cp->exp_sa = exp_sa;
+    cp->phy_id = phy_id;
+    cp->what = what;
+    cp->old_pi = old_pi;
+    cp->new_pi = new_pi;
+    return 0;
+}
+
+/* Compares the phys of old expander record oxp with new record nxp. */
+static int
+sn_diff_exp(const struct smp_snap * osp, const uint8_t * oxp,
+            const struct smp_snap * nsp, const uint8_t * nxp,
+            struct sn_chg_arr * cap)
+{
+    int k, on, nn, opi, npi;
+    unsigned int what;
+    uint64_t sa = sg_get_unaligned_be64(oxp);
+    const uint8_t * op;
+    const uint8_t * np;
+
+    on = oxp[10];
+    nn = nxp[10];
+    opi = sg_get_unaligned_be32(oxp + 20);
+    npi = sg_get_unaligned_be32(nxp + 20);
+    for (k = 0; (k < on) || (k < nn); ++k) {
+        op = (k < on) ? smp_snap_phy(osp, opi + k) : NULL;
+        np = (k < nn) ? smp_snap_phy(nsp, npi + k) : NULL;
+        if (op && np) {
+            if (0 == (what = sn_phy_diff(op, np)))
+                continue;
+        } else if (op)
+            what = SMP_SNAP_CHG_PHY_REMOVED;
+        else if (np)
+            what = SMP_SNAP_CHG_PHY_ADDED;
+        else
+            continue;
+        if (sn_add_chg(cap, sa, k, what, (op ? opi + k : -1),
+                       (np ? npi + k : -1)))
+            return -1;
+    }
+    return 0;
+}
+
+int
+smp_snap_diff(const struct smp_snap * old_sp, const struct smp_snap * new_sp,
+              struct smp_snap_chg ** chgpp)
+{
+    int k, xi;
+    uint64_t sa, oh, nh;
+    const uint8_t * oxp;
+    const uint8_t * nxp;
+    struct sn_chg_arr ca;
+
+    memset(&ca, 0, sizeof(ca));
+    *chgpp = NULL;
+    for (k = 0; k < old_sp->num_exp; ++k) {
+        oxp = smp_snap_exp(old_sp, k);
+        sa = sg_get_unaligned_be64(oxp);
+        xi = sn_find_exp(new_sp, sa);
+        if (xi < 0) {
+            if (sn_add_chg(&ca, sa, -1, SMP_SNAP_CHG_EXP_REMOVED, -1, -1))
+                goto err_out;
+            continue;
+        }
+        nxp = smp_snap_exp(new_sp, xi);
+        oh = sg_get_unaligned_be64(oxp + 56);
+        nh = sg_get_unaligned_be64(nxp + 56);
+        if (oh && (oh == nh))
+            continue;           /* same content, skip its phys */
+        if (sn_diff_exp(old_sp, oxp, new_sp, nxp, &ca))
+            goto err_out;
+    }
+    for (k = 0; k < new_sp->num_exp; ++k) {
+        sa = sg_get_unaligned_be64(smp_snap_exp(new_sp, k));
+        if ((sn_find_exp(old_sp, sa) < 0) &&
+            sn_add_chg(&ca, sa, -1, SMP_SNAP_CHG_EXP_ADDED, -1, -1))
+            goto err_out;
+    }
+    *chgpp = ca.arr;
+    return ca.num;
+
+err_out:
+    free(ca.arr);
+    return -1;
+}
@@ -32,6 +32,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
 #include <stropts.h>
 
 #include <sys/scsi/impl/usmp.h>
@@ -41,6 +42,7 @@
 #endif
 #include "smp_lib.h"
 #include "sg_unaligned.h"
+#include "smp_pt.h"
 
 #define I_USMP 1
 #define DEF_USMP_TIMEOUT 60 /* seconds  */
@@ -87,10 +89,11 @@ smp_initiator_open(const char * device_name, int subvalue,
 }
 
 int
-smp_send_req(const struct smp_target_obj * tobj,
-             struct smp_req_resp * rresp, int verbose)
+smp_pt_send_req(const struct smp_target_obj * tobj,
+                struct smp_req_resp * rresp, int verbose)
 {
     struct usmp_cmd urr;
+    int to;
 
     if ((NULL == tobj) || (0 == tobj->opened)) {
         if (verbose > 2)
@@ -102,13 +105,22 @@ smp_send_req(const struct smp_target_obj * tobj,
                 tobj->interface_selector);
         return -1;
     }
+    to = smp_req_eff_timeout_ms(rresp, DEF_USMP_TIMEOUT * 1000);
+    if (to <= 0) {
+        if (verbose)
+            fprintf(stderr, "smp_send_req: deadline passed, request not "
+                    "sent\n");
+        return -1;
+    }
     memset(&urr, 0, sizeof(urr));
     urr.usmp_req = rresp->request;
     urr.usmp_reqsize = rresp->request_len; /* header+payload+CRC in bytes */
     urr.usmp_rsp = rresp->response;
     urr.usmp_rspsize = rresp->max_response_len;
-    urr.usmp_timeout = DEF_USMP_TIMEOUT;
+    urr.usmp_timeout = (to + 999) / 1000;       /* seconds, round up */
     if (ioctl(tobj->fd, USMP_IO, &urr) < 0) {
+        if (ETIMEDOUT == errno)
+            rresp->timed_out = true;
         perror("smp_send_req: ioctl(USMPCMD)");
         return -1;
     }
@@ -137,3 +149,16 @@ smp_initiator_close(struct smp_target_obj * tobj)
     tobj->opened = 0;
     return 0;
 }
+
+/* Not supported by this pass-through: each usmp device reaches one
+ * expander. */
+int
+smp_initiator_open_sa(const struct smp_target_obj * base, uint64_t sa,
+                      struct smp_target_obj * tobj, int verbose)
+{
+    if (base && sa && tobj) { ; }       /* unused, suppress warning */
+    if (verbose)
+        fprintf(stderr, "smp_initiator_open_sa: not supported, give each "
+                "SMP target's device explicitly\n");
+    return -1;
+}
@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Fills phy descriptors for an expander from the Linux SAS transport
+ * class in sysfs, rather than sending DISCOVER functions. Expander phys
+ * appear as class/sas_phy/phy-H:N:P and the devices attached to them as
+ * class/sas_device entries below the expander's port-H:N:M directories.
+ * Nothing here is Linux specific beyond the layout, so a fake tree can be
+ * given as the root. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "smp_lib.h"
+#include "sg_pr2serr.h"
+
+#define SF_NAME_LEN 64
+
+/* SAS transport class strings, see drivers/scsi/scsi_transport_sas.c */
+static struct sf_rate_name {
+    int val;
+    const char * name;
+} sf_rate_arr[] = {
+    {0, "Unknown"},
+    {1, "Phy disabled"},
+    {2, "Link Rate failed"},
+    {3, "Spin-up hold"},
+    {8, "1.5 Gbit"},
+    {9, "3.0 Gbit"},
+    {0xa, "6.0 Gbit"},
+    {0xb, "12.0 Gbit"},
+    {0xc, "22.5 Gbit"},
+    {-1, NULL},
+};
+
+
+/* Reads the first line of root/class/cls/nm/attr into b without its
+ * newline. Returns 0 on success else -1 . */
+static int
+sf_attr(const char * root, const char * cls, const char * nm,
+        const char * attr, char * b, int blen)
+{
+    int n;
+    FILE * fp;
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/class/%s/%s/%s", root, cls, nm, attr);
+    fp = fopen(path, "r");
+    if (NULL == fp)
+        return -1;
+    if (NULL == fgets(b, blen, fp)) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    n = strlen(b);
+    if ((n > 0) && ('\n' == b[n - 1]))
+        b[n - 1] = '\0';
+    return 0;
+}
+
+static uint64_t
+sf_attr_sa(const char * root, const char * cls, const char * nm)
+{
+    char b[SF_NAME_LEN];
+
+    if (sf_attr(root, cls, nm, "sas_address", b, sizeof(b)))
+        return 0;
+    return strtoull(b, NULL, 16);
+}
+
+static int
+sf_attr_rate(const char * root, const char * nm, const char * attr)
+{
+    const struct sf_rate_name * rp;
+    char b[SF_NAME_LEN];
+
+    if (sf_attr(root, "sas_phy", nm, attr, b, sizeof(b)))
+        return 0;
+    for (rp = sf_rate_arr; rp->name; ++rp) {
+        if (0 == strcmp(b, rp->name))
+            return rp->val;
+    }
+    return 0;
+}
+
+/* Converts a list like "smp, ssp" into DISCOVER protocol bits. */
+static int
+sf_attr_protos(const char * root, const char * nm, const char * attr)
+{
+    int v = 0;
+    char b[SF_NAME_LEN];
+
+    if (sf_attr(root, "sas_device", nm, attr, b, sizeof(b)))
+        return 0;
+    if (strstr(b, "sata"))
+        v |= 0x1;
+    if (strstr(b, "smp"))
+        v |= 0x2;
+    if (strstr(b, "stp"))
+        v |= 0x4;
+    if (strstr(b, "ssp"))
+        v |= 0x8;
+    return v;
+}
+
+/* Places the class/sas_device name of the expander in nm. It is found by
+ * SAS address if sa is non-zero, else by the last component of dev_name
+ * (e.g. /dev/bsg/expander-6:0). Returns 0 if found else -1 . */
+static int
+sf_find_exp(const char * root, const char * dev_name, uint64_t sa, char * nm)
+{
+    int ret = -1;
+    const char * cp;
+    DIR * dp;
+    struct dirent * dep;
+    char b[512];
+
+    if (0 == sa) {
+        cp = dev_name ? strrchr(dev_name, '/') : NULL;
+        cp = cp ? (cp + 1) : dev_name;
+        if ((NULL == cp) || strncmp(cp, "expander-", 9) ||
+            (strlen(cp) >= SF_NAME_LEN) ||
+            (0 == sf_attr_sa(root, "sas_device", cp)))
+            return -1;
+        strcpy(nm, cp);
+        return 0;
+    }
+    snprintf(b, sizeof(b), "%s/class/sas_device", root);
+    dp = opendir(b);
+    if (NULL == dp)
+        return -1;
+    while ((dep = readdir(dp))) {
+        if (strncmp(dep->d_name, "expander-", 9) ||
+            (strlen(dep->d_name) >= SF_NAME_LEN))
+            continue;
+        if (sa == sf_attr_sa(root, "sas_device", dep->d_name)) {
+            strcpy(nm, dep->d_name);
+            ret = 0;
+            break;
+        }
+    }
+    closedir(dp);
+    return ret;
+}
+
+/* Returns the index P of a name ending in ":P" . */
+static int
+sf_name_idx(const char * nm)
+{
+    const char * cp = strrchr(nm, ':');
+
+    return cp ? atoi(cp + 1) : -1;
+}
+
+/* For each port-* directory below the expander's device directory, notes
+ * the device attached (an end_device-* or expander-* entry) against each
+ * of the port's phys (phy-H:N:P entries) in att_arr, indexed by P. */
+static void
+sf_ports(const char * root, const char * exp_nm, char (*att_arr)[SF_NAME_LEN],
+         int max_phys)
+{
+    int k, n;
+    DIR * dp;
+    DIR * pdp;
+    struct dirent * dep;
+    struct dirent * pdep;
+    char att[SF_NAME_LEN];
+    int phy_arr[256];
+    char b[512];
+    char pb[768];
+
+    snprintf(b, sizeof(b), "%s/class/sas_device/%s/device", root, exp_nm);
+    dp = opendir(b);
+    if (NULL == dp)
+        return;
+    while ((dep = readdir(dp))) {
+        if (strncmp(dep->d_name, "port-", 5))
+            continue;
+        snprintf(pb, sizeof(pb), "%s/%s", b, dep->d_name);
+        pdp = opendir(pb);
+        if (NULL == pdp)
+            continue;
+        att[0] = '\0';
+        n = 0;
+        while ((pdep = readdir(pdp))) {
+            if ((0 == strncmp(pdep->d_name, "phy-", 4)) && (n < 256))
+                phy_arr[n++] = sf_name_idx(pdep->d_name);
+            else if (((0 == strncmp(pdep->d_name, "end_device-", 11)) ||
+                      (0 == strncmp(pdep->d_name, "expander-", 9))) &&
+                     (strlen(pdep->d_name) < SF_NAME_LEN))
+                strcpy(att, pdep->d_name);
+        }
+        closedir(pdp);
+        for (k = 0; att[0] && (k < n); ++k) {
+            if ((phy_arr[k] >= 0) && (phy_arr[k] < max_phys))
+                strcpy(att_arr[phy_arr[k]], att);
+        }
+    }
+    closedir(dp);
+}
+
+int
+smp_sysfs_get_phys(const char * root, const struct smp_target_obj * top,
+                   uint64_t sa, struct smp_phy_desc * pda, int max_phys,
+                   int verbose)
+{
+    int k, id, num, plen;
+    int num_smp = 0;
+    uint64_t exp_sa;
+    DIR * dp;
+    struct dirent * dep;
+    struct smp_phy_desc * pdp;
+    char (*att_arr)[SF_NAME_LEN];
+    char exp_nm[SF_NAME_LEN];
+    char pfx[SF_NAME_LEN + 8];
+    char b[512];
+
+    if (NULL == root) {
+        root = getenv("SMP_UTILS_SYSFS_ROOT");
+        if (NULL == root)
+            root = SMP_SYSFS_DEF_ROOT;
+    }
+    if (sf_find_exp(root, (top ? top->device_name : NULL), sa, exp_nm)) {
+        if (verbose)
+            pr2serr("%s: expander not found below %s/class/sas_device\n",
+                    __func__, root);
+        return -1;
+    }
+    exp_sa = sf_attr_sa(root, "sas_device", exp_nm);
+    att_arr = (char (*)[SF_NAME_LEN])calloc(max_phys, SF_NAME_LEN);
+    if (NULL == att_arr)
+        return -1;
+    sf_ports(root, exp_nm, att_arr, max_phys);
+
+    /* phys of expander-H:N are phy-H:N:P */
+    plen = snprintf(pfx, sizeof(pfx), "phy-%s:", exp_nm + 9);
+    snprintf(b, sizeof(b), "%s/class/sas_phy", root);
+    dp = opendir(b);
+    if (NULL == dp) {
+        free(att_arr);
+        return -1;
+    }
+    for (k = 0; k < max_phys; ++k) {
+        memset(pda + k, 0, sizeof(pda[0]));
+        pda[k].func_res = SMP_FRES_PHY_VACANT;
+    }
+    num = 0;
+    while ((dep = readdir(dp))) {
+        if (strncmp(dep->d_name, pfx, plen) ||
+            sf_attr(root, "sas_phy", dep->d_name, "phy_identifier", b,
+                    sizeof(b)))
+            continue;
+        id = atoi(b);
+        if ((id < 0) || (id >= max_phys))
+            continue;
+        pdp = pda + id;
+        pdp->func_res = 0;
+        pdp->phy_id = id;
+        pdp->sa = exp_sa;
+        pdp->routing = SMP_DESC_ROUTING_UNKNOWN;
+        pdp->dsn = 0xff;
+        pdp->neg_lrate = sf_attr_rate(root, dep->d_name,
+                                      "negotiated_linkrate");
+        pdp->neg_prate = pdp->neg_lrate;
+        pdp->prog_min_prate = sf_attr_rate(root, dep->d_name,
+                                           "minimum_linkrate");
+        pdp->hw_min_prate = sf_attr_rate(root, dep->d_name,
+                                         "minimum_linkrate_hw");
+        pdp->prog_max_prate = sf_attr_rate(root, dep->d_name,
+                                           "maximum_linkrate");
+        pdp->hw_max_prate = sf_attr_rate(root, dep->d_name,
+                                         "maximum_linkrate_hw");
+        k = sf_name_idx(dep->d_name);
+        if ((k >= 0) && (k < max_phys) && att_arr[k][0]) {
+            pdp->att_sa = sf_attr_sa(root, "sas_device", att_arr[k]);
+            if (0 == sf_attr(root, "sas_device", att_arr[k],
+                             "phy_identifier", b, sizeof(b)))
+                pdp->att_phy_id = atoi(b);
+            if (0 == sf_attr(root, "sas_device", att_arr[k], "device_type",
+                             b, sizeof(b))) {
+                if (0 == strcmp(b, "end device"))
+                    pdp->adt = 1;
+                else if (0 == strcmp(b, "edge expander"))
+                    pdp->adt = 2;
+                else if (0 == strcmp(b, "fanout expander"))
+                    pdp->adt = 3;
+            }
+            pdp->att_iproto = sf_attr_protos(root, att_arr[k],
+                                             "initiator_port_protocols");
+            pdp->att_tproto = sf_attr_protos(root, att_arr[k],
+                                             "target_port_protocols");
+        }
+        if (id >= num)
+            num = id + 1;
+    }
+    closedir(dp);
+    free(att_arr);
+    if (0 == num) {
+        if (verbose)
+            pr2serr("%s: no phys of %s below %s/class/sas_phy\n", __func__,
+                    exp_nm, root);
+        return -1;
+    }
+
+    /* A link is up but sysfs does not know what is attached (e.g. the
+     * phys towards the parent expander): ask the expander. */
+    for (k = 0; top && (k < num); ++k) {
+        pdp = pda + k;
+        if (pdp->func_res || (pdp->neg_lrate < 8) || pdp->adt)
+            continue;
+        ++num_smp;
+        if (smp_discover_phy(top, k, pdp, verbose) && verbose)
+            pr2serr("%s: DISCOVER of phy %d failed, using sysfs\n",
+                    __func__, k);
+    }
+    if (verbose)
+        pr2serr("%s: %s has %d phys, %d fetched with DISCOVER\n", __func__,
+                exp_nm, num, num_smp);
+    return num;
+}
@@ -0,0 +1,524 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Breadth first walk of a SAS domain, see the "Fabric topology walk"
+ * section of smp_lib.h . All requests go through one smp_batch so the
+ * worker pool bounds how many are outstanding. The calling thread reaps
+ * completions and decides what to send next: REPORT GENERAL and REPORT
+ * MANUFACTURER INFORMATION first, then DISCOVER LIST windows covering all
+ * phys. When the last response for an expander arrives, expanders attached
+ * to it that have not been seen are opened and started. Since all
+ * expanders at one depth are found before any of them completes, the order
+ * found is breadth first; it is made deterministic before returning. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "smp_lib.h"
+#include "sg_unaligned.h"
+#include "sg_pr2serr.h"
+
+#define TW_RG 1                 /* REPORT GENERAL */
+#define TW_RM 2                 /* REPORT MANUFACTURER INFORMATION */
+#define TW_DL 3                 /* DISCOVER LIST */
+#define TW_DISC 4               /* DISCOVER */
+
+#define TW_DL_DESCS 8           /* long descriptors per DISCOVER LIST */
+#define TW_RESP_LEN (48 + (TW_DL_DESCS * 120) + 4)
+
+/* walker private, one per expander */
+struct tw_exp {
+    struct smp_topo_exp te;
+    const struct smp_target_obj * top;  /* start's or &tobj */
+    struct smp_target_obj tobj;
+    bool opened;                /* tobj opened here */
+    int pending;                /* requests outstanding */
+};
+
+/* one outstanding request */
+struct tw_req {
+    struct smp_batch_elem be;
+    struct smp_req_resp rr;
+    int kind;                   /* TW_* */
+    int xi;                     /* index of expander */
+    int sphy;                   /* starting phy id (TW_DL, TW_DISC) */
+    uint8_t req[32];
+    uint8_t resp[TW_RESP_LEN];
+};
+
+struct tw {
+    struct tw_exp ** xa;        /* in order found */
+    int num;
+    int max_exp;
+    bool ign_zg;
+    int verbose;
+    const struct smp_target_obj * start;
+    struct smp_batch * bp;
+};
+
+
+static int
+tw_submit(struct tw * twp, int xi, int kind, int sphy)
+{
+    int n, req_len, resp_len;
+    struct tw_req * rp;
+    struct tw_exp * xp = twp->xa[xi];
+
+    rp = (struct tw_req *)calloc(1, sizeof(*rp));
+    if (NULL == rp)
+        return -1;
+    rp->kind = kind;
+    rp->xi = xi;
+    rp->sphy = sphy;
+    rp->req[0] = SMP_FRAME_TYPE_REQ;
+    switch (kind) {
+    case TW_RG:
+        rp->req[1] = SMP_FN_REPORT_GENERAL;
+        req_len = 8;
+        resp_len = 76;
+        break;
+    case TW_RM:
+        rp->req[1] = SMP_FN_REPORT_MANUFACTURER;
+        req_len = 8;
+        resp_len = 64;
+        break;
+    case TW_DL:
+        rp->req[1] = SMP_FN_DISCOVER_LIST;
+        req_len = 32;
+        resp_len = TW_RESP_LEN;
+        rp->req[3] = 6;
+        rp->req[8] = sphy;
+        /* windows start at multiples of TW_DL_DESCS, one continuing
+         * after a short response ends where its window does */
+        n = xp->te.num_phys - sphy;
+        if (n > (TW_DL_DESCS - (sphy % TW_DL_DESCS)))
+            n = TW_DL_DESCS - (sphy % TW_DL_DESCS);
+        rp->req[9] = n;
+        if (twp->ign_zg)
+            rp->req[10] = 0x80;
+        /* phy filter 0 (all) and descriptor type 0 (long) */
+        break;
+    case TW_DISC:
+    default:
+        rp->req[1] = SMP_FN_DISCOVER;
+        req_len = 16;
+        resp_len = 128;
+        rp->req[3] = 2;
+        if (twp->ign_zg)
+            rp->req[8] = 0x1;
+        rp->req[9] = sphy;
+        break;
+    }
+    if (kind != TW_RG && kind != TW_RM) {
+        n = (resp_len - 8) / 4;
+        rp->req[2] = (n < 0x100) ? n : 0xff;    /* allocated response len */
+    }
+    rp->rr.request_len = req_len;
+    rp->rr.request = rp->req;
+    rp->rr.max_response_len = resp_len;
+    rp->rr.response = rp->resp;
+    rp->be.tobj = xp->top;
+    rp->be.rresp = &rp->rr;
+    rp->be.user_p = rp;
+    if (smp_batch_submit(twp->bp, &rp->be)) {
+        free(rp);
+        return -1;
+    }
+    ++xp->pending;
+    return 0;
+}
+
+/* Returns the function result (0 for success) or -1 if the request or
+ * response is bad. Places the response length (excluding CRC) in *lenp. */
+static int
+tw_check(const struct tw_req * rp, int * lenp)
+{
+    int len;
+    const uint8_t * bp = rp->resp;
+
+    if (rp->be.res || rp->rr.transport_err)
+        return -1;
+    if ((SMP_FRAME_TYPE_RESP != bp[0]) || (rp->req[1] != bp[1]))
+        return -1;
+    if (bp[2])
+        return bp[2];
+    len = 4 + (bp[3] * 4);
+    if ((rp->rr.act_response_len >= 0) && (len > rp->rr.act_response_len))
+        len = rp->rr.act_response_len;
+    if (len > (rp->rr.max_response_len - 4))
+        len = rp->rr.max_response_len - 4;
+    *lenp = len;
+    return 0;
+}
+
+/* Copies a space padded ASCII field into a NUL terminated string. */
+static void
+tw_ascii(const uint8_t * bp, int n, char * b)
+{
+    memcpy(b, bp, n);
+    b[n] = '\0';
+    for (--n; (n >= 0) && (' ' == b[n]); --n)
+        b[n] = '\0';
+}
+
+/* Decodes a DISCOVER response (or long DISCOVER LIST descriptor) of len
+ * bytes into the expander's phy table. */
+static void
+tw_phy(struct tw_exp * xp, const uint8_t * bp, int len)
+{
+    int id = bp[9];
+    struct smp_phy_desc pd;
+    struct smp_topo_phy * pp;
+
+    if ((id >= xp->te.num_phys) || smp_decode_phy_desc(bp, len, 0, &pd))
+        return;
+    pp = xp->te.phys + id;
+    pp->func_res = pd.func_res;
+    if (pd.func_res)
+        return;
+    if (pd.sa && (0 == xp->te.sa))
+        xp->te.sa = pd.sa;
+    pp->adt = pd.adt;
+    pp->neg_lrate = pd.neg_lrate;
+    pp->att_iproto = pd.att_iproto;
+    pp->att_tproto = pd.att_tproto;
+    pp->att_sa = pd.att_sa;
+    pp->att_phy_id = pd.att_phy_id;
+    pp->virt = pd.virt;
+    pp->routing = pd.routing;
+    pp->zone_group = pd.zone_group;
+    pp->zoning_flags = pd.zoning_flags;
+    pp->cur_phy_cap = pd.cur_phy_cap;
+    pp->att_phy_cap = pd.att_phy_cap;
+}
+
+static int
+tw_find(const struct tw * twp, uint64_t sa)
+{
+    int k;
+
+    for (k = 0; k < twp->num; ++k) {
+        if (twp->xa[k]->te.sa == sa)
+            return k;
+    }
+    return -1;
+}
+
+/* Adds an expander. If top is NULL it is opened by SAS address. Returns
+ * its index, or -1 if out of room or resources. */
+static int
+tw_add(struct tw * twp, uint64_t sa, const struct smp_target_obj * top,
+       int parent, int parent_phy, int depth)
+{
+    int xi;
+    struct tw_exp * xp;
+
+    if (twp->num >= twp->max_exp)
+        return -1;
+    xp = (struct tw_exp *)calloc(1, sizeof(*xp));
+    if (NULL == xp)
+        return -1;
+    xi = twp->num++;
+    twp->xa[xi] = xp;
+    xp->te.sa = sa;
+    xp->te.parent = parent;
+    xp->te.parent_phy = parent_phy;
+    xp->te.depth = depth;
+    xp->te.ecc = -1;
+    if (top)
+        xp->top = top;
+    else if (0 == smp_initiator_open_sa(twp->start, sa, &xp->tobj,
+                                        twp->verbose)) {
+        xp->opened = true;
+        xp->top = &xp->tobj;
+    } else {
+        xp->te.err = SMP_LIB_FILE_ERROR;
+        return xi;
+    }
+    snprintf(xp->te.device_name, sizeof(xp->te.device_name), "%s",
+             xp->top->device_name);
+    if (twp->verbose > 1)
+        pr2serr("%s: expander 0x%" PRIx64 " at depth %d via %s\n",
+                __func__, sa, depth, xp->te.device_name);
+    if (tw_submit(twp, xi, TW_RG, 0) || tw_submit(twp, xi, TW_RM, 0))
+        xp->te.err = SMP_LIB_RESOURCE_ERROR;
+    return xi;
+}
+
+/* All responses for expander xi are in: find and start the expanders
+ * attached to it. */
+static void
+tw_exp_done(struct tw * twp, int xi)
+{
+    int k, j;
+    struct smp_topo_phy * pp;
+    struct tw_exp * xp = twp->xa[xi];
+
+    for (k = 0; k < xp->te.num_phys; ++k) {
+        pp = xp->te.phys + k;
+        if (pp->func_res || ((2 != pp->adt) && (3 != pp->adt)) ||
+            (0 == pp->att_sa))
+            continue;
+        j = tw_find(twp, pp->att_sa);
+        if (j < 0) {
+            j = tw_add(twp, pp->att_sa, NULL, xi, k, xp->te.depth + 1);
+            if ((j < 0) && twp->verbose)
+                pr2serr("%s: expander 0x%" PRIx64 " not visited, limit "
+                        "of %d reached\n", __func__, pp->att_sa,
+                        twp->max_exp);
+        }
+        pp->att_exp = j;
+    }
+}
+
+static void
+tw_complete(struct tw * twp, struct tw_req * rp)
+{
+    int k, n, len, desc_len, fres, next, wend;
+    const uint8_t * bp = rp->resp;
+    struct tw_exp * xp = twp->xa[rp->xi];
+
+    len = 0;
+    fres = tw_check(rp, &len);
+    switch (rp->kind) {
+    case TW_RG:
+        if (fres || (len < 10)) {
+            xp->te.err = (fres > 0) ? fres : SMP_LIB_CAT_MALFORMED;
+            if (rp->be.res || rp->rr.transport_err)
+                xp->te.err = SMP_LIB_CAT_OTHER;
+            break;
+        }
+        xp->te.ecc = sg_get_unaligned_be16(bp + 4);
+        xp->te.num_phys = bp[9];
+        xp->te.rep_gen_len = (len < SMP_TOPO_RG_LEN) ? len : SMP_TOPO_RG_LEN;
+        memcpy(xp->te.rep_gen, bp, xp->te.rep_gen_len);
+        xp->te.phys = (struct smp_topo_phy *)
+                        calloc(xp->te.num_phys + 1, sizeof(*xp->te.phys));
+        if (NULL == xp->te.phys) {
+            xp->te.num_phys = 0;
+            xp->te.err = SMP_LIB_RESOURCE_ERROR;
+            break;
+        }
+        for (k = 0; k < xp->te.num_phys; ++k) {
+            xp->te.phys[k].phy_id = k;
+            xp->te.phys[k].func_res = SMP_FRES_NO_PHY;
+            xp->te.phys[k].att_exp = -1;
+        }
+        for (k = 0; k < xp->te.num_phys; k += TW_DL_DESCS)
+            tw_submit(twp, rp->xi, TW_DL, k);
+        break;
+    case TW_RM:
+        if ((0 == fres) && (len >= 40)) {
+            tw_ascii(bp + 12, 8, xp->te.vendor);
+            tw_ascii(bp + 20, 16, xp->te.product);
+            tw_ascii(bp + 36, 4, xp->te.revision);
+        }
+        break;
+    case TW_DL:
+        n = bp[9];
+        desc_len = bp[12] * 4;
+        if (fres || (len < 48) || (0 != (bp[11] & 0xf)) ||
+            ((n > 0) && ((desc_len < 64) || (len < (48 + (n * desc_len)))))) {
+            /* fall back to DISCOVER for each phy in this window */
+            if (twp->verbose > 1)
+                pr2serr("%s: DISCOVER LIST at phy %d failed, using "
+                        "DISCOVER\n", __func__, rp->sphy);
+            wend = rp->sphy - (rp->sphy % TW_DL_DESCS) + TW_DL_DESCS;
+            for (k = rp->sphy; (k < xp->te.num_phys) && (k < wend); ++k)
+                tw_submit(twp, rp->xi, TW_DISC, k);
+            break;
+        }
+        for (k = 0; k < n; ++k)
+            tw_phy(xp, bp + 48 + (k * desc_len), desc_len);
+        /* some expanders cap the descriptors per response: fetch the
+         * rest of the window from after the last phy returned */
+        wend = rp->sphy - (rp->sphy % TW_DL_DESCS) + TW_DL_DESCS;
+        if (wend > xp->te.num_phys)
+            wend = xp->te.num_phys;
+        next = (n > 0) ? (bp[48 + ((n - 1) * desc_len) + 9] + 1) : rp->sphy;
+        if (next >= wend)
+            break;
+        if (next > rp->sphy)
+            tw_submit(twp, rp->xi, TW_DL, next);
+        else {          /* no progress, use DISCOVER for the rest */
+            for (k = next; k < wend; ++k)
+                tw_submit(twp, rp->xi, TW_DISC, k);
+        }
+        break;
+    case TW_DISC:
+        if (0 == fres)
+            tw_phy(xp, bp, len);
+        else if (fres > 0)
+            xp->te.phys[rp->sphy].func_res = fres;
+        break;
+    }
+    if ((0 == --xp->pending) && (0 == xp->te.err))
+        tw_exp_done(twp, rp->xi);
+}
+
+/* Places expanders in order of depth, then of their parent's (new) index,
+ * then of phy on the parent, and fixes up the indexes held. */
+static void
+tw_order(struct tw * twp, struct smp_topo_exp * out)
+{
+    int k, j, d, n, best, max_depth;
+    int * new_idx;
+    int * old_idx;
+    struct tw_exp * xp;
+
+    new_idx = (int *)calloc(twp->num * 2, sizeof(int));
+    if (NULL == new_idx) {      /* keep order found */
+        for (k = 0; k < twp->num; ++k)
+            out[k] = twp->xa[k]->te;
+        return;
+    }
+    old_idx = new_idx + twp->num;
+    for (k = 0; k < twp->num; ++k)
+        new_idx[k] = -1;
+    max_depth = 0;
+    for (k = 0; k < twp->num; ++k) {
+        if (twp->xa[k]->te.depth > max_depth)
+            max_depth = twp->xa[k]->te.depth;
+    }
+    for (n = 0, d = 0; d <= max_depth; ++d) {
+        while (true) {          /* selection, expander counts are small */
+            best = -1;
+            for (k = 0; k < twp->num; ++k) {
+                xp = twp->xa[k];
+                if ((xp->te.depth != d) || (new_idx[k] >= 0))
+                    continue;
+                if (best < 0)
+                    best = k;
+                else {
+                    const struct smp_topo_exp * bp = &twp->xa[best]->te;
+                    int pk = (xp->te.parent < 0) ? -1 :
+                             new_idx[xp->te.parent];
+                    int pb = (bp->parent < 0) ? -1 : new_idx[bp->parent];
+
+                    if ((pk < pb) || ((pk == pb) &&
+                                      (xp->te.parent_phy < bp->parent_phy)))
+                        best = k;
+                }
+            }
+            if (best < 0)
+                break;
+            new_idx[best] = n;
+            old_idx[n++] = best;
+        }
+    }
+    for (k = 0; k < twp->num; ++k) {
+        out[k] = twp->xa[old_idx[k]]->te;
+        if (out[k].parent >= 0)
+            out[k].parent = new_idx[out[k].parent];
+        for (j = 0; j < out[k].num_phys; ++j) {
+            if (out[k].phys[j].att_exp >= 0)
+                out[k].phys[j].att_exp = new_idx[out[k].phys[j].att_exp];
+        }
+    }
+    free(new_idx);
+}
+
+int
+smp_topo_walk(const struct smp_target_obj * start, int num_workers,
+              int max_exp, bool ign_zg, struct smp_topo ** topopp,
+              int verbose)
+{
+    int k;
+    int ret = -1;
+    struct smp_batch_elem * bep;
+    struct smp_topo * tp = NULL;
+    struct tw tw;
+
+    if ((NULL == start) || (NULL == topopp))
+        return -1;
+    *topopp = NULL;
+    memset(&tw, 0, sizeof(tw));
+    tw.max_exp = (max_exp > 0) ? max_exp : SMP_TOPO_DEF_MAX_EXP;
+    tw.ign_zg = ign_zg;
+    tw.verbose = verbose;
+    tw.start = start;
+    tw.xa = (struct tw_exp **)calloc(tw.max_exp, sizeof(struct tw_exp *));
+    if (NULL == tw.xa)
+        return -1;
+    tw.bp = smp_batch_create(num_workers, NULL, NULL, verbose);
+    if (NULL == tw.bp)
+        goto fini;
+    if (tw_add(&tw, start->sas_addr64, start, -1, -1, 0) < 0)
+        goto fini;
+    while (smp_batch_outstanding(tw.bp) > 0) {
+        bep = smp_batch_reap(tw.bp, true);
+        if (NULL == bep)
+            break;
+        tw_complete(&tw, (struct tw_req *)bep->user_p);
+        free(bep->user_p);
+    }
+    tp = (struct smp_topo *)calloc(1, sizeof(*tp));
+    if (tp)
+        tp->exps = (struct smp_topo_exp *)calloc(tw.num,
+                                                 sizeof(*tp->exps));
+    if ((NULL == tp) || (NULL == tp->exps)) {
+        free(tp);
+        goto fini;
+    }
+    tp->num_exp = tw.num;
+    tw_order(&tw, tp->exps);
+    for (k = 0; k < tw.num; ++k)
+        tw.xa[k]->te.phys = NULL;       /* now owned by tp */
+    *topopp = tp;
+    ret = 0;
+fini:
+    if (tw.bp)
+        smp_batch_destroy(tw.bp);
+    for (k = 0; k < tw.num; ++k) {
+        if (tw.xa[k]->opened)
+            smp_initiator_close(&tw.xa[k]->tobj);
+        free(tw.xa[k]->te.phys);
+        free(tw.xa[k]);
+    }
+    free(tw.xa);
+    return ret;
+}
+
+void
+smp_topo_free(struct smp_topo * tp)
+{
+    int k;
+
+    if (NULL == tp)
+        return;
+    for (k = 0; k < tp->num_exp; ++k)
+        free(tp->exps[k].phys);
+    free(tp->exps);
+    free(tp);
+}
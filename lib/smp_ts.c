@@ -0,0 +1,752 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Counter time series files, see the "Counter time series store" section
+ * of smp_lib.h for the layout. A writer keeps the last chunk of each series
+ * it appends to in memory and rewrites it in place when flushing; new
+ * chunks go after the last one, over the old index, and a fresh index and
+ * footer are written at the end. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "smp_lib.h"
+#include "sg_unaligned.h"
+#include "sg_pr2serr.h"
+
+#define TS_MAGIC "SMPTSER"      /* 8 bytes with trailing NUL */
+#define TS_CHUNK_MAGIC "SMTC"
+#define TS_IDX_MAGIC "SMPTSIDX"
+#define TS_END_MAGIC "SMPTSEND"
+#define TS_IDX_HDR_LEN 16
+#define TS_FOOTER_LEN 16
+#define TS_MAX_SAMPLE_LEN 20    /* two varints of at most 10 bytes */
+#define TS_MAX_CHUNK_LEN 65536
+
+struct ts_idx {
+    uint64_t sa;
+    uint32_t chunk;
+    uint16_t src;
+    uint8_t phy_id;
+    int64_t first_ms;
+    int64_t last_ms;
+};
+
+/* writer state of one series */
+struct ts_ser {
+    uint64_t sa;
+    uint16_t src;
+    uint8_t phy_id;
+    bool dirty;
+    int chunk;                  /* latest chunk of series, -1 if none */
+    int used;                   /* bytes used in buf */
+    int nsamp;
+    int64_t prev_ms;
+    int64_t prev_dms;
+    uint64_t prev_val;
+    uint8_t * buf;              /* that chunk, NULL if not loaded */
+};
+
+struct smp_ts {
+    int fd;
+    bool for_write;
+    bool sorted;                /* idx in key order, else chunk order */
+    int verbose;
+    int chunk_len;
+    int num_chunks;
+    int max_idx;
+    struct ts_idx * idx;
+    int num_ser;
+    int max_ser;
+    struct ts_ser * ser;
+    int num_slots;              /* power of 2 */
+    int * slots;                /* index in ser plus 1, 0 for empty */
+    uint8_t * cbuf;             /* reader's chunk buffer */
+};
+
+
+static int
+ts_put_varint(uint8_t * bp, int64_t sv)
+{
+    int n = 0;
+    /* zigzag: small magnitudes of either sign give small values */
+    uint64_t v = ((uint64_t)sv << 1) ^ (uint64_t)(sv >> 63);
+
+    while (v >= 0x80) {
+        bp[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    bp[n++] = (uint8_t)v;
+    return n;
+}
+
+/* Returns bytes consumed, or 0 if the varint runs past end. */
+static int
+ts_get_varint(const uint8_t * bp, const uint8_t * end, int64_t * svp)
+{
+    int n, shift;
+    uint64_t v = 0;
+
+    for (n = 0, shift = 0; (bp + n < end) && (shift < 64); ++n, shift += 7) {
+        v |= (uint64_t)(bp[n] & 0x7f) << shift;
+        if (0 == (bp[n] & 0x80)) {
+            *svp = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+static off_t
+ts_chunk_off(const struct smp_ts * tsp, int chunk)
+{
+    return SMP_TS_HDR_LEN + ((off_t)chunk * tsp->chunk_len);
+}
+
+static int
+ts_idx_cmp(const void * a, const void * b)
+{
+    const struct ts_idx * l = (const struct ts_idx *)a;
+    const struct ts_idx * r = (const struct ts_idx *)b;
+
+    if (l->sa != r->sa)
+        return (l->sa < r->sa) ? -1 : 1;
+    if (l->phy_id != r->phy_id)
+        return (l->phy_id < r->phy_id) ? -1 : 1;
+    if (l->src != r->src)
+        return (l->src < r->src) ? -1 : 1;
+    if (l->first_ms != r->first_ms)
+        return (l->first_ms < r->first_ms) ? -1 : 1;
+    return (l->chunk < r->chunk) ? -1 : (l->chunk > r->chunk);
+}
+
+static int
+ts_idx_grow(struct smp_ts * tsp, int need)
+{
+    int n;
+    struct ts_idx * ip;
+
+    if (need <= tsp->max_idx)
+        return 0;
+    n = tsp->max_idx ? tsp->max_idx : 256;
+    while (n < need)
+        n *= 2;
+    ip = (struct ts_idx *)realloc(tsp->idx, n * sizeof(*ip));
+    if (NULL == ip)
+        return -1;
+    tsp->idx = ip;
+    tsp->max_idx = n;
+    return 0;
+}
+
+/* Decodes a chunk header into *ip; returns -1 if it is not one. */
+static int
+ts_chunk_hdr(const struct smp_ts * tsp, const uint8_t * bp, int chunk,
+             struct ts_idx * ip)
+{
+    int used = sg_get_unaligned_be16(bp + 4);
+
+    if ((0 != memcmp(bp, TS_CHUNK_MAGIC, 4)) ||
+        (used < SMP_TS_CHUNK_HDR_LEN) || (used > tsp->chunk_len) ||
+        (0 == sg_get_unaligned_be16(bp + 6)))
+        return -1;
+    ip->sa = sg_get_unaligned_be64(bp + 8);
+    ip->phy_id = bp[16];
+    ip->src = sg_get_unaligned_be16(bp + 18);
+    ip->chunk = chunk;
+    ip->first_ms = (int64_t)sg_get_unaligned_be64(bp + 24);
+    ip->last_ms = (int64_t)sg_get_unaligned_be64(bp + 32);
+    return 0;
+}
+
+/* Reads the index via the footer. Returns 0, or -1 if it is not usable. */
+static int
+ts_load_idx(struct smp_ts * tsp, off_t fsize)
+{
+    int k, n;
+    uint64_t off;
+    uint8_t b[TS_FOOTER_LEN];
+    uint8_t * ibp;
+    const uint8_t * bp;
+    struct ts_idx * ip;
+
+    if (fsize < SMP_TS_HDR_LEN + TS_IDX_HDR_LEN + TS_FOOTER_LEN)
+        return -1;
+    if (pread(tsp->fd, b, TS_FOOTER_LEN, fsize - TS_FOOTER_LEN) !=
+        TS_FOOTER_LEN)
+        return -1;
+    off = sg_get_unaligned_be64(b);
+    if ((0 != memcmp(b + 8, TS_END_MAGIC, 8)) || (off < SMP_TS_HDR_LEN) ||
+        (0 != ((off - SMP_TS_HDR_LEN) % tsp->chunk_len)))
+        return -1;
+    n = (off - SMP_TS_HDR_LEN) / tsp->chunk_len;
+    if ((uint64_t)fsize != off + TS_IDX_HDR_LEN +
+                           ((uint64_t)n * SMP_TS_IDX_LEN) + TS_FOOTER_LEN)
+        return -1;
+    if (ts_idx_grow(tsp, n + 1))
+        return -1;
+    ibp = (uint8_t *)malloc(TS_IDX_HDR_LEN + (n * SMP_TS_IDX_LEN));
+    if (NULL == ibp)
+        return -1;
+    if ((pread(tsp->fd, ibp, TS_IDX_HDR_LEN + (n * SMP_TS_IDX_LEN), off) !=
+         TS_IDX_HDR_LEN + (n * SMP_TS_IDX_LEN)) ||
+        (0 != memcmp(ibp, TS_IDX_MAGIC, 8)) ||
+        ((int)sg_get_unaligned_be32(ibp + 8) != n)) {
+        free(ibp);
+        return -1;
+    }
+    for (k = 0; k < n; ++k) {
+        bp = ibp + TS_IDX_HDR_LEN + (k * SMP_TS_IDX_LEN);
+        ip = tsp->idx + k;
+        ip->sa = sg_get_unaligned_be64(bp + 0);
+        ip->phy_id = bp[8];
+        ip->src = sg_get_unaligned_be16(bp + 10);
+        ip->chunk = sg_get_unaligned_be32(bp + 12);
+        ip->first_ms = (int64_t)sg_get_unaligned_be64(bp + 16);
+        ip->last_ms = (int64_t)sg_get_unaligned_be64(bp + 24);
+        if ((int)ip->chunk >= n) {
+            free(ibp);
+            return -1;
+        }
+    }
+    free(ibp);
+    tsp->num_chunks = n;
+    tsp->sorted = true;
+    return 0;
+}
+
+/* Rebuilds the index from the chunk headers, stopping at the first slot
+ * that does not hold a chunk (e.g. an old index). */
+static int
+ts_scan_chunks(struct smp_ts * tsp, off_t fsize)
+{
+    int k, n;
+    uint8_t b[SMP_TS_CHUNK_HDR_LEN];
+
+    n = (fsize - SMP_TS_HDR_LEN) / tsp->chunk_len;
+    for (k = 0; k < n; ++k) {
+        if (ts_idx_grow(tsp, k + 1))
+            return -1;
+        if ((pread(tsp->fd, b, sizeof(b), ts_chunk_off(tsp, k)) !=
+             (ssize_t)sizeof(b)) || ts_chunk_hdr(tsp, b, k, tsp->idx + k))
+            break;
+    }
+    if (tsp->verbose)
+        pr2serr("%s: no usable index, rebuilt from %d chunk headers\n",
+                __func__, k);
+    tsp->num_chunks = k;
+    tsp->sorted = false;
+    return 0;
+}
+
+static int
+ts_slot_hash(const struct smp_ts * tsp, uint64_t sa, int phy_id, int src)
+{
+    uint64_t h = sa ^ ((uint64_t)phy_id << 48) ^ ((uint64_t)src << 32);
+
+    h *= 0x9e3779b97f4a7c15ULL;
+    return (int)(h >> 32) & (tsp->num_slots - 1);
+}
+
+static int
+ts_rehash(struct smp_ts * tsp, int num_slots)
+{
+    int k, h;
+    struct ts_ser * sp;
+
+    free(tsp->slots);
+    tsp->slots = (int *)calloc(num_slots, sizeof(int));
+    if (NULL == tsp->slots)
+        return -1;
+    tsp->num_slots = num_slots;
+    for (k = 0; k < tsp->num_ser; ++k) {
+        sp = tsp->ser + k;
+        h = ts_slot_hash(tsp, sp->sa, sp->phy_id, sp->src);
+        while (tsp->slots[h])
+            h = (h + 1) & (num_slots - 1);
+        tsp->slots[h] = k + 1;
+    }
+    return 0;
+}
+
+static struct ts_ser *
+ts_find_ser(struct smp_ts * tsp, uint64_t sa, int phy_id, int src,
+            bool add)
+{
+    int h, n;
+    struct ts_ser * sp;
+
+    if (tsp->num_slots) {
+        h = ts_slot_hash(tsp, sa, phy_id, src);
+        for ( ; tsp->slots[h]; h = (h + 1) & (tsp->num_slots - 1)) {
+            sp = tsp->ser + tsp->slots[h] - 1;
+            if ((sp->sa == sa) && (sp->phy_id == phy_id) && (sp->src == src))
+                return sp;
+        }
+    }
+    if (! add)
+        return NULL;
+    if (tsp->num_ser >= tsp->max_ser) {
+        n = tsp->max_ser ? (2 * tsp->max_ser) : 256;
+        sp = (struct ts_ser *)realloc(tsp->ser, n * sizeof(*sp));
+        if (NULL == sp)
+            return NULL;
+        tsp->ser = sp;
+        tsp->max_ser = n;
+    }
+    sp = tsp->ser + tsp->num_ser++;
+    memset(sp, 0, sizeof(*sp));
+    sp->sa = sa;
+    sp->phy_id = phy_id;
+    sp->src = src;
+    sp->chunk = -1;
+    /* keep the slot table at most half full */
+    if ((2 * tsp->num_ser) > tsp->num_slots) {
+        if (ts_rehash(tsp, tsp->num_slots ? (2 * tsp->num_slots) : 1024)) {
+            --tsp->num_ser;
+            return NULL;
+        }
+    } else {
+        h = ts_slot_hash(tsp, sa, phy_id, src);
+        while (tsp->slots[h])
+            h = (h + 1) & (tsp->num_slots - 1);
+        tsp->slots[h] = tsp->num_ser;
+    }
+    return sp;
+}
+
+struct smp_ts *
+smp_ts_open(const char * fname, bool for_write, int verbose)
+{
+    int k, res;
+    struct stat st;
+    struct smp_ts * tsp;
+    struct ts_ser * sp;
+    struct ts_idx * ip;
+    struct timespec ts;
+    uint8_t hdr[SMP_TS_HDR_LEN];
+
+    tsp = (struct smp_ts *)calloc(1, sizeof(*tsp));
+    if (NULL == tsp)
+        return NULL;
+    tsp->verbose = verbose;
+    tsp->for_write = for_write;
+    tsp->fd = open(fname, for_write ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+    if (tsp->fd < 0) {
+        if (verbose)
+            pr2serr("%s: unable to open %s: %s\n", __func__, fname,
+                    safe_strerror(errno));
+        free(tsp);
+        return NULL;
+    }
+    if (for_write && flock(tsp->fd, LOCK_EX | LOCK_NB)) {
+        if (verbose)
+            pr2serr("%s: %s is being written by another process\n",
+                    __func__, fname);
+        goto err_out;
+    }
+    if (fstat(tsp->fd, &st) < 0)
+        goto err_out;
+    if (for_write && (0 == st.st_size)) {
+        memset(hdr, 0, sizeof(hdr));
+        memcpy(hdr, TS_MAGIC, 8);
+        hdr[8] = SMP_TS_VERSION;
+        sg_put_unaligned_be32(SMP_TS_DEF_CHUNK_LEN, hdr + 12);
+        if (0 == clock_gettime(CLOCK_REALTIME, &ts))
+            sg_put_unaligned_be64(((uint64_t)ts.tv_sec * 1000) +
+                                  (ts.tv_nsec / 1000000), hdr + 16);
+        if (pwrite(tsp->fd, hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr))
+            goto err_out;
+        st.st_size = sizeof(hdr);
+    } else if ((st.st_size < (off_t)sizeof(hdr)) ||
+               (pread(tsp->fd, hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr))
+               || (0 != memcmp(hdr, TS_MAGIC, 8)) ||
+               (SMP_TS_VERSION != hdr[8])) {
+        if (verbose)
+            pr2serr("%s: %s: not a time series file, or another version\n",
+                    __func__, fname);
+        goto err_out;
+    }
+    tsp->chunk_len = sg_get_unaligned_be32(hdr + 12);
+    if ((tsp->chunk_len < SMP_TS_CHUNK_HDR_LEN + TS_MAX_SAMPLE_LEN) ||
+        (tsp->chunk_len > TS_MAX_CHUNK_LEN))
+        goto err_out;
+    if ((st.st_size > SMP_TS_HDR_LEN) && ts_load_idx(tsp, st.st_size) &&
+        ts_scan_chunks(tsp, st.st_size))
+        goto err_out;
+    if (for_write) {
+        /* the writer wants the index in chunk order */
+        if (tsp->sorted) {
+            ip = (struct ts_idx *)malloc((tsp->num_chunks + 1) * sizeof(*ip));
+            if (NULL == ip)
+                goto err_out;
+            for (k = 0; k < tsp->num_chunks; ++k)
+                ip[tsp->idx[k].chunk] = tsp->idx[k];
+            memcpy(tsp->idx, ip, tsp->num_chunks * sizeof(*ip));
+            free(ip);
+            tsp->sorted = false;
+        }
+        for (k = 0; k < tsp->num_chunks; ++k) {
+            ip = tsp->idx + k;
+            sp = ts_find_ser(tsp, ip->sa, ip->phy_id, ip->src, true);
+            if (NULL == sp)
+                goto err_out;
+            sp->chunk = k;      /* chunks of a series ascend in time */
+        }
+    } else {
+        if (! tsp->sorted)
+            qsort(tsp->idx, tsp->num_chunks, sizeof(*tsp->idx), ts_idx_cmp);
+        tsp->sorted = true;
+        tsp->cbuf = (uint8_t *)malloc(tsp->chunk_len);
+        if (NULL == tsp->cbuf)
+            goto err_out;
+    }
+    return tsp;
+err_out:
+    res = errno;
+    if (verbose > 1)
+        pr2serr("%s: %s: failed, errno=%d\n", __func__, fname, res);
+    close(tsp->fd);
+    free(tsp->idx);
+    for (k = 0; k < tsp->num_ser; ++k)
+        free(tsp->ser[k].buf);
+    free(tsp->ser);
+    free(tsp->slots);
+    free(tsp);
+    return NULL;
+}
+
+/* Reads the latest chunk of sp and restores the encoder state. */
+static int
+ts_load_ser(struct smp_ts * tsp, struct ts_ser * sp)
+{
+    int k, n;
+    int64_t dod, dv;
+    const uint8_t * bp;
+    const uint8_t * end;
+    struct ts_idx hdr;
+
+    sp->buf = (uint8_t *)malloc(tsp->chunk_len);
+    if (NULL == sp->buf)
+        return -1;
+    /* the index may come from the footer, so check 'used' here too */
+    if ((pread(tsp->fd, sp->buf, tsp->chunk_len,
+               ts_chunk_off(tsp, sp->chunk)) != tsp->chunk_len) ||
+        ts_chunk_hdr(tsp, sp->buf, sp->chunk, &hdr))
+        return -1;
+    sp->used = sg_get_unaligned_be16(sp->buf + 4);
+    sp->nsamp = sg_get_unaligned_be16(sp->buf + 6);
+    sp->prev_ms = (int64_t)sg_get_unaligned_be64(sp->buf + 24);
+    sp->prev_val = sg_get_unaligned_be64(sp->buf + 40);
+    sp->prev_dms = 0;
+    bp = sp->buf + SMP_TS_CHUNK_HDR_LEN;
+    end = sp->buf + sp->used;
+    for (k = 1; k < sp->nsamp; ++k) {
+        n = ts_get_varint(bp, end, &dod);
+        if (0 == n)
+            return -1;
+        bp += n;
+        n = ts_get_varint(bp, end, &dv);
+        if (0 == n)
+            return -1;
+        bp += n;
+        sp->prev_dms += dod;
+        sp->prev_ms += sp->prev_dms;
+        sp->prev_val += (uint64_t)dv;
+    }
+    return 0;
+}
+
+static int
+ts_write_ser(struct smp_ts * tsp, struct ts_ser * sp)
+{
+    if (! sp->dirty)
+        return 0;
+    if (pwrite(tsp->fd, sp->buf, tsp->chunk_len,
+               ts_chunk_off(tsp, sp->chunk)) != tsp->chunk_len)
+        return -1;
+    sp->dirty = false;
+    return 0;
+}
+
+int
+smp_ts_append(struct smp_ts * tsp, uint64_t sa, int phy_id, int src,
+              int64_t t_ms, uint64_t val)
+{
+    int64_t dms;
+    struct ts_ser * sp;
+    struct ts_idx * ip;
+
+    if ((NULL == tsp) || (! tsp->for_write) || (phy_id < 0) ||
+        (phy_id > 0xff) || (src < 0) || (src > 0xffff))
+        return -1;
+    sp = ts_find_ser(tsp, sa, phy_id, src, true);
+    if (NULL == sp)
+        return -1;
+    if ((sp->chunk >= 0) && (NULL == sp->buf) && ts_load_ser(tsp, sp)) {
+        if (tsp->verbose)
+            pr2serr("%s: chunk %d unreadable, starting another\n", __func__,
+                    sp->chunk);
+        sp->chunk = -1;
+    }
+    if ((sp->chunk >= 0) && sp->buf &&
+        ((sp->used + TS_MAX_SAMPLE_LEN) <= tsp->chunk_len) &&
+        (sp->nsamp < 0xffff)) {
+        dms = t_ms - sp->prev_ms;
+        sp->used += ts_put_varint(sp->buf + sp->used, dms - sp->prev_dms);
+        sp->used += ts_put_varint(sp->buf + sp->used,
+                                  (int64_t)(val - sp->prev_val));
+        ++sp->nsamp;
+        sp->prev_dms = dms;
+    } else {                    /* start a new chunk */
+        if (sp->buf && ts_write_ser(tsp, sp))
+            return -1;
+        if (ts_idx_grow(tsp, tsp->num_chunks + 1))
+            return -1;
+        if ((NULL == sp->buf) &&
+            (NULL == (sp->buf = (uint8_t *)malloc(tsp->chunk_len))))
+            return -1;
+        memset(sp->buf, 0, tsp->chunk_len);
+        memcpy(sp->buf, TS_CHUNK_MAGIC, 4);
+        sg_put_unaligned_be64(sa, sp->buf + 8);
+        sp->buf[16] = phy_id;
+        sg_put_unaligned_be16(src, sp->buf + 18);
+        sg_put_unaligned_be64((uint64_t)t_ms, sp->buf + 24);
+        sg_put_unaligned_be64(val, sp->buf + 40);
+        sp->chunk = tsp->num_chunks++;
+        sp->used = SMP_TS_CHUNK_HDR_LEN;
+        sp->nsamp = 1;
+        sp->prev_dms = 0;
+        ip = tsp->idx + sp->chunk;
+        ip->sa = sa;
+        ip->phy_id = phy_id;
+        ip->src = src;
+        ip->chunk = sp->chunk;
+        ip->first_ms = t_ms;
+    }
+    sp->prev_ms = t_ms;
+    sp->prev_val = val;
+    sg_put_unaligned_be16(sp->used, sp->buf + 4);
+    sg_put_unaligned_be16(sp->nsamp, sp->buf + 6);
+    sg_put_unaligned_be64((uint64_t)t_ms, sp->buf + 32);
+    tsp->idx[sp->chunk].last_ms = t_ms;
+    sp->dirty = true;
+    return 0;
+}
+
+int
+smp_ts_flush(struct smp_ts * tsp)
+{
+    int k, n, len;
+    off_t off;
+    uint8_t * bp;
+    uint8_t * ibp;
+    struct ts_idx * ip;
+    struct ts_idx * sorted;
+
+    if ((NULL == tsp) || (! tsp->for_write))
+        return -1;
+    for (k = 0; k < tsp->num_ser; ++k) {
+        if (ts_write_ser(tsp, tsp->ser + k))
+            return -1;
+    }
+    n = tsp->num_chunks;
+    len = TS_IDX_HDR_LEN + (n * SMP_TS_IDX_LEN) + TS_FOOTER_LEN;
+    ibp = (uint8_t *)calloc(1, len);
+    sorted = (struct ts_idx *)malloc((n + 1) * sizeof(*sorted));
+    if ((NULL == ibp) || (NULL == sorted)) {
+        free(ibp);
+        free(sorted);
+        return -1;
+    }
+    memcpy(sorted, tsp->idx, n * sizeof(*sorted));
+    qsort(sorted, n, sizeof(*sorted), ts_idx_cmp);
+    memcpy(ibp, TS_IDX_MAGIC, 8);
+    sg_put_unaligned_be32(n, ibp + 8);
+    for (k = 0; k < n; ++k) {
+        ip = sorted + k;
+        bp = ibp + TS_IDX_HDR_LEN + (k * SMP_TS_IDX_LEN);
+        sg_put_unaligned_be64(ip->sa, bp + 0);
+        bp[8] = ip->phy_id;
+        sg_put_unaligned_be16(ip->src, bp + 10);
+        sg_put_unaligned_be32(ip->chunk, bp + 12);
+        sg_put_unaligned_be64((uint64_t)ip->first_ms, bp + 16);
+        sg_put_unaligned_be64((uint64_t)ip->last_ms, bp + 24);
+    }
+    off = ts_chunk_off(tsp, n);
+    bp = ibp + len - TS_FOOTER_LEN;
+    sg_put_unaligned_be64((uint64_t)off, bp);
+    memcpy(bp + 8, TS_END_MAGIC, 8);
+    k = ((pwrite(tsp->fd, ibp, len, off) == len) &&
+         (0 == ftruncate(tsp->fd, off + len))) ? 0 : -1;
+    free(ibp);
+    free(sorted);
+    return k;
+}
+
+int
+smp_ts_close(struct smp_ts * tsp)
+{
+    int k;
+    int ret = 0;
+
+    if (NULL == tsp)
+        return 0;
+    if (tsp->for_write)
+        ret = smp_ts_flush(tsp);
+    if (close(tsp->fd) < 0)
+        ret = -1;
+    free(tsp->idx);
+    for (k = 0; k < tsp->num_ser; ++k)
+        free(tsp->ser[k].buf);
+    free(tsp->ser);
+    free(tsp->slots);
+    free(tsp->cbuf);
+    free(tsp);
+    return ret;
+}
+
+int
+smp_ts_num_chunks(const struct smp_ts * tsp)
+{
+    return tsp ? tsp->num_chunks : 0;
+}
+
+static bool
+ts_idx_match(const struct ts_idx * ip, uint64_t sa, int phy_id, int src)
+{
+    return ((0 == sa) || (ip->sa == sa)) &&
+           ((SMP_TS_ANY == phy_id) || (ip->phy_id == phy_id)) &&
+           ((SMP_TS_ANY == src) || (ip->src == src));
+}
+
+/* Decodes one chunk, passing samples in [from_ms, to_ms] to cb and
+ * counting them in *countp. Returns 0, 1 if cb asked to stop, or -1 if
+ * the chunk could not be read or decoded. */
+static int
+ts_scan_chunk(struct smp_ts * tsp, const struct ts_idx * ip,
+              int64_t from_ms, int64_t to_ms, smp_ts_cb_t cb, void * cb_arg,
+              int * countp)
+{
+    int k, n, nsamp;
+    int64_t t, dms, dod, dv;
+    uint64_t val;
+    const uint8_t * bp = tsp->cbuf;
+    const uint8_t * end;
+    struct ts_idx hdr;
+
+    if (pread(tsp->fd, tsp->cbuf, tsp->chunk_len,
+              ts_chunk_off(tsp, ip->chunk)) != tsp->chunk_len)
+        return -1;
+    if (ts_chunk_hdr(tsp, bp, ip->chunk, &hdr))
+        return -1;
+    end = bp + sg_get_unaligned_be16(bp + 4);
+    nsamp = sg_get_unaligned_be16(bp + 6);
+    t = (int64_t)sg_get_unaligned_be64(bp + 24);
+    val = sg_get_unaligned_be64(bp + 40);
+    dms = 0;
+    bp += SMP_TS_CHUNK_HDR_LEN;
+    for (k = 0; k < nsamp; ++k) {
+        if (k > 0) {
+            n = ts_get_varint(bp, end, &dod);
+            if (0 == n)
+                return -1;
+            bp += n;
+            n = ts_get_varint(bp, end, &dv);
+            if (0 == n)
+                return -1;
+            bp += n;
+            dms += dod;
+            t += dms;
+            val += (uint64_t)dv;
+        }
+        if (t > to_ms)
+            break;              /* samples are in time order */
+        if (t < from_ms)
+            continue;
+        ++*countp;
+        if (cb(ip->sa, ip->phy_id, ip->src, t, val, cb_arg))
+            return 1;
+    }
+    return 0;
+}
+
+int
+smp_ts_scan(struct smp_ts * tsp, uint64_t sa, int phy_id, int src,
+            int64_t from_ms, int64_t to_ms, smp_ts_cb_t cb, void * cb_arg)
+{
+    int k, lo, hi, mid, res;
+    int count = 0;
+    const struct ts_idx * ip;
+
+    if ((NULL == tsp) || (! tsp->sorted) || (NULL == cb))
+        return -1;
+    lo = 0;
+    if (sa) {                   /* first index entry for sa */
+        hi = tsp->num_chunks;
+        while (lo < hi) {
+            mid = (lo + hi) / 2;
+            ip = tsp->idx + mid;
+            if ((ip->sa < sa) || ((ip->sa == sa) && (phy_id >= 0) &&
+                                  (ip->phy_id < phy_id)))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+    }
+    for (k = lo; k < tsp->num_chunks; ++k) {
+        ip = tsp->idx + k;
+        if (sa && ((ip->sa != sa) ||
+                   ((phy_id >= 0) && (ip->phy_id > phy_id))))
+            break;              /* past the wanted keys */
+        if ((! ts_idx_match(ip, sa, phy_id, src)) ||
+            (ip->last_ms < from_ms) || (ip->first_ms > to_ms))
+            continue;
+        res = ts_scan_chunk(tsp, ip, from_ms, to_ms, cb, cb_arg, &count);
+        if (res < 0) {
+            if (tsp->verbose)
+                pr2serr("%s: chunk %u unreadable or corrupt\n", __func__,
+                        ip->chunk);
+            return -1;
+        } else if (res > 0)
+            break;
+    }
+    return count;
+}
@@ -0,0 +1,92 @@
+#ifndef SMP_USDT_H
+#define SMP_USDT_H
+
+/* USDT (user level statically defined tracing) probes on the SMP request
+ * path. Built in when configure is given --enable-usdt, otherwise every
+ * macro here expands to nothing. Each probe is a single nop in the text
+ * segment until a tracer (e.g. bpftrace, perf, systemtap) attaches. All
+ * probes are in the "smp_utils" provider:
+ *
+ *   send_req__entry(func, req_len, max_resp_len)
+ *   send_req__return(func, res, fres, resp_len, lat_us)
+ *   bsg__entry, mpt__entry, aac__entry  (same arguments as above)
+ *   bsg__return, mpt__return, aac__return
+ *
+ * func is the SMP function code, fres the function result byte (-1 if no
+ * valid response), res the return value of the function and resp_len the
+ * response length (-1 if unknown). lat_us is microseconds, or 0 if the
+ * tracer attached while the request was in flight.
+ *
+ * Each probe has a semaphore (defined in smp_req.c) that tracers increment
+ * while attached, so the clock is only read when a return probe is being
+ * watched. */
+
+#include <stdint.h>
+#include <time.h>
+
+#include "smp_lib.h"
+
+#ifdef SMP_UTILS_USDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define SMP_PROBE3(nm, a1, a2, a3) DTRACE_PROBE3(smp_utils, nm, a1, a2, a3)
+#define SMP_PROBE5(nm, a1, a2, a3, a4, a5) \
+        DTRACE_PROBE5(smp_utils, nm, a1, a2, a3, a4, a5)
+
+#define SMP_USDT_SEMA(nm) \
+        unsigned short smp_utils_##nm##_semaphore \
+        __attribute__((unused)) __attribute__((section(".probes")))
+
+__extension__ extern SMP_USDT_SEMA(send_req__entry);
+__extension__ extern SMP_USDT_SEMA(send_req__return);
+__extension__ extern SMP_USDT_SEMA(bsg__entry);
+__extension__ extern SMP_USDT_SEMA(bsg__return);
+__extension__ extern SMP_USDT_SEMA(mpt__entry);
+__extension__ extern SMP_USDT_SEMA(mpt__return);
+__extension__ extern SMP_USDT_SEMA(aac__entry);
+__extension__ extern SMP_USDT_SEMA(aac__return);
+
+#define SMP_USDT_ENABLED(nm) \
+        __builtin_expect(smp_utils_##nm##_semaphore, 0)
+
+static inline uint64_t
+smp_usdt_now_us(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts))
+        return 0;
+    return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/* start time for the return probe 'nm', 0 when nothing is attached */
+#define SMP_USDT_START_US(nm) \
+        (SMP_USDT_ENABLED(nm) ? smp_usdt_now_us() : 0)
+#define SMP_USDT_LAT_US(t0) ((t0) ? (smp_usdt_now_us() - (t0)) : 0)
+
+#else
+
+/* arguments are evaluated (and discarded) to keep compilers quiet about
+ * variables only used by probes; the optimizer removes them */
+#define SMP_PROBE3(nm, a1, a2, a3) \
+        do { (void)(a1); (void)(a2); (void)(a3); } while (0)
+#define SMP_PROBE5(nm, a1, a2, a3, a4, a5) \
+        do { (void)(a1); (void)(a2); (void)(a3); (void)(a4); (void)(a5); \
+        } while (0)
+#define SMP_USDT_START_US(nm) 0
+#define SMP_USDT_LAT_US(t0) (t0)
+
+#endif
+
+/* Probe argument helpers */
+#define SMP_USDT_FUNC(rrp) \
+        (((rrp)->request && ((rrp)->request_len > 1)) ? \
+         (int)(rrp)->request[1] : -1)
+#define SMP_USDT_FRES(rrp) \
+        (((rrp)->response && ((rrp)->max_response_len > 2) && \
+          (SMP_FRAME_TYPE_RESP == (rrp)->response[0])) ? \
+         (int)(rrp)->response[2] : -1)
+
+#endif
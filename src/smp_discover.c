@@ -58,11 +58,16 @@
  * defined in the SPL series. The most recent SPL-5 draft is spl5r05.pdf .
  */
 
-static const char * version_str = "1.65 20260401";    /* spl5r05 */
+static const char * version_str = "1.67 20261016";    /* spl5r05 */
 
 
 #define SMP_FN_DISCOVER_RESP_LEN 124
 #define SMP_FN_REPORT_GENERAL_RESP_LEN 76
+#define MAX_DLIST_LONG_DESCS 8
+#define DLIST_LONG_DESC_LEN 120
+/* 48 byte header, long descriptors and 4 byte CRC */
+#define SMP_FN_DISCOVER_LIST_RESP_LEN \
+        (48 + (MAX_DLIST_LONG_DESCS * DLIST_LONG_DESC_LEN) + 4)
 
 
 struct opts_t {
@@ -75,6 +80,7 @@ struct opts_t {
     bool phy_id_given;
     bool do_raw;        /* -r option given */
     bool do_summary;    /* -S option given */
+    bool do_sysfs;      /* -y option given */
     bool do_zero;       /* -z option given */
     bool sa_given;
     int do_brief;       /* -b option given */
@@ -102,6 +108,7 @@ static struct option long_options[] = {
         {"phy", required_argument, 0, 'p'},
         {"sa", required_argument, 0, 's'},
         {"summary", no_argument, 0, 'S'},
+        {"sysfs", no_argument, 0, 'y'},
         {"raw", no_argument, 0, 'r'},
         {"verbose", no_argument, 0, 'v'},
         {"version", no_argument, 0, 'V'},
@@ -120,8 +127,8 @@ usage(void)
             "[--multiple]\n"
             "                    [--my] [--num=NUM] [--phy=ID] [--raw] "
             "[--sa=SAS_ADDR]\n"
-            "                    [--summary] [--verbose] [--version] "
-            "[--zero]\n"
+            "                    [--summary] [--sysfs] [--verbose] "
+            "[--version] [--zero]\n"
             "                    SMP_DEVICE[,N]\n"
             "  where:\n"
             "    --adn|-A             output attached device name in one "
@@ -162,6 +169,11 @@ usage(void)
             "('-mb').\n"
             "                         This option is assumed if '--phy=ID' "
             "not given\n"
+            "    --sysfs|-y           with --summary or --multiple take phy "
+            "states from\n"
+            "                         sysfs (Linux), sending SMP functions "
+            "only for\n"
+            "                         what sysfs lacks\n"
             "    --verbose|-v         increase verbosity\n"
             "    --version|-V         print version string and exit\n"
             "    --zero|-z            zero Allocated Response Length "
@@ -185,11 +197,14 @@ dStrRaw(const uint8_t * str, int len)
 
 /* Returns the number of phys (from REPORT GENERAL response) and if
  * t2t_routingp is non-NULL places 'Table to Table Supported' bit where it
- * points. Returns -3 (or less) -> SMP_LIB errors negated (-4 - smp_err),
- * -1 for other errors. */
+ * points. If dlistp is non-NULL, sets it when the response is in SAS-2 (or
+ * later) format, the first in which DISCOVER LIST is defined. If eccp is
+ * non-NULL places the expander change count there, or -1 if the expander
+ * is configuring. Returns -3 (or less) -> SMP_LIB errors negated
+ * (-4 - smp_err), -1 for other errors. */
 static int
 get_num_phys(struct smp_target_obj * top, const struct opts_t * op,
-             bool * t2t_routingp)
+             bool * t2t_routingp, bool * dlistp, int * eccp)
 {
     bool t2t;
     int len, res, k, act_resplen;
@@ -279,6 +294,11 @@ get_num_phys(struct smp_target_obj * top, const struct opts_t * op,
     t2t = (len > 10) ? !!(0x80 & rp[10]) : false;
     if (t2t_routingp)
         *t2t_routingp = t2t;
+    if (dlistp)
+        *dlistp = (rp[3] > 0);  /* response length only set in SAS-2+ */
+    if (eccp)
+        *eccp = ((len > 10) && (0 == (0x2 & rp[10]))) ?
+                (int)sg_get_unaligned_be16(rp + 4) : -1;
     if (op->verbose > 2)
         pr2serr("%s: len=%d, number of phys: %u, t2t=%d\n", __func__, len,
                 rp[9], (int)t2t);
@@ -312,82 +332,6 @@ static const char * smp_short_attached_device_type[] = {
     "res",
 };
 
-static char *
-smp_get_plink_rate(int val, bool prog, int b_len, char * b)
-{
-    switch (val) {
-    case 8:
-        snprintf(b, b_len, "1.5 Gbps");
-        return b;
-    case 9:
-        snprintf(b, b_len, "3 Gbps");
-        return b;
-    case 0xa:
-        snprintf(b, b_len, "6 Gbps");
-        return b;
-    case 0xb:
-        snprintf(b, b_len, "12 Gbps");
-        return b;
-    case 0xc:
-        snprintf(b, b_len, "22.5 Gbps");
-        return b;
-    default:
-        break;
-    }
-    if (prog && (0 == val))
-        snprintf(b, b_len, "not programmable");
-    else
-        snprintf(b, b_len, "reserved [%d]", val);
-    return b;
-}
-
-static char *
-smp_get_reason(int val, int b_len, char * b)
-{
-    switch (val) {
-    case 0: snprintf(b, b_len, "unknown"); break;
-    case 1: snprintf(b, b_len, "power on"); break;
-    case 2: snprintf(b, b_len, "hard reset");
-         break;
-    case 3: snprintf(b, b_len, "SMP phy control requested");
-         break;
-    case 4: snprintf(b, b_len, "loss of dword synchronization"); break;
-    case 5:     /* hardware muxing made obsolete in spl5r01 */
-        snprintf(b, b_len, "error in multiplexing (MUX) sequence");
-        break;
-    case 6: snprintf(b, b_len, "I_T nexus loss timeout STP/SATA"); break;
-    case 7: snprintf(b, b_len, "break timeout timer expired"); break;
-    case 8: snprintf(b, b_len, "phy test function stopped"); break;
-    case 9: snprintf(b, b_len, "expander reduced functionality"); break;
-    default: snprintf(b, b_len, "reserved [%d]", val); break;
-    }
-    return b;
-}
-
-static char *
-smp_get_neg_xxx_link_rate(int val, int b_len, char * b)
-{
-    switch (val) {
-    case 0: snprintf(b, b_len, "phy enabled; unknown"); break;
-    case 1: snprintf(b, b_len, "phy disabled"); break;
-    case 2: snprintf(b, b_len, "phy enabled; speed negotiation failed");
-         break;
-    case 3: snprintf(b, b_len, "phy enabled; SATA spinup hold state");
-         break;
-    case 4: snprintf(b, b_len, "phy enabled; port selector"); break;
-    case 5: snprintf(b, b_len, "phy enabled; reset in progress"); break;
-    case 6: snprintf(b, b_len, "phy enabled; unsupported phy attached");
-         break;
-    case 8: snprintf(b, b_len, "phy enabled, 1.5 Gbps"); break;
-    case 9: snprintf(b, b_len, "phy enabled, 3 Gbps"); break;
-    case 0xa: snprintf(b, b_len, "phy enabled, 6 Gbps"); break;
-    case 0xb: snprintf(b, b_len, "phy enabled, 12 Gbps"); break;
-    case 0xc: snprintf(b, b_len, "phy enabled, 22.5 Gbps"); break;
-    default: snprintf(b, b_len, "reserved [%d]", val); break;
-    }
-    return b;
-}
-
 /* Returns length of response in bytes, excluding the CRC on success,
    -3 (or less) -> SMP_LIB errors negated (-4 - smp_err),
    -1 for other errors */
@@ -493,6 +437,92 @@ do_discover(struct smp_target_obj * top, int disc_phy_id,
     return len;
 }
 
+/* Fetches up to max_desc long descriptors, starting at sphy_id, with one
+ * DISCOVER LIST function (all phys filter). Each long descriptor has the
+ * same layout as a DISCOVER response (less CRC). Returns the number of
+ * descriptors (0 or more) placing their length in *desc_lenp, -3 (or
+ * less) -> SMP_LIB errors negated (-4 - smp_err), -1 for other errors.
+ * Errors are only reported when verbose since the caller falls back to
+ * DISCOVER. */
+static int
+do_discover_list(struct smp_target_obj * top, int sphy_id, int max_desc,
+                 uint8_t * resp, int max_resp_len, int * desc_lenp,
+                 const struct opts_t * op)
+{
+    int len, res, k, num_desc, desc_len, act_resplen;
+    uint8_t smp_req[] = {SMP_FRAME_TYPE_REQ, SMP_FN_DISCOVER_LIST, 0, 6,
+                         0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                         0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                         0, 0, 0, 0, };
+    char b[256];
+    struct smp_req_resp smp_rr;
+
+    memset(resp, 0, max_resp_len);
+    len = (max_resp_len - 8) / 4;
+    smp_req[2] = (len < 0x100) ? len : 0xff; /* Allocated Response Len */
+    smp_req[8] = sphy_id;
+    smp_req[9] = (max_desc > MAX_DLIST_LONG_DESCS) ? MAX_DLIST_LONG_DESCS :
+                                                     max_desc;
+    if (op->ign_zp)
+        smp_req[10] |= 0x80;
+    /* phy filter 0 (all phys) and descriptor type 0 (long) */
+    if (op->verbose) {
+        pr2serr("    Discover list request: ");
+        for (k = 0; k < (int)sizeof(smp_req); ++k) {
+            if (0 == (k % 16))
+                pr2serr("\n      ");
+            else if (0 == (k % 8))
+                pr2serr(" ");
+            pr2serr("%02x ", smp_req[k]);
+        }
+        pr2serr("\n");
+    }
+    memset(&smp_rr, 0, sizeof(smp_rr));
+    smp_rr.request_len = sizeof(smp_req);
+    smp_rr.request = smp_req;
+    smp_rr.max_response_len = max_resp_len;
+    smp_rr.response = resp;
+    res = smp_send_req(top, &smp_rr, op->verbose);
+
+    if (res) {
+        if (op->verbose)
+            pr2serr("DL smp_send_req failed, res=%d\n", res);
+        return -1;
+    }
+    if (smp_rr.transport_err) {
+        if (op->verbose)
+            pr2serr("DL smp_send_req transport_error=%d\n",
+                    smp_rr.transport_err);
+        return -1;
+    }
+    act_resplen = smp_rr.act_response_len;
+    if ((act_resplen >= 0) && (act_resplen < 4))
+        return -4 - SMP_LIB_CAT_MALFORMED;
+    if ((SMP_FRAME_TYPE_RESP != resp[0]) || (resp[1] != smp_req[1]))
+        return -4 - SMP_LIB_CAT_MALFORMED;
+    if (resp[2]) {
+        if (op->verbose > 1)
+            pr2serr("Discover list result: %s\n",
+                    smp_get_func_res_str(resp[2], sizeof(b), b));
+        return -4 - resp[2];
+    }
+    len = 4 + (resp[3] * 4);    /* length in bytes, excluding 4 byte CRC */
+    if ((act_resplen >= 0) && (len > act_resplen))
+        len = act_resplen;
+    num_desc = resp[9];
+    desc_len = resp[12] * 4;
+    if ((len < 48) || (0 != (resp[11] & 0xf)) ||
+        ((num_desc > 0) && ((desc_len < 64) ||
+                            (len < (48 + (num_desc * desc_len)))))) {
+        if (op->verbose)
+            pr2serr("DL response malformed: len=%d, num_desc=%d, "
+                    "desc_len=%d\n", len, num_desc, desc_len);
+        return -4 - SMP_LIB_CAT_MALFORMED;
+    }
+    *desc_lenp = desc_len;
+    return num_desc;
+}
+
 /* Note that the inner attributes are output in alphabetical order. */
 /* N.B. This function has not been kept up to date. */
 static int
@@ -613,87 +643,12 @@ print_single_list(const uint8_t * rp, int len, bool show_exp_cc,
     return 0;
 }
 
-static const char * g_name[] = {"G1", "G2", "G3", "G4", "G5"};
-static const char * g_name_long[] =
-        {"G1 (1.5 Gbps)", "G2 (3 Gbps)", "G3 (6 Gbps)", "G4 (12 Gbps)",
-         "G5 (22.5 Gbps)"};
-
-/* Taken from spl5r02 SNW-3 table 70 on page 199. Note that the "Requested
- * logical link rate" field became obsolete in spl5r01 when multiplexing
- * was removed. */
 static void
 decode_phy_cap(unsigned int p_cap, const struct opts_t * op)
 {
-    bool prev_nl;
-    int k, skip;
-    unsigned int g1_g5_val, g;
-    const char * cp;
-
-    printf("    Tx SSC type: %d, Requested interleaved SPL: %d, [Req logical "
-           "lr: 0x%x]\n", ((p_cap >> 30) & 0x1), (p_cap >> 28) & 0x3,
-           (p_cap >> 24) & 0xf);
-    prev_nl = true;
-    g1_g5_val = (p_cap >> 14) & 0x3ff;
-    for (skip = 0, k = 4; k >= 0; --k) {
-        cp = op->verbose ? g_name_long[4 - k] : g_name[4 - k];
-        g = (g1_g5_val >> (k * 2)) & 0x3;
-        switch (g) {
-        case 0:
-            ++skip;
-            break;
-        case 1:
-            printf("    %s: with SSC", cp);
-            prev_nl = false;
-            break;
-        case 2:
-            printf("    %s: without SSC", cp);
-            prev_nl = false;
-            break;
-        case 3:
-            printf("    %s: with/without SSC", cp);
-            prev_nl = false;
-            break;
-        default:
-            printf("    %s: g1_g5_val=0x%x, k=%d", cp, g1_g5_val, k);
-            prev_nl = false;
-            break;
-        }
-        if ((3 == k) && (0 == skip)) {
-            printf("\n");
-            skip = 2;
-            prev_nl = true;
-        }
-        if ((1 == k) && (skip < 2)) {
-            printf("\n");
-            prev_nl = true;
-        }
-    }
-    if (! prev_nl)
-        printf("\n");
-    printf("    Extended coefficient settings: %d\n", (p_cap >> 1) & 0x1);
-}
-
-/* Returns 0 if att_cap is not more capable (speed-wise) than my_cap. If
- * att_cap can do G5 (22.5 Gbps) and my_cap can't, returns 12 (0xc). If
- * att_cap can do G4 (12 Gbps) and my_cap can't, returns 11 (0xb). If
- * att_cap can do G3 (6 Gbps) and my_cap can't, returns 10 (0xa). Stops
- * at this point and returns 0. */
-static int
-attached_phy_more_capable(unsigned int my_cap, unsigned int att_cap)
-{
-    int k;
-    unsigned int my_g1_g5_val, att_g1_g5_val, my_g, att_g;
-    unsigned int g_res = 0xc;
+    char b[256];
 
-    my_g1_g5_val = (my_cap >> 14) & 0x3ff;
-    att_g1_g5_val = (att_cap >> 14) & 0x3ff;
-    for (k = 0; k < 3; ++k, --g_res) {
-        my_g = (my_g1_g5_val >> (k * 2)) & 0x3;
-        att_g = (att_g1_g5_val >> (k * 2)) & 0x3;
-        if (att_g && (0 == my_g))
-            return g_res;
-    }
-    return 0;
+    printf("%s", smp_get_phy_cap_str(p_cap, !! op->verbose, sizeof(b), b));
 }
 
 static int
@@ -703,35 +658,34 @@ print_single(const uint8_t * rp, int len, bool just1,
     bool sas2;
     int res;
     unsigned int ui;
-    uint64_t ull = 0;
     char b[256];
+    struct smp_phy_desc pd;
 
-    if (len > 23) /* fetch my (expander's) SAS address */
-        ull = sg_get_unaligned_be64(rp + 16);
+    if (smp_decode_phy_desc(rp, len, 0, &pd)) {
+        pr2serr("DISCOVER response too short (%d bytes)\n", len);
+        return SMP_LIB_CAT_MALFORMED;
+    }
     if (just1)
         printf("Discover response%s:\n", (op->do_brief ? " (brief)" : ""));
     else
-        printf("phy identifier: %d\n", rp[9]);
+        printf("phy identifier: %d\n", pd.phy_id);
     sas2 = !! (rp[3]);          /* response length other than zero */
-    res = sg_get_unaligned_be16(rp + 4);
     if ((sas2 && (! op->do_brief)) || (op->verbose > 3)) {
-        if (op->verbose || (res > 0))
-            printf("  expander change count: %d\n", res);
+        if (op->verbose || (pd.ecc > 0))
+            printf("  expander change count: %d\n", pd.ecc);
     }
     if (just1)
-        printf("  phy identifier: %d\n", rp[9]);
-    res = ((0x70 & rp[12]) >> 4);
-    if (res < 8)
-        printf("  attached SAS device type: %s\n",
-               smp_attached_device_type[res]);
-    if ((op->do_brief > 1) && (0 == res))
+        printf("  phy identifier: %d\n", pd.phy_id);
+    printf("  attached SAS device type: %s\n",
+           smp_attached_device_type[pd.adt]);
+    if ((op->do_brief > 1) && (0 == pd.adt))
         return 0;
     if (sas2 || (op->verbose > 3))
         printf("  attached reason: %s\n",
-               smp_get_reason(0xf & rp[12], sizeof(b), b));
+               smp_get_reason(pd.att_reason, sizeof(b), b));
 
     printf("  negotiated logical link rate: %s\n",
-           smp_get_neg_xxx_link_rate(0xf & rp[13], sizeof(b), b));
+           smp_get_neg_xxx_link_rate(pd.neg_lrate, sizeof(b), b));
 
     printf("  attached initiator: ssp=%d stp=%d smp=%d sata_host=%d\n",
            !!(rp[14] & 8), !!(rp[14] & 4), !!(rp[14] & 2), (rp[14] & 1));
@@ -743,10 +697,9 @@ print_single(const uint8_t * rp, int len, bool just1,
     printf("  attached target: ssp=%d stp=%d smp=%d sata_device=%d\n",
            !!(rp[15] & 8), !!(rp[15] & 4), !!(rp[15] & 2), (rp[15] & 1));
 
-    printf("  SAS address: 0x%" PRIx64 "\n", ull);
-    printf("  attached SAS address: 0x%" PRIx64 "\n",
-           sg_get_unaligned_be64(rp + 24));
-    printf("  attached phy identifier: %d\n", rp[32]);
+    printf("  SAS address: 0x%" PRIx64 "\n", pd.sa);
+    printf("  attached SAS address: 0x%" PRIx64 "\n", pd.att_sa);
+    printf("  attached phy identifier: %d\n", pd.att_phy_id);
     if (0 == op->do_brief) {
         if (sas2 || (op->verbose > 3)) {
             printf("  attached persistent capable: %d\n", !!(rp[33] & 0x80));
@@ -762,19 +715,19 @@ print_single(const uint8_t * rp, int len, bool just1,
             printf("  attached pwr_dis capable: %d\n", !!(rp[34] & 1));
         }
         printf("  programmed minimum physical link rate: %s\n",
-               smp_get_plink_rate(((rp[40] >> 4) & 0xf), true, sizeof(b), b));
+               smp_get_plink_rate(pd.prog_min_prate, true, sizeof(b), b));
         printf("  hardware minimum physical link rate: %s\n",
-               smp_get_plink_rate((rp[40] & 0xf), false, sizeof(b), b));
+               smp_get_plink_rate(pd.hw_min_prate, false, sizeof(b), b));
         printf("  programmed maximum physical link rate: %s\n",
-               smp_get_plink_rate(((rp[41] >> 4) & 0xf), true, sizeof(b), b));
+               smp_get_plink_rate(pd.prog_max_prate, true, sizeof(b), b));
         printf("  hardware maximum physical link rate: %s\n",
-               smp_get_plink_rate((rp[41] & 0xf), false, sizeof(b), b));
-        printf("  phy change count: %d\n", rp[42]);
-        printf("  virtual phy: %d\n", !!(rp[43] & 0x80));
+               smp_get_plink_rate(pd.hw_max_prate, false, sizeof(b), b));
+        printf("  phy change count: %d\n", pd.phy_cc);
+        printf("  virtual phy: %d\n", (int)pd.virt);
         printf("  partial pathway timeout value: %d microsecs\n",
                (rp[43] & 0xf));
     }
-    res = (0xf & rp[44]);
+    res = pd.routing;
     switch (res) {
     case 0: snprintf(b, sizeof(b), "direct"); break;
     case 1: snprintf(b, sizeof(b), "subtractive"); break;
@@ -783,14 +736,13 @@ print_single(const uint8_t * rp, int len, bool just1,
     }
     printf("  routing attribute: %s\n", b);
     if (op->do_brief) {
-        if ((len > 63) && !!(rp[60] & 0x1))
-            printf("  zone group: %d\n", rp[63]);
+        if (pd.zoning_flags & 0x1)
+            printf("  zone group: %d\n", pd.zone_group);
         return 0;
     }
-    if (sas2 || (rp[45] & 0x7f)) {
+    if (sas2 || pd.conn_type) {
         printf("  connector type: %s\n",
-               smp_get_connector_type_str((rp[45] & 0x7f), true, sizeof(b),
-                                          b));
+               smp_get_connector_type_str(pd.conn_type, true, sizeof(b), b));
         printf("  connector element index: %d\n", rp[46]);
         printf("  connector physical link: %d\n", rp[47]);
         printf("  phy power condition: %s\n",
@@ -812,7 +764,7 @@ print_single(const uint8_t * rp, int len, bool just1,
     }
     if (len > 59) {
         printf("  attached device name: 0x%" PRIx64 "\n",
-               sg_get_unaligned_be64(rp + 52));
+               pd.att_dev_name);
         printf("  requested inside ZPSDS changed by expander: %d\n",
                !!(rp[60] & 0x40));
         printf("  inside ZPSDS persistent: %d\n", !!(rp[60] & 0x20));
@@ -828,24 +780,21 @@ print_single(const uint8_t * rp, int len, bool just1,
         printf("  self-configuration levels completed: %d\n", rp[65]);
         printf("  self-configuration sas address: 0x%" PRIx64 "\n",
                sg_get_unaligned_be64(rp + 68));
-        ui = sg_get_unaligned_be32(rp + 76);
-        printf("  programmed phy capabilities: 0x%x\n", ui);
+        printf("  programmed phy capabilities: 0x%x\n", pd.prog_phy_cap);
         if (op->do_cap_phy)
-            decode_phy_cap(ui, op);
-        ui = sg_get_unaligned_be32(rp + 80);
-        printf("  current phy capabilities: 0x%x\n", ui);
+            decode_phy_cap(pd.prog_phy_cap, op);
+        printf("  current phy capabilities: 0x%x\n", pd.cur_phy_cap);
         if (op->do_cap_phy)
-            decode_phy_cap(ui, op);
-        ui = sg_get_unaligned_be32(rp + 84);
-        printf("  attached phy capabilities: 0x%x\n", ui);
+            decode_phy_cap(pd.cur_phy_cap, op);
+        printf("  attached phy capabilities: 0x%x\n", pd.att_phy_cap);
         if (op->do_cap_phy)
-            decode_phy_cap(ui, op);
+            decode_phy_cap(pd.att_phy_cap, op);
     }
     if (len > 95) {
         printf("  reason: %s\n",
-               smp_get_reason((0xf0 & rp[94]) >> 4, sizeof(b), b));
+               smp_get_reason(pd.reason, sizeof(b), b));
         printf("  negotiated physical link rate: %s\n",
-               smp_get_neg_xxx_link_rate(0xf & rp[94], sizeof(b), b));
+               smp_get_neg_xxx_link_rate(pd.neg_prate, sizeof(b), b));
         printf("  optical mode enabled: %d\n", !!(rp[95] & 0x4));
         printf("  negotiated SSC: %d\n", !!(rp[95] & 0x2));
         /* hardware muxing obsolete spl5r01 */
@@ -940,30 +889,246 @@ fini:
 
 #define MAX_PHY_ID 254
 
-/* Calls do_discover() multiple times. Summarizes info into one
- * line per phy. Returns 0 if ok, else function result. */
+/* Calls do_discover() multiple times, or when the expander is SAS-2 or
+ * later, do_discover_list() once per MAX_DLIST_LONG_DESCS phys (falling
+ * back to do_discover() if that fails). Summarizes info into one line per
+ * phy. Returns 0 if ok, else function result. */
+/* Outputs one line for phy k in the style of --summary (or --multiple
+ * when do_brief is 0). len is the DISCOVER response length, fields
+ * beyond it are not shown. */
+static void
+print_1line(const struct smp_phy_desc * pdp, int k, int len, bool has_t2t,
+            const struct opts_t * op)
+{
+    bool plus;
+    int off, negot;
+    const char * cp;
+    char b[256];
+    char dsn[10] = "";
+
+    /* attached SAS device type: 0-> none, 1-> (SAS or SATA end) device,
+     * 2-> expander, 3-> fanout expander (obsolete), rest-> reserved */
+    if ((op->do_brief > 1) && (0 == pdp->adt))
+        return;
+
+    negot = pdp->neg_lrate;
+    switch(pdp->routing) {
+    case 0:
+        cp = "D";
+        break;
+    case 1:
+        cp = "S";
+        break;
+    case 2:
+        /* table routing phy when expander does t2t is Universal */
+        cp = has_t2t ? "U" : "T";
+        break;
+    case SMP_DESC_ROUTING_UNKNOWN:
+        cp = "-";       /* from sysfs */
+        break;
+    default:
+        cp = "R";
+        break;
+    }
+
+    if (op->do_dsn && (0xff != pdp->dsn))
+        sprintf(dsn, "  dsn=%d", pdp->dsn);
+
+    switch (negot) {
+    case 1:
+        printf("  phy %3d:%s:disabled%s\n", pdp->phy_id, cp, dsn);
+        return;     /* N.B. not break; finished with this line/phy */
+    case 2:
+        printf("  phy %3d:%s:reset problem%s\n", pdp->phy_id, cp, dsn);
+        return;
+    case 3:
+        printf("  phy %3d:%s:spinup hold%s\n", pdp->phy_id, cp, dsn);
+        return;
+    case 4:
+        printf("  phy %3d:%s:port selector%s\n", pdp->phy_id, cp, dsn);
+        return;
+    case 5:
+        printf("  phy %3d:%s:reset in progress%s\n", pdp->phy_id, cp, dsn);
+        return;
+    case 6:
+        printf("  phy %3d:%s:unsupported phy attached%s\n", pdp->phy_id, cp,
+               dsn);
+        return;
+    default:
+        /* keep going in this loop, probably attached to something */
+        break;
+    }
+    if ((op->do_brief > 0) && (0 == pdp->adt))
+        return;
+    if (k != pdp->phy_id)
+        pr2serr(">> requested phy_id=%d differs from response phy=%d\n",
+                k, pdp->phy_id);
+    if ((0 == pdp->adt) || (pdp->adt > 3)) {
+        printf("  phy %3d:%s:attached:[0000000000000000:00]", k, cp);
+        if ((op->do_brief > 1) || op->do_adn || (len < 64)) {
+            printf("\n");
+            return;
+        }
+        /* zoning_enabled and a zone_group other than 1 */
+        if ((pdp->zoning_flags & 0x1) && (1 != pdp->zone_group))
+            printf("  ZG:%d", pdp->zone_group);
+        if ('\0' != dsn[0])
+            printf("%s", dsn);
+        printf("\n");
+        return;
+    }
+    if (op->do_adn && (len > 59))
+        printf("  phy %3d:%s:attached:[%016" PRIx64 ":%02d %016" PRIx64
+               " %s%s", k, cp, pdp->att_sa, pdp->att_phy_id, pdp->att_dev_name,
+               smp_short_attached_device_type[pdp->adt],
+               (pdp->virt ? " V" : ""));
+    else
+        printf("  phy %3d:%s:attached:[%016" PRIx64 ":%02d %s%s", k, cp,
+               pdp->att_sa, pdp->att_phy_id,
+               smp_short_attached_device_type[pdp->adt],
+               (pdp->virt ? " V" : ""));
+    if (pdp->att_iproto & 0xf) {
+        off = 0;
+        plus = false;
+        off += snprintf(b + off, sizeof(b) - off, " i(");
+        if (pdp->att_iproto & 0x8) {
+            off += snprintf(b + off, sizeof(b) - off, "SSP");
+            plus = true;
+        }
+        if (pdp->att_iproto & 0x4) {
+            off += snprintf(b + off, sizeof(b) - off, "%sSTP",
+                            (plus ? "+" : ""));
+            plus = true;
+        }
+        if (pdp->att_iproto & 0x2) {
+            off += snprintf(b + off, sizeof(b) - off, "%sSMP",
+                            (plus ? "+" : ""));
+            plus = true;
+        }
+        if (pdp->att_iproto & 0x1) {
+            off += snprintf(b + off, sizeof(b) - off, "%sSATA",
+                            (plus ? "+" : ""));
+            plus = true;
+        }
+        printf("%s)", b);
+    }
+    if (pdp->att_tproto & 0xf) {
+        off = 0;
+        plus = false;
+        off += snprintf(b + off, sizeof(b) - off, " t(");
+        if (pdp->att_tproto & 0x80) {
+            off += snprintf(b + off, sizeof(b) - off, "PORT_SEL");
+            plus = true;
+        }
+        if (pdp->att_tproto & 0x8) {
+            off += snprintf(b + off, sizeof(b) - off, "%sSSP",
+                            (plus ? "+" : ""));
+            plus = true;
+        }
+        if (pdp->att_tproto & 0x4) {
+            off += snprintf(b + off, sizeof(b) - off, "%sSTP",
+                            (plus ? "+" : ""));
+            plus = true;
+        }
+        if (pdp->att_tproto & 0x2) {
+            off += snprintf(b + off, sizeof(b) - off, "%sSMP",
+                            (plus ? "+" : ""));
+            plus = true;
+        }
+        if (pdp->att_tproto & 0x1) {
+            off += snprintf(b + off, sizeof(b) - off, "%sSATA",
+                            (plus ? "+" : ""));
+            plus = true;
+        }
+        printf("%s)", b);
+    }
+    if ((op->do_brief > 1) || op->do_adn) {
+        printf("]");
+        if ('\0' != dsn[0])
+            printf("%s", dsn);
+        printf("\n");
+        return;
+    } else
+        printf("]");
+    switch(negot) {
+    case 8:
+        cp = "  1.5 Gbps";
+        break;
+    case 9:
+        cp = "  3 Gbps";
+        break;
+    case 0xa:
+        cp = "  6 Gbps";
+        break;
+    case 0xb:
+        cp = "  12 Gbps";
+        break;
+    case 0xc:
+        cp = "  22.5 Gbps";
+        break;
+    default:
+        cp = "";
+        break;
+    }
+    printf("%s", cp);
+    if (op->do_cap_phy && (! pdp->virt)) {
+        negot = smp_att_phy_more_capable(pdp->cur_phy_cap, pdp->att_phy_cap);
+
+        if (negot > 9) {
+            const char * speed_s[] = {"6", "12", "22.5", "??"};
+
+            printf("  [att: %s G capable]", speed_s[negot - 10]);
+        }
+    }
+    if ((pdp->zoning_flags & 0x1) && (1 != pdp->zone_group))
+        printf("  ZG:%d", pdp->zone_group);
+    if ('\0' != dsn[0])
+        printf("%s", dsn);
+    printf("\n");
+}
+
 static int
 do_multiple(struct smp_target_obj * top, const struct opts_t * op)
 {
     bool first = true;
     bool has_t2t = false;
-    bool plus, virt;
-    int len, k, num, off, negot, adt, zg;
+    bool use_dl = false;
+    int len, k, j, num, n, ecc, rg_num;
+    int dl_end = 0;
+    int dl_num = 0;
+    int dl_desc_len = 0;
     int ret = 0;
-    uint64_t ull, adn, expander_sa;
-    const char * cp;
-    char b[256];
-    char dsn[10] = "";
-    uint8_t * rp = NULL;
-    uint8_t * free_rp = NULL;
+    uint64_t expander_sa;
+    const uint8_t * rp;
+    uint8_t * dp;
+    uint8_t * d_rp = NULL;
+    uint8_t * free_d_rp = NULL;
+    uint8_t * dl_rp = NULL;
+    uint8_t * free_dl_rp = NULL;
+    struct smp_disc_cache * dcp = NULL;
+    struct smp_phy_desc pd;
 
-    rp = smp_memalign(SMP_FN_DISCOVER_RESP_LEN, 0, &free_rp, false);
-    if (NULL == rp) {
+    d_rp = smp_memalign(SMP_FN_DISCOVER_RESP_LEN, 0, &free_d_rp, false);
+    if (NULL == d_rp) {
         pr2serr("%s: heap allocation problem\n", __func__);
         return SMP_LIB_RESOURCE_ERROR;
     }
     expander_sa = 0;
-    num = get_num_phys(top, op, &has_t2t);
+    ecc = -1;
+    num = get_num_phys(top, op, &has_t2t, &use_dl, &ecc);
+    rg_num = num;
+    /* --zero implies pre SAS-2; --hex and --raw show DISCOVER responses */
+    if (op->do_zero || op->do_hex || op->do_raw)
+        use_dl = false;
+    else if (num > 0)
+        dcp = smp_disc_cache_open(top->device_name, op->sa, ecc, num,
+                                  op->ign_zp, op->verbose);
+    if (use_dl) {
+        dl_rp = smp_memalign(SMP_FN_DISCOVER_LIST_RESP_LEN, 0, &free_dl_rp,
+                             false);
+        if (NULL == dl_rp)
+            use_dl = false;
+    }
     if (num <= 0)
         num = op->do_num ? (op->phy_id + op->do_num) : MAX_PHY_ID;
     else {
@@ -976,11 +1141,75 @@ do_multiple(struct smp_target_obj * top, const struct opts_t * op)
         num = op->do_num ? (op->phy_id + op->do_num) : MAX_PHY_ID;
     }
     for (k = op->phy_id; k < num; ++k) {
-        len = do_discover(top, k, rp, SMP_FN_DISCOVER_RESP_LEN, true, op);
-        if (len < 0)
-            ret = (len < -2) ? (-4 - len) : len;
-        else
-            ret = 0;
+        rp = NULL;
+        if (dcp) {
+            if (k >= smp_disc_cache_num_phys(dcp)) {
+                ret = 0;        /* REPORT GENERAL says no more phys */
+                goto fini;
+            }
+            rp = smp_disc_cache_get_phy(dcp, k, &len);
+        }
+        if (rp)
+            ret = rp[2];        /* expander unchanged, use cached copy */
+        else {
+            if (use_dl && (k >= dl_end)) {
+                if ((rg_num > 0) && (k >= rg_num)) {
+                    ret = 0;    /* REPORT GENERAL says no more phys */
+                    goto fini;
+                }
+                /* an expander may return fewer descriptors than asked
+                 * for, the next window starts after the last one */
+                n = do_discover_list(top, k, num - k, dl_rp,
+                                     SMP_FN_DISCOVER_LIST_RESP_LEN,
+                                     &dl_desc_len, op);
+                if ((0 == n) || ((-4 - SMP_FRES_NO_PHY) == n)) {
+                    ret = 0;    /* expected, end condition */
+                    goto fini;
+                } else if (n > 0) {
+                    dl_num = n;
+                    /* window ends after phy id in its last descriptor */
+                    dl_end = dl_rp[48 + ((n - 1) * dl_desc_len) + 9] + 1;
+                    if (dl_end <= k)
+                        dl_end = k + 1;
+                    smp_disc_cache_put_dl_hdr(dcp, dl_rp);
+                } else {
+                    if (op->verbose)
+                        pr2serr("DISCOVER LIST failed at phy_id=%d, "
+                                "falling back to DISCOVER\n", k);
+                    use_dl = false;
+                }
+            }
+            dp = NULL;
+            if (use_dl) {
+                /* long descriptor has the layout of a DISCOVER response;
+                 * a phy missing from the window is fetched with DISCOVER */
+                for (j = 0; j < dl_num; ++j) {
+                    if (k == dl_rp[48 + (j * dl_desc_len) + 9]) {
+                        dp = dl_rp + 48 + (j * dl_desc_len);
+                        break;
+                    }
+                }
+            }
+            if (dp) {
+                len = 4 + (dp[3] * 4);
+                if ((len <= 4) || (len > dl_desc_len)) {
+                    len = dl_desc_len;
+                    dp[3] = (len - 4) / 4;  /* SAS-2 so expect length */
+                }
+                ret = dp[2];
+            } else {
+                dp = d_rp;
+                len = do_discover(top, k, dp, SMP_FN_DISCOVER_RESP_LEN, true,
+                                  op);
+                if (len < 0)
+                    ret = (len < -2) ? (-4 - len) : len;
+                else
+                    ret = 0;
+            }
+            rp = dp;
+            if ((0 == ret) || (SMP_FRES_PHY_VACANT == ret))
+                smp_disc_cache_put_phy(dcp, k, rp, (len > 4) ? len : 4);
+        }
         if (SMP_FRES_NO_PHY == ret) {
             ret = 0;   /* expected, end condition */
             goto fini;
@@ -989,19 +1218,24 @@ do_multiple(struct smp_target_obj * top, const struct opts_t * op)
             continue;
         } else if (ret)
             goto fini;
-        ull = sg_get_unaligned_be64(rp + 16);
+        if (smp_decode_phy_desc(rp, len, 0, &pd)) {
+            pr2serr(">> DISCOVER response for phy_id=%d too short (%d "
+                    "bytes)\n", k, len);
+            ret = SMP_LIB_CAT_MALFORMED;
+            goto fini;
+        }
         if (0 == expander_sa)
-            expander_sa = ull;
+            expander_sa = pd.sa;
         else {
-            if (ull != expander_sa) {
-                if (ull > 0) {
+            if (pd.sa != expander_sa) {
+                if (pd.sa > 0) {
                     pr2serr(">> expander's SAS address is changing?? "
                             "phy_id=%d, was=0x%" PRIx64 ", now=0x%" PRIx64
-                    "\n", rp[9], expander_sa, ull);
-                    expander_sa = ull;
+                    "\n", pd.phy_id, expander_sa, pd.sa);
+                    expander_sa = pd.sa;
                 } else if (op->verbose)
                     pr2serr(">> expander's SAS address shown as 0 at "
-                            "phy_id=%d\n", rp[9]);
+                            "phy_id=%d\n", pd.phy_id);
             }
         }
         if (first && (! op->do_raw)) {
@@ -1026,194 +1260,64 @@ do_multiple(struct smp_target_obj * top, const struct opts_t * op)
             print_single(rp, len, false, op);
             continue;
         }
-        adt = ((0x70 & rp[12]) >> 4);
-        /* attached SAS device type: 0-> none, 1-> (SAS or SATA end) device,
-         * 2-> expander, 3-> fanout expander (obsolete), rest-> reserved */
-        if ((op->do_brief > 1) && (0 == adt))
-            continue;
-
-        negot = rp[13] & 0xf;
-        switch(rp[44] & 0xf) {
-        case 0:
-            cp = "D";
-            break;
-        case 1:
-            cp = "S";
-            break;
-        case 2:
-            /* table routing phy when expander does t2t is Universal */
-            cp = has_t2t ? "U" : "T";
-            break;
-        default:
-            cp = "R";
-            break;
-        }
+        print_1line(&pd, k, len, has_t2t, op);
+    }
+fini:
+    smp_disc_cache_close(dcp, op->verbose);
+    if (free_d_rp)
+        free(free_d_rp);
+    if (free_dl_rp)
+        free(free_dl_rp);
+    return ret;
+}
 
-        if (op->do_dsn && (len > 108) && (0xff != rp[108]))
-            sprintf(dsn, "  dsn=%d", rp[108]);
+/* One line per phy output (i.e. --multiple or --summary) served from
+ * sysfs. Returns -1 if that is not possible (e.g. the expander is not in
+ * sysfs, or the options need fields sysfs lacks) so the caller should
+ * use SMP functions, else 0 or an SMP_LIB_* error. */
+static int
+do_sysfs(struct smp_target_obj * top, const struct opts_t * op)
+{
+    int k, num, end;
+    struct smp_phy_desc * pda;
 
-        switch (negot) {
-        case 1:
-            printf("  phy %3d:%s:disabled%s\n", rp[9], cp, dsn);
-            continue;   /* N.B. not break; finished with this line/phy */
-        case 2:
-            printf("  phy %3d:%s:reset problem%s\n", rp[9], cp, dsn);
-            continue;
-        case 3:
-            printf("  phy %3d:%s:spinup hold%s\n", rp[9], cp, dsn);
-            continue;
-        case 4:
-            printf("  phy %3d:%s:port selector%s\n", rp[9], cp, dsn);
-            continue;
-        case 5:
-            printf("  phy %3d:%s:reset in progress%s\n", rp[9], cp, dsn);
-            continue;
-        case 6:
-            printf("  phy %3d:%s:unsupported phy attached%s\n", rp[9], cp,
-                   dsn);
-            continue;
-        default:
-            /* keep going in this loop, probably attached to something */
-            break;
-        }
-        if ((op->do_brief > 0) && (0 == adt))
-            continue;
-        if (k != rp[9])
-            pr2serr(">> requested phy_id=%d differs from response phy=%d\n",
-                    k, rp[9]);
-        ull = sg_get_unaligned_be64(rp + 24);
-        if ((0 == adt) || (adt > 3)) {
-            printf("  phy %3d:%s:attached:[0000000000000000:00]", k, cp);
-            if ((op->do_brief > 1) || op->do_adn || (len < 64)) {
-                printf("\n");
-                continue;
-            }
-            zg = rp[63];
-            /* zoning_enabled and a zone_group other than 1 */
-            if ((rp[60] & 0x1) && (1 != zg))
-                printf("  ZG:%d", zg);
-            if ('\0' != dsn[0])
-                printf("%s", dsn);
-            printf("\n");
-            continue;
-        }
-        virt = !!(0x80 & rp[43]);
-        if (op->do_adn && (len > 59)) {
-            adn = sg_get_unaligned_be64(rp + 52);
-            printf("  phy %3d:%s:attached:[%016" PRIx64 ":%02d %016" PRIx64
-                   " %s%s", k, cp, ull, rp[32], adn,
-                   smp_short_attached_device_type[adt], (virt ? " V" : ""));
-        } else
-            printf("  phy %3d:%s:attached:[%016" PRIx64 ":%02d %s%s", k, cp,
-                   ull, rp[32], smp_short_attached_device_type[adt],
-                   (virt ? " V" : ""));
-        if (rp[14] & 0xf) {
-            off = 0;
-            plus = false;
-            off += snprintf(b + off, sizeof(b) - off, " i(");
-            if (rp[14] & 0x8) {
-                off += snprintf(b + off, sizeof(b) - off, "SSP");
-                plus = true;
-            }
-            if (rp[14] & 0x4) {
-                off += snprintf(b + off, sizeof(b) - off, "%sSTP",
-                                (plus ? "+" : ""));
-                plus = true;
-            }
-            if (rp[14] & 0x2) {
-                off += snprintf(b + off, sizeof(b) - off, "%sSMP",
-                                (plus ? "+" : ""));
-                plus = true;
-            }
-            if (rp[14] & 0x1) {
-                off += snprintf(b + off, sizeof(b) - off, "%sSATA",
-                                (plus ? "+" : ""));
-                plus = true;
-            }
-            printf("%s)", b);
-        }
-        if (rp[15] & 0xf) {
-            off = 0;
-            plus = false;
-            off += snprintf(b + off, sizeof(b) - off, " t(");
-            if (rp[15] & 0x80) {
-                off += snprintf(b + off, sizeof(b) - off, "PORT_SEL");
-                plus = true;
-            }
-            if (rp[15] & 0x8) {
-                off += snprintf(b + off, sizeof(b) - off, "%sSSP",
-                                (plus ? "+" : ""));
-                plus = true;
-            }
-            if (rp[15] & 0x4) {
-                off += snprintf(b + off, sizeof(b) - off, "%sSTP",
-                                (plus ? "+" : ""));
-                plus = true;
-            }
-            if (rp[15] & 0x2) {
-                off += snprintf(b + off, sizeof(b) - off, "%sSMP",
-                                (plus ? "+" : ""));
-                plus = true;
-            }
-            if (rp[15] & 0x1) {
-                off += snprintf(b + off, sizeof(b) - off, "%sSATA",
-                                (plus ? "+" : ""));
-                plus = true;
-            }
-            printf("%s)", b);
-        }
-        if ((op->do_brief > 1) || op->do_adn) {
-            printf("]");
-            if ('\0' != dsn[0])
-                printf("%s", dsn);
-            printf("\n");
+    if ((op->multiple > 1) || op->do_list || op->do_hex || op->do_raw ||
+        op->do_zero || op->do_adn || op->do_cap_phy || op->do_dsn) {
+        if (op->verbose)
+            pr2serr("options need fields not in sysfs, using SMP\n");
+        return -1;
+    }
+    pda = (struct smp_phy_desc *)calloc(MAX_PHY_ID, sizeof(*pda));
+    if (NULL == pda) {
+        pr2serr("%s: heap allocation problem\n", __func__);
+        return SMP_LIB_RESOURCE_ERROR;
+    }
+    num = smp_sysfs_get_phys(NULL, top, op->sa, pda, MAX_PHY_ID,
+                             op->verbose);
+    if (num < 0) {
+        if (op->verbose)
+            pr2serr("expander or its phys not in sysfs, using SMP\n");
+        free(pda);
+        return -1;
+    }
+    if (op->phy_id >= num)
+        printf("Given phy_id=%d at or beyond number of phys (%d)\n",
+               op->phy_id, num);
+    end = op->do_num ? (op->phy_id + op->do_num) : num;
+    if (end > num)
+        end = num;
+    for (k = op->phy_id; k < end; ++k) {
+        if (SMP_FRES_PHY_VACANT == pda[k].func_res) {
+            printf("  phy %3d: inaccessible (phy vacant)\n", k);
             continue;
-        } else
-            printf("]");
-        switch(negot) {
-        case 8:
-            cp = "  1.5 Gbps";
-            break;
-        case 9:
-            cp = "  3 Gbps";
-            break;
-        case 0xa:
-            cp = "  6 Gbps";
-            break;
-        case 0xb:
-            cp = "  12 Gbps";
-            break;
-        case 0xc:
-            cp = "  22.5 Gbps";
-            break;
-        default:
-            cp = "";
-            break;
         }
-        printf("%s", cp);
-        if (op->do_cap_phy && (! virt)) {
-            negot = attached_phy_more_capable(sg_get_unaligned_be32(rp + 80),
-                                              sg_get_unaligned_be32(rp + 84));
-
-            if (negot > 9) {
-                const char * speed_s[] = {"6", "12", "22.5", "??"};
-
-                printf("  [att: %s G capable]", speed_s[negot - 10]);
-            }
-        }
-        if (len > 63) {
-            zg = rp[63];
-            if ((rp[60] & 0x1) && (1 != zg))
-                printf("  ZG:%d", zg);
-        }
-        if ('\0' != dsn[0])
-            printf("%s", dsn);
-        printf("\n");
+        /* long_fmt is only set for phys fetched with DISCOVER */
+        print_1line(pda + k, k, (pda[k].long_fmt ?
+                    (SMP_FN_DISCOVER_RESP_LEN - 4) : SMP_DESC_LONG_MIN_LEN),
+                    false, op);
     }
-fini:
-    if (free_rp)
-        free(free_rp);
-    return ret;
+    free(pda);
+    return 0;
 }
 
 
@@ -1238,7 +1342,7 @@ main(int argc, char * argv[])
     while (1) {
         int option_index = 0;
 
-        c = getopt_long(argc, argv, "AbcDhHiI:lmMn:p:rs:SvVz", long_options,
+        c = getopt_long(argc, argv, "AbcDhHiI:lmMn:p:rs:SvVyz", long_options,
                         &option_index);
         if (c == -1)
             break;
@@ -1317,6 +1421,9 @@ main(int argc, char * argv[])
         case 'V':
             pr2serr("version: %s\n", version_str);
             return 0;
+        case 'y':
+            op->do_sysfs = true;
+            break;
         case 'z':
             op->do_zero = true;
             break;
@@ -1403,9 +1510,11 @@ main(int argc, char * argv[])
     if (res < 0)
         return SMP_LIB_FILE_ERROR;
 
-    if (op->multiple)
-        ret = do_multiple(&tobj, op);
-    else
+    if (op->multiple) {
+        ret = op->do_sysfs ? do_sysfs(&tobj, op) : -1;
+        if (ret < 0)
+            ret = do_multiple(&tobj, op);
+    } else
         ret = do_single(&tobj, op);
     res = smp_initiator_close(&tobj);
     if (res < 0) {
@@ -55,11 +55,27 @@
  * defined in the SPL series. The most recent SPL-5 draft is spl5r05.pdf .
  */
 
-static const char * version_str = "1.52 20260402";    /* spl5r05 */
+static const char * version_str = "1.55 20261016";    /* spl5r05 */
 
 #define MAX_DLIST_SHORT_DESCS 40
 #define MAX_DLIST_LONG_DESCS 8
+#define MAX_PHY_ID 254
 #define SMP_FN_REPORT_GENERAL_RESP_LEN 76
+#define SMP_FN_DISCOVER_LIST_RESP_LEN (1020 + 8)
+
+/* One DISCOVER LIST request and its response buffer. There are two so the
+ * next window can be in flight while the current one is decoded. */
+struct dl_win {
+    struct smp_batch_elem be;
+    struct smp_req_resp rr;
+    bool pending;               /* submitted to batch, not yet reaped */
+    bool from_cache;
+    int res;                    /* result when not pending */
+    int req_num;                /* descriptors asked for */
+    uint8_t req[32];
+    uint8_t * resp;
+    uint8_t * free_resp;
+};
 
 static struct option long_options[] = {
         {"adn", no_argument, 0, 'A'},
@@ -78,6 +94,7 @@ static struct option long_options[] = {
         {"phy", required_argument, 0, 'p'},
         {"sa", required_argument, 0, 's'},
         {"summary", no_argument, 0, 'S'},
+        {"sysfs", no_argument, 0, 'y'},
         {"raw", no_argument, 0, 'r'},
         {"verbose", no_argument, 0, 'v'},
         {"version", no_argument, 0, 'V'},
@@ -96,11 +113,13 @@ struct opts_t {
     bool phy_id_given;
     bool do_raw;
     bool do_summary;
+    bool do_sysfs;              /* -y option */
     int do_brief;
     int desc_type;              /* 0 -> full, 1 -> short format */
     int filter;
     int do_hex;
     int do_num;
+    int win;                    /* descriptors asked for per request */
     int phy_id;                 /* -p <ID> option */
     int verbose;
     uint64_t sa;
@@ -121,7 +140,8 @@ usage(void)
             "[--one]\n"
             "                          [--phy=ID] [--raw] [--sa=SAS_ADDR] "
             "[--summary]\n"
-            "                          [--verbose] [--version] [--zpi=FN]\n"
+            "                          [--sysfs] [--verbose] [--version] "
+            "[--zpi=FN]\n"
             "                          <smp_device>[,<n>]\n");
     pr2serr(
             "  where:\n"
@@ -166,6 +186,11 @@ usage(void)
             "                         equivalent to: '-o -d 1 -n 254 -b' .\n"
             "                         This option is assumed if '--phy=ID' "
             "not given\n"
+            "    --sysfs|-y           in one line per phy mode take phy "
+            "states from\n"
+            "                         sysfs (Linux), sending SMP functions "
+            "only for\n"
+            "                         what sysfs lacks\n"
             "    --verbose|-v         increase verbosity\n"
             "    --version|-V         print version string and exit\n"
             "    --zpi=FN|-Z FN       FN is file that zone phy information "
@@ -190,11 +215,12 @@ dStrRaw(const uint8_t * str, int len)
 
 /* Returns the number of phys (from REPORT GENERAL response) and if
  * t2t_routingp is non-NULL places 'Table to Table Supported' bit where it
- * points. Returns -3 (or less) -> SMP_LIB errors negated (-4 - smp_err),
- * -1 for other errors. */
+ * points. If eccp is non-NULL places the expander change count there, or
+ * -1 if the expander is configuring. Returns -3 (or less) -> SMP_LIB
+ * errors negated (-4 - smp_err), -1 for other errors. */
 static int
 get_num_phys(struct smp_target_obj * top, const struct opts_t * op,
-             bool * t2t_routingp)
+             bool * t2t_routingp, int * eccp)
 {
     int len, res, k, act_resplen;
     int ret = 0;
@@ -282,6 +308,9 @@ get_num_phys(struct smp_target_obj * top, const struct opts_t * op,
     }
     if (t2t_routingp)
         *t2t_routingp = (len > 10) ? !!(0x80 & rp[10]) : false;
+    if (eccp)
+        *eccp = ((len > 10) && (0 == (0x2 & rp[10]))) ?
+                (int)sg_get_unaligned_be16(rp + 4) : -1;
     ret = (len > 9) ? rp[9] : 0;
 fini:
     if (free_rp)
@@ -312,114 +341,31 @@ static const char * smp_short_attached_device_type[] = {
     "res",
 };
 
-static char *
-smp_get_plink_rate(int val, bool prog, int b_len, char * b)
-{
-    switch (val) {
-    case 8:
-        snprintf(b, b_len, "1.5 Gbps");
-        return b;
-    case 9:
-        snprintf(b, b_len, "3 Gbps");
-        return b;
-    case 0xa:
-        snprintf(b, b_len, "6 Gbps");
-        return b;
-    case 0xb:
-        snprintf(b, b_len, "12 Gbps");
-        return b;
-    case 0xc:
-        snprintf(b, b_len, "22.5 Gbps");
-        return b;
-    default:
-        break;
-    }
-    if (prog && (0 == val))
-        snprintf(b, b_len, "not programmable");
-    else
-        snprintf(b, b_len, "reserved [%d]", val);
-    return b;
-}
-
-static char *
-smp_get_reason(int val, int b_len, char * b)
-{
-    switch (val) {
-    case 0: snprintf(b, b_len, "unknown"); break;
-    case 1: snprintf(b, b_len, "power on"); break;
-    case 2: snprintf(b, b_len, "hard reset");
-         break;
-    case 3: snprintf(b, b_len, "SMP phy control requested");
-         break;
-    case 4: snprintf(b, b_len, "loss of dword synchronization"); break;
-    case 5:     /* hardware muxing made obsolete in spl5r01 */
-        snprintf(b, b_len, "error in multiplexing (MUX) sequence");
-        break;
-    case 6: snprintf(b, b_len, "I_T nexus loss timeout STP/SATA"); break;
-    case 7: snprintf(b, b_len, "break timeout timer expired"); break;
-    case 8: snprintf(b, b_len, "phy test function stopped"); break;
-    case 9: snprintf(b, b_len, "expander reduced functionality"); break;
-    default: snprintf(b, b_len, "reserved [%d]", val); break;
-    }
-    return b;
-}
-
-static char *
-smp_get_neg_xxx_link_rate(int val, int b_len, char * b)
-{
-    switch (val) {
-    case 0: snprintf(b, b_len, "phy enabled; unknown"); break;
-    case 1: snprintf(b, b_len, "phy disabled"); break;
-    case 2: snprintf(b, b_len, "phy enabled; speed negotiation failed");
-         break;
-    case 3: snprintf(b, b_len, "phy enabled; SATA spinup hold state");
-        break;
-    case 4: snprintf(b, b_len, "phy enabled; port selector"); break;
-    case 5: snprintf(b, b_len, "phy enabled; reset in progress"); break;
-    case 6: snprintf(b, b_len, "phy enabled; unsupported phy attached");
-        break;
-    case 8: snprintf(b, b_len, "phy enabled, 1.5 Gbps"); break;
-    case 9: snprintf(b, b_len, "phy enabled, 3 Gbps"); break;
-    case 0xa: snprintf(b, b_len, "phy enabled, 6 Gbps"); break;
-    case 0xb: snprintf(b, b_len, "phy enabled, 12 Gbps"); break;
-    case 0xc: snprintf(b, b_len, "phy enabled, 22.5 Gbps"); break;
-    default: snprintf(b, b_len, "reserved [%d]", val); break;
-    }
-    return b;
-}
-
-/* Returns 0 when successful, -1 for low level errors and > 0
-   for other error categories. */
-static int
-do_discover_list(struct smp_target_obj * top, int sphy_id,
-                 uint8_t * resp, int max_resp_len,
-                 struct opts_t * op)
+/* Builds the DISCOVER LIST request for the window starting at sphy_id in
+ * wp->req and clears the response buffer. */
+static void
+build_discover_list(struct dl_win * wp, int sphy_id, int max_resp_len,
+                    const struct opts_t * op)
 {
-    uint8_t smp_req[] = {SMP_FRAME_TYPE_REQ, SMP_FN_DISCOVER_LIST, 0, 6,
-                         0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-                         0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-                         0, 0, 0, 0, };
-    struct smp_req_resp smp_rr;
-    char b[256];
-    char * cp;
-    int len, res, k, dword_resp_len, mnum_desc, act_resplen;
+    int k, dword_resp_len;
+    uint8_t * smp_req = wp->req;
 
+    memset(smp_req, 0, sizeof(wp->req));
+    smp_req[0] = SMP_FRAME_TYPE_REQ;
+    smp_req[1] = SMP_FN_DISCOVER_LIST;
+    smp_req[3] = 6;
     dword_resp_len = (max_resp_len - 8) / 4;
     smp_req[2] = (dword_resp_len < 0x100) ? dword_resp_len : 0xff;
     smp_req[8] = sphy_id;
-    mnum_desc = op->do_num;
-    if ((0 == op->desc_type) && (mnum_desc > MAX_DLIST_LONG_DESCS))
-        mnum_desc = MAX_DLIST_LONG_DESCS;
-    if ((1 == op->desc_type) && (mnum_desc > MAX_DLIST_SHORT_DESCS))
-        mnum_desc = MAX_DLIST_SHORT_DESCS;
-    smp_req[9] = mnum_desc;
+    smp_req[9] = op->win;
     smp_req[10] = op->filter & 0xf;
     if (op->ign_zp)
         smp_req[10] |= 0x80;
     smp_req[11] = op->desc_type & 0xf;
+    wp->req_num = op->win;
     if (op->verbose) {
         pr2serr("    Discover list request: ");
-        for (k = 0; k < (int)sizeof(smp_req); ++k) {
+        for (k = 0; k < (int)sizeof(wp->req); ++k) {
             if (0 == (k % 16))
                 pr2serr("\n      ");
             else if (0 == (k % 8))
@@ -428,25 +374,38 @@ do_discover_list(struct smp_target_obj * top, int sphy_id,
         }
         pr2serr("\n");
     }
-    memset(&smp_rr, 0, sizeof(smp_rr));
-    smp_rr.request_len = sizeof(smp_req);
-    smp_rr.request = smp_req;
-    smp_rr.max_response_len = max_resp_len;
-    smp_rr.response = resp;
+    memset(&wp->rr, 0, sizeof(wp->rr));
+    wp->rr.request_len = sizeof(wp->req);
+    wp->rr.request = smp_req;
+    wp->rr.max_response_len = max_resp_len;
+    wp->rr.response = wp->resp;
+    memset(wp->resp, 0, max_resp_len);
+}
+
+/* Checks the response to the request in wp, res being what smp_send_req()
+ * returned. Returns 0 when successful, -1 for low level errors and > 0
+ * for other error categories. */
+static int
+check_discover_list(struct dl_win * wp, int res, struct opts_t * op)
+{
+    int len, act_resplen;
+    const uint8_t * smp_req = wp->req;
+    uint8_t * resp = wp->resp;
+    char b[256];
+    char * cp;
 
-    res = smp_send_req(top, &smp_rr, op->verbose);
     if (res) {
         pr2serr("smp_send_req failed, res=%d\n", res);
         if (0 == op->verbose)
             pr2serr("    try adding '-v' option for more debug\n");
         return -1;
     }
-    if (smp_rr.transport_err) {
+    if (wp->rr.transport_err) {
         pr2serr("smp_send_req transport_error=%d\n",
-                smp_rr.transport_err);
+                wp->rr.transport_err);
         return -1;
     }
-    act_resplen = smp_rr.act_response_len;
+    act_resplen = wp->rr.act_response_len;
     if ((act_resplen >= 0) && (act_resplen < 4)) {
         pr2serr("response too short, len=%d\n", act_resplen);
         return SMP_LIB_CAT_MALFORMED;
@@ -503,126 +462,223 @@ do_discover_list(struct smp_target_obj * top, int sphy_id,
     return 0;
 }
 
-static const char * g_name[] = {"G1", "G2", "G3", "G4", "G5"};
-static const char * g_name_long[] =
-        {"G1 (1.5 Gbps)", "G2 (3 Gbps)", "G3 (6 Gbps)", "G4 (12 Gbps)",
-         "G5 (22.5 Gbps)"};
+/* Builds, in resp, the DISCOVER LIST response that the expander would
+ * return, from the phy table in dcp. Short descriptors are derived
+ * from the cached long ones. Returns 0 on success, SMP_FRES_NO_PHY if
+ * sphy_id is beyond the last phy, or -1 if a phy needed is not cached. */
+static int
+cached_discover_list(const struct smp_disc_cache * dcp, int sphy_id,
+                     uint8_t * resp, int max_resp_len,
+                     const struct opts_t * op)
+{
+    int id, n, adt, mnum_desc, desc_len, off, len;
+    const uint8_t * hp;
+    const uint8_t * rp;
+    uint8_t * dp;
+
+    hp = smp_disc_cache_get_dl_hdr(dcp);
+    if (NULL == hp)
+        return -1;
+    if (sphy_id >= smp_disc_cache_num_phys(dcp))
+        return SMP_FRES_NO_PHY;
+    desc_len = op->desc_type ? 24 : 120;
+    mnum_desc = op->win;
+    n = (max_resp_len - 48 - 4) / desc_len;
+    if (mnum_desc > n)
+        mnum_desc = n;
+    memset(resp, 0, max_resp_len);
+    memcpy(resp, hp, SMP_DISC_CACHE_DL_HDR_LEN);
+    for (n = 0, id = sphy_id, off = 48;
+         (id < smp_disc_cache_num_phys(dcp)) && (n < mnum_desc); ++id) {
+        rp = smp_disc_cache_get_phy(dcp, id, &len);
+        if (NULL == rp)
+            return -1;
+        adt = (0x70 & rp[12]) >> 4;
+        if (SMP_FRES_PHY_VACANT == rp[2]) {
+            if (0 != op->filter)
+                continue;
+        } else if (((1 == op->filter) && (2 != adt) && (3 != adt)) ||
+                   ((2 == op->filter) && ((adt < 1) || (adt > 3))) ||
+                   ((3 == op->filter) && (1 != adt)))
+            continue;
+        dp = resp + off;
+        if (0 == op->desc_type)
+            memcpy(dp, rp, (len < desc_len) ? len : desc_len);
+        else {  /* abridged (short) descriptor from long one */
+            dp[0] = id;
+            dp[1] = rp[2];
+            if (SMP_FRES_PHY_VACANT != rp[2]) {
+                dp[2] = rp[12];
+                dp[3] = rp[13];
+                dp[4] = rp[14];
+                dp[5] = rp[15];
+                dp[6] = (0x80 & rp[43]) | (0xf & rp[44]);
+                dp[7] = rp[94];
+                dp[8] = rp[63];
+                dp[9] = rp[60];
+                dp[10] = rp[32];
+                dp[11] = rp[42];
+                memcpy(dp + 12, rp + 24, 8);
+            }
+        }
+        off += desc_len;
+        ++n;
+    }
+    resp[0] = SMP_FRAME_TYPE_RESP;
+    resp[1] = SMP_FN_DISCOVER_LIST;
+    resp[2] = 0;
+    resp[3] = (off - 4) / 4;
+    resp[8] = sphy_id;
+    resp[9] = n;
+    resp[10] = (resp[10] & 0xf0) | (op->filter & 0xf);
+    resp[11] = (resp[11] & 0xf0) | (op->desc_type & 0xf);
+    resp[12] = desc_len / 4;
+    if (op->verbose > 1)
+        pr2serr("    Discover list at phy_id=%d: %d descriptors from "
+                "cache\n", sphy_id, n);
+    return 0;
+}
 
-/* Taken from spl5r02 SNW-3 table 70 on page 199. Note that the "Requested
- * logical link rate" field became obsolete in spl5r01 when multiplexing
- * was removed. */
+/* Adds the long descriptors of an all phys DISCOVER LIST response to the
+ * phy table in dcp. */
 static void
-decode_phy_cap(unsigned int p_cap, const struct opts_t * op)
+cache_discover_list(struct smp_disc_cache * dcp, const uint8_t * resp)
 {
-    bool prev_nl;
-    int k, skip;
-    unsigned int g15_val, g;
-    const char * cp;
+    int k, num_desc, desc_len, len;
+    const uint8_t * rp;
+    uint8_t d[SMP_DISC_CACHE_SLOT_LEN];
 
-    printf("    Tx SSC type: %d, Requested interleaved SPL: %d, [Req logical "
-           "lr: 0x%x]\n", ((p_cap >> 30) & 0x1), (p_cap >> 28) & 0x3,
-           (p_cap >> 24) & 0xf);
-    prev_nl = true;
-    g15_val = (p_cap >> 14) & 0x3ff;
-    for (skip = 0, k = 4; k >= 0; --k) {
-        cp = op->verbose ? g_name_long[4 - k] : g_name[4 - k];
-        g = (g15_val >> (k * 2)) & 0x3;
-        switch (g) {
-        case 0:
-            ++skip;
-            break;
-        case 1:
-            printf("    %s: with SSC", cp);
-            prev_nl = false;
-            break;
-        case 2:
-            printf("    %s: without SSC", cp);
-            prev_nl = false;
-            break;
-        case 3:
-            printf("    %s: with/without SSC", cp);
-            prev_nl = false;
-            break;
-        default:
-            printf("    %s: g15_val=0x%x, k=%d", cp, g15_val, k);
-            prev_nl = false;
-            break;
-        }
-        if ((3 == k) && (0 == skip)) {
-            printf("\n");
-            skip = 2;
-            prev_nl = true;
-        }
-        if ((1 == k) && (skip < 2)) {
-            printf("\n");
-            prev_nl = true;
+    if ((NULL == dcp) || (0 != (resp[10] & 0xf)) ||
+        (0 != (resp[11] & 0xf)))
+        return;
+    num_desc = resp[9];
+    desc_len = resp[12] * 4;
+    if ((desc_len < 64) || (desc_len > SMP_DISC_CACHE_SLOT_LEN))
+        return;
+    smp_disc_cache_put_dl_hdr(dcp, resp);
+    for (k = 0; k < num_desc; ++k) {
+        rp = resp + 48 + (k * desc_len);
+        if (rp[2] && (SMP_FRES_PHY_VACANT != rp[2]))
+            continue;
+        len = 4 + (rp[3] * 4);
+        if ((len > 4) && (len <= desc_len))
+            smp_disc_cache_put_phy(dcp, rp[9], rp, len);
+        else {  /* descriptor may not carry its length, fill it in */
+            memcpy(d, rp, desc_len);
+            d[3] = (desc_len - 4) / 4;
+            smp_disc_cache_put_phy(dcp, rp[9], d, desc_len);
         }
     }
-    if (! prev_nl)
-        printf("\n");
-    printf("    Extended coefficient settings: %d\n", (p_cap >> 1) & 0x1);
 }
 
-/* Returns 0 if att_cap is not more capable (speed-wise) than my_cap. If
- * att_cap can do G5 (22.5 Gbps) and my_cap can't, returns 12 (0xc). If
- * att_cap can do G4 (12 Gbps) and my_cap can't, returns 11 (0xb). If
- * att_cap can do G3 (6 Gbps) and my_cap can't, returns 10 (0xa). Stops
- * at this point and returns 0. */
+/* Starts fetching the window of descriptors beginning at sphy_id into wp:
+ * from the cache if it holds them, else by submitting a DISCOVER LIST
+ * request to bp so it is in flight while the caller decodes the previous
+ * window. If bp is NULL the request is sent synchronously. */
+static void
+start_window(struct smp_batch * bp, struct smp_target_obj * top,
+             struct smp_disc_cache * dcp, struct dl_win * wp, int sphy_id,
+             struct opts_t * op)
+{
+    const int resp_sz = SMP_FN_DISCOVER_LIST_RESP_LEN;
+
+    wp->pending = false;
+    wp->from_cache = false;
+    wp->req_num = op->win;
+    wp->res = dcp ? cached_discover_list(dcp, sphy_id, wp->resp, resp_sz,
+                                         op) : -1;
+    if (wp->res >= 0) {
+        wp->from_cache = true;
+        return;
+    }
+    build_discover_list(wp, sphy_id, resp_sz, op);
+    wp->be.tobj = top;
+    wp->be.rresp = &wp->rr;
+    wp->be.user_p = wp;
+    if (bp && (0 == smp_batch_submit(bp, &wp->be))) {
+        wp->pending = true;
+        return;
+    }
+    wp->res = check_discover_list(wp, smp_send_req(top, &wp->rr,
+                                                   op->verbose), op);
+    if ((0 == wp->res) && (0 == op->desc_type))
+        cache_discover_list(dcp, wp->resp);
+}
+
+/* Waits for the window in wp to be fetched. Returns 0 when successful, -1
+ * for low level errors and > 0 for other error categories. */
 static int
-attached_phy_more_capable(unsigned int my_cap, unsigned int att_cap)
+finish_window(struct smp_batch * bp, struct smp_disc_cache * dcp,
+              struct dl_win * wp, struct opts_t * op)
 {
-    int k;
-    unsigned int my_g1_g5_val, att_g1_g5_val, my_g, att_g;
-    unsigned int g_res = 0xc;
+    struct smp_batch_elem * bep;
 
-    my_g1_g5_val = (my_cap >> 14) & 0x3ff;
-    att_g1_g5_val = (att_cap >> 14) & 0x3ff;
-    for (k = 0; k < 3; ++k, --g_res) {
-        my_g = (my_g1_g5_val >> (k * 2)) & 0x3;
-        att_g = (att_g1_g5_val >> (k * 2)) & 0x3;
-        if (att_g && (0 == my_g))
-            return g_res;
+    if (! wp->pending)
+        return wp->res;
+    /* at most one request is outstanding, so this is the one reaped */
+    bep = smp_batch_reap(bp, true);
+    wp->pending = false;
+    if (bep != &wp->be) {
+        pr2serr("%s: lost DISCOVER LIST request\n", __func__);
+        return -1;
     }
-    return 0;
+    wp->res = check_discover_list(wp, bep->res, op);
+    if ((0 == wp->res) && (0 == op->desc_type))
+        cache_discover_list(dcp, wp->resp);
+    return wp->res;
 }
 
-/* long format: as described in (full, single) DISCOVER response
- * Returns 0 for okay, else -1 . */
+static void
+decode_phy_cap(unsigned int p_cap, const struct opts_t * op)
+{
+    char b[256];
+
+    printf("%s", smp_get_phy_cap_str(p_cap, !! op->verbose, sizeof(b), b));
+}
+
+/* long format: as described in (full, single) DISCOVER response. The
+ * descriptor is desc_len bytes long, as given in the response header (its
+ * own length byte is zero when the phy is vacant). Returns 0 for okay,
+ * else -1 . */
 static int
-decode_desc0_multiline(const uint8_t * rp, int hdr_ecc, struct opts_t * op)
+decode_desc0_multiline(const uint8_t * rp, int desc_len, int hdr_ecc,
+                       struct opts_t * op)
 {
     unsigned int ui;
-    int func_res, phy_id, ecc, adt, route_attr, len;
+    int route_attr, len;
     char b[256];
+    struct smp_phy_desc pd;
 
-    phy_id = rp[9];
-    func_res = rp[2];
-    len = 4 + (rp[3] * 4);        /* length in bytes, excluding 4 byte CRC */
-    printf("  phy identifier: %d\n", phy_id);
-    if (SMP_FRES_PHY_VACANT == func_res) {
+    printf("  phy identifier: %d\n", rp[9]);
+    if (SMP_FRES_PHY_VACANT == rp[2]) {
         printf("  inaccessible (phy vacant)\n");
         return 0;
-    } else if (func_res) {
+    }
+    len = 4 + (rp[3] * 4);        /* length in bytes, excluding 4 byte CRC */
+    if ((len <= 4) || (len > desc_len))
+        len = desc_len;
+    if (smp_decode_phy_desc(rp, len, 0, &pd)) {
+        printf("  >>> descriptor too short (%d bytes)\n", len);
+        return -1;
+    }
+    if (pd.func_res) {
         printf("  >>> function result: %s\n",
-               smp_get_func_res_str(func_res, sizeof(b), b));
+               smp_get_func_res_str(pd.func_res, sizeof(b), b));
         return -1;
     }
-    ecc = sg_get_unaligned_be16(rp + 4);
-    if ((0 != ecc) && (hdr_ecc != ecc))
+    if ((0 != pd.ecc) && (hdr_ecc != pd.ecc))
         printf("  >>> expander change counts differ, header: %d, this phy: "
-        "%d\n", hdr_ecc, ecc);
-    adt = ((0x70 & rp[12]) >> 4);
-    if (adt < 8)
-        printf("  attached SAS device type: %s\n",
-               smp_attached_device_type[adt]);
-    if ((op->do_brief > 1) && (0 == adt))
+        "%d\n", hdr_ecc, pd.ecc);
+    printf("  attached SAS device type: %s\n",
+           smp_attached_device_type[pd.adt]);
+    if ((op->do_brief > 1) && (0 == pd.adt))
         return 0;
     if (0 == op->do_brief)
         printf("  attached reason: %s\n",
-               smp_get_reason(0xf & rp[12], sizeof(b), b));
+               smp_get_reason(pd.att_reason, sizeof(b), b));
 
     printf("  negotiated logical link rate: %s\n",
-           smp_get_neg_xxx_link_rate(0xf & rp[13], sizeof(b), b));
+           smp_get_neg_xxx_link_rate(pd.neg_lrate, sizeof(b), b));
     printf("  attached initiator: ssp=%d stp=%d smp=%d sata_host=%d\n",
            !!(rp[14] & 8), !!(rp[14] & 4), !!(rp[14] & 2), (rp[14] & 1));
     if (0 == op->do_brief) {
@@ -632,10 +688,9 @@ decode_desc0_multiline(const uint8_t * rp, int hdr_ecc, struct opts_t * op)
     printf("  attached target: ssp=%d stp=%d smp=%d sata_device=%d\n",
            !!(rp[15] & 8), !!(rp[15] & 4), !!(rp[15] & 2), (rp[15] & 1));
 
-    printf("  SAS address: 0x%" PRIx64 "\n", sg_get_unaligned_be64(rp + 16));
-    printf("  attached SAS address: 0x%" PRIx64 "\n",
-           sg_get_unaligned_be64(rp + 24));
-    printf("  attached phy identifier: %d\n", rp[32]);
+    printf("  SAS address: 0x%" PRIx64 "\n", pd.sa);
+    printf("  attached SAS address: 0x%" PRIx64 "\n", pd.att_sa);
+    printf("  attached phy identifier: %d\n", pd.att_phy_id);
     if (0 == op->do_brief) {
         printf("  attached persistent capable: %d\n", !!(rp[33] & 0x80));
         printf("  attached power capable: %d\n", ((rp[33] >> 5) & 0x3));
@@ -648,22 +703,19 @@ decode_desc0_multiline(const uint8_t * rp, int hdr_ecc, struct opts_t * op)
         printf("  attached smp priority capable: %d\n", !!(rp[34] & 2));
         printf("  attached pwr_dis capable: %d\n", !!(rp[34] & 1));
         printf("  programmed minimum physical link rate: %s\n",
-               smp_get_plink_rate(((rp[40] >> 4) & 0xf), true,
-                                  sizeof(b), b));
+               smp_get_plink_rate(pd.prog_min_prate, true, sizeof(b), b));
         printf("  hardware minimum physical link rate: %s\n",
-               smp_get_plink_rate((rp[40] & 0xf), false, sizeof(b), b));
+               smp_get_plink_rate(pd.hw_min_prate, false, sizeof(b), b));
         printf("  programmed maximum physical link rate: %s\n",
-               smp_get_plink_rate(((rp[41] >> 4) & 0xf), true,
-                                  sizeof(b), b));
+               smp_get_plink_rate(pd.prog_max_prate, true, sizeof(b), b));
         printf("  hardware maximum physical link rate: %s\n",
-               smp_get_plink_rate((rp[41] & 0xf), false,
-                                  sizeof(b), b));
-        printf("  phy change count: %d\n", rp[42]);
-        printf("  virtual phy: %d\n", !!(rp[43] & 0x80));
+               smp_get_plink_rate(pd.hw_max_prate, false, sizeof(b), b));
+        printf("  phy change count: %d\n", pd.phy_cc);
+        printf("  virtual phy: %d\n", (int)pd.virt);
         printf("  partial pathway timeout value: %d us\n",
                (rp[43] & 0xf));
     }
-    route_attr = (0xf & rp[44]);
+    route_attr = pd.routing;
     switch (route_attr) {
     case 0: snprintf(b, sizeof(b), "direct"); break;
     case 1: snprintf(b, sizeof(b), "subtractive"); break;
@@ -672,12 +724,12 @@ decode_desc0_multiline(const uint8_t * rp, int hdr_ecc, struct opts_t * op)
     }
     printf("  routing attribute: %s\n", b);
     if (op->do_brief) {
-        if ((len > 59) && (rp[60] & 0x1))
-            printf("  zone group: %d\n", rp[63]);
+        if (pd.zoning_flags & 0x1)
+            printf("  zone group: %d\n", pd.zone_group);
         return 0;
     }
     printf("  connector type: %s\n",
-           smp_get_connector_type_str((rp[45] & 0x7f), true, sizeof(b), b));
+           smp_get_connector_type_str(pd.conn_type, true, sizeof(b), b));
     printf("  connector element index: %d\n", rp[46]);
     printf("  connector physical link: %d\n", rp[47]);
     printf("  phy power condition: %s\n",
@@ -696,7 +748,7 @@ decode_desc0_multiline(const uint8_t * rp, int hdr_ecc, struct opts_t * op)
     printf("  sata partial enabled: %d\n", !!(rp[49] & 0x1));
     if (len > 59) {
         printf("  attached device name: 0x%" PRIx64 "\n",
-               sg_get_unaligned_be64(rp + 52));
+               pd.att_dev_name);
         printf("  requested inside ZPSDS changed by expander: %d\n",
                !!(rp[60] & 0x40));
         printf("  inside ZPSDS persistent: %d\n", !!(rp[60] & 0x20));
@@ -712,24 +764,21 @@ decode_desc0_multiline(const uint8_t * rp, int hdr_ecc, struct opts_t * op)
         printf("  self-configuration levels completed: %d\n", rp[65]);
         printf("  self-configuration sas address: 0x%" PRIx64 "\n",
                sg_get_unaligned_be64(rp + 68));
-        ui = sg_get_unaligned_be32(rp + 76);
-        printf("  programmed phy capabilities: 0x%x\n", ui);
+        printf("  programmed phy capabilities: 0x%x\n", pd.prog_phy_cap);
         if (op->do_cap_phy)
-            decode_phy_cap(ui, op);
-        ui = sg_get_unaligned_be32(rp + 80);
-        printf("  current phy capabilities: 0x%x\n", ui);
+            decode_phy_cap(pd.prog_phy_cap, op);
+        printf("  current phy capabilities: 0x%x\n", pd.cur_phy_cap);
         if (op->do_cap_phy)
-            decode_phy_cap(ui, op);
-        ui = sg_get_unaligned_be32(rp + 84);
-        printf("  attached phy capabilities: 0x%x\n", ui);
+            decode_phy_cap(pd.cur_phy_cap, op);
+        printf("  attached phy capabilities: 0x%x\n", pd.att_phy_cap);
         if (op->do_cap_phy)
-            decode_phy_cap(ui, op);
+            decode_phy_cap(pd.att_phy_cap, op);
     }
     if (len > 95) {
         printf("  reason: %s\n",
-               smp_get_reason((0xf0 & rp[94]) >> 4, sizeof(b), b));
+               smp_get_reason(pd.reason, sizeof(b), b));
         printf("  negotiated physical link rate: %s\n",
-               smp_get_neg_xxx_link_rate(0xf & rp[94], sizeof(b), b));
+               smp_get_neg_xxx_link_rate(pd.neg_prate, sizeof(b), b));
         printf("  optical mode enabled: %d\n", !!(rp[95] & 0x4));
         printf("  negotiated SSC: %d\n", !!(rp[95] & 0x2));
         /* hardware muxing made obsolete in spl5r01 */
@@ -776,31 +825,29 @@ decode_desc0_multiline(const uint8_t * rp, int hdr_ecc, struct opts_t * op)
 static int
 decode_desc1_multiline(const uint8_t * rp, bool z_enabled, struct opts_t * op)
 {
-    int func_res, phy_id, adt, route_attr;
+    int route_attr;
     char b[256];
+    struct smp_phy_desc pd;
 
-    phy_id = rp[0];
-    func_res = rp[1];
-    printf("  phy identifier: %d\n", phy_id);
-    if (SMP_FRES_PHY_VACANT == func_res) {
+    smp_decode_phy_desc(rp, SMP_DESC_SHORT_LEN, 1, &pd);
+    printf("  phy identifier: %d\n", pd.phy_id);
+    if (SMP_FRES_PHY_VACANT == pd.func_res) {
         printf("  inaccessible (phy vacant)\n");
         return 0;
-    } else if (func_res) {
+    } else if (pd.func_res) {
         printf("  >>> function result: %s\n",
-               smp_get_func_res_str(func_res, sizeof(b), b));
+               smp_get_func_res_str(pd.func_res, sizeof(b), b));
         return -1;
     }
-    adt = ((0x70 & rp[2]) >> 4);
-    if (adt < 8)
-        printf("  attached SAS device type: %s\n",
-               smp_attached_device_type[adt]);
-    if ((op->do_brief > 1) && (0 == adt))
+    printf("  attached SAS device type: %s\n",
+           smp_attached_device_type[pd.adt]);
+    if ((op->do_brief > 1) && (0 == pd.adt))
         return 0;
     if (0 == op->do_brief)
         printf("  attached reason: %s\n",
-               smp_get_reason(0xf & rp[2], sizeof(b), b));
+               smp_get_reason(pd.att_reason, sizeof(b), b));
     printf("  negotiated logical link rate: %s\n",
-           smp_get_neg_xxx_link_rate(0xf & rp[3], sizeof(b), b));
+           smp_get_neg_xxx_link_rate(pd.neg_lrate, sizeof(b), b));
 
     printf("  attached initiator: ssp=%d stp=%d smp=%d sata_host=%d\n",
            !!(rp[4] & 8), !!(rp[4] & 4), !!(rp[4] & 2), (rp[4] & 1));
@@ -810,13 +857,12 @@ decode_desc1_multiline(const uint8_t * rp, bool z_enabled, struct opts_t * op)
            !!(rp[5] & 8), !!(rp[5] & 4), !!(rp[5] & 2), (rp[5] & 1));
 
     if (0 == op->do_brief)
-        printf("  virtual phy: %d\n", !!(rp[6] & 0x80));
-    printf("  attached SAS address: 0x%" PRIx64 "\n",
-           sg_get_unaligned_be64(rp + 12));
-    printf("  attached phy identifier: %d\n", rp[10]);
+        printf("  virtual phy: %d\n", (int)pd.virt);
+    printf("  attached SAS address: 0x%" PRIx64 "\n", pd.att_sa);
+    printf("  attached phy identifier: %d\n", pd.att_phy_id);
     if (0 == op->do_brief)
-        printf("  phy change count: %d\n", rp[11]);
-    route_attr = (0xf & rp[6]);
+        printf("  phy change count: %d\n", pd.phy_cc);
+    route_attr = pd.routing;
     switch (route_attr) {
     case 0: snprintf(b, sizeof(b), "direct"); break;
     case 1: snprintf(b, sizeof(b), "subtractive"); break;
@@ -826,14 +872,13 @@ decode_desc1_multiline(const uint8_t * rp, bool z_enabled, struct opts_t * op)
     printf("  routing attribute: %s\n", b);
     if (op->do_brief) {
         if (z_enabled)
-            printf("  zone group: %d\n", rp[8]);
+            printf("  zone group: %d\n", pd.zone_group);
         return 0;
     }
-    printf("  reason: %s\n", smp_get_reason(0xf & (rp[7] >> 4),
-                                            sizeof(b), b));
+    printf("  reason: %s\n", smp_get_reason(pd.reason, sizeof(b), b));
     printf("  negotiated physical link rate: %s\n",
-           smp_get_neg_xxx_link_rate(0xf & rp[7], sizeof(b), b));
-    printf("  zone group: %d\n", rp[8]);
+           smp_get_neg_xxx_link_rate(pd.neg_prate, sizeof(b), b));
+    printf("  zone group: %d\n", pd.zone_group);
     printf("  inside ZPSDS persistent: %d\n", !!(rp[9] & 0x20));
     printf("  requested inside ZPSDS: %d\n", !!(rp[9] & 0x10));
     /* printf("  zone address resolved: %d\n", !!(rp[9] & 0x8)); */
@@ -846,81 +891,32 @@ decode_desc1_multiline(const uint8_t * rp, bool z_enabled, struct opts_t * op)
 /* Decodes either descriptor type into one line output. This is a
  * "per phy" function. Returns 0 for ok, 1 for ok plus zoning enabled and
   * seen ZG other than 1, else -1 (for problem) . */
+/* Outputs one line for a phy. desc is the descriptor type the fields in
+ * *pdp came from. Returns -1 for a bad function result, 1 if a zone
+ * group other than 1 is shown, else 0. */
 static int
-decode_1line(const uint8_t * rp, int len, int desc, bool z_enabled,
-             int has_t2t, struct opts_t * op)
+print_1line(const struct smp_phy_desc * pdp, int desc, bool z_enabled,
+            int has_t2t, struct opts_t * op)
 {
-    bool plus, virt;
+    bool plus;
     bool zg_not1 = true;
-    int phy_id, off, negot, adt, route_attr, asa_off;
-    int func_res, aphy_id, a_init, a_target, z_group, iz_mask;
-    unsigned int my_cap, att_cap;
-    uint64_t ull, adn;
+    int off, negot;
     const char * cp;
     char b[256];
     char dsn[10] = "";
 
-    switch (desc) {
-    case 0:     /* longer descriptor */
-        phy_id = rp[9];
-        func_res = rp[2];
-        adt = ((0x70 & rp[12]) >> 4);
-        negot = rp[13] & 0xf;
-        route_attr = rp[44] & 0xf;
-        virt = !!(rp[43] & 0x80);
-        my_cap = sg_get_unaligned_be32(rp + 80);
-        att_cap = sg_get_unaligned_be32(rp + 84);
-        asa_off = 24;
-        aphy_id = rp[32];
-        a_init = rp[14];
-        a_target = rp[15];
-        z_group = rp[63];
-        iz_mask = rp[60];
-        break;
-    case 1:     /* abridged 24 byte descriptor [short] */
-        phy_id = rp[0];
-        func_res = rp[1];
-        adt = ((0x70 & rp[2]) >> 4);
-        negot = rp[3] & 0xf;
-        route_attr = rp[6] & 0xf;
-        virt = !!(rp[6] & 0x80);
-        my_cap = 0;
-        att_cap = 0;
-        asa_off = 12;
-        aphy_id = rp[10];
-        a_init = rp[4];
-        a_target = rp[5];
-        z_group = rp[8];
-        iz_mask = rp[9];
-        break;
-    default:
-        pr2serr("  Unknown descriptor type %d\n", desc);
-        return -1;
-    }
-    if (op->zpi_fn) {
-        if (func_res && (SMP_FRES_PHY_VACANT != func_res)) {
-            pr2serr("  >>> function result: %s\n",
-                    smp_get_func_res_str(func_res, sizeof(b), b));
-            return -1;
-        }
-        snprintf(b, sizeof(b) - 1, "%x,%x,0,%x\n", phy_id, iz_mask & 0x34,
-                 z_group);
-        b[sizeof(b) - 1] = '\0';
-        fprintf(op->zpi_filep, "%s", b);
-        return 0;
-    }
-    if (SMP_FRES_PHY_VACANT == func_res) {
-        printf("  phy %3d: inaccessible (phy vacant)\n", phy_id);
+    if (SMP_FRES_PHY_VACANT == pdp->func_res) {
+        printf("  phy %3d: inaccessible (phy vacant)\n", pdp->phy_id);
         return 0;
-    } else if (func_res) {
-        printf("  phy %3d: function result: %s\n", phy_id,
-               smp_get_func_res_str(func_res, sizeof(b), b));
+    } else if (pdp->func_res) {
+        printf("  phy %3d: function result: %s\n", pdp->phy_id,
+               smp_get_func_res_str(pdp->func_res, sizeof(b), b));
         return -1;
     }
-    if ((0 == op->verbose) && (0 == adt) && (op->do_brief > 1))
+    if ((0 == op->verbose) && (0 == pdp->adt) && (op->do_brief > 1))
         return 0;
 
-    switch (route_attr) {
+    switch (pdp->routing) {
     case 0:
         cp = "D";
         break;
@@ -930,113 +926,119 @@ decode_1line(const uint8_t * rp, int len, int desc, bool z_enabled,
     case 2:     /* table routing phy when expander does t2t is Universal */
         cp = has_t2t ? "U" : "T";
         break;
+    case SMP_DESC_ROUTING_UNKNOWN:
+        cp = "-";       /* from sysfs */
+        break;
     default:
         cp = "R";
         break;
     }
 
-    if (op->do_dsn && (0 == desc) && (len > 108) && (0xff != rp[108]))
-        sprintf(dsn, "  dsn=%d", rp[108]);
+    if (op->do_dsn && (0xff != pdp->dsn))
+        sprintf(dsn, "  dsn=%d", pdp->dsn);
 
+    negot = pdp->neg_lrate;
     switch (negot) {
     case 1:
-        printf("  phy %3d:%s:disabled%s\n", phy_id, cp, dsn);
+        printf("  phy %3d:%s:disabled%s\n", pdp->phy_id, cp, dsn);
         return 0;
     case 2:
-        printf("  phy %3d:%s:reset problem%s\n", phy_id, cp, dsn);
+        printf("  phy %3d:%s:reset problem%s\n", pdp->phy_id, cp, dsn);
         return 0;
     case 3:
-        printf("  phy %3d:%s:spinup hold%s\n", phy_id, cp, dsn);
+        printf("  phy %3d:%s:spinup hold%s\n", pdp->phy_id, cp, dsn);
         return 0;
     case 4:
-        printf("  phy %3d:%s:port selector%s\n", phy_id, cp, dsn);
+        printf("  phy %3d:%s:port selector%s\n", pdp->phy_id, cp, dsn);
         return 0;
     case 5:
-        printf("  phy %3d:%s:reset in progress%s\n", phy_id, cp, dsn);
+        printf("  phy %3d:%s:reset in progress%s\n", pdp->phy_id, cp, dsn);
         return 0;
     case 6:
-        printf("  phy %3d:%s:unsupported phy attached%s\n", phy_id, cp, dsn);
+        printf("  phy %3d:%s:unsupported phy attached%s\n", pdp->phy_id, cp,
+               dsn);
         return 0;
     default:
         /* keep going */
         break;
     }
-    if ((0 == op->verbose) && (0 == adt) && op->do_brief)
+    if ((0 == op->verbose) && (0 == pdp->adt) && op->do_brief)
         return 0;
-    ull = sg_get_unaligned_be64(rp + asa_off);
-    if ((0 == adt) || (adt > 3)) {
-        printf("  phy %3d:%s:attached:[0000000000000000:00]", phy_id, cp);
+    if ((0 == pdp->adt) || (pdp->adt > 3)) {
+        printf("  phy %3d:%s:attached:[0000000000000000:00]", pdp->phy_id,
+               cp);
         if ((op->do_brief > 1) || op->do_adn) {
             printf("\n");
             return 0;
         }
-        if (z_enabled && (1 != z_group)) {
+        if (z_enabled && (1 != pdp->zone_group)) {
             zg_not1 = true;
-            printf("  ZG:%d", z_group);
+            printf("  ZG:%d", pdp->zone_group);
         }
         if ('\0' != dsn[0])
              printf("%s", dsn);
         printf("\n");
         return (int)zg_not1;
     }
-    if ((0 == desc) && op->do_adn) {
-        adn = sg_get_unaligned_be64(rp + 52);
+    if ((0 == desc) && op->do_adn)
         printf("  phy %3d:%s:attached:[%016" PRIx64 ":%02d %016" PRIx64
-               " %s%s", phy_id, cp, ull, aphy_id, adn,
-               smp_short_attached_device_type[adt], (virt ? " V" : ""));
-    } else
-        printf("  phy %3d:%s:attached:[%016" PRIx64 ":%02d %s%s", phy_id, cp,
-               ull, aphy_id, smp_short_attached_device_type[adt],
-               (virt ? " V" : ""));
-    if (a_init & 0xf) {
+               " %s%s", pdp->phy_id, cp, pdp->att_sa, pdp->att_phy_id,
+               pdp->att_dev_name, smp_short_attached_device_type[pdp->adt],
+               (pdp->virt ? " V" : ""));
+    else
+        printf("  phy %3d:%s:attached:[%016" PRIx64 ":%02d %s%s", pdp->phy_id,
+               cp, pdp->att_sa, pdp->att_phy_id,
+               smp_short_attached_device_type[pdp->adt],
+               (pdp->virt ? " V" : ""));
+    if (pdp->att_iproto & 0xf) {
         off = 0;
         plus = false;
         off += snprintf(b + off, sizeof(b) - off, " i(");
-        if (a_init & 0x8) {
+        if (pdp->att_iproto & 0x8) {
             off += snprintf(b + off, sizeof(b) - off, "SSP");
             plus = true;
         }
-        if (a_init & 0x4) {
+        if (pdp->att_iproto & 0x4) {
             off += snprintf(b + off, sizeof(b) - off, "%sSTP",
                             (plus ? "+" : ""));
             plus = true;
         }
-        if (a_init & 0x2) {
+        if (pdp->att_iproto & 0x2) {
             off += snprintf(b + off, sizeof(b) - off, "%sSMP",
                             (plus ? "+" : ""));
             plus = true;
         }
-        if (a_init & 0x1) {
+        if (pdp->att_iproto & 0x1) {
             off += snprintf(b + off, sizeof(b) - off, "%sSATA",
                             (plus ? "+" : ""));
             plus = true;
         }
         printf("%s)", b);
     }
-    if (a_target & 0xf) {
+    if (pdp->att_tproto & 0xf) {
         off = 0;
         plus = false;
         off += snprintf(b + off, sizeof(b) - off, " t(");
-        if (a_target & 0x80) {
+        if (pdp->att_tproto & 0x80) {
             off += snprintf(b + off, sizeof(b) - off, "PORT_SEL");
             plus = true;
         }
-        if (a_target & 0x8) {
+        if (pdp->att_tproto & 0x8) {
             off += snprintf(b + off, sizeof(b) - off, "%sSSP",
                             (plus ? "+" : ""));
             plus = true;
         }
-        if (a_target & 0x4) {
+        if (pdp->att_tproto & 0x4) {
             off += snprintf(b + off, sizeof(b) - off, "%sSTP",
                             (plus ? "+" : ""));
             plus = true;
         }
-        if (a_target & 0x2) {
+        if (pdp->att_tproto & 0x2) {
             off += snprintf(b + off, sizeof(b) - off, "%sSMP",
                             (plus ? "+" : ""));
             plus = true;
         }
-        if (a_target & 0x1) {
+        if (pdp->att_tproto & 0x1) {
             off += snprintf(b + off, sizeof(b) - off, "%sSATA",
                             (plus ? "+" : ""));
             plus = true;
@@ -1066,8 +1068,9 @@ decode_1line(const uint8_t * rp, int len, int desc, bool z_enabled,
             break;
         }
         printf("%s", cp);
-        if (op->do_cap_phy && (0 == op->desc_type) && (! virt)) {
-            negot = attached_phy_more_capable(my_cap, att_cap);
+        if (op->do_cap_phy && (0 == op->desc_type) && (! pdp->virt)) {
+            negot = smp_att_phy_more_capable(pdp->cur_phy_cap,
+                                             pdp->att_phy_cap);
 
             if (negot > 9) {
                 const char * speed_s[] = {"6", "12", "22.5", "??"};
@@ -1075,9 +1078,9 @@ decode_1line(const uint8_t * rp, int len, int desc, bool z_enabled,
                 printf("  [att: %s G capable]", speed_s[negot - 10]);
             }
         }
-        if (z_enabled && (1 != z_group)) {
+        if (z_enabled && (1 != pdp->zone_group)) {
             zg_not1 = true;
-            printf("  ZG:%d", z_group);
+            printf("  ZG:%d", pdp->zone_group);
         }
         if ('\0' != dsn[0])
             printf("%s", dsn);
@@ -1086,6 +1089,32 @@ decode_1line(const uint8_t * rp, int len, int desc, bool z_enabled,
     return (int)zg_not1;
 }
 
+static int
+decode_1line(const uint8_t * rp, int len, int desc, bool z_enabled,
+             int has_t2t, struct opts_t * op)
+{
+    char b[256];
+    struct smp_phy_desc pd;
+
+    if (smp_decode_phy_desc(rp, len, desc, &pd)) {
+        pr2serr("  Unknown descriptor type %d or length %d\n", desc, len);
+        return -1;
+    }
+    if (op->zpi_fn) {
+        if (pd.func_res && (SMP_FRES_PHY_VACANT != pd.func_res)) {
+            pr2serr("  >>> function result: %s\n",
+                    smp_get_func_res_str(pd.func_res, sizeof(b), b));
+            return -1;
+        }
+        snprintf(b, sizeof(b) - 1, "%x,%x,0,%x\n", pd.phy_id,
+                 pd.zoning_flags & 0x34, pd.zone_group);
+        b[sizeof(b) - 1] = '\0';
+        fprintf(op->zpi_filep, "%s", b);
+        return 0;
+    }
+    return print_1line(&pd, desc, z_enabled, has_t2t, op);
+}
+
 static void
 output_header_info(const uint8_t * rp, struct opts_t * op)
 {
@@ -1136,6 +1165,53 @@ output_header_info(const uint8_t * rp, struct opts_t * op)
     }
 }
 
+/* One line per phy output served from sysfs. Returns -1 if that is not
+ * possible (e.g. the expander is not in sysfs, or the options need fields
+ * sysfs lacks) so the caller should use SMP functions, else 0 or an
+ * SMP_LIB_* error. */
+static int
+do_sysfs(struct smp_target_obj * top, struct opts_t * op)
+{
+    int k, num, end;
+    int err = 0;
+    struct smp_phy_desc * pda;
+
+    if ((! op->do_1line) || op->zpi_fn || op->do_hex || op->do_raw ||
+        op->do_adn || op->do_dsn || op->filter ||
+        (op->do_cap_phy && (0 == op->desc_type))) {
+        if (op->verbose)
+            pr2serr("options need fields not in sysfs, using SMP\n");
+        return -1;
+    }
+    pda = (struct smp_phy_desc *)calloc(MAX_PHY_ID + 1, sizeof(*pda));
+    if (NULL == pda) {
+        pr2serr("%s: heap allocation problem\n", __func__);
+        return SMP_LIB_RESOURCE_ERROR;
+    }
+    num = smp_sysfs_get_phys(NULL, top, op->sa, pda, MAX_PHY_ID + 1,
+                             op->verbose);
+    if (num < 0) {
+        if (op->verbose)
+            pr2serr("expander or its phys not in sysfs, using SMP\n");
+        free(pda);
+        return -1;
+    }
+    if (op->phy_id >= num)
+        printf("Given phy_id=%d equals or exceeds number of phys (%d)\n",
+               op->phy_id, num);
+    end = op->phy_id + op->do_num;
+    if (end > num)
+        end = num;
+    /* zoning is not in sysfs so zone groups are not shown */
+    for (k = op->phy_id; k < end; ++k) {
+        if (print_1line(pda + k, (pda[k].long_fmt ? 0 : 1), false, false,
+                        op) < 0)
+            ++err;
+    }
+    free(pda);
+    return err ? SMP_LIB_CAT_OTHER : 0;
+}
+
 
 int
 main(int argc, char * argv[])
@@ -1145,7 +1221,7 @@ main(int argc, char * argv[])
     bool z_enabled = false;
     bool zg_not1 = false;
     int res, c, len, hdr_ecc, num_desc, resp_filter, resp_desc_type;
-    int desc_len, k, j, err, off, adt, fresult, num;
+    int desc_len, k, j, err, off, num, num_phys, ecc, cur;
     int ret = 0;
     int subvalue = 0;
     int64_t sa_ll;
@@ -1153,20 +1229,25 @@ main(int argc, char * argv[])
     struct opts_t * op;
     char i_params[256];
     char device_name[512];
-    const uint32_t resp_sz = 1020 + 8;
-    uint8_t * resp = NULL;
-    uint8_t * free_resp = NULL;
+    const uint32_t resp_sz = SMP_FN_DISCOVER_LIST_RESP_LEN;
+    uint8_t * resp;
+    const uint8_t * dp;
     struct smp_target_obj tobj;
     struct opts_t opts;
+    struct smp_disc_cache * dcp = NULL;
+    struct smp_batch * bp = NULL;
+    struct dl_win * wp;
+    struct dl_win win_arr[2];
 
     op = &opts;
     memset(op, 0, sizeof(opts));
+    memset(win_arr, 0, sizeof(win_arr));
     memset(device_name, 0, sizeof device_name);
     memset(i_params, 0, sizeof i_params);
     while (1) {
         int option_index = 0;
 
-        c = getopt_long(argc, argv, "Abcd:Df:hHiI:ln:op:rs:SvVZ:",
+        c = getopt_long(argc, argv, "Abcd:Df:hHiI:ln:op:rs:SvVyZ:",
                         long_options, &option_index);
         if (c == -1)
             break;
@@ -1257,6 +1338,9 @@ main(int argc, char * argv[])
         case 'V':
             pr2serr("version: %s\n", version_str);
             return 0;
+        case 'y':
+            op->do_sysfs = true;
+            break;
         case 'Z':
             op->zpi_fn = optarg;
             break;
@@ -1379,17 +1463,26 @@ main(int argc, char * argv[])
                         "override descriptor type to zero\n");
         }
     }
-    resp = smp_memalign(resp_sz, 0, &free_resp, op->verbose > 3);
-    if (NULL == resp) {
-        pr2serr("Could not allocate %u bytes on heap\n", resp_sz);
-        return SMP_LIB_RESOURCE_ERROR;
+    op->win = op->do_num;
+    if ((0 == op->desc_type) && (op->win > MAX_DLIST_LONG_DESCS))
+        op->win = MAX_DLIST_LONG_DESCS;
+    if ((1 == op->desc_type) && (op->win > MAX_DLIST_SHORT_DESCS))
+        op->win = MAX_DLIST_SHORT_DESCS;
+    for (k = 0; k < 2; ++k) {
+        win_arr[k].resp = smp_memalign(resp_sz, 0, &win_arr[k].free_resp,
+                                       op->verbose > 3);
+        if (NULL == win_arr[k].resp) {
+            pr2serr("Could not allocate %u bytes on heap\n", resp_sz);
+            ret = SMP_LIB_RESOURCE_ERROR;
+            goto free_out;
+        }
     }
 
     res = smp_initiator_open(device_name, subvalue, i_params, op->sa,
                              &tobj, op->verbose);
     if (res < 0) {
         ret = SMP_LIB_FILE_ERROR;
-        goto err_out;
+        goto free_out;
     }
 
     if (op->zpi_fn) {
@@ -1405,7 +1498,18 @@ main(int argc, char * argv[])
             }
         }
     }
-    num = get_num_phys(&tobj, op, &has_t2t);
+    if (op->do_sysfs) {
+        ret = do_sysfs(&tobj, op);
+        if (ret >= 0)
+            goto err_out;
+        ret = 0;
+    }
+    ecc = -1;
+    num = get_num_phys(&tobj, op, &has_t2t, &ecc);
+    num_phys = num;
+    if ((num > 0) && (! (op->do_hex || op->do_raw)))
+        dcp = smp_disc_cache_open(tobj.device_name, op->sa, ecc, num,
+                                  op->ign_zp, op->verbose);
     if (num <= 0)
         num = (num > op->do_num) ? op->do_num : num;
     else {
@@ -1417,24 +1521,44 @@ main(int argc, char * argv[])
         }
         num = (num > op->do_num) ? op->do_num : num;
     }
+    /* Pipelined: once a window's response has arrived the request for
+     * the next window is sent (on the other buffer, by a batch worker
+     * thread) before the current window is decoded. */
+    if (num > op->win)
+        bp = smp_batch_create(1, NULL, NULL, op->verbose);
     no_more = false;
-    for (j = 0; (j < num) && (! no_more); j += num_desc) {
-        memset(resp, 0, resp_sz);
+    if ((num > 0) && (op->phy_id <= 254))
+        start_window(bp, &tobj, dcp, win_arr, op->phy_id, op);
+    for (j = 0, cur = 0; (j < num) && (! no_more); j += num_desc, cur ^= 1) {
         if ((op->phy_id + j) > 254) {
             ret = 0;    /* off the end so not error */
             break;
         }
-        ret = do_discover_list(&tobj, op->phy_id + j, resp, resp_sz, op);
+        wp = win_arr + cur;
+        ret = finish_window(bp, dcp, wp, op);
         if (ret) {
             if (SMP_FRES_NO_PHY == ret)
                 ret = 0;    /* off the end so not error */
             break;
         }
+        resp = wp->resp;
         num_desc = resp[9];
-        if ((0 == op->desc_type) && (num_desc < MAX_DLIST_LONG_DESCS))
-            no_more = true;
-        if ((1 == op->desc_type) && (num_desc < MAX_DLIST_SHORT_DESCS))
-            no_more = true;
+        if (num_desc < wp->req_num) {
+            /* Fewer than asked for: either the end has been reached or
+             * this is the most the expander will return at once. */
+            if ((num_desc > 0) && (0 == op->filter) &&
+                ((op->phy_id + j + num_desc) < num_phys)) {
+                if (op->verbose > 1)
+                    pr2serr("    expander returns at most %d descriptors, "
+                            "adjust window\n", num_desc);
+                op->win = num_desc;
+            } else
+                no_more = true;
+        }
+        if ((! no_more) && ((j + num_desc) < num) &&
+            ((op->phy_id + j + num_desc) <= 254))
+            start_window(bp, &tobj, dcp, win_arr + (cur ^ 1),
+                         op->phy_id + j + num_desc, op);
         if (op->do_hex || op->do_raw)
             continue;
         len = (resp[3] * 4) + 4;    /* length in bytes excluding CRC field */
@@ -1469,23 +1593,21 @@ main(int argc, char * argv[])
                     ++err;
                 else if (res > 0)
                     zg_not1 = true;
-            } else {
-                fresult = resp[off + 2];    /* function result, 0 -> ok */
+            } else if (resp_desc_type > 1)
+                ++err;
+            else {
+                dp = resp + off;
+                /* byte 2 is the function result of a long descriptor; a
+                 * short one has it in byte 1 so --brief skips its vacant
+                 * phys as well */
+                if (op->do_brief && (0 == smp_desc_adt(dp, resp_desc_type)) &&
+                    (0 == dp[2]))
+                    continue;
+                printf("descriptor %d:\n", j + k);
                 if (0 == resp_desc_type) {
-                    adt = (resp[off + 12] >> 4) & 7;
-                    if ((0 == op->do_brief) || adt || fresult) {
-                        printf("descriptor %d:\n", j + k);
-                        if (decode_desc0_multiline(resp + off, hdr_ecc, op))
-                            ++err;
-                    }
-                } else if (1 == resp_desc_type) {
-                    adt = (resp[off + 2] >> 4) & 7;
-                    if ((0 == op->do_brief) || adt || fresult) {
-                        printf("descriptor %d:\n", j + k);
-                        if (decode_desc1_multiline(resp + off, z_enabled, op))
-                            ++err;
-                    }
-                } else
+                    if (decode_desc0_multiline(dp, desc_len, hdr_ecc, op))
+                        ++err;
+                } else if (decode_desc1_multiline(dp, z_enabled, op))
                     ++err;
             }
         }
@@ -1501,14 +1623,18 @@ main(int argc, char * argv[])
         printf("Zoning %sabled\n", z_enabled ? "en" : "dis");
 
 err_out:
-    if (free_resp)
-        free(free_resp);
+    if (bp)     /* waits for a request still in flight */
+        smp_batch_destroy(bp);
+    smp_disc_cache_close(dcp, op->verbose);
     if (op->zpi_filep && (stdout != op->zpi_filep))
         fclose(op->zpi_filep);
     res = smp_initiator_close(&tobj);
-    if (res < 0) {
-        if (0 == ret)
-            return SMP_LIB_FILE_ERROR;
+    if ((res < 0) && (0 == ret))
+        ret = SMP_LIB_FILE_ERROR;
+free_out:
+    for (k = 0; k < 2; ++k) {
+        if (win_arr[k].free_resp)
+            free(win_arr[k].free_resp);
     }
     if (ret < 0)
         ret = SMP_LIB_CAT_OTHER;
@@ -0,0 +1,526 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#define __STDC_FORMAT_MACROS 1
+#include <inttypes.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "smp_lib.h"
+#include "sg_pr2serr.h"
+
+
+
+/* This is a Serial Attached SCSI (SAS) Serial Management Protocol (SMP)
+ * utility.
+ *
+ * This utility finds where SAS addresses are attached: the expander, the
+ * phy (lowest phy of a wide port), the port width and the negotiated link
+ * rate. It walks the SAS domain once from the given expander (or reads a
+ * topology snapshot written by 'smp_topology --snapshot=FN'), builds a
+ * hash index of attached SAS addresses, then answers each query from it.
+ */
+
+static const char * version_str = "1.00 20261016";
+
+#define DEF_ADDR_MAX 64
+
+struct opts_t {
+    bool do_json;       /* -j option given */
+    bool ign_zp;        /* -i option given */
+    int max_exp;        /* -m MAX option given */
+    int num_workers;    /* -w NUM option given */
+    int verbose;
+    int num_addr;
+    int max_addr;
+    uint64_t sa;
+    uint64_t * addr_arr;        /* from -a SA and -f FN options */
+    const char * read_fn;       /* -r FN option given */
+};
+
+static struct option long_options[] = {
+        {"addr", required_argument, 0, 'a'},
+        {"file", required_argument, 0, 'f'},
+        {"help", no_argument, 0, 'h'},
+        {"ignore", no_argument, 0, 'i'},
+        {"interface", required_argument, 0, 'I'},
+        {"json", no_argument, 0, 'j'},
+        {"max", required_argument, 0, 'm'},
+        {"read", required_argument, 0, 'r'},
+        {"sa", required_argument, 0, 's'},
+        {"verbose", no_argument, 0, 'v'},
+        {"version", no_argument, 0, 'V'},
+        {"workers", required_argument, 0, 'w'},
+        {0, 0, 0, 0},
+};
+
+static const char * smp_attached_device_type[] = {
+    "no device attached",
+    "SAS or SATA device",
+    "expander device",
+    "expander device (fanout)",
+    "reserved [4]",
+    "reserved [5]",
+    "reserved [6]",
+    "reserved [7]",
+};
+
+
+static void
+usage(void)
+{
+    pr2serr("Usage: smp_locate [--addr=SA[,SA...]] [--file=FN] [--help] "
+            "[--ignore]\n"
+            "                  [--interface=PARAMS] [--json] [--max=MAX] "
+            "[--read=FN]\n"
+            "                  [--sa=SAS_ADDR] [--verbose] [--version] "
+            "[--workers=NUM]\n"
+            "                  [SMP_DEVICE[,N]]\n"
+            "  where:\n"
+            "    --addr=SA[,SA...]|-a SA[,SA...]    SAS address(es) to "
+            "locate; may be\n"
+            "                                       given more than once\n"
+            "    --file=FN|-f FN      read SAS addresses to locate from FN, "
+            "one per line\n"
+            "                         ('-' for stdin, '#' starts a "
+            "comment)\n"
+            "    --help|-h            print out usage message\n"
+            "    --ignore|-i          sets the Ignore Zone Group bit; "
+            "will show\n"
+            "                         phys otherwise hidden by zoning\n"
+            "    --interface=PARAMS|-I PARAMS    specify or override "
+            "interface\n"
+            "    --json|-j            output results as JSON\n"
+            "    --max=MAX|-m MAX     maximum number of expanders to "
+            "visit\n"
+            "                         (def: %d)\n"
+            "    --read=FN|-r FN      use topology snapshot FN rather than "
+            "walking\n"
+            "                         from SMP_DEVICE\n"
+            "    --sa=SAS_ADDR|-s SAS_ADDR    SAS address of SMP "
+            "target (use leading\n"
+            "                                 '0x' or trailing 'h'). "
+            "Depending on\n"
+            "                                 the interface, may not be "
+            "needed\n"
+            "    --verbose|-v         increase verbosity\n"
+            "    --version|-V         print version string and exit\n"
+            "    --workers=NUM|-w NUM    number of requests outstanding "
+            "at once\n"
+            "                            (def: %d, max: %d)\n\n"
+            "Finds the expander, phy, port width and link rate at which "
+            "each SAS\naddress is attached. If no addresses are given, "
+            "lists all attached\naddresses\n", SMP_TOPO_DEF_MAX_EXP,
+            SMP_BATCH_DEF_WORKERS, SMP_BATCH_MAX_WORKERS);
+}
+
+static const char *
+neg_lrate_str(int val)
+{
+    switch (val) {
+    case 1: return "disabled";
+    case 2: return "reset problem";
+    case 3: return "spinup hold";
+    case 4: return "port selector";
+    case 5: return "reset in progress";
+    case 6: return "unsupported phy attached";
+    case 8: return "1.5 Gbps";
+    case 9: return "3 Gbps";
+    case 0xa: return "6 Gbps";
+    case 0xb: return "12 Gbps";
+    case 0xc: return "22.5 Gbps";
+    default: return "unknown";
+    }
+}
+
+/* Appends sa to the list of addresses to locate. Returns 0 on success
+ * else -1 . */
+static int
+add_addr(struct opts_t * op, uint64_t sa)
+{
+    uint64_t * p;
+
+    if (op->num_addr >= op->max_addr) {
+        op->max_addr = op->max_addr ? (op->max_addr * 2) : DEF_ADDR_MAX;
+        p = (uint64_t *)realloc(op->addr_arr,
+                                op->max_addr * sizeof(uint64_t));
+        if (NULL == p) {
+            pr2serr("%s: out of memory\n", __func__);
+            return -1;
+        }
+        op->addr_arr = p;
+    }
+    op->addr_arr[op->num_addr++] = sa;
+    return 0;
+}
+
+/* Decodes a list of SAS addresses separated by commas or whitespace;
+ * '#' starts a comment. Returns 0 on success else an SMP_LIB_* error. */
+static int
+decode_addr_list(struct opts_t * op, const char * lcp)
+{
+    int n;
+    int64_t sa_ll;
+    const char * cp;
+    char b[32];
+
+    for (cp = lcp; *cp && ('#' != *cp); cp += n) {
+        n = strcspn(cp, ", \t\r\n#");
+        if (0 == n) {
+            n = 1;
+            continue;
+        }
+        if (n >= (int)sizeof(b)) {
+            pr2serr("bad SAS address: %.*s\n", n, cp);
+            return SMP_LIB_SYNTAX_ERROR;
+        }
+        memcpy(b, cp, n);
+        b[n] = '\0';
+        sa_ll = smp_get_llnum_nomult(b);
+        if ((-1LL == sa_ll) || (0 == sa_ll)) {
+            pr2serr("bad SAS address: %s\n", b);
+            return SMP_LIB_SYNTAX_ERROR;
+        }
+        if (add_addr(op, (uint64_t)sa_ll))
+            return SMP_LIB_RESOURCE_ERROR;
+    }
+    return 0;
+}
+
+/* Reads SAS addresses from fname ("-" for stdin), one or more per line.
+ * Returns 0 on success else an SMP_LIB_* error. */
+static int
+read_addr_file(struct opts_t * op, const char * fname)
+{
+    int res, lnum;
+    bool use_stdin = (0 == strcmp(fname, "-"));
+    FILE * fp;
+    char line[512];
+
+    fp = use_stdin ? stdin : fopen(fname, "r");
+    if (NULL == fp) {
+        pr2serr("unable to open %s: %s\n", fname, safe_strerror(errno));
+        return SMP_LIB_FILE_ERROR;
+    }
+    for (res = 0, lnum = 1; fgets(line, sizeof(line), fp); ++lnum) {
+        res = decode_addr_list(op, line);
+        if (res) {
+            pr2serr("    at line %d of %s\n", lnum, fname);
+            break;
+        }
+    }
+    if (! use_stdin)
+        fclose(fp);
+    return res;
+}
+
+static void
+print_ent_text(const struct smp_loc_ent * ep)
+{
+    printf("%016" PRIx64 "  expander %016" PRIx64 " [%d]  phy %3d  "
+           "width %d  %s  %s\n", ep->sa, ep->exp_sa, ep->exp_idx,
+           ep->phy_id, ep->width, neg_lrate_str(ep->neg_lrate),
+           smp_attached_device_type[ep->adt & 0x7]);
+}
+
+static void
+print_ent_json(const struct smp_loc_ent * ep, bool first)
+{
+    printf("%s\n        {\"expander\": \"0x%016" PRIx64 "\", "
+           "\"expander_index\": %d, \"phy\": %d, \"width\": %d,\n"
+           "         \"negotiated_rate\": %d, \"attached_type\": %d}",
+           (first ? "" : ","), ep->exp_sa, ep->exp_idx, ep->phy_id,
+           ep->width, ep->neg_lrate, ep->adt);
+}
+
+/* Resolves each address in op->addr_arr or, if there are none, lists
+ * every address in the index. Returns the number of addresses not
+ * found. */
+static int
+do_locate(const struct smp_loc_tbl * ltp, const struct opts_t * op)
+{
+    int k, j, n, num, not_found;
+    uint64_t sa;
+    const struct smp_loc_ent * ep;
+
+    num = op->num_addr ? op->num_addr : smp_loc_tbl_num(ltp);
+    if (op->do_json)
+        printf("{\n  \"results\": [");
+    for (not_found = 0, k = 0; k < num; k += (op->num_addr ? 1 : n)) {
+        if (op->num_addr) {
+            sa = op->addr_arr[k];
+            n = smp_loc_find(ltp, sa, &ep);
+        } else {
+            sa = smp_loc_tbl_ent(ltp, k)->sa;
+            n = smp_loc_find(ltp, sa, &ep);
+        }
+        if (0 == n)
+            ++not_found;
+        if (op->do_json) {
+            printf("%s\n    {\"sas_address\": \"0x%016" PRIx64 "\", "
+                   "\"found\": [", (k ? "," : ""), sa);
+            for (j = 0; j < n; ++j)
+                print_ent_json(ep + j, (0 == j));
+            printf("%s]}", (n ? "\n      " : ""));
+        } else if (0 == n)
+            printf("%016" PRIx64 "  not found\n", sa);
+        else {
+            for (j = 0; j < n; ++j)
+                print_ent_text(ep + j);
+        }
+    }
+    if (op->do_json)
+        printf("\n  ]\n}\n");
+    return not_found;
+}
+
+
+int
+main(int argc, char * argv[])
+{
+    int res, c, n;
+    int ret = 0;
+    int subvalue = 0;
+    int64_t sa_ll;
+    char * cp;
+    struct smp_topo * tp = NULL;
+    struct smp_snap * sp = NULL;
+    struct smp_loc_tbl * ltp = NULL;
+    struct opts_t opts;
+    struct opts_t * op;
+    char device_name[512];
+    char i_params[256];
+    struct smp_target_obj tobj;
+
+    op = &opts;
+    memset(op, 0, sizeof(opts));
+    memset(device_name, 0, sizeof device_name);
+    memset(i_params, 0, sizeof i_params);
+    op->num_workers = SMP_BATCH_DEF_WORKERS;
+    while (1) {
+        int option_index = 0;
+
+        c = getopt_long(argc, argv, "a:f:hiI:jm:r:s:vVw:", long_options,
+                        &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'a':
+            res = decode_addr_list(op, optarg);
+            if (res) {
+                pr2serr("bad argument to '--addr'\n");
+                return res;
+            }
+            break;
+        case 'f':
+            res = read_addr_file(op, optarg);
+            if (res)
+                return res;
+            break;
+        case 'h':
+        case '?':
+            usage();
+            return 0;
+        case 'i':
+            op->ign_zp = true;
+            break;
+        case 'I':
+            strncpy(i_params, optarg, sizeof(i_params));
+            i_params[sizeof(i_params) - 1] = '\0';
+            break;
+        case 'j':
+            op->do_json = true;
+            break;
+        case 'm':
+            n = smp_get_num(optarg);
+            if (n < 1) {
+                pr2serr("bad argument to '--max', expect value 1 or "
+                        "more\n");
+                return SMP_LIB_SYNTAX_ERROR;
+            }
+            op->max_exp = n;
+            break;
+        case 'r':
+            op->read_fn = optarg;
+            break;
+        case 's':
+           sa_ll = smp_get_llnum_nomult(optarg);
+           if (-1LL == sa_ll) {
+                pr2serr("bad argument to '--sa'\n");
+                return SMP_LIB_SYNTAX_ERROR;
+            }
+            op->sa = (uint64_t)sa_ll;
+            break;
+        case 'v':
+            ++op->verbose;
+            break;
+        case 'V':
+            pr2serr("version: %s\n", version_str);
+            return 0;
+        case 'w':
+            n = smp_get_num(optarg);
+            if ((n < 1) || (n > SMP_BATCH_MAX_WORKERS)) {
+                pr2serr("bad argument to '--workers', expect value from 1 "
+                        "to %d\n", SMP_BATCH_MAX_WORKERS);
+                return SMP_LIB_SYNTAX_ERROR;
+            }
+            op->num_workers = n;
+            break;
+        default:
+            pr2serr("unrecognised switch code 0x%x ??\n", c);
+            usage();
+            return SMP_LIB_SYNTAX_ERROR;
+        }
+    }
+    if (optind < argc) {
+        if ('\0' == device_name[0]) {
+            strncpy(device_name, argv[optind], sizeof(device_name) - 1);
+            device_name[sizeof(device_name) - 1] = '\0';
+            ++optind;
+        }
+        if (optind < argc) {
+            for (; optind < argc; ++optind)
+                pr2serr("Unexpected extra argument: %s\n", argv[optind]);
+            usage();
+            return SMP_LIB_SYNTAX_ERROR;
+        }
+    }
+    if (op->read_fn) {
+        sp = smp_snap_open(op->read_fn, op->verbose + 1);
+        if (NULL == sp) {
+            ret = SMP_LIB_FILE_ERROR;
+            goto fini;
+        }
+        ltp = smp_loc_tbl_from_snap(sp);
+        goto have_tbl;
+    }
+    if (0 == device_name[0]) {
+        cp = getenv("SMP_UTILS_DEVICE");
+        if (cp)
+            strncpy(device_name, cp, sizeof(device_name) - 1);
+        else {
+            pr2serr("missing device name on command line\n    [Could use "
+                    "environment variable SMP_UTILS_DEVICE instead]\n\n");
+            usage();
+            ret = SMP_LIB_SYNTAX_ERROR;
+            goto fini;
+        }
+    }
+    if ((cp = strchr(device_name, SMP_SUBVALUE_SEPARATOR))) {
+        *cp = '\0';
+        if (1 != sscanf(cp + 1, "%d", &subvalue)) {
+            pr2serr("expected number after separator in SMP_DEVICE name\n");
+            ret = SMP_LIB_SYNTAX_ERROR;
+            goto fini;
+        }
+    }
+    if (0 == op->sa) {
+        cp = getenv("SMP_UTILS_SAS_ADDR");
+        if (cp) {
+           sa_ll = smp_get_llnum_nomult(cp);
+           if (-1LL == sa_ll) {
+                pr2serr("bad value in environment variable "
+                        "SMP_UTILS_SAS_ADDR\n    use 0\n");
+                sa_ll = 0;
+            }
+            op->sa = (uint64_t)sa_ll;
+        }
+    }
+    if (op->sa > 0) {
+        if (! smp_is_naa5(op->sa)) {
+            pr2serr("SAS (target) address not in naa-5 format (may need "
+                    "leading '0x')\n");
+            if ('\0' == i_params[0]) {
+                pr2serr("    use '--interface=' to override\n");
+                ret = SMP_LIB_SYNTAX_ERROR;
+                goto fini;
+            }
+        }
+    }
+
+    res = smp_initiator_open(device_name, subvalue, i_params, op->sa,
+                             &tobj, op->verbose);
+    if (res < 0) {
+        ret = SMP_LIB_FILE_ERROR;
+        goto fini;
+    }
+    res = smp_topo_walk(&tobj, op->num_workers, op->max_exp, op->ign_zp,
+                        &tp, op->verbose);
+    if (res || (NULL == tp)) {
+        pr2serr("topology walk failed\n");
+        ret = SMP_LIB_RESOURCE_ERROR;
+    } else {
+        if (tp->num_exp > 0)
+            ret = tp->exps[0].err;
+        ltp = smp_loc_tbl_from_topo(tp);
+    }
+    res = smp_initiator_close(&tobj);
+    if (res < 0) {
+        pr2serr("close error: %s\n", safe_strerror(errno));
+        if (0 == ret)
+            ret = SMP_LIB_FILE_ERROR;
+    }
+    if (NULL == tp)
+        goto fini;
+
+have_tbl:
+    if (NULL == ltp) {
+        pr2serr("unable to build location index\n");
+        if (0 == ret)
+            ret = SMP_LIB_RESOURCE_ERROR;
+        goto fini;
+    }
+    if (op->verbose)
+        pr2serr("location index holds %d ports\n", smp_loc_tbl_num(ltp));
+    n = do_locate(ltp, op);
+    if (n > 0) {
+        if (op->verbose)
+            pr2serr("%d address%s not found\n", n, ((1 == n) ? "" : "es"));
+        if (0 == ret)
+            ret = SMP_LIB_CAT_OTHER;
+    }
+
+fini:
+    smp_loc_tbl_free(ltp);
+    smp_topo_free(tp);
+    smp_snap_close(sp);
+    free(op->addr_arr);
+    if (ret < 0)
+        ret = SMP_LIB_CAT_OTHER;
+    if (op->verbose && ret)
+        pr2serr("Exit status %d indicates error detected\n", ret);
+    return ret;
+}
@@ -0,0 +1,1179 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <getopt.h>
+#define __STDC_FORMAT_MACROS 1
+#include <inttypes.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "smp_lib.h"
+#include "sg_unaligned.h"
+#include "sg_pr2serr.h"
+
+/* This is a Serial Attached SCSI (SAS) Serial Management Protocol (SMP)
+ * utility.
+ *
+ * This utility is a daemon that keeps SMP targets (expanders) open and
+ * polls each one on its own schedule: REPORT GENERAL, DISCOVER LIST (or
+ * DISCOVER), REPORT PHY EVENT LIST and REPORT PHY ERROR LOG for attached
+ * phys. After each poll the expander's phy states and counters are
+ * published to a POSIX shared memory object (see the "Monitor shared
+ * memory" section of smp_lib.h) which local readers, such as this utility
+ * with --read, access without sending SMP functions or taking locks.
+ * With --textfile the same is also written in OpenMetrics text format for
+ * a Prometheus node exporter textfile collector.
+ */
+
+static const char * version_str = "1.01 20261016";
+
+#define DEF_INTERVAL_MS 10000
+#define MD_MAX_EXP 1024
+#define MD_OM_MIN_MS 1000       /* least time between --textfile writes
+                                 * while some expander is being polled */
+#define MD_STOP_CHECK_MS 200    /* longest wait before a stop request is
+                                 * noticed */
+
+#define MD_RG 1                 /* REPORT GENERAL */
+#define MD_DL 2                 /* DISCOVER LIST */
+#define MD_DISC 3               /* DISCOVER */
+#define MD_PEL 4                /* REPORT PHY EVENT LIST */
+#define MD_PERR 5               /* REPORT PHY ERROR LOG */
+
+#define MD_DL_DESCS 8           /* long descriptors per DISCOVER LIST */
+#define MD_RESP_LEN 1028        /* fits REPORT PHY EVENT LIST, and
+                                 * DISCOVER LIST with MD_DL_DESCS */
+
+struct opts_t {
+    bool do_daemon;     /* -d option given */
+    bool do_read;       /* -r option given */
+    bool do_walk;       /* -W option given */
+    int count;          /* -c N option given */
+    int interval_ms;    /* -t MS option given */
+    int num_workers;    /* -w NUM option given */
+    int verbose;
+    const char * cfg_fn;        /* -f FN option given */
+    const char * shm_name;      /* -n NAME option given */
+    const char * om_fn;         /* -T FN option given */
+};
+
+/* one monitored expander */
+struct md_exp {
+    struct smp_target_obj tobj;
+    const struct smp_target_obj * top;  /* &tobj or a base's */
+    bool opened;
+    bool busy;                  /* poll in progress */
+    bool no_pel;                /* REPORT PHY EVENT LIST not supported */
+    int pending;                /* requests outstanding */
+    int inflight;               /* of those, given to the batch */
+    struct md_req * defer_head; /* the others, held back while this */
+    struct md_req * defer_tail; /* expander has its share of workers */
+    int64_t next_ms;            /* when next poll is due (mono clock) */
+    int64_t start_ms;           /* when current poll started */
+    struct smp_mon_exp mx;      /* built here, then published */
+};
+
+/* one outstanding request */
+struct md_req {
+    struct smp_batch_elem be;
+    struct smp_req_resp rr;
+    int kind;                   /* MD_* */
+    int xi;                     /* index of expander */
+    int arg;                    /* phy id or descriptor index */
+    struct md_req * next;       /* in its expander's held back list */
+    uint8_t req[32];
+    uint8_t resp[MD_RESP_LEN];
+};
+
+struct md {
+    struct md_exp ** xa;
+    int num;
+    const struct opts_t * op;
+    struct smp_batch * bp;
+    struct smp_mon * mp;
+    int max_inflight;           /* requests to one expander in the batch */
+    struct smp_mon_exp * om_arr;        /* published copies and */
+    const struct smp_mon_exp ** mxa;    /* pointers to them, for
+                                         * --textfile */
+    bool om_dirty;              /* polls done since last --textfile */
+    int64_t om_ms;              /* when --textfile last written */
+};
+
+static volatile sig_atomic_t md_stop;
+
+static struct option long_options[] = {
+        {"count", required_argument, 0, 'c'},
+        {"daemon", no_argument, 0, 'd'},
+        {"file", required_argument, 0, 'f'},
+        {"help", no_argument, 0, 'h'},
+        {"interface", required_argument, 0, 'I'},
+        {"interval", required_argument, 0, 't'},
+        {"name", required_argument, 0, 'n'},
+        {"read", no_argument, 0, 'r'},
+        {"sa", required_argument, 0, 's'},
+        {"textfile", required_argument, 0, 'T'},
+        {"verbose", no_argument, 0, 'v'},
+        {"version", no_argument, 0, 'V'},
+        {"walk", no_argument, 0, 'W'},
+        {"workers", required_argument, 0, 'w'},
+        {0, 0, 0, 0},
+};
+
+
+static void
+usage(void)
+{
+    pr2serr("Usage: smp_monitord [--count=N] [--daemon] [--file=FN] "
+            "[--help]\n"
+            "                    [--interface=PARAMS] [--interval=MS] "
+            "[--name=NAME]\n"
+            "                    [--read] [--sa=SAS_ADDR] [--textfile=FN] "
+            "[--verbose]\n"
+            "                    [--version] [--walk] [--workers=NUM] "
+            "[SMP_DEVICE[,N]]\n"
+            "  where:\n"
+            "    --count=N|-c N       stop after polling each expander N "
+            "times\n"
+            "                         (def: 0 which is until SIGINT or "
+            "SIGTERM)\n"
+            "    --daemon|-d          detach and run in the background\n"
+            "    --file=FN|-f FN      expanders to monitor, one per line: "
+            "SMP_DEVICE[,N]\n"
+            "                         [SAS_ADDR [MS]] ('#' starts a "
+            "comment)\n"
+            "    --help|-h            print out usage message\n"
+            "    --interface=PARAMS|-I PARAMS    specify or override "
+            "interface\n"
+            "    --interval=MS|-t MS    poll each expander every MS "
+            "milliseconds\n"
+            "                           (def: %d) unless FN gives its "
+            "own\n"
+            "    --name=NAME|-n NAME    shared memory object name (def: "
+            "SMP_UTILS_MON_SHM\n"
+            "                           environment variable, else %s)\n"
+            "    --read|-r            print what a running smp_monitord "
+            "has published\n"
+            "                         then exit; no SMP functions are "
+            "sent\n"
+            "    --sa=SAS_ADDR|-s SAS_ADDR    SAS address of SMP "
+            "target (use leading\n"
+            "                                 '0x' or trailing 'h'). "
+            "Depending on\n"
+            "                                 the interface, may not be "
+            "needed\n"
+            "    --textfile=FN|-T FN    also write OpenMetrics text to FN "
+            "after polls\n"
+            "                           ('-' for stdout with --read)\n"
+            "    --verbose|-v         increase verbosity\n"
+            "    --version|-V         print version string and exit\n"
+            "    --walk|-W            also monitor every expander found by "
+            "walking\n"
+            "                         the SAS domain from each one given\n"
+            "    --workers=NUM|-w NUM    number of requests outstanding "
+            "at once\n"
+            "                            (def: %d)\n\n"
+            "Polls expanders and publishes their phy states and counters "
+            "in shared\nmemory\n", DEF_INTERVAL_MS, SMP_MON_DEF_NAME,
+            SMP_BATCH_DEF_WORKERS);
+}
+
+static int64_t
+real_ms(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_REALTIME, &ts))
+        return 0;
+    return ((int64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static void
+stop_handler(int sig)
+{
+    (void)sig;
+    md_stop = 1;
+}
+
+static int
+md_find(const struct md * mdp, uint64_t sa)
+{
+    int k;
+
+    for (k = 0; sa && (k < mdp->num); ++k) {
+        if (mdp->xa[k]->mx.sa == sa)
+            return k;
+    }
+    return -1;
+}
+
+/* Adds an expander whose target object is *top (copied) or, if top is
+ * NULL, opened here from base by SAS address. Returns its index or -1 . */
+static int
+md_add(struct md * mdp, const struct smp_target_obj * top,
+       const struct smp_target_obj * base, uint64_t sa, int interval_ms)
+{
+    struct md_exp * xp;
+
+    if (mdp->num >= MD_MAX_EXP) {
+        pr2serr("too many expanders, limit is %d\n", MD_MAX_EXP);
+        return -1;
+    }
+    xp = (struct md_exp *)calloc(1, sizeof(*xp));
+    if (NULL == xp)
+        return -1;
+    if (top) {
+        xp->tobj = *top;
+        xp->opened = true;
+    } else if (smp_initiator_open_sa(base, sa, &xp->tobj,
+                                     mdp->op->verbose)) {
+        pr2serr("unable to open expander 0x%" PRIx64 "\n", sa);
+        free(xp);
+        return -1;
+    } else
+        xp->opened = true;
+    xp->top = &xp->tobj;
+    xp->mx.sa = sa;
+    xp->mx.ecc = -1;
+    xp->mx.interval_ms = interval_ms;
+    snprintf(xp->mx.device_name, sizeof(xp->mx.device_name), "%s",
+             xp->tobj.device_name);
+    mdp->xa[mdp->num] = xp;
+    return mdp->num++;
+}
+
+/* Opens SMP_DEVICE[,N] with optional SAS address and adds it, then (with
+ * --walk) every expander reachable from it. Returns 0 or an exit status. */
+static int
+md_add_dev(struct md * mdp, const char * dev, uint64_t sa,
+           const char * i_params, int interval_ms)
+{
+    int k, xi;
+    int subvalue = 0;
+    char * cp;
+    struct smp_topo * tp = NULL;
+    struct smp_target_obj tobj;
+    char device_name[512];
+
+    if (md_find(mdp, sa) >= 0) {
+        if (mdp->op->verbose)
+            pr2serr("expander 0x%" PRIx64 " given more than once\n", sa);
+        return 0;
+    }
+    snprintf(device_name, sizeof(device_name), "%s", dev);
+    if ((cp = strchr(device_name, SMP_SUBVALUE_SEPARATOR))) {
+        *cp = '\0';
+        if (1 != sscanf(cp + 1, "%d", &subvalue)) {
+            pr2serr("expected number after separator in SMP_DEVICE name: "
+                    "%s\n", dev);
+            return SMP_LIB_SYNTAX_ERROR;
+        }
+    }
+    if (smp_initiator_open(device_name, subvalue, i_params, sa, &tobj,
+                           mdp->op->verbose) < 0) {
+        pr2serr("unable to open %s\n", dev);
+        return SMP_LIB_FILE_ERROR;
+    }
+    xi = md_add(mdp, &tobj, NULL, sa, interval_ms);
+    if (xi < 0) {
+        smp_initiator_close(&tobj);
+        return SMP_LIB_RESOURCE_ERROR;
+    }
+    if (! mdp->op->do_walk)
+        return 0;
+    if (smp_topo_walk(mdp->xa[xi]->top, mdp->op->num_workers, 0, false, &tp,
+                      mdp->op->verbose) || (NULL == tp)) {
+        pr2serr("topology walk from %s failed\n", dev);
+        return SMP_LIB_CAT_OTHER;
+    }
+    if ((tp->num_exp > 0) && (0 == mdp->xa[xi]->mx.sa))
+        mdp->xa[xi]->mx.sa = tp->exps[0].sa;
+    for (k = 1; k < tp->num_exp; ++k) {
+        if (tp->exps[k].err || (md_find(mdp, tp->exps[k].sa) >= 0))
+            continue;
+        md_add(mdp, NULL, mdp->xa[xi]->top, tp->exps[k].sa, interval_ms);
+    }
+    smp_topo_free(tp);
+    return 0;
+}
+
+/* Reads expanders to monitor from fn. Returns 0 or an exit status. */
+static int
+md_read_file(struct md * mdp, const char * fn, const char * i_params)
+{
+    int n, res, ms;
+    int ln = 0;
+    int64_t ll;
+    uint64_t sa;
+    char * cp;
+    char * dev;
+    char * saveptr;
+    FILE * fp;
+    char line[1024];
+
+    fp = fopen(fn, "r");
+    if (NULL == fp) {
+        pr2serr("unable to open %s: %s\n", fn, safe_strerror(errno));
+        return SMP_LIB_FILE_ERROR;
+    }
+    res = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        ++ln;
+        if ((cp = strchr(line, '#')))
+            *cp = '\0';
+        dev = strtok_r(line, " \t\r\n", &saveptr);
+        if (NULL == dev)
+            continue;
+        sa = 0;
+        ms = mdp->op->interval_ms;
+        if ((cp = strtok_r(NULL, " \t\r\n", &saveptr))) {
+            ll = smp_get_llnum_nomult(cp);
+            if (-1LL == ll) {
+                pr2serr("%s: line %d: bad SAS address: %s\n", fn, ln, cp);
+                res = SMP_LIB_SYNTAX_ERROR;
+                break;
+            }
+            sa = (uint64_t)ll;
+            if ((cp = strtok_r(NULL, " \t\r\n", &saveptr))) {
+                n = smp_get_num(cp);
+                if (n < 1) {
+                    pr2serr("%s: line %d: bad interval: %s\n", fn, ln, cp);
+                    res = SMP_LIB_SYNTAX_ERROR;
+                    break;
+                }
+                ms = n;
+            }
+        }
+        res = md_add_dev(mdp, dev, sa, i_params, ms);
+        if (res)
+            break;
+    }
+    fclose(fp);
+    return res;
+}
+
+static int
+md_submit(struct md * mdp, int xi, int kind, int arg)
+{
+    int n, req_len, resp_len;
+    struct md_req * rp;
+    struct md_exp * xp = mdp->xa[xi];
+
+    rp = (struct md_req *)calloc(1, sizeof(*rp));
+    if (NULL == rp)
+        return -1;
+    rp->kind = kind;
+    rp->xi = xi;
+    rp->arg = arg;
+    rp->req[0] = SMP_FRAME_TYPE_REQ;
+    switch (kind) {
+    case MD_RG:
+        rp->req[1] = SMP_FN_REPORT_GENERAL;
+        req_len = 8;
+        resp_len = 76;
+        break;
+    case MD_DL:
+        rp->req[1] = SMP_FN_DISCOVER_LIST;
+        req_len = 32;
+        resp_len = 48 + (MD_DL_DESCS * 120) + 4;
+        rp->req[3] = 6;
+        rp->req[8] = arg;
+        /* windows start at multiples of MD_DL_DESCS, one continuing
+         * after a short response ends where its window does */
+        n = xp->mx.num_phys - arg;
+        if (n > (MD_DL_DESCS - (arg % MD_DL_DESCS)))
+            n = MD_DL_DESCS - (arg % MD_DL_DESCS);
+        rp->req[9] = n;
+        /* phy filter 0 (all) and descriptor type 0 (long) */
+        break;
+    case MD_DISC:
+        rp->req[1] = SMP_FN_DISCOVER;
+        req_len = 16;
+        resp_len = 128;
+        rp->req[3] = 2;
+        rp->req[9] = arg;
+        break;
+    case MD_PEL:
+        rp->req[1] = SMP_FN_REPORT_PHY_EVENT_LIST;
+        req_len = 12;
+        resp_len = MD_RESP_LEN;
+        rp->req[3] = 1;
+        sg_put_unaligned_be16(arg, rp->req + 6);
+        break;
+    case MD_PERR:
+    default:
+        rp->req[1] = SMP_FN_REPORT_PHY_ERR_LOG;
+        req_len = 16;
+        resp_len = 32;
+        rp->req[3] = 2;
+        rp->req[9] = arg;
+        break;
+    }
+    if (MD_RG != kind) {
+        n = (resp_len - 8) / 4;
+        rp->req[2] = (n < 0x100) ? n : 0xff;    /* allocated response len */
+    }
+    rp->rr.request_len = req_len;
+    rp->rr.request = rp->req;
+    rp->rr.max_response_len = resp_len;
+    rp->rr.response = rp->resp;
+    rp->be.tobj = xp->top;
+    rp->be.rresp = &rp->rr;
+    rp->be.user_p = rp;
+    if (xp->inflight >= mdp->max_inflight) {
+        /* so a slow expander cannot hold every worker */
+        if (xp->defer_tail)
+            xp->defer_tail->next = rp;
+        else
+            xp->defer_head = rp;
+        xp->defer_tail = rp;
+    } else if (smp_batch_submit(mdp->bp, &rp->be)) {
+        free(rp);
+        return -1;
+    } else
+        ++xp->inflight;
+    ++xp->pending;
+    return 0;
+}
+
+/* Returns the function result (0 for success) or -1 if the request or
+ * response is bad. Places the response length (excluding CRC) in *lenp. */
+static int
+md_check(const struct md_req * rp, int * lenp)
+{
+    int len;
+    const uint8_t * bp = rp->resp;
+
+    if (rp->be.res || rp->rr.transport_err)
+        return -1;
+    if ((SMP_FRAME_TYPE_RESP != bp[0]) || (rp->req[1] != bp[1]))
+        return -1;
+    if (bp[2])
+        return bp[2];
+    len = 4 + (bp[3] * 4);
+    if ((rp->rr.act_response_len >= 0) && (len > rp->rr.act_response_len))
+        len = rp->rr.act_response_len;
+    if (len > (rp->rr.max_response_len - 4))
+        len = rp->rr.max_response_len - 4;
+    *lenp = len;
+    return 0;
+}
+
+/* Decodes a DISCOVER response (or long DISCOVER LIST descriptor) into the
+ * expander's phy table, then asks for the error log of an attached phy. */
+static void
+md_phy(struct md * mdp, int xi, const uint8_t * bp, int len)
+{
+    int id = bp[9];
+    struct smp_phy_desc pd;
+    struct smp_mon_phy * pp;
+    struct md_exp * xp = mdp->xa[xi];
+
+    if ((id >= xp->mx.num_phys) || smp_decode_phy_desc(bp, len, 0, &pd))
+        return;
+    pp = xp->mx.phys + id;
+    pp->func_res = pd.func_res;
+    if (pd.func_res)
+        return;
+    if (pd.sa && (0 == xp->mx.sa))
+        xp->mx.sa = pd.sa;
+    pp->adt = pd.adt;
+    pp->neg_lrate = pd.neg_lrate;
+    pp->routing = pd.routing;
+    pp->att_phy_id = pd.att_phy_id;
+    pp->zone_group = pd.zone_group;
+    pp->att_sa = pd.att_sa;
+    if (pd.adt)
+        md_submit(mdp, xi, MD_PERR, id);
+}
+
+static void
+md_pel(struct md * mdp, int xi, const uint8_t * bp, int len)
+{
+    int k, n, id, ped_len;
+    unsigned int first_di, last_di;
+    const uint8_t * pedp;
+    struct smp_mon_phy * pp;
+    struct md_exp * xp = mdp->xa[xi];
+
+    if (len < 16)
+        return;
+    first_di = sg_get_unaligned_be16(bp + 6);
+    last_di = sg_get_unaligned_be16(bp + 8);
+    ped_len = bp[10] * 4;
+    n = bp[15];
+    if (ped_len < 12)
+        return;
+    if (n > (len - 16) / ped_len)
+        n = (len - 16) / ped_len;
+    for (k = 0, pedp = bp + 16; k < n; ++k, pedp += ped_len) {
+        if ((first_di + k) > last_di)
+            break;
+        id = pedp[2];
+        if (id >= xp->mx.num_phys)
+            continue;
+        pp = xp->mx.phys + id;
+        if (pp->num_ev >= SMP_MON_MAX_EV) {
+            pp->flags |= SMP_MON_PF_EV_TRUNC;
+            continue;
+        }
+        pp->ev_src[pp->num_ev] = pedp[3];
+        pp->ev_val[pp->num_ev++] = sg_get_unaligned_be32(pedp + 4);
+    }
+    if ((k == n) && (n > 0) && ((first_di + n) <= last_di) &&
+        ((first_di + n) <= 0xffff))
+        md_submit(mdp, xi, MD_PEL, first_di + n);
+}
+
+static void
+md_start(struct md * mdp, int xi)
+{
+    struct md_exp * xp = mdp->xa[xi];
+
+    xp->busy = true;
+    xp->start_ms = smp_get_mono_ms();
+    xp->mx.err = 0;
+    if (md_submit(mdp, xi, MD_RG, 0)) {
+        xp->mx.err = SMP_LIB_RESOURCE_ERROR;
+        xp->busy = false;
+    }
+}
+
+/* The last response of a poll is in: publish it. */
+static void
+md_done(struct md * mdp, int xi)
+{
+    struct md_exp * xp = mdp->xa[xi];
+
+    xp->busy = false;
+    xp->mx.upd_ms = real_ms();
+    xp->mx.poll_ms = (uint32_t)(smp_get_mono_ms() - xp->start_ms);
+    ++xp->mx.num_polls;
+    if (xp->mx.err)
+        ++xp->mx.num_errs;
+    smp_mon_publish(mdp->mp, xi, &xp->mx);
+    mdp->om_dirty = true;
+    if (mdp->op->verbose > 1)
+        pr2serr("expander 0x%" PRIx64 ": poll %u took %u ms, err=%d\n",
+                xp->mx.sa, xp->mx.num_polls, xp->mx.poll_ms, xp->mx.err);
+}
+
+static void
+md_complete(struct md * mdp, struct md_req * rp)
+{
+    int k, n, len, desc_len, fres, next, wend;
+    const uint8_t * bp = rp->resp;
+    struct smp_mon_phy * pp;
+    struct md_exp * xp = mdp->xa[rp->xi];
+
+    len = 0;
+    fres = md_check(rp, &len);
+    switch (rp->kind) {
+    case MD_RG:
+        if (fres || (len < 10)) {
+            xp->mx.err = (fres > 0) ? fres : SMP_LIB_CAT_MALFORMED;
+            if (rp->be.res || rp->rr.transport_err)
+                xp->mx.err = SMP_LIB_CAT_OTHER;
+            break;
+        }
+        xp->mx.ecc = sg_get_unaligned_be16(bp + 4);
+        xp->mx.rep_num_phys = bp[9];
+        n = (bp[9] > SMP_MON_MAX_PHYS) ? SMP_MON_MAX_PHYS : bp[9];
+        xp->mx.num_phys = n;
+        memset(xp->mx.phys, 0, sizeof(xp->mx.phys));
+        for (k = 0; k < n; ++k) {
+            pp = xp->mx.phys + k;
+            pp->phy_id = k;
+            pp->func_res = SMP_FRES_NO_PHY;
+        }
+        for (k = 0; k < n; k += MD_DL_DESCS)
+            md_submit(mdp, rp->xi, MD_DL, k);
+        if (! xp->no_pel)
+            md_submit(mdp, rp->xi, MD_PEL, 1);
+        break;
+    case MD_DL:
+        n = bp[9];
+        desc_len = bp[12] * 4;
+        if (fres || (len < 48) || (0 != (bp[11] & 0xf)) ||
+            ((n > 0) && ((desc_len < 64) || (len < (48 + (n * desc_len)))))) {
+            /* fall back to DISCOVER for each phy in this window */
+            wend = rp->arg - (rp->arg % MD_DL_DESCS) + MD_DL_DESCS;
+            for (k = rp->arg; (k < xp->mx.num_phys) && (k < wend); ++k)
+                md_submit(mdp, rp->xi, MD_DISC, k);
+            break;
+        }
+        for (k = 0; k < n; ++k)
+            md_phy(mdp, rp->xi, bp + 48 + (k * desc_len), desc_len);
+        /* some expanders cap the descriptors per response: fetch the
+         * rest of the window from after the last phy returned */
+        wend = rp->arg - (rp->arg % MD_DL_DESCS) + MD_DL_DESCS;
+        if (wend > xp->mx.num_phys)
+            wend = xp->mx.num_phys;
+        next = (n > 0) ? (bp[48 + ((n - 1) * desc_len) + 9] + 1) : rp->arg;
+        if (next >= wend)
+            break;
+        if (next > rp->arg)
+            md_submit(mdp, rp->xi, MD_DL, next);
+        else {          /* no progress, use DISCOVER for the rest */
+            for (k = next; k < wend; ++k)
+                md_submit(mdp, rp->xi, MD_DISC, k);
+        }
+        break;
+    case MD_DISC:
+        if (0 == fres)
+            md_phy(mdp, rp->xi, bp, len);
+        else if (fres > 0)
+            xp->mx.phys[rp->arg].func_res = fres;
+        break;
+    case MD_PEL:
+        if (0 == fres)
+            md_pel(mdp, rp->xi, bp, len);
+        else if (SMP_FRES_UNKNOWN_FUNCTION == fres) {
+            if (mdp->op->verbose)
+                pr2serr("expander 0x%" PRIx64 ": no REPORT PHY EVENT "
+                        "LIST, not asked again\n", xp->mx.sa);
+            xp->no_pel = true;
+        }
+        break;
+    case MD_PERR:
+        if ((0 == fres) && (len >= 28) && (rp->arg < xp->mx.num_phys)) {
+            pp = xp->mx.phys + rp->arg;
+            pp->inv_dword = sg_get_unaligned_be32(bp + 12);
+            pp->disparity = sg_get_unaligned_be32(bp + 16);
+            pp->loss_sync = sg_get_unaligned_be32(bp + 20);
+            pp->reset_prob = sg_get_unaligned_be32(bp + 24);
+            pp->flags |= SMP_MON_PF_ERR_LOG;
+        }
+        break;
+    }
+    if (0 == --xp->pending)
+        md_done(mdp, rp->xi);
+}
+
+/* A request is back from the batch: processes it then sends what its
+ * expander has held back, as far as its share of the workers allows. */
+static void
+md_reaped(struct md * mdp, struct md_req * rp)
+{
+    struct md_exp * xp = mdp->xa[rp->xi];
+
+    --xp->inflight;
+    md_complete(mdp, rp);
+    free(rp);
+    while (xp->defer_head && (xp->inflight < mdp->max_inflight)) {
+        rp = xp->defer_head;
+        xp->defer_head = rp->next;
+        if (NULL == xp->defer_head)
+            xp->defer_tail = NULL;
+        if (smp_batch_submit(mdp->bp, &rp->be)) {
+            rp->be.res = -1;    /* completes as a failed request */
+            md_complete(mdp, rp);
+            free(rp);
+        } else
+            ++xp->inflight;
+    }
+}
+
+static void
+sleep_until_ms(int64_t when_ms)
+{
+    int64_t ms = when_ms - smp_get_mono_ms();
+    struct timespec ts;
+
+    if (ms <= 0)
+        return;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);       /* a signal cuts this short */
+}
+
+/* With --textfile, rewrites it if polls have completed since it was last
+ * written. Unless force is true that waits until no poll is in progress,
+ * or MD_OM_MIN_MS has passed. What is written comes from the published
+ * slots since an expander being polled has a half built copy. */
+static void
+md_textfile(struct md * mdp, bool force)
+{
+    int k;
+    int64_t now;
+
+    if ((NULL == mdp->op->om_fn) || (! mdp->om_dirty))
+        return;
+    now = smp_get_mono_ms();
+    if ((! force) && ((now - mdp->om_ms) < MD_OM_MIN_MS)) {
+        for (k = 0; k < mdp->num; ++k) {
+            if (mdp->xa[k]->busy)
+                return;
+        }
+    }
+    for (k = 0; k < mdp->num; ++k)
+        smp_mon_read(mdp->mp, k, mdp->om_arr + k);
+    if (smp_mon_write_om(mdp->op->om_fn, mdp->mxa, mdp->num,
+                         mdp->op->verbose + 1) && mdp->op->verbose)
+        pr2serr("unable to write %s\n", mdp->op->om_fn);
+    mdp->om_dirty = false;
+    mdp->om_ms = now;
+}
+
+/* Polls until stopped by a signal or, with --count, until each expander
+ * has been polled that many times. */
+static void
+md_run(struct md * mdp)
+{
+    int k, idle;
+    int64_t now, wake;
+    struct md_exp * xp;
+    struct md_req * rp;
+    struct smp_batch_elem * bep;
+    const struct opts_t * op = mdp->op;
+
+    now = smp_get_mono_ms();
+    for (k = 0; k < mdp->num; ++k)      /* spread first polls a little */
+        mdp->xa[k]->next_ms = now + k;
+    while (! md_stop) {
+        now = smp_get_mono_ms();
+        wake = now + MD_STOP_CHECK_MS;
+        for (k = 0, idle = 0; k < mdp->num; ++k) {
+            xp = mdp->xa[k];
+            if (xp->busy)
+                continue;
+            if (op->count && ((int)xp->mx.num_polls >= op->count)) {
+                ++idle;
+                continue;
+            }
+            if (now >= xp->next_ms) {
+                xp->next_ms += xp->mx.interval_ms;
+                if (xp->next_ms <= now)         /* fell behind, skip */
+                    xp->next_ms = now + xp->mx.interval_ms;
+                md_start(mdp, k);
+            }
+            if (xp->next_ms < wake)
+                wake = xp->next_ms;
+        }
+        if (smp_batch_outstanding(mdp->bp) > 0) {
+            /* wakes for the next poll due, or to check md_stop */
+            now = smp_get_mono_ms();
+            bep = smp_batch_reap_ms(mdp->bp,
+                                    (wake > now) ? (int)(wake - now) : 0);
+            while (bep) {
+                md_reaped(mdp, (struct md_req *)bep->user_p);
+                bep = smp_batch_reap(mdp->bp, false);
+            }
+        } else if (idle >= mdp->num)
+            break;
+        else
+            sleep_until_ms(wake);
+        md_textfile(mdp, false);
+    }
+    /* when stopped: drop what is not yet sent, wait for what is */
+    smp_batch_cancel(mdp->bp);
+    while ((bep = smp_batch_reap(mdp->bp, true)))
+        free(bep->user_p);
+    for (k = 0; k < mdp->num; ++k) {
+        xp = mdp->xa[k];
+        while ((rp = xp->defer_head)) {
+            xp->defer_head = rp->next;
+            free(rp);
+        }
+        xp->defer_tail = NULL;
+    }
+    md_textfile(mdp, true);
+}
+
+/* --read with --textfile: writes a consistent copy of each slot in
+ * OpenMetrics text format. */
+static int
+md_export(const struct opts_t * op)
+{
+    int k, n;
+    int ret = 0;
+    struct smp_mon * mp;
+    struct smp_mon_exp * xarr;
+    const struct smp_mon_exp ** mxa;
+
+    mp = smp_mon_open(op->shm_name, op->verbose + 1);
+    if (NULL == mp)
+        return SMP_LIB_FILE_ERROR;
+    n = smp_mon_get_hdr(mp)->num_exp;
+    xarr = (struct smp_mon_exp *)malloc((n + 1) * sizeof(*xarr));
+    mxa = (const struct smp_mon_exp **)malloc((n + 1) * sizeof(*mxa));
+    if ((NULL == xarr) || (NULL == mxa)) {
+        ret = SMP_LIB_RESOURCE_ERROR;
+        goto fini;
+    }
+    for (k = 0, n = 0; k < (int)smp_mon_get_hdr(mp)->num_exp; ++k) {
+        if (smp_mon_read(mp, k, xarr + n)) {
+            if (op->verbose)
+                pr2serr("expander slot %d: busy, left out\n", k);
+            continue;
+        }
+        mxa[n] = xarr + n;
+        ++n;
+    }
+    if (smp_mon_write_om(op->om_fn, mxa, n, op->verbose + 1))
+        ret = SMP_LIB_FILE_ERROR;
+fini:
+    free(mxa);
+    free(xarr);
+    smp_mon_close(mp, false);
+    return ret;
+}
+
+/* --read: prints what is in the shared memory object. */
+static int
+md_show(const struct opts_t * op)
+{
+    int k, j, e;
+    int64_t now;
+    struct smp_mon * mp;
+    const struct smp_mon_hdr * hp;
+    const struct smp_mon_phy * pp;
+    struct smp_mon_exp * xp;
+    char b[64];
+
+    mp = smp_mon_open(op->shm_name, op->verbose + 1);
+    if (NULL == mp)
+        return SMP_LIB_FILE_ERROR;
+    xp = (struct smp_mon_exp *)malloc(sizeof(*xp));
+    if (NULL == xp) {
+        smp_mon_close(mp, false);
+        return SMP_LIB_RESOURCE_ERROR;
+    }
+    hp = smp_mon_get_hdr(mp);
+    now = real_ms();
+    printf("smp_monitord pid %d, %u expanders\n", (int)hp->pid,
+           hp->num_exp);
+    for (k = 0; k < (int)hp->num_exp; ++k) {
+        if (smp_mon_read(mp, k, xp)) {
+            printf("expander slot %d: busy, no consistent copy\n", k);
+            continue;
+        }
+        printf("expander 0x%" PRIx64 " via %s\n", xp->sa, xp->device_name);
+        if (0 == xp->upd_ms) {
+            printf("  not polled yet\n");
+            continue;
+        }
+        printf("  polls: %u, with errors: %u, last %" PRId64 " ms ago, took "
+               "%u ms\n", xp->num_polls, xp->num_errs, now - xp->upd_ms,
+               xp->poll_ms);
+        if (xp->err)
+            printf("  last poll error: %d\n", xp->err);
+        printf("  expander change count: %d, phys: %u\n", xp->ecc,
+               xp->rep_num_phys);
+        for (j = 0; j < xp->num_phys; ++j) {
+            pp = xp->phys + j;
+            if (pp->func_res || ((0 == pp->adt) && (op->verbose < 1)))
+                continue;
+            printf("  phy %3d: ", pp->phy_id);
+            if (pp->adt)
+                printf("attached:[%016" PRIx64 ":%02d] %s", pp->att_sa,
+                       pp->att_phy_id,
+                       smp_get_neg_xxx_link_rate(pp->neg_lrate, sizeof(b),
+                                                 b));
+            else
+                printf("%s", smp_get_neg_xxx_link_rate(pp->neg_lrate,
+                                                       sizeof(b), b));
+            printf("\n");
+            if (pp->flags & SMP_MON_PF_ERR_LOG)
+                printf("      err log: inv_dword=%u disparity=%u "
+                       "loss_sync=%u reset_prob=%u\n", pp->inv_dword,
+                       pp->disparity, pp->loss_sync, pp->reset_prob);
+            if (pp->num_ev > 0) {
+                printf("      events:");
+                for (e = 0; e < pp->num_ev; ++e)
+                    printf(" [0x%x]=%u", pp->ev_src[e], pp->ev_val[e]);
+                printf("%s\n", (pp->flags & SMP_MON_PF_EV_TRUNC) ?
+                       " ..." : "");
+            }
+        }
+    }
+    free(xp);
+    smp_mon_close(mp, false);
+    return 0;
+}
+
+
+int
+main(int argc, char * argv[])
+{
+    int res, c, k, n;
+    int ret = 0;
+    int64_t sa_ll;
+    uint64_t sa = 0;
+    char * cp;
+    struct opts_t opts;
+    struct opts_t * op;
+    struct md md;
+    struct sigaction sa_act;
+    char device_name[512];
+    char i_params[256];
+
+    op = &opts;
+    memset(op, 0, sizeof(opts));
+    memset(&md, 0, sizeof(md));
+    memset(device_name, 0, sizeof device_name);
+    memset(i_params, 0, sizeof i_params);
+    op->interval_ms = DEF_INTERVAL_MS;
+    op->num_workers = SMP_BATCH_DEF_WORKERS;
+    while (1) {
+        int option_index = 0;
+
+        c = getopt_long(argc, argv, "c:df:hI:n:rs:t:T:vVWw:", long_options,
+                        &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'c':
+            op->count = smp_get_num(optarg);
+            if (op->count < 0) {
+                pr2serr("bad argument to '--count'\n");
+                return SMP_LIB_SYNTAX_ERROR;
+            }
+            break;
+        case 'd':
+            op->do_daemon = true;
+            break;
+        case 'f':
+            op->cfg_fn = optarg;
+            break;
+        case 'h':
+        case '?':
+            usage();
+            return 0;
+        case 'I':
+            strncpy(i_params, optarg, sizeof(i_params));
+            i_params[sizeof(i_params) - 1] = '\0';
+            break;
+        case 'n':
+            op->shm_name = optarg;
+            break;
+        case 'r':
+            op->do_read = true;
+            break;
+        case 's':
+           sa_ll = smp_get_llnum_nomult(optarg);
+           if (-1LL == sa_ll) {
+                pr2serr("bad argument to '--sa'\n");
+                return SMP_LIB_SYNTAX_ERROR;
+            }
+            sa = (uint64_t)sa_ll;
+            break;
+        case 'T':
+            op->om_fn = optarg;
+            break;
+        case 't':
+            op->interval_ms = smp_get_num(optarg);
+            if (op->interval_ms < 1) {
+                pr2serr("bad argument to '--interval', expect 1 or more "
+                        "milliseconds\n");
+                return SMP_LIB_SYNTAX_ERROR;
+            }
+            break;
+        case 'v':
+            ++op->verbose;
+            break;
+        case 'V':
+            pr2serr("version: %s\n", version_str);
+            return 0;
+        case 'W':
+            op->do_walk = true;
+            break;
+        case 'w':
+            n = smp_get_num(optarg);
+            if ((n < 1) || (n > SMP_BATCH_MAX_WORKERS)) {
+                pr2serr("bad argument to '--workers', expect value from 1 "
+                        "to %d\n", SMP_BATCH_MAX_WORKERS);
+                return SMP_LIB_SYNTAX_ERROR;
+            }
+            op->num_workers = n;
+            break;
+        default:
+            pr2serr("unrecognised switch code 0x%x ??\n", c);
+            usage();
+            return SMP_LIB_SYNTAX_ERROR;
+        }
+    }
+    if (optind < argc) {
+        if ('\0' == device_name[0]) {
+            strncpy(device_name, argv[optind], sizeof(device_name) - 1);
+            device_name[sizeof(device_name) - 1] = '\0';
+            ++optind;
+        }
+        if (optind < argc) {
+            for (; optind < argc; ++optind)
+                pr2serr("Unexpected extra argument: %s\n", argv[optind]);
+            usage();
+            return SMP_LIB_SYNTAX_ERROR;
+        }
+    }
+    if (op->do_read)
+        return op->om_fn ? md_export(op) : md_show(op);
+    if (op->om_fn && (0 == strcmp(op->om_fn, "-"))) {
+        pr2serr("'--textfile=-' only with --read\n");
+        return SMP_LIB_SYNTAX_ERROR;
+    }
+    if (op->om_fn && op->do_daemon && ('/' != op->om_fn[0])) {
+        pr2serr("with --daemon, --textfile needs an absolute path\n");
+        return SMP_LIB_SYNTAX_ERROR;
+    }
+
+    if ((0 == device_name[0]) && (NULL == op->cfg_fn)) {
+        cp = getenv("SMP_UTILS_DEVICE");
+        if (cp)
+            strncpy(device_name, cp, sizeof(device_name) - 1);
+        else {
+            pr2serr("missing device name on command line\n    [Could use "
+                    "environment variable SMP_UTILS_DEVICE or --file=FN "
+                    "instead]\n\n");
+            usage();
+            return SMP_LIB_SYNTAX_ERROR;
+        }
+    }
+    if (device_name[0] && (0 == sa)) {
+        cp = getenv("SMP_UTILS_SAS_ADDR");
+        if (cp) {
+           sa_ll = smp_get_llnum_nomult(cp);
+           if (-1LL == sa_ll) {
+                pr2serr("bad value in environment variable "
+                        "SMP_UTILS_SAS_ADDR\n    use 0\n");
+                sa_ll = 0;
+            }
+            sa = (uint64_t)sa_ll;
+        }
+    }
+    if (sa > 0) {
+        if (! smp_is_naa5(sa)) {
+            pr2serr("SAS (target) address not in naa-5 format (may need "
+                    "leading '0x')\n");
+            if ('\0' == i_params[0]) {
+                pr2serr("    use '--interface=' to override\n");
+                return SMP_LIB_SYNTAX_ERROR;
+            }
+        }
+    }
+
+    md.op = op;
+    md.xa = (struct md_exp **)calloc(MD_MAX_EXP, sizeof(struct md_exp *));
+    if (NULL == md.xa)
+        return SMP_LIB_RESOURCE_ERROR;
+    if (device_name[0]) {
+        ret = md_add_dev(&md, device_name, sa, i_params, op->interval_ms);
+        if (ret)
+            goto fini;
+    }
+    if (op->cfg_fn) {
+        ret = md_read_file(&md, op->cfg_fn, i_params);
+        if (ret)
+            goto fini;
+    }
+    if (0 == md.num) {
+        pr2serr("no expanders to monitor\n");
+        ret = SMP_LIB_SYNTAX_ERROR;
+        goto fini;
+    }
+    if (op->om_fn) {
+        md.om_arr = (struct smp_mon_exp *)calloc(md.num,
+                                                 sizeof(*md.om_arr));
+        md.mxa = (const struct smp_mon_exp **)calloc(md.num,
+                                                     sizeof(*md.mxa));
+        if ((NULL == md.om_arr) || (NULL == md.mxa)) {
+            ret = SMP_LIB_RESOURCE_ERROR;
+            goto fini;
+        }
+        for (k = 0; k < md.num; ++k)
+            md.mxa[k] = md.om_arr + k;
+    }
+    if (op->do_daemon && daemon(0, 0)) {
+        pr2serr("daemon() failed: %s\n", safe_strerror(errno));
+        ret = SMP_LIB_CAT_OTHER;
+        goto fini;
+    }
+    /* after daemon() so the writer pid in the header is right */
+    md.mp = smp_mon_create(op->shm_name, md.num, op->verbose + 1);
+    if (NULL == md.mp) {
+        ret = SMP_LIB_FILE_ERROR;
+        goto fini;
+    }
+    for (k = 0; k < md.num; ++k)        /* readers see what is monitored */
+        smp_mon_publish(md.mp, k, &md.xa[k]->mx);
+    md.bp = smp_batch_create(op->num_workers, NULL, NULL, op->verbose);
+    if (NULL == md.bp) {
+        ret = SMP_LIB_RESOURCE_ERROR;
+        goto fini;
+    }
+    /* with several expanders each may use at most half the workers */
+    md.max_inflight = op->num_workers;
+    if (md.num > 1)
+        md.max_inflight /= 2;
+    if (md.max_inflight < 1)
+        md.max_inflight = 1;
+    memset(&sa_act, 0, sizeof(sa_act));
+    sa_act.sa_handler = stop_handler;
+    sigemptyset(&sa_act.sa_mask);
+    sigaction(SIGINT, &sa_act, NULL);
+    sigaction(SIGTERM, &sa_act, NULL);
+    if (op->verbose)
+        pr2serr("monitoring %d expander%s\n", md.num,
+                ((1 == md.num) ? "" : "s"));
+    md_run(&md);
+
+fini:
+    if (md.bp)
+        smp_batch_destroy(md.bp);
+    /* with --count the results stay for readers, else remove them */
+    if (md.mp)
+        smp_mon_close(md.mp, 0 == op->count);
+    if (md.mp && op->om_fn && (0 == op->count))
+        unlink(op->om_fn);      /* stale metrics are worse than none */
+    for (k = 0; k < md.num; ++k) {
+        if (md.xa[k]->opened) {
+            res = smp_initiator_close(&md.xa[k]->tobj);
+            if ((res < 0) && (0 == ret)) {
+                pr2serr("close error: %s\n", safe_strerror(errno));
+                ret = SMP_LIB_FILE_ERROR;
+            }
+        }
+        free(md.xa[k]);
+    }
+    free(md.xa);
+    free(md.mxa);
+    free(md.om_arr);
+    if (ret < 0)
+        ret = SMP_LIB_CAT_OTHER;
+    if (op->verbose && ret)
+        pr2serr("Exit status %d indicates error detected\n", ret);
+    return ret;
+}
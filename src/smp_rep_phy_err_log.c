@@ -33,6 +33,7 @@
 #include <string.h>
 #include <errno.h>
 #include <getopt.h>
+#include <time.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -51,7 +52,7 @@
  * response.
  */
 
-static const char * version_str = "1.21 20210615";
+static const char * version_str = "1.22 20261016";
 
 #define SMP_FN_REPORT_PHY_ERR_LOG_RESP_LEN 32
 
@@ -62,6 +63,7 @@ static struct option long_options[] = {
     {"phy", required_argument, 0, 'p'},
     {"raw", no_argument, 0, 'r'},
     {"sa", required_argument, 0, 's'},
+    {"store", required_argument, 0, 'S'},
     {"verbose", no_argument, 0, 'v'},
     {"version", no_argument, 0, 'V'},
     {"zero", no_argument, 0, 'z'},
@@ -74,9 +76,10 @@ usage(void)
 {
     pr2serr("Usage: smp_rep_phy_err_log [--help] [--hex] "
             "[--interface=PARAMS] [--phy=ID]\n"
-            "                           [--raw] [--sa=SAS_ADDR] [--verbose] "
-            "[--version]\n"
-            "                           [--zero] SMP_DEVICE[,N]\n"
+            "                           [--raw] [--sa=SAS_ADDR] [--store=FN] "
+            "[--verbose]\n"
+            "                           [--version] [--zero] "
+            "SMP_DEVICE[,N]\n"
             "  where:\n"
             "    --help|-h            print out usage message\n"
             "    --hex|-H             print response in hexadecimal\n"
@@ -90,6 +93,8 @@ usage(void)
             "Depending on\n"
             "                                 the interface, may not be "
             "needed\n"
+            "    --store=FN|-S FN     append the counters to time series "
+            "file FN\n"
             "    --verbose|-v         increase verbosity\n"
             "    --version|-V         print version string and exit\n"
             "    --zero|-z            zero Allocated Response Length "
@@ -99,6 +104,50 @@ usage(void)
            );
 }
 
+static int64_t
+real_ms(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_REALTIME, &ts))
+        return 0;
+    return ((int64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/* Appends the four counters in resp to time series file fn. If sa is 0
+ * the expander's SAS address is fetched with a DISCOVER function. */
+static int
+store_counters(const char * fn, const struct smp_target_obj * top,
+               uint64_t sa, const uint8_t * resp, int verbose)
+{
+    int k;
+    int64_t t_ms = real_ms();
+    struct smp_ts * tsp;
+    struct smp_phy_desc pd;
+
+    if (0 == sa) {
+        if (smp_discover_phy(top, resp[9], &pd, verbose) || (0 == pd.sa)) {
+            pr2serr("unable to fetch SAS address of expander for --store, "
+                    "give --sa=\n");
+            return SMP_LIB_CAT_OTHER;
+        }
+        sa = pd.sa;
+    }
+    tsp = smp_ts_open(fn, true, verbose ? verbose : 1);
+    if (NULL == tsp)
+        return SMP_LIB_FILE_ERROR;
+    for (k = 0; k < 4; ++k) {
+        if (smp_ts_append(tsp, sa, resp[9], SMP_TS_SRC_ERR_LOG + k, t_ms,
+                          sg_get_unaligned_be32(resp + 12 + (4 * k))))
+            break;
+    }
+    if (smp_ts_close(tsp) || (k < 4)) {
+        pr2serr("error writing time series file %s\n", fn);
+        return SMP_LIB_FILE_ERROR;
+    }
+    return 0;
+}
+
 static void
 dStrRaw(const uint8_t * str, int len)
 {
@@ -123,6 +172,7 @@ main(int argc, char * argv[])
     int verbose = 0;
     int64_t sa_ll;
     uint64_t sa = 0;
+    const char * store_fn = NULL;
     char * cp;
     char b[256];
     char device_name[512];
@@ -139,7 +189,7 @@ main(int argc, char * argv[])
     while (1) {
         int option_index = 0;
 
-        c = getopt_long(argc, argv, "hHI:p:rs:vVz", long_options,
+        c = getopt_long(argc, argv, "hHI:p:rs:S:vVz", long_options,
                         &option_index);
         if (c == -1)
             break;
@@ -176,6 +226,9 @@ main(int argc, char * argv[])
             }
             sa = (uint64_t)sa_ll;
             break;
+        case 'S':
+            store_fn = optarg;
+            break;
         case 'v':
             ++verbose;
             break;
@@ -204,6 +257,10 @@ main(int argc, char * argv[])
             return SMP_LIB_SYNTAX_ERROR;
         }
     }
+    if (store_fn && (do_hex || do_raw)) {
+        pr2serr("--store cannot be used with --hex or --raw\n");
+        return SMP_LIB_SYNTAX_ERROR;
+    }
     if (0 == device_name[0]) {
         cp = getenv("SMP_UTILS_DEVICE");
         if (cp)
@@ -360,6 +417,8 @@ main(int argc, char * argv[])
            sg_get_unaligned_be32(smp_resp + 20));
     printf("  phy reset problem count: %u\n",
            sg_get_unaligned_be32(smp_resp + 24));
+    if (store_fn)
+        ret = store_counters(store_fn, &tobj, sa, smp_resp, verbose);
 
 err_out:
      if (free_smp_resp)
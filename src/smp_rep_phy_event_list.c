@@ -30,9 +30,12 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <inttypes.h>
 #include <string.h>
 #include <errno.h>
 #include <getopt.h>
+#include <time.h>
+#include <signal.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -48,21 +51,78 @@
  * utility.
  *
  * This utility issues a REPORT PHY EVENT LIST function and outputs its
- * response.
+ * response. With --interval or --count it samples the whole list (paging
+ * through the descriptor indexes) repeatedly and reports counter deltas.
+ * With --store each sample is also appended to a time series file. With
+ * --peaks the peak value detectors are read then cleared each interval and
+ * their values gathered into per phy log-linear histograms.
  */
 
-static const char * version_str = "1.16 20230201";
+static const char * version_str = "1.19 20261016";
 
 #define SMP_FN_REPORT_PHY_EVENT_LIST_RESP_LEN (1020 + 4 + 4)
 
 #define DEF_STARTING_INDEX 1
 
+#define DEF_INTERVAL_MS 1000
+
+/* Log-linear histogram of peak values: values below PVD_LIN_MAX get a
+ * bucket each, above that each power of two is split into PVD_LIN_SUB
+ * linear buckets, so a bucket is at most 1/8 of its lower bound wide. */
+#define PVD_LIN_BITS 3
+#define PVD_LIN_SUB (1 << PVD_LIN_BITS)
+#define PVD_LIN_MAX (2 * PVD_LIN_SUB)
+#define PVD_NUM_BUCKETS (PVD_LIN_MAX + ((31 - PVD_LIN_BITS) * PVD_LIN_SUB))
+#define PVD_NUM_SRC 4           /* sources 0x2b to 0x2e */
+
 struct pes_name_t {
     int pes;    /* phy event source, an 8 bit number */
     const char * pes_name;
 };
 
+struct opts_t {
+    bool do_desc;
+    bool do_force;
+    bool do_long;
+    bool do_nonz;
+    bool do_peaks;
+    int count;
+    int interval_ms;
+    int starting_index;
+    int verbose;
+    uint64_t store_sa;          /* SAS address series are stored under */
+    struct smp_ts * tsp;        /* non-NULL if --store given */
+};
+
+/* One phy event list descriptor as kept between samples */
+struct ped_samp_t {
+    unsigned int di;            /* descriptor index */
+    uint8_t phy_id;
+    uint8_t pes;
+    uint32_t val;
+    uint32_t pvdt;
+};
+
+struct ped_arr_t {
+    int num;
+    int max;
+    int ecc;                    /* expander change count */
+    struct ped_samp_t * arr;
+};
+
+/* Peak values of one phy event source on one phy, across samples */
+struct pvd_hist_t {
+    uint32_t num;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t cnt[PVD_NUM_BUCKETS];
+};
+
+static volatile sig_atomic_t pk_stop;
+
 static struct option long_options[] = {
+    {"count", required_argument, 0, 'c'},
     {"desc", no_argument, 0, 'd'},
     {"enumerate", no_argument, 0, 'e'},
     {"force", no_argument, 0, 'f'},
@@ -70,10 +130,13 @@ static struct option long_options[] = {
     {"hex", no_argument, 0, 'H'},
     {"index", required_argument, 0, 'i'},
     {"interface", required_argument, 0, 'I'},
+    {"interval", required_argument, 0, 't'},
     {"long", no_argument, 0, 'l'},
     {"nonz", no_argument, 0, 'n'},
+    {"peaks", no_argument, 0, 'P'},
     {"raw", no_argument, 0, 'r'},
     {"sa", required_argument, 0, 's'},
+    {"store", required_argument, 0, 'S'},
     {"verbose", no_argument, 0, 'v'},
     {"version", no_argument, 0, 'V'},
     {0, 0, 0, 0},
@@ -132,15 +195,19 @@ static struct pes_name_t pes_name_arr[] = {
 static void
 usage(void)
 {
-    pr2serr("Usage: smp_rep_phy_event_list [--desc] [--enumerate] [--force] "
-            "[--help]\n"
-            "                              [--hex] [--index=IN] "
+    pr2serr("Usage: smp_rep_phy_event_list [--count=N] [--desc] "
+            "[--enumerate] [--force]\n"
+            "                              [--help] [--hex] [--index=IN] "
             "[--interface=PARAMS]\n"
-            "                              [--long] [--nonz] [--raw] "
-            "[--sa=SAS_ADDR]\n"
-            "                              [--verbose] [--version] "
-            "SMP_DEVICE[,N]\n"
+            "                              [--interval=MS] [--long] "
+            "[--nonz] [--peaks]\n"
+            "                              [--raw] [--sa=SAS_ADDR] "
+            "[--store=FN] [--verbose]\n"
+            "                              [--version] SMP_DEVICE[,N]\n"
             "  where:\n"
+            "    --count=N|-c N       number of delta reports in interval "
+            "mode (def: 0\n"
+            "                         which is until interrupted)\n"
             "    --desc|-d            show descriptor number in output\n"
             "    --enumerate|-e       enumerate phy event source names, "
             "ignore\n"
@@ -153,10 +220,19 @@ usage(void)
             "index (def: 1)\n"
             "    --interface=PARAMS|-I PARAMS    specify or override "
             "interface\n"
+            "    --interval=MS|-t MS    sample the whole list every MS "
+            "milliseconds and\n"
+            "                           report per second counter deltas "
+            "(def: 1000\n"
+            "                           when --count given)\n"
             "    --long|-l            show phy event source hex value in "
             "output\n"
             "    --nonz|-n            only show phy events with non-zero "
             "counts\n"
+            "    --peaks|-P           read then clear peak value detectors "
+            "each interval,\n"
+            "                         show histograms of the peaks when "
+            "done\n"
             "    --raw|-r             output response in binary\n"
             "    --sa=SAS_ADDR|-s SAS_ADDR    SAS address of SMP "
             "target (use leading\n"
@@ -164,9 +240,13 @@ usage(void)
             "Depending on\n"
             "                                 the interface, may not be "
             "needed\n"
+            "    --store=FN|-S FN     append each sample to time series "
+            "file FN\n"
             "    --verbose|-v         increase verbosity\n"
             "    --version|-V         print version string and exit\n\n"
-            "Performs a SMP REPORT PHY EVENT LIST function\n"
+            "Performs a SMP REPORT PHY EVENT LIST function. In interval "
+            "mode all\ndescriptors from IN onward are fetched each "
+            "sample\n"
            );
 }
 
@@ -201,14 +281,10 @@ get_pes_name(int pes, char * b, int blen)
     return res;
 }
 
-/* from sas2r15 */
 static void
-show_phy_event_info(int phy_id, int prev_pid, int pes, unsigned int val,
-                    unsigned int thresh_val, bool do_long)
+show_phy_prefix(int phy_id, int prev_pid, int pes, bool do_long)
 {
-    unsigned int u;
-    char b[80];
-    const char * cp;
+    char b[32];
 
     if (do_long)
         printf("    phy_id=%d: [0x%x] ", phy_id, (unsigned int)pes);
@@ -219,7 +295,18 @@ show_phy_event_info(int phy_id, int prev_pid, int pes, unsigned int val,
             memset(b, ' ', strlen(b));
         printf("%s", b);
     }
+}
 
+/* from sas2r15 */
+static void
+show_phy_event_info(int phy_id, int prev_pid, int pes, unsigned int val,
+                    unsigned int thresh_val, bool do_long)
+{
+    unsigned int u;
+    char b[80];
+    const char * cp;
+
+    show_phy_prefix(phy_id, prev_pid, pes, do_long);
     switch (pes) {
     case 0:
         printf("No event\n");
@@ -295,57 +382,707 @@ show_phy_event_info(int phy_id, int prev_pid, int pes, unsigned int val,
     }
 }
 
+/* Sends a REPORT PHY EVENT LIST request starting at descriptor 'index'.
+ * On success returns 0 and places the response length in bytes (less the
+ * CRC) in *lenp; otherwise returns -1 or SMP_LIB_CAT_MALFORMED. */
+static int
+send_rpel(struct smp_target_obj * top, int index, uint8_t * smp_resp,
+          int * lenp, int verbose)
+{
+    int res, k, len, act_resplen;
+    uint8_t smp_req[] = {SMP_FRAME_TYPE_REQ, SMP_FN_REPORT_PHY_EVENT_LIST,
+                         0, 1,  0, 0, 0, 0,  0, 0, 0, 0};
+    struct smp_req_resp smp_rr;
+
+    len = (SMP_FN_REPORT_PHY_EVENT_LIST_RESP_LEN - 8) / 4;
+    smp_req[2] = (len < 0x100) ? len : 0xff; /* Allocated Response Len */
+    sg_put_unaligned_be16(index, smp_req + 6);
+    if (verbose) {
+        pr2serr("    Report phy event list request: ");
+        for (k = 0; k < (int)sizeof(smp_req); ++k)
+            pr2serr("%02x ", smp_req[k]);
+        pr2serr("\n");
+    }
+    memset(&smp_rr, 0, sizeof(smp_rr));
+    smp_rr.request_len = sizeof(smp_req);
+    smp_rr.request = smp_req;
+    smp_rr.max_response_len = SMP_FN_REPORT_PHY_EVENT_LIST_RESP_LEN;
+    smp_rr.response = smp_resp;
+    res = smp_send_req(top, &smp_rr, verbose);
+
+    if (res) {
+        pr2serr("smp_send_req failed, res=%d\n", res);
+        if (0 == verbose)
+            pr2serr("    try adding '-v' option for more debug\n");
+        return -1;
+    }
+    if (smp_rr.transport_err) {
+        pr2serr("smp_send_req transport_error=%d\n", smp_rr.transport_err);
+        return -1;
+    }
+    act_resplen = smp_rr.act_response_len;
+    if ((act_resplen >= 0) && (act_resplen < 4)) {
+        pr2serr("response too short, len=%d\n", act_resplen);
+        return SMP_LIB_CAT_MALFORMED;
+    }
+    len = smp_resp[3];
+    if ((0 == len) && (0 == smp_resp[2])) {
+        len = smp_get_func_def_resp_len(smp_resp[1]);
+        if (len < 0) {
+            len = 0;
+            if (verbose > 0)
+                pr2serr("unable to determine response length\n");
+        }
+    }
+    len = 4 + (len * 4);        /* length in bytes, excluding 4 byte CRC */
+    if ((act_resplen >= 0) && (len > act_resplen)) {
+        if (verbose)
+            pr2serr("actual response length [%d] less than deduced length "
+                    "[%d]\n", act_resplen, len);
+        len = act_resplen;
+    }
+    *lenp = len;
+    return 0;
+}
+
+/* Checks the response header. Returns 0 if it is good, else an exit
+ * status. */
+static int
+chk_rpel_resp(const uint8_t * smp_resp)
+{
+    char b[256];
+
+    if (SMP_FRAME_TYPE_RESP != smp_resp[0]) {
+        pr2serr("expected SMP frame response type, got=0x%x\n", smp_resp[0]);
+        return SMP_LIB_CAT_MALFORMED;
+    }
+    if (SMP_FN_REPORT_PHY_EVENT_LIST != smp_resp[1]) {
+        pr2serr("Expected function code=0x%x, got=0x%x\n",
+                SMP_FN_REPORT_PHY_EVENT_LIST, smp_resp[1]);
+        return SMP_LIB_CAT_MALFORMED;
+    }
+    if (smp_resp[2]) {
+        pr2serr("Report phy event list result: %s\n",
+                smp_get_func_res_str(smp_resp[2], sizeof(b), b));
+        return smp_resp[2];
+    }
+    return 0;
+}
+
+/* Peak value detector sources hold a peak, not a count, so they are not
+ * differenced in interval mode. */
+static bool
+is_pvd_source(int pes)
+{
+    return (pes >= 0x2b) && (pes <= 0x2e);
+}
+
+static int
+ped_arr_add(struct ped_arr_t * pap, unsigned int di, const uint8_t * pedp)
+{
+    int n;
+    struct ped_samp_t * sp;
+
+    if (pap->num >= pap->max) {
+        n = pap->max ? (2 * pap->max) : 64;
+        sp = (struct ped_samp_t *)realloc(pap->arr, n * sizeof(*sp));
+        if (NULL == sp)
+            return SMP_LIB_RESOURCE_ERROR;
+        pap->arr = sp;
+        pap->max = n;
+    }
+    sp = pap->arr + pap->num++;
+    sp->di = di;
+    sp->phy_id = pedp[2];
+    sp->pes = pedp[3];
+    sp->val = sg_get_unaligned_be32(pedp + 4);
+    sp->pvdt = sg_get_unaligned_be32(pedp + 8);
+    return 0;
+}
+
+/* Fetches every phy event list descriptor from op->starting_index up to
+ * the last descriptor index, one REPORT PHY EVENT LIST per page of the
+ * response, into *pap. Returns 0 on success, else an exit status. */
+static int
+fetch_all_peds(struct smp_target_obj * top, uint8_t * smp_resp,
+               const struct opts_t * op, struct ped_arr_t * pap)
+{
+    int ret, k, len, ped_len, num_ped;
+    unsigned int index, first_di, last_di;
+
+    pap->num = 0;
+    for (index = op->starting_index; ; index = first_di + num_ped) {
+        ret = send_rpel(top, index, smp_resp, &len, op->verbose);
+        if (ret)
+            return ret;
+        ret = chk_rpel_resp(smp_resp);
+        if (ret)
+            return ret;
+        if (len < 16) {
+            pr2serr("response too short, len=%d\n", len);
+            return SMP_LIB_CAT_MALFORMED;
+        }
+        pap->ecc = sg_get_unaligned_be16(smp_resp + 4);
+        first_di = sg_get_unaligned_be16(smp_resp + 6);
+        last_di = sg_get_unaligned_be16(smp_resp + 8);
+        ped_len = smp_resp[10] * 4;
+        num_ped = smp_resp[15];
+        if (ped_len < 12) {
+            pr2serr("Unexpectedly low descriptor length: %d bytes\n",
+                    ped_len);
+            return -1;
+        }
+        if (num_ped > (len - 16) / ped_len)
+            num_ped = (len - 16) / ped_len;
+        for (k = 0; k < num_ped; ++k) {
+            if ((! op->do_force) && ((first_di + k) > last_di))
+                break;
+            ret = ped_arr_add(pap, first_di + k,
+                              smp_resp + 16 + (k * ped_len));
+            if (ret)
+                return ret;
+        }
+        /* stop at the end of the list, or if the target does not move on */
+        if ((k < num_ped) || (0 == num_ped) ||
+            ((first_di + num_ped) > last_di) ||
+            ((first_di + num_ped) <= index) ||
+            ((first_di + num_ped) > 0xffff))
+            break;
+    }
+    return 0;
+}
+
+/* Counters are 32 bits wide and wrap, so an unsigned difference gives the
+ * right delta across (at most) one wrap between samples. */
+static void
+show_phy_event_delta(const struct ped_samp_t * sp, int prev_pid,
+                     const struct ped_samp_t * prev_sp, int elapsed_ms,
+                     bool do_long)
+{
+    uint32_t delta;
+    uint64_t r10;
+    char b[80];
+    const char * cp;
+
+    show_phy_prefix(sp->phy_id, prev_pid, sp->pes, do_long);
+    if ((cp = get_pes_name(sp->pes, b, sizeof(b))))
+        printf("%s: ", cp);
+    else
+        printf("Unknown Phy Event Source [0x%x]: ", sp->pes);
+    if (NULL == prev_sp) {
+        printf("%u (new, no delta)\n", sp->val);
+        return;
+    }
+    delta = sp->val - prev_sp->val;
+    /* rate per second to one decimal place, without floating point */
+    r10 = (elapsed_ms > 0) ? (((uint64_t)delta * 10000) / elapsed_ms) : 0;
+    printf("%u (%" PRIu64 ".%u/s)\n", delta, r10 / 10,
+           (unsigned int)(r10 % 10));
+}
+
+static void
+show_deltas(const struct ped_arr_t * cur, const struct ped_arr_t * prev,
+            int elapsed_ms, const struct opts_t * op)
+{
+    int k, j, prev_pid;
+    const struct ped_samp_t * sp;
+    const struct ped_samp_t * prev_sp;
+
+    for (k = 0, j = 0, prev_pid = -1; k < cur->num; ++k) {
+        sp = cur->arr + k;
+        /* both lists ascend by descriptor index */
+        while ((j < prev->num) && (prev->arr[j].di < sp->di))
+            ++j;
+        prev_sp = NULL;
+        if ((j < prev->num) && (prev->arr[j].di == sp->di) &&
+            (prev->arr[j].phy_id == sp->phy_id) &&
+            (prev->arr[j].pes == sp->pes))
+            prev_sp = prev->arr + j;
+        if ((0 == sp->pes) || is_pvd_source(sp->pes)) {
+            if (op->do_nonz && (0 == sp->val))
+                continue;
+            if (op->do_desc)
+                printf("   Descriptor index %u:\n", sp->di);
+            show_phy_event_info(sp->phy_id, prev_pid, sp->pes, sp->val,
+                                sp->pvdt, op->do_long);
+        } else {
+            if (op->do_nonz && prev_sp && (sp->val == prev_sp->val))
+                continue;
+            if (op->do_desc)
+                printf("   Descriptor index %u:\n", sp->di);
+            show_phy_event_delta(sp, prev_pid, prev_sp, elapsed_ms,
+                                 op->do_long);
+        }
+        prev_pid = sp->phy_id;
+    }
+}
+
+static int64_t
+real_ms(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_REALTIME, &ts))
+        return 0;
+    return ((int64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/* Appends a sample of each descriptor in *pap to the time series file,
+ * then flushes it so readers see whole samples. */
+static int
+store_peds(const struct ped_arr_t * pap, const struct opts_t * op)
+{
+    int k;
+    int64_t t_ms = real_ms();
+    const struct ped_samp_t * sp;
+
+    for (k = 0; k < pap->num; ++k) {
+        sp = pap->arr + k;
+        if (0 == sp->pes)
+            continue;
+        if (smp_ts_append(op->tsp, op->store_sa, sp->phy_id, sp->pes, t_ms,
+                          sp->val))
+            break;
+    }
+    if ((k < pap->num) || smp_ts_flush(op->tsp)) {
+        pr2serr("error writing time series file\n");
+        return SMP_LIB_FILE_ERROR;
+    }
+    return 0;
+}
+
+static void
+sleep_until_ms(int64_t when_ms)
+{
+    int64_t ms = when_ms - smp_get_mono_ms();
+    struct timespec ts;
+
+    if (ms <= 0)
+        return;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    while ((nanosleep(&ts, &ts) < 0) && (EINTR == errno) && (! pk_stop))
+        ;
+}
+
+/* Interval mode: the whole list is sampled every op->interval_ms
+ * milliseconds, keeping the previous sample to difference against. The
+ * first sample is shown as absolute values, then op->count reports of
+ * deltas (0 for until interrupted). */
+static int
+do_interval(struct smp_target_obj * top, uint8_t * smp_resp,
+            const struct opts_t * op)
+{
+    int ret, k, prev_pid;
+    int64_t start_ms, prev_ms, now_ms;
+    struct ped_arr_t a[2];
+    struct ped_arr_t * cur;
+    struct ped_arr_t * prev;
+    const struct ped_samp_t * sp;
+
+    memset(a, 0, sizeof(a));
+    prev = a + 0;
+    cur = a + 1;
+    start_ms = smp_get_mono_ms();
+    prev_ms = start_ms;
+    ret = fetch_all_peds(top, smp_resp, op, prev);
+    if ((0 == ret) && op->tsp)
+        ret = store_peds(prev, op);
+    if (ret)
+        goto fini;
+    printf("Report phy event list, baseline of %d descriptors:\n",
+           prev->num);
+    if (op->verbose || prev->ecc)
+        printf("  Expander change count: %d\n", prev->ecc);
+    for (k = 0, prev_pid = -1; k < prev->num; ++k) {
+        sp = prev->arr + k;
+        if (op->do_nonz && (0 == sp->val))
+            continue;
+        if (op->do_desc)
+            printf("   Descriptor index %u:\n", sp->di);
+        show_phy_event_info(sp->phy_id, prev_pid, sp->pes, sp->val,
+                            sp->pvdt, op->do_long);
+        prev_pid = sp->phy_id;
+    }
+    fflush(stdout);
+    for (k = 1; (0 == op->count) || (k <= op->count); ++k) {
+        sleep_until_ms(start_ms + ((int64_t)k * op->interval_ms));
+        now_ms = smp_get_mono_ms();
+        ret = fetch_all_peds(top, smp_resp, op, cur);
+        if ((0 == ret) && op->tsp)
+            ret = store_peds(cur, op);
+        if (ret)
+            goto fini;
+        printf("Phy event deltas over %d ms [%d]:\n",
+               (int)(now_ms - prev_ms), k);
+        if (cur->ecc != prev->ecc)
+            printf("  Expander change count: %d (was %d)\n", cur->ecc,
+                   prev->ecc);
+        show_deltas(cur, prev, (int)(now_ms - prev_ms), op);
+        fflush(stdout);
+        prev_ms = now_ms;
+        if (cur == a + 1) {
+            cur = a + 0;
+            prev = a + 1;
+        } else {
+            cur = a + 1;
+            prev = a + 0;
+        }
+    }
+fini:
+    free(a[0].arr);
+    free(a[1].arr);
+    return ret;
+}
+
+static void
+stop_handler(int sig)
+{
+    (void)sig;
+    pk_stop = 1;
+}
+
+/* Sends a CONFIGURE PHY EVENT request with the CLEAR PEAKS bit set and no
+ * phy event configuration descriptors, as 'smp_conf_phy_event --clear'
+ * does, so only the peak value detectors of 'phy_id' are changed. The
+ * expected expander change count is 0 (not checked). Returns 0 on success,
+ * else an exit status. */
+static int
+send_clear_peaks(struct smp_target_obj * top, int phy_id, int verbose)
+{
+    int res, k;
+    uint8_t smp_req[] = {SMP_FRAME_TYPE_REQ, SMP_FN_CONFIG_PHY_EVENT, 0, 2,
+                         0, 0, 1, 0,  0, 0, 2, 0,  0, 0, 0, 0};
+    uint8_t smp_resp[8];
+    struct smp_req_resp smp_rr;
+    char b[256];
+
+    smp_req[9] = phy_id;
+    if (verbose > 1) {
+        pr2serr("    Configure phy event request: ");
+        for (k = 0; k < (int)sizeof(smp_req); ++k)
+            pr2serr("%02x ", smp_req[k]);
+        pr2serr("\n");
+    }
+    memset(&smp_rr, 0, sizeof(smp_rr));
+    smp_rr.request_len = sizeof(smp_req);
+    smp_rr.request = smp_req;
+    smp_rr.max_response_len = sizeof(smp_resp);
+    smp_rr.response = smp_resp;
+    res = smp_send_req(top, &smp_rr, verbose);
+
+    if (res) {
+        pr2serr("smp_send_req failed, res=%d\n", res);
+        return -1;
+    }
+    if (smp_rr.transport_err) {
+        pr2serr("smp_send_req transport_error=%d\n", smp_rr.transport_err);
+        return -1;
+    }
+    if ((smp_rr.act_response_len >= 0) && (smp_rr.act_response_len < 4)) {
+        pr2serr("response too short, len=%d\n", smp_rr.act_response_len);
+        return SMP_LIB_CAT_MALFORMED;
+    }
+    if ((SMP_FRAME_TYPE_RESP != smp_resp[0]) ||
+        (SMP_FN_CONFIG_PHY_EVENT != smp_resp[1])) {
+        pr2serr("Unexpected configure phy event response\n");
+        return SMP_LIB_CAT_MALFORMED;
+    }
+    if (smp_resp[2]) {
+        pr2serr("Configure phy event (clear peaks, phy %d) result: %s\n",
+                phy_id, smp_get_func_res_str(smp_resp[2], sizeof(b), b));
+        return smp_resp[2];
+    }
+    return 0;
+}
+
+/* Clears the peak value detectors of each phy that has at least one of
+ * them in the list held in *pap, placing the number of phys cleared in
+ * *nump. Returns 0 on success, else an exit status. */
+static int
+clear_all_peaks(struct smp_target_obj * top, const struct ped_arr_t * pap,
+                int * nump, int verbose)
+{
+    int k, ret, n;
+    const struct ped_samp_t * sp;
+    bool done[256];
+
+    memset(done, 0, sizeof(done));
+    for (k = 0, n = 0; k < pap->num; ++k) {
+        sp = pap->arr + k;
+        if ((! is_pvd_source(sp->pes)) || done[sp->phy_id])
+            continue;
+        done[sp->phy_id] = true;
+        ret = send_clear_peaks(top, sp->phy_id, verbose);
+        if (ret)
+            return ret;
+        ++n;
+    }
+    *nump = n;
+    return 0;
+}
+
+/* Returns a peak value in the unit it is shown in: a count for 0x2b and
+ * microseconds for the others. 0x2c uses microseconds below 0x8000 and
+ * milliseconds (offset by 33) above; both are returned as microseconds. */
+static uint32_t
+pvd_value(int pes, uint32_t val)
+{
+    uint32_t u;
+
+    switch (pes) {
+    case 0x2b:
+        return val & 0xff;
+    case 0x2c:
+        u = val & 0xffff;
+        return (u < 0x8000) ? u : (33 + (u - 0x8000)) * 1000;
+    default:
+        return val;
+    }
+}
+
+static int
+pvd_bucket(uint32_t v)
+{
+    int k;
+
+    if (v < PVD_LIN_MAX)
+        return v;
+    for (k = 0; (v >> k) > 1; ++k)
+        ;               /* k is the position of the most significant bit */
+    return PVD_LIN_MAX + ((k - PVD_LIN_BITS - 1) * PVD_LIN_SUB) +
+           ((v >> (k - PVD_LIN_BITS)) & (PVD_LIN_SUB - 1));
+}
+
+/* Places the lowest and highest value held by bucket 'idx' in *lop and
+ * *hip. */
+static void
+pvd_bucket_range(int idx, uint32_t * lop, uint32_t * hip)
+{
+    int j, shift;
+
+    if (idx < PVD_LIN_MAX) {
+        *lop = idx;
+        *hip = idx;
+        return;
+    }
+    j = idx - PVD_LIN_MAX;
+    shift = (j / PVD_LIN_SUB) + 1;
+    *lop = (uint32_t)(PVD_LIN_SUB + (j % PVD_LIN_SUB)) << shift;
+    *hip = *lop + ((1U << shift) - 1);
+}
+
+static void
+pvd_hist_add(struct pvd_hist_t * hp, uint32_t v)
+{
+    if ((0 == hp->num) || (v < hp->min))
+        hp->min = v;
+    if (v > hp->max)
+        hp->max = v;
+    ++hp->num;
+    hp->sum += v;
+    ++hp->cnt[pvd_bucket(v)];
+}
+
+/* Returns the upper bound of the bucket holding the 'pc' percentile,
+ * capped at the largest value seen. */
+static uint32_t
+pvd_hist_pc(const struct pvd_hist_t * hp, int pc)
+{
+    int k;
+    uint32_t lo, hi;
+    uint64_t target, tot;
+
+    target = (((uint64_t)hp->num * pc) + 99) / 100;
+    for (k = 0, tot = 0; k < PVD_NUM_BUCKETS; ++k) {
+        tot += hp->cnt[k];
+        if (tot >= target)
+            break;
+    }
+    if (k >= PVD_NUM_BUCKETS)
+        return hp->max;
+    pvd_bucket_range(k, &lo, &hi);
+    return (hi < hp->max) ? hi : hp->max;
+}
+
+static void
+show_pvd_hists(struct pvd_hist_t ** hpp, int num_samp,
+               const struct opts_t * op)
+{
+    int k, j, pes;
+    uint32_t lo, hi;
+    const struct pvd_hist_t * hp;
+    char b[80];
+
+    printf("Peak value detector histograms, %d samples of %d ms:\n",
+           num_samp, op->interval_ms);
+    for (k = 0; k < (256 * PVD_NUM_SRC); ++k) {
+        hp = hpp[k];
+        if ((NULL == hp) || (0 == hp->num) || (op->do_nonz && (0 == hp->max)))
+            continue;
+        pes = 0x2b + (k % PVD_NUM_SRC);
+        if (op->do_long)
+            printf("  phy_id=%d: [0x%x] %s%s\n", k / PVD_NUM_SRC, pes,
+                   get_pes_name(pes, b, sizeof(b)),
+                   (0x2b == pes) ? "" : " (us)");
+        else
+            printf("  %d: %s%s\n", k / PVD_NUM_SRC,
+                   get_pes_name(pes, b, sizeof(b)),
+                   (0x2b == pes) ? "" : " (us)");
+        printf("    samples=%u min=%u mean=%" PRIu64 " max=%u p50<=%u "
+               "p90<=%u p99<=%u\n", hp->num, hp->min, hp->sum / hp->num,
+               hp->max, pvd_hist_pc(hp, 50), pvd_hist_pc(hp, 90),
+               pvd_hist_pc(hp, 99));
+        for (j = 0; j < PVD_NUM_BUCKETS; ++j) {
+            if (0 == hp->cnt[j])
+                continue;
+            pvd_bucket_range(j, &lo, &hi);
+            if (lo == hi)
+                printf("      %21u: %u\n", lo, hp->cnt[j]);
+            else
+                printf("      %10u-%10u: %u\n", lo, hi, hp->cnt[j]);
+        }
+    }
+}
+
+/* Peak sampling mode: the peak value detectors (sources 0x2b to 0x2e) are
+ * cleared, then every op->interval_ms milliseconds the whole list is read
+ * and those phys cleared again, so each sample is the peak over one
+ * interval. Events between the read and the clear are not seen. Histograms
+ * are shown after op->count samples (0 for until interrupted). */
+static int
+do_peaks(struct smp_target_obj * top, uint8_t * smp_resp,
+         const struct opts_t * op)
+{
+    int ret, k, j, idx, num_phys;
+    int64_t start_ms;
+    struct ped_arr_t a;
+    const struct ped_samp_t * sp;
+    struct pvd_hist_t ** hpp;
+    struct sigaction sa_act;
+
+    memset(&a, 0, sizeof(a));
+    hpp = (struct pvd_hist_t **)calloc(256 * PVD_NUM_SRC, sizeof(*hpp));
+    if (NULL == hpp)
+        return SMP_LIB_RESOURCE_ERROR;
+    memset(&sa_act, 0, sizeof(sa_act));
+    sa_act.sa_handler = stop_handler;
+    sigemptyset(&sa_act.sa_mask);
+    sigaction(SIGINT, &sa_act, NULL);
+    sigaction(SIGTERM, &sa_act, NULL);
+
+    ret = fetch_all_peds(top, smp_resp, op, &a);
+    if (ret)
+        goto fini;
+    ret = clear_all_peaks(top, &a, &num_phys, op->verbose);
+    if (ret)
+        goto fini;
+    if (0 == num_phys) {
+        pr2serr("no peak value detectors (sources 0x2b to 0x2e) in phy "
+                "event list,\n    add some with smp_conf_phy_event\n");
+        ret = SMP_LIB_CAT_OTHER;
+        goto fini;
+    }
+    start_ms = smp_get_mono_ms();
+    printf("Sampling peak value detectors of %d phys every %d ms\n",
+           num_phys, op->interval_ms);
+    fflush(stdout);
+    for (k = 1; ((0 == op->count) || (k <= op->count)) && (! pk_stop); ++k) {
+        sleep_until_ms(start_ms + ((int64_t)k * op->interval_ms));
+        if (pk_stop)
+            break;
+        ret = fetch_all_peds(top, smp_resp, op, &a);
+        if ((0 == ret) && op->tsp)
+            ret = store_peds(&a, op);
+        if (ret)
+            break;
+        for (j = 0; j < a.num; ++j) {
+            sp = a.arr + j;
+            if (! is_pvd_source(sp->pes))
+                continue;
+            idx = (sp->phy_id * PVD_NUM_SRC) + (sp->pes - 0x2b);
+            if (NULL == hpp[idx]) {
+                hpp[idx] = (struct pvd_hist_t *)calloc(1, sizeof(**hpp));
+                if (NULL == hpp[idx]) {
+                    ret = SMP_LIB_RESOURCE_ERROR;
+                    break;
+                }
+            }
+            pvd_hist_add(hpp[idx], pvd_value(sp->pes, sp->val));
+        }
+        if (ret)
+            break;
+        ret = clear_all_peaks(top, &a, &num_phys, op->verbose);
+        if (ret)
+            break;
+    }
+    /* show what was gathered, even after an error or a signal */
+    show_pvd_hists(hpp, k - 1, op);
+fini:
+    for (k = 0; k < (256 * PVD_NUM_SRC); ++k)
+        free(hpp[k]);
+    free(hpp);
+    free(a.arr);
+    return ret;
+}
+
 
 int
 main(int argc, char * argv[])
 {
-    bool do_desc = false;
     bool do_enumerate = false;
-    bool do_force = false;
-    bool do_long = false;
-    bool do_nonz = false;
     bool do_raw = false;
-    int res, c, k, len, ped_len, num_ped, pes, phy_id, prev_pid, act_resplen;
+    int res, c, k, len, ped_len, num_ped, pes, phy_id, prev_pid;
     int do_hex = 0;
     int ret = 0;
-    int starting_index = DEF_STARTING_INDEX;
     int subvalue = 0;
-    int verbose = 0;
     unsigned int first_di, last_di, pe_val, pvdt;
     int64_t sa_ll;
+    int64_t t_ms;
     uint64_t sa = 0;
+    const char * store_fn = NULL;
     char * cp;
     uint8_t * pedp;
     const struct pes_name_t * pnp;
+    struct opts_t * op;
     char i_params[256];
     char device_name[512];
     char b[256];
-    uint8_t smp_req[] = {SMP_FRAME_TYPE_REQ, SMP_FN_REPORT_PHY_EVENT_LIST,
-                         0, 1,  0, 0, 0, 0,  0, 0, 0, 0};
     uint8_t * smp_resp = NULL;
     uint8_t * free_smp_resp = NULL;
-    struct smp_req_resp smp_rr;
     struct smp_target_obj tobj;
+    struct opts_t opts;
 
+    op = &opts;
+    memset(op, 0, sizeof(opts));
+    op->starting_index = DEF_STARTING_INDEX;
+    op->count = -1;
     memset(device_name, 0, sizeof device_name);
     memset(i_params, 0, sizeof i_params);
     while (1) {
         int option_index = 0;
 
-        c = getopt_long(argc, argv, "defhHi:I:lnrs:vV", long_options,
+        c = getopt_long(argc, argv, "c:defhHi:I:lnPrs:S:t:vV", long_options,
                         &option_index);
         if (c == -1)
             break;
 
         switch (c) {
+        case 'c':
+           op->count = smp_get_num(optarg);
+           if (op->count < 0) {
+                pr2serr("bad argument to '--count'\n");
+                return SMP_LIB_SYNTAX_ERROR;
+            }
+            break;
         case 'd':
-            do_desc = true;
+            op->do_desc = true;
             break;
         case 'e':
             do_enumerate = true;
             break;
         case 'f':
-            do_force = true;
+            op->do_force = true;
             break;
         case 'h':
         case '?':
@@ -355,8 +1092,8 @@ main(int argc, char * argv[])
             ++do_hex;
             break;
         case 'i':
-           starting_index = smp_get_num(optarg);
-           if ((starting_index < 0) || (starting_index > 65535)) {
+           op->starting_index = smp_get_num(optarg);
+           if ((op->starting_index < 0) || (op->starting_index > 65535)) {
                 pr2serr("bad argument to '--index'\n");
                 return SMP_LIB_SYNTAX_ERROR;
             }
@@ -366,10 +1103,13 @@ main(int argc, char * argv[])
             i_params[sizeof(i_params) - 1] = '\0';
             break;
         case 'l':
-            do_long = true;
+            op->do_long = true;
             break;
         case 'n':
-            do_nonz = true;
+            op->do_nonz = true;
+            break;
+        case 'P':
+            op->do_peaks = true;
             break;
         case 'r':
             do_raw = true;
@@ -382,8 +1122,19 @@ main(int argc, char * argv[])
             }
             sa = (uint64_t)sa_ll;
             break;
+        case 'S':
+            store_fn = optarg;
+            break;
+        case 't':
+           op->interval_ms = smp_get_num(optarg);
+           if (op->interval_ms < 1) {
+                pr2serr("bad argument to '--interval', expect 1 or more "
+                        "milliseconds\n");
+                return SMP_LIB_SYNTAX_ERROR;
+            }
+            break;
         case 'v':
-            ++verbose;
+            ++op->verbose;
             break;
         case 'V':
             pr2serr("version: %s\n", version_str);
@@ -414,6 +1165,15 @@ main(int argc, char * argv[])
             printf("    [0x%02x] %s\n", pnp->pes, pnp->pes_name);
         return 0;
     }
+    if (((op->count >= 0) || op->do_peaks) && (0 == op->interval_ms))
+        op->interval_ms = DEF_INTERVAL_MS;
+    if (op->count < 0)
+        op->count = 0;          /* no --count: until interrupted */
+    if ((op->interval_ms || store_fn) && (do_hex || do_raw)) {
+        pr2serr("--interval, --count, --peaks and --store cannot be used "
+                "with --hex or --raw\n");
+        return SMP_LIB_SYNTAX_ERROR;
+    }
     if (0 == device_name[0]) {
         cp = getenv("SMP_UTILS_DEVICE");
         if (cp)
@@ -457,7 +1217,7 @@ main(int argc, char * argv[])
     }
 
     res = smp_initiator_open(device_name, subvalue, i_params, sa,
-                             &tobj, verbose);
+                             &tobj, op->verbose);
     if (res < 0)
         return SMP_LIB_FILE_ERROR;
 
@@ -470,56 +1230,38 @@ main(int argc, char * argv[])
         ret = SMP_LIB_RESOURCE_ERROR;
         goto err_out;
     }
-    len = (SMP_FN_REPORT_PHY_EVENT_LIST_RESP_LEN - 8) / 4;
-    smp_req[2] = (len < 0x100) ? len : 0xff; /* Allocated Response Len */
-    sg_put_unaligned_be16(starting_index, smp_req + 6);
-    if (verbose) {
-        pr2serr("    Report phy event list request: ");
-        for (k = 0; k < (int)sizeof(smp_req); ++k)
-            pr2serr("%02x ", smp_req[k]);
-        pr2serr("\n");
-    }
-    memset(&smp_rr, 0, sizeof(smp_rr));
-    smp_rr.request_len = sizeof(smp_req);
-    smp_rr.request = smp_req;
-    smp_rr.max_response_len = SMP_FN_REPORT_PHY_EVENT_LIST_RESP_LEN;
-    smp_rr.response = smp_resp;
-    res = smp_send_req(&tobj, &smp_rr, verbose);
+    if (store_fn) {
+        op->store_sa = sa;
+        if (0 == op->store_sa) {
+            struct smp_phy_desc pd;
 
-    if (res) {
-        pr2serr("smp_send_req failed, res=%d\n", res);
-        if (0 == verbose)
-            pr2serr("    try adding '-v' option for more debug\n");
-        ret = -1;
-        goto err_out;
+            if ((0 == smp_discover_phy(&tobj, 0, &pd, op->verbose)) &&
+                pd.sa)
+                op->store_sa = pd.sa;
+            else {
+                pr2serr("unable to fetch SAS address of expander for "
+                        "--store, give --sa=\n");
+                ret = SMP_LIB_CAT_OTHER;
+                goto err_out;
+            }
+        }
+        op->tsp = smp_ts_open(store_fn, true,
+                              op->verbose ? op->verbose : 1);
+        if (NULL == op->tsp) {
+            ret = SMP_LIB_FILE_ERROR;
+            goto err_out;
+        }
     }
-    if (smp_rr.transport_err) {
-        pr2serr("smp_send_req transport_error=%d\n", smp_rr.transport_err);
-        ret = -1;
+    if (op->interval_ms) {
+        if (op->do_peaks)
+            ret = do_peaks(&tobj, smp_resp, op);
+        else
+            ret = do_interval(&tobj, smp_resp, op);
         goto err_out;
     }
-    act_resplen = smp_rr.act_response_len;
-    if ((act_resplen >= 0) && (act_resplen < 4)) {
-        pr2serr("response too short, len=%d\n", act_resplen);
-        ret = SMP_LIB_CAT_MALFORMED;
+    ret = send_rpel(&tobj, op->starting_index, smp_resp, &len, op->verbose);
+    if (ret)
         goto err_out;
-    }
-    len = smp_resp[3];
-    if ((0 == len) && (0 == smp_resp[2])) {
-        len = smp_get_func_def_resp_len(smp_resp[1]);
-        if (len < 0) {
-            len = 0;
-            if (verbose > 0)
-                pr2serr("unable to determine response length\n");
-        }
-    }
-    len = 4 + (len * 4);        /* length in bytes, excluding 4 byte CRC */
-    if ((act_resplen >= 0) && (len > act_resplen)) {
-        if (verbose)
-            pr2serr("actual response length [%d] less than deduced length "
-                    "[%d]\n", act_resplen, len);
-        len = act_resplen;
-    }
     if (do_hex || do_raw) {
         if (do_hex)
             hex2stdout(smp_resp, len, 1);
@@ -527,36 +1269,22 @@ main(int argc, char * argv[])
             dStrRaw(smp_resp, len);
         if (SMP_FRAME_TYPE_RESP != smp_resp[0])
             ret = SMP_LIB_CAT_MALFORMED;
-        if (smp_resp[1] != smp_req[1])
+        if (smp_resp[1] != SMP_FN_REPORT_PHY_EVENT_LIST)
             ret = SMP_LIB_CAT_MALFORMED;
         if (smp_resp[2]) {
             ret = smp_resp[2];
-            if (verbose)
+            if (op->verbose)
                 pr2serr("Report phy event list result: %s\n",
                         smp_get_func_res_str(ret, sizeof(b), b));
         }
         goto err_out;
     }
-    if (SMP_FRAME_TYPE_RESP != smp_resp[0]) {
-        pr2serr("expected SMP frame response type, got=0x%x\n", smp_resp[0]);
-        ret = SMP_LIB_CAT_MALFORMED;
+    ret = chk_rpel_resp(smp_resp);
+    if (ret)
         goto err_out;
-    }
-    if (smp_resp[1] != smp_req[1]) {
-        pr2serr("Expected function code=0x%x, got=0x%x\n", smp_req[1],
-                smp_resp[1]);
-        ret = SMP_LIB_CAT_MALFORMED;
-        goto err_out;
-    }
-    if (smp_resp[2]) {
-        cp = smp_get_func_res_str(smp_resp[2], sizeof(b), b);
-        pr2serr("Report phy event list result: %s\n", cp);
-        ret = smp_resp[2];
-        goto err_out;
-    }
     printf("Report phy event list response:\n");
     res = sg_get_unaligned_be16(smp_resp + 4);
-    if (verbose || res)
+    if (op->verbose || res)
         printf("  Expander change count: %d\n", res);
     first_di = sg_get_unaligned_be16(smp_resp + 6);
     last_di = sg_get_unaligned_be16(smp_resp + 8);
@@ -572,10 +1300,11 @@ main(int argc, char * argv[])
         goto err_out;
     }
     pedp = smp_resp + 16;
+    t_ms = real_ms();
     for (k = 0, prev_pid = -1; k < num_ped;
          ++k, pedp += ped_len, prev_pid = phy_id) {
-        if ((! do_force) && ((first_di + k) > last_di)) {
-            if (do_long)
+        if ((! op->do_force) && ((first_di + k) > last_di)) {
+            if (op->do_long)
                 printf("last descriptor index exceeded, exiting\n");
             break;
         }
@@ -583,16 +1312,28 @@ main(int argc, char * argv[])
         pes = pedp[3];
         pe_val = sg_get_unaligned_be32(pedp + 4);
         pvdt = sg_get_unaligned_be32(pedp + 8);
-        if ((! do_nonz) || pe_val) {
-            if (do_desc)
+        if (op->tsp && pes && smp_ts_append(op->tsp, op->store_sa, phy_id,
+                                            pes, t_ms, pe_val)) {
+            pr2serr("error writing time series file %s\n", store_fn);
+            ret = SMP_LIB_FILE_ERROR;
+            break;
+        }
+        if ((! op->do_nonz) || pe_val) {
+            if (op->do_desc)
                 printf("   Descriptor index %u:\n", first_di + k);
-            show_phy_event_info(phy_id, prev_pid, pes, pe_val, pvdt, do_long);
+            show_phy_event_info(phy_id, prev_pid, pes, pe_val, pvdt,
+                                op->do_long);
         }
     }
     if ((k >= num_ped) && ((first_di + k) < last_di))
         printf("Start next invocation at '--index=%u'\n", first_di + k);
 
 err_out:
+    if (op->tsp && smp_ts_close(op->tsp)) {
+        pr2serr("error closing time series file %s\n", store_fn);
+        if (0 == ret)
+            ret = SMP_LIB_FILE_ERROR;
+    }
     if (free_smp_resp)
         free(free_smp_resp);
     res = smp_initiator_close(&tobj);
@@ -603,7 +1344,7 @@ err_out:
     }
     if (ret < 0)
         ret = SMP_LIB_CAT_OTHER;
-    if (verbose && ret)
+    if (op->verbose && ret)
         pr2serr("Exit status %d indicates error detected\n", ret);
     return ret;
 }
@@ -0,0 +1,717 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#define __STDC_FORMAT_MACROS 1
+#include <inttypes.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "smp_lib.h"
+#include "sg_pr2serr.h"
+
+
+/* This is a Serial Attached SCSI (SAS) Serial Management Protocol (SMP)
+ * utility.
+ *
+ * This utility starts at the given expander and walks the SAS domain
+ * breadth first, following phys attached to expanders. Expanders at the
+ * same depth are interrogated concurrently. The result is output as one
+ * document, either text (one line per phy, like 'smp_discover -m') or
+ * JSON. Alternatively the result may be compared with an earlier snapshot
+ * and only the differences output.
+ */
+
+static const char * version_str = "1.02 20261016";
+
+struct opts_t {
+    bool do_json;       /* -j option given */
+    bool ign_zp;        /* -i option given */
+    int do_brief;       /* -b option given */
+    int max_exp;        /* -m MAX option given */
+    int num_workers;    /* -w NUM option given */
+    int verbose;
+    uint64_t sa;
+    const char * snap_fn;       /* -S FN option given */
+    const char * diff_fn;       /* -d OLD_FN option given */
+    const char * read_fn;       /* -r NEW_FN option given */
+};
+
+static struct option long_options[] = {
+        {"brief", no_argument, 0, 'b'},
+        {"diff", required_argument, 0, 'd'},
+        {"help", no_argument, 0, 'h'},
+        {"ignore", no_argument, 0, 'i'},
+        {"interface", required_argument, 0, 'I'},
+        {"json", no_argument, 0, 'j'},
+        {"max", required_argument, 0, 'm'},
+        {"read", required_argument, 0, 'r'},
+        {"sa", required_argument, 0, 's'},
+        {"snapshot", required_argument, 0, 'S'},
+        {"verbose", no_argument, 0, 'v'},
+        {"version", no_argument, 0, 'V'},
+        {"workers", required_argument, 0, 'w'},
+        {0, 0, 0, 0},
+};
+
+static const char * smp_short_attached_device_type[] = {
+    "",         /* was "no " */
+    "",         /* was "end" */
+    "exp",
+    "fex",      /* obsolete in sas2r05a */
+    "res",
+    "res",
+    "res",
+    "res",
+};
+
+
+static void
+usage(void)
+{
+    pr2serr("Usage: smp_topology [--brief] [--diff=OLD_FN] [--help] "
+            "[--ignore]\n"
+            "                    [--interface=PARAMS] [--json] [--max=MAX] "
+            "[--read=NEW_FN]\n"
+            "                    [--sa=SAS_ADDR] [--snapshot=FN] "
+            "[--verbose] [--version]\n"
+            "                    [--workers=NUM] SMP_DEVICE[,N]\n"
+            "  where:\n"
+            "    --brief|-b           only output phys that are "
+            "attached\n"
+            "    --diff=OLD_FN|-d OLD_FN    output only changes since "
+            "snapshot OLD_FN\n"
+            "    --help|-h            print out usage message\n"
+            "    --ignore|-i          sets the Ignore Zone Group bit; "
+            "will show\n"
+            "                         phys otherwise hidden by zoning\n"
+            "    --interface=PARAMS|-I PARAMS    specify or override "
+            "interface\n"
+            "    --json|-j            output topology as JSON\n"
+            "    --max=MAX|-m MAX     maximum number of expanders to "
+            "visit\n"
+            "                         (def: %d)\n"
+            "    --read=NEW_FN|-r NEW_FN    with --diff, compare with "
+            "snapshot NEW_FN\n"
+            "                               rather than walking from "
+            "SMP_DEVICE\n"
+            "    --sa=SAS_ADDR|-s SAS_ADDR    SAS address of SMP "
+            "target (use leading\n"
+            "                                 '0x' or trailing 'h'). "
+            "Depending on\n"
+            "                                 the interface, may not be "
+            "needed\n"
+            "    --snapshot=FN|-S FN    also write topology to binary "
+            "snapshot file FN\n"
+            "    --verbose|-v         increase verbosity\n"
+            "    --version|-V         print version string and exit\n"
+            "    --workers=NUM|-w NUM    number of requests outstanding "
+            "at once\n"
+            "                            (def: %d, max: %d)\n\n"
+            "Walks the SAS domain breadth first starting at SMP_DEVICE, "
+            "following\nphys attached to expanders\n", SMP_TOPO_DEF_MAX_EXP,
+            SMP_BATCH_DEF_WORKERS, SMP_BATCH_MAX_WORKERS);
+}
+
+static const char *
+neg_lrate_str(int val)
+{
+    switch (val) {
+    case 0: return "unknown";
+    case 1: return "disabled";
+    case 2: return "reset problem";
+    case 3: return "spinup hold";
+    case 4: return "port selector";
+    case 5: return "reset in progress";
+    case 6: return "unsupported phy attached";
+    case 8: return "1.5 Gbps";
+    case 9: return "3 Gbps";
+    case 0xa: return "6 Gbps";
+    case 0xb: return "12 Gbps";
+    case 0xc: return "22.5 Gbps";
+    default: return "reserved";
+    }
+}
+
+static const char *
+routing_str(int val)
+{
+    switch (val) {
+    case 0: return "D";
+    case 1: return "S";
+    case 2: return "T";
+    default: return "R";
+    }
+}
+
+/* Places protocol names for bits 3 to 0 of val in b, separated by '+'. */
+static const char *
+proto_str(int val, char * b, int blen)
+{
+    static const char * pn[] = {"SATA", "SMP", "STP", "SSP"};
+    int k, off;
+
+    b[0] = '\0';
+    for (k = 3, off = 0; k >= 0; --k) {
+        if (val & (1 << k))
+            off += snprintf(b + off, blen - off, "%s%s", (off ? "+" : ""),
+                            pn[k]);
+    }
+    return b;
+}
+
+static void
+print_text(const struct smp_topo * tp, const struct opts_t * op)
+{
+    int k, j, neg;
+    const struct smp_topo_exp * ep;
+    const struct smp_topo_phy * pp;
+    char b[128];
+
+    printf("Topology: %d expander%s\n", tp->num_exp,
+           (1 == tp->num_exp) ? "" : "s");
+    for (k = 0; k < tp->num_exp; ++k) {
+        ep = tp->exps + k;
+        printf("expander %d  <%016" PRIx64 ">  depth=%d", k, ep->sa,
+               ep->depth);
+        if (ep->parent >= 0)
+            printf("  parent=%d/phy %d", ep->parent, ep->parent_phy);
+        printf("\n");
+        if (SMP_LIB_FILE_ERROR == ep->err) {
+            printf("  unable to open\n");
+            continue;
+        } else if (ep->err >= SMP_LIB_FILE_ERROR) {
+            printf("  no valid response to REPORT GENERAL\n");
+            continue;
+        } else if (ep->err) {
+            printf("  REPORT GENERAL: %s\n",
+                   smp_get_func_res_str(ep->err, sizeof(b), b));
+            continue;
+        }
+        if (ep->vendor[0] || ep->product[0])
+            printf("  %s  %s  %s\n", ep->vendor, ep->product,
+                   ep->revision);
+        if (op->verbose)
+            printf("  device: %s\n", ep->device_name);
+        printf("  number of phys: %d  expander change count: %d\n",
+               ep->num_phys, ep->ecc);
+        for (j = 0; j < ep->num_phys; ++j) {
+            pp = ep->phys + j;
+            if (pp->func_res) {
+                if (SMP_FRES_PHY_VACANT == pp->func_res) {
+                    if (0 == op->do_brief)
+                        printf("  phy %3d: inaccessible (phy vacant)\n", j);
+                } else if (SMP_FRES_NO_PHY == pp->func_res)
+                    printf("  phy %3d: not reported\n", j);
+                else
+                    printf("  phy %3d: %s\n", j,
+                           smp_get_func_res_str(pp->func_res, sizeof(b), b));
+                continue;
+            }
+            neg = pp->neg_lrate;
+            if ((neg > 0) && (neg < 8)) {
+                if (0 == op->do_brief)
+                    printf("  phy %3d:%s:%s\n", j, routing_str(pp->routing),
+                           neg_lrate_str(neg));
+                continue;
+            }
+            if ((0 == pp->adt) || (pp->adt > 3)) {
+                if (0 == op->do_brief)
+                    printf("  phy %3d:%s:attached:[0000000000000000:00]\n",
+                           j, routing_str(pp->routing));
+                continue;
+            }
+            printf("  phy %3d:%s:attached:[%016" PRIx64 ":%02d %s%s", j,
+                   routing_str(pp->routing), pp->att_sa, pp->att_phy_id,
+                   smp_short_attached_device_type[pp->adt],
+                   (pp->virt ? " V" : ""));
+            if (pp->att_iproto & 0xf)
+                printf(" i(%s)", proto_str(pp->att_iproto, b, sizeof(b)));
+            if (pp->att_tproto & 0xf)
+                printf(" t(%s)", proto_str(pp->att_tproto, b, sizeof(b)));
+            printf("]");
+            if (neg >= 8)
+                printf("  %s", neg_lrate_str(neg));
+            if (pp->att_exp >= 0)
+                printf("  -> expander %d", pp->att_exp);
+            printf("\n");
+        }
+    }
+}
+
+/* Outputs a JSON string, escaping as required. */
+static void
+json_str(const char * cp)
+{
+    putchar('"');
+    for ( ; *cp; ++cp) {
+        if (('"' == *cp) || ('\\' == *cp))
+            printf("\\%c", *cp);
+        else if ((unsigned char)*cp < 0x20)
+            printf("\\u%04x", (unsigned char)*cp);
+        else
+            putchar(*cp);
+    }
+    putchar('"');
+}
+
+static void
+print_json(const struct smp_topo * tp, const struct opts_t * op)
+{
+    bool first;
+    int k, j;
+    const struct smp_topo_exp * ep;
+    const struct smp_topo_phy * pp;
+
+    printf("{\n  \"expanders\": [");
+    for (k = 0; k < tp->num_exp; ++k) {
+        ep = tp->exps + k;
+        printf("%s\n    {\n", (k ? "," : ""));
+        printf("      \"index\": %d,\n", k);
+        printf("      \"sas_address\": \"0x%016" PRIx64 "\",\n", ep->sa);
+        printf("      \"depth\": %d,\n", ep->depth);
+        printf("      \"parent\": %d,\n", ep->parent);
+        printf("      \"parent_phy\": %d,\n", ep->parent_phy);
+        printf("      \"device\": ");
+        json_str(ep->device_name);
+        printf(",\n      \"vendor\": ");
+        json_str(ep->vendor);
+        printf(",\n      \"product\": ");
+        json_str(ep->product);
+        printf(",\n      \"revision\": ");
+        json_str(ep->revision);
+        printf(",\n      \"error\": %d,\n", ep->err);
+        printf("      \"change_count\": %d,\n", ep->ecc);
+        printf("      \"num_phys\": %d,\n", ep->num_phys);
+        printf("      \"phys\": [");
+        first = true;
+        for (j = 0; j < ep->num_phys; ++j) {
+            pp = ep->phys + j;
+            if (op->do_brief && (pp->func_res || (0 == pp->adt)))
+                continue;
+            printf("%s\n        {\"phy\": %d, \"function_result\": %d",
+                   (first ? "" : ","), j, pp->func_res);
+            first = false;
+            if (pp->func_res) {
+                printf("}");
+                continue;
+            }
+            printf(", \"routing\": \"%s\", \"negotiated_rate\": %d, "
+                   "\"attached_type\": %d,\n         \"attached_sas_"
+                   "address\": \"0x%016" PRIx64 "\", \"attached_phy\": %d, "
+                   "\"virtual\": %s,\n         \"initiator_proto\": %d, "
+                   "\"target_proto\": %d, \"zone_group\": %d, "
+                   "\"attached_expander\": %d}", routing_str(pp->routing),
+                   pp->neg_lrate, pp->adt, pp->att_sa, pp->att_phy_id,
+                   (pp->virt ? "true" : "false"), pp->att_iproto,
+                   pp->att_tproto, pp->zone_group, pp->att_exp);
+        }
+        printf("%s]\n    }", (first ? "" : "\n      "));
+    }
+    printf("\n  ]\n}\n");
+}
+
+/* Indexed by SMP_SNAP_CHG_* bit number. The text and JSON outputs both
+ * use these names so the two can be matched on. */
+static const char * chg_name[] = {
+    "expander added", "expander removed", "phy added", "phy removed",
+    "function result", "attached SAS address", "attached phy",
+    "attached device type", "negotiated logical link rate", "zone group",
+    "routing attribute", "other",
+};
+
+static const char *
+chg_str(unsigned int bit)
+{
+    int k;
+
+    for (k = 0; k < (int)(sizeof(chg_name) / sizeof(chg_name[0])); ++k) {
+        if (bit == (1U << k))
+            return chg_name[k];
+    }
+    return "unknown";
+}
+
+/* Outputs the old and new values of the fields flagged in what. */
+static void
+print_chg_fields(unsigned int what, const struct smp_phy_desc * odp,
+                 const struct smp_phy_desc * ndp)
+{
+    char b[128];
+    char b2[128];
+
+    if (what & SMP_SNAP_CHG_FUNC_RES)
+        printf("    %s: %s -> %s\n", chg_str(SMP_SNAP_CHG_FUNC_RES),
+               smp_get_func_res_str(odp->func_res, sizeof(b), b),
+               smp_get_func_res_str(ndp->func_res, sizeof(b2), b2));
+    if (what & SMP_SNAP_CHG_ATT_SA)
+        printf("    %s: 0x%016" PRIx64 " -> 0x%016" PRIx64 "\n",
+               chg_str(SMP_SNAP_CHG_ATT_SA), odp->att_sa, ndp->att_sa);
+    if (what & SMP_SNAP_CHG_ATT_PHY)
+        printf("    %s: %d -> %d\n", chg_str(SMP_SNAP_CHG_ATT_PHY),
+               odp->att_phy_id, ndp->att_phy_id);
+    if (what & SMP_SNAP_CHG_ADT)
+        printf("    %s: %d -> %d\n", chg_str(SMP_SNAP_CHG_ADT), odp->adt,
+               ndp->adt);
+    if (what & SMP_SNAP_CHG_LINK)
+        printf("    %s: %s [0x%x] -> %s [0x%x]\n", chg_str(SMP_SNAP_CHG_LINK),
+               neg_lrate_str(odp->neg_lrate), odp->neg_lrate,
+               neg_lrate_str(ndp->neg_lrate), ndp->neg_lrate);
+    if (what & SMP_SNAP_CHG_ZONE) {
+        printf("    %s: %d", chg_str(SMP_SNAP_CHG_ZONE), odp->zone_group);
+        if (odp->zone_group != ndp->zone_group)
+            printf(" -> %d", ndp->zone_group);
+        if (odp->zoning_flags != ndp->zoning_flags)
+            printf("  zoning flags: 0x%x -> 0x%x", odp->zoning_flags,
+                   ndp->zoning_flags);
+        printf("\n");
+    }
+    if (what & SMP_SNAP_CHG_ROUTING)
+        printf("    %s: %s -> %s\n", chg_str(SMP_SNAP_CHG_ROUTING),
+               routing_str(odp->routing), routing_str(ndp->routing));
+    if (what & SMP_SNAP_CHG_OTHER)
+        printf("    %s: protocols, virtual or phy capabilities changed\n",
+               chg_str(SMP_SNAP_CHG_OTHER));
+}
+
+static void
+print_diff_text(const struct smp_snap * osp, const struct smp_snap * nsp,
+                const struct smp_snap_chg * chp, int num)
+{
+    int k;
+    const struct smp_snap_chg * cp;
+    struct smp_phy_desc od;
+    struct smp_phy_desc nd;
+
+    printf("Changes: %d\n", num);
+    for (k = 0; k < num; ++k) {
+        cp = chp + k;
+        if (cp->phy_id < 0) {
+            printf("expander <%016" PRIx64 ">: %s\n", cp->exp_sa,
+                   (cp->what & SMP_SNAP_CHG_EXP_ADDED) ? "added" :
+                                                         "removed");
+            continue;
+        }
+        printf("expander <%016" PRIx64 ">  phy %3d:", cp->exp_sa,
+               cp->phy_id);
+        if (cp->what & (SMP_SNAP_CHG_PHY_ADDED | SMP_SNAP_CHG_PHY_REMOVED)) {
+            printf(" %s\n", (cp->what & SMP_SNAP_CHG_PHY_ADDED) ? "added" :
+                                                                  "removed");
+            continue;
+        }
+        printf("\n");
+        smp_snap_get_phy(osp, cp->old_pi, &od);
+        smp_snap_get_phy(nsp, cp->new_pi, &nd);
+        print_chg_fields(cp->what, &od, &nd);
+    }
+}
+
+static void
+print_json_phy(const struct smp_phy_desc * pdp)
+{
+    printf("{\"function_result\": %d, \"routing\": \"%s\", "
+           "\"negotiated_rate\": %d, \"attached_type\": %d, "
+           "\"attached_sas_address\": \"0x%016" PRIx64 "\", "
+           "\"attached_phy\": %d, \"zone_group\": %d}", pdp->func_res,
+           routing_str(pdp->routing), pdp->neg_lrate, pdp->adt,
+           pdp->att_sa, pdp->att_phy_id, pdp->zone_group);
+}
+
+static void
+print_diff_json(const struct smp_snap * osp, const struct smp_snap * nsp,
+                const struct smp_snap_chg * chp, int num)
+{
+    int k, j, n;
+    const struct smp_snap_chg * cp;
+    struct smp_phy_desc pd;
+
+    printf("{\n  \"changes\": [");
+    for (k = 0; k < num; ++k) {
+        cp = chp + k;
+        printf("%s\n    {\"sas_address\": \"0x%016" PRIx64 "\", "
+               "\"phy\": %d, \"what\": [", (k ? "," : ""), cp->exp_sa,
+               cp->phy_id);
+        for (j = 0, n = 0; j < (int)(sizeof(chg_name) / sizeof(chg_name[0]));
+             ++j) {
+            if (cp->what & (1 << j))
+                printf("%s\"%s\"", (n++ ? ", " : ""), chg_name[j]);
+        }
+        printf("]");
+        if (cp->old_pi >= 0) {
+            smp_snap_get_phy(osp, cp->old_pi, &pd);
+            printf(",\n     \"old\": ");
+            print_json_phy(&pd);
+        }
+        if (cp->new_pi >= 0) {
+            smp_snap_get_phy(nsp, cp->new_pi, &pd);
+            printf(",\n     \"new\": ");
+            print_json_phy(&pd);
+        }
+        printf("}");
+    }
+    printf("\n  ]\n}\n");
+}
+
+/* Compares snapshot op->diff_fn with new_sp and outputs the changes.
+ * Returns 0 or an SMP_LIB_* error. */
+static int
+do_diff(const struct smp_snap * new_sp, const struct opts_t * op)
+{
+    int num;
+    struct smp_snap * old_sp;
+    struct smp_snap_chg * chp;
+
+    old_sp = smp_snap_open(op->diff_fn, op->verbose + 1);
+    if (NULL == old_sp)
+        return SMP_LIB_FILE_ERROR;
+    num = smp_snap_diff(old_sp, new_sp, &chp);
+    if (num < 0) {
+        pr2serr("out of memory comparing snapshots\n");
+        smp_snap_close(old_sp);
+        return SMP_LIB_RESOURCE_ERROR;
+    }
+    if (op->do_json)
+        print_diff_json(old_sp, new_sp, chp, num);
+    else
+        print_diff_text(old_sp, new_sp, chp, num);
+    free(chp);
+    smp_snap_close(old_sp);
+    return 0;
+}
+
+
+int
+main(int argc, char * argv[])
+{
+    int res, c, n;
+    int ret = 0;
+    int subvalue = 0;
+    int64_t sa_ll;
+    char * cp;
+    struct smp_topo * tp = NULL;
+    struct smp_snap * sp;
+    struct opts_t opts;
+    struct opts_t * op;
+    char device_name[512];
+    char i_params[256];
+    struct smp_target_obj tobj;
+
+    op = &opts;
+    memset(op, 0, sizeof(opts));
+    memset(device_name, 0, sizeof device_name);
+    memset(i_params, 0, sizeof i_params);
+    op->num_workers = SMP_BATCH_DEF_WORKERS;
+    while (1) {
+        int option_index = 0;
+
+        c = getopt_long(argc, argv, "bd:hiI:jm:r:s:S:vVw:", long_options,
+                        &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'b':
+            ++op->do_brief;
+            break;
+        case 'd':
+            op->diff_fn = optarg;
+            break;
+        case 'h':
+        case '?':
+            usage();
+            return 0;
+        case 'i':
+            op->ign_zp = true;
+            break;
+        case 'I':
+            strncpy(i_params, optarg, sizeof(i_params));
+            i_params[sizeof(i_params) - 1] = '\0';
+            break;
+        case 'j':
+            op->do_json = true;
+            break;
+        case 'm':
+            n = smp_get_num(optarg);
+            if (n < 1) {
+                pr2serr("bad argument to '--max', expect value 1 or "
+                        "more\n");
+                return SMP_LIB_SYNTAX_ERROR;
+            }
+            op->max_exp = n;
+            break;
+        case 'r':
+            op->read_fn = optarg;
+            break;
+        case 's':
+           sa_ll = smp_get_llnum_nomult(optarg);
+           if (-1LL == sa_ll) {
+                pr2serr("bad argument to '--sa'\n");
+                return SMP_LIB_SYNTAX_ERROR;
+            }
+            op->sa = (uint64_t)sa_ll;
+            break;
+        case 'S':
+            op->snap_fn = optarg;
+            break;
+        case 'v':
+            ++op->verbose;
+            break;
+        case 'V':
+            pr2serr("version: %s\n", version_str);
+            return 0;
+        case 'w':
+            n = smp_get_num(optarg);
+            if ((n < 1) || (n > SMP_BATCH_MAX_WORKERS)) {
+                pr2serr("bad argument to '--workers', expect value from 1 "
+                        "to %d\n", SMP_BATCH_MAX_WORKERS);
+                return SMP_LIB_SYNTAX_ERROR;
+            }
+            op->num_workers = n;
+            break;
+        default:
+            pr2serr("unrecognised switch code 0x%x ??\n", c);
+            usage();
+            return SMP_LIB_SYNTAX_ERROR;
+        }
+    }
+    if (optind < argc) {
+        if ('\0' == device_name[0]) {
+            strncpy(device_name, argv[optind], sizeof(device_name) - 1);
+            device_name[sizeof(device_name) - 1] = '\0';
+            ++optind;
+        }
+        if (optind < argc) {
+            for (; optind < argc; ++optind)
+                pr2serr("Unexpected extra argument: %s\n", argv[optind]);
+            usage();
+            return SMP_LIB_SYNTAX_ERROR;
+        }
+    }
+    if (op->read_fn) {
+        if (NULL == op->diff_fn) {
+            pr2serr("--read=NEW_FN needs --diff=OLD_FN\n");
+            return SMP_LIB_SYNTAX_ERROR;
+        }
+        sp = smp_snap_open(op->read_fn, op->verbose + 1);
+        if (NULL == sp)
+            return SMP_LIB_FILE_ERROR;
+        ret = do_diff(sp, op);
+        smp_snap_close(sp);
+        return ret;
+    }
+    if (0 == device_name[0]) {
+        cp = getenv("SMP_UTILS_DEVICE");
+        if (cp)
+            strncpy(device_name, cp, sizeof(device_name) - 1);
+        else {
+            pr2serr("missing device name on command line\n    [Could use "
+                    "environment variable SMP_UTILS_DEVICE instead]\n\n");
+            usage();
+            return SMP_LIB_SYNTAX_ERROR;
+        }
+    }
+    if ((cp = strchr(device_name, SMP_SUBVALUE_SEPARATOR))) {
+        *cp = '\0';
+        if (1 != sscanf(cp + 1, "%d", &subvalue)) {
+            pr2serr("expected number after separator in SMP_DEVICE name\n");
+            return SMP_LIB_SYNTAX_ERROR;
+        }
+    }
+    if (0 == op->sa) {
+        cp = getenv("SMP_UTILS_SAS_ADDR");
+        if (cp) {
+           sa_ll = smp_get_llnum_nomult(cp);
+           if (-1LL == sa_ll) {
+                pr2serr("bad value in environment variable "
+                        "SMP_UTILS_SAS_ADDR\n    use 0\n");
+                sa_ll = 0;
+            }
+            op->sa = (uint64_t)sa_ll;
+        }
+    }
+    if (op->sa > 0) {
+        if (! smp_is_naa5(op->sa)) {
+            pr2serr("SAS (target) address not in naa-5 format (may need "
+                    "leading '0x')\n");
+            if ('\0' == i_params[0]) {
+                pr2serr("    use '--interface=' to override\n");
+                return SMP_LIB_SYNTAX_ERROR;
+            }
+        }
+    }
+
+    res = smp_initiator_open(device_name, subvalue, i_params, op->sa,
+                             &tobj, op->verbose);
+    if (res < 0)
+        return SMP_LIB_FILE_ERROR;
+
+    res = smp_topo_walk(&tobj, op->num_workers, op->max_exp, op->ign_zp,
+                        &tp, op->verbose);
+    if (res || (NULL == tp)) {
+        pr2serr("topology walk failed\n");
+        ret = SMP_LIB_RESOURCE_ERROR;
+        goto err_out;
+    }
+    if (tp->num_exp > 0)
+        ret = tp->exps[0].err;
+    if (op->diff_fn) {
+        sp = smp_snap_from_topo(tp);
+        res = sp ? do_diff(sp, op) : SMP_LIB_RESOURCE_ERROR;
+        smp_snap_close(sp);
+        if (res && (0 == ret))
+            ret = res;
+    } else if (op->do_json)
+        print_json(tp, op);
+    else
+        print_text(tp, op);
+    if (op->snap_fn && smp_snap_write(op->snap_fn, tp, op->verbose + 1)) {
+        pr2serr("unable to write snapshot to %s\n", op->snap_fn);
+        if (0 == ret)
+            ret = SMP_LIB_FILE_ERROR;
+    }
+    smp_topo_free(tp);
+
+err_out:
+    res = smp_initiator_close(&tobj);
+    if (res < 0) {
+        pr2serr("close error: %s\n", safe_strerror(errno));
+        if (0 == ret)
+            ret = SMP_LIB_FILE_ERROR;
+    }
+    if (ret < 0)
+        ret = SMP_LIB_CAT_OTHER;
+    if (op->verbose && ret)
+        pr2serr("Exit status %d indicates error detected\n", ret);
+    return ret;
+}
@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) 2026, Douglas Gilbert
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#define __STDC_FORMAT_MACROS 1
+#include <inttypes.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "smp_lib.h"
+#include "sg_pr2serr.h"
+
+/* This is a Serial Attached SCSI (SAS) Serial Management Protocol (SMP)
+ * utility.
+ *
+ * This utility reads a counter time series file written by the --store
+ * option of smp_rep_phy_event_list or smp_rep_phy_err_log. It outputs the
+ * samples of the selected series within a time range; only the chunks
+ * whose index entries overlap that range are read and decoded.
+ */
+
+static const char * version_str = "1.00 20261016";
+
+struct opts_t {
+    bool do_csv;        /* -c option given */
+    bool do_delta;      /* -d option given */
+    int verbose;
+    int64_t prev_ms;    /* previous sample, for --delta */
+    uint64_t prev_val;
+    uint64_t prev_sa;
+    int prev_phy_id;
+    int prev_src;
+};
+
+static struct option long_options[] = {
+        {"csv", no_argument, 0, 'c'},
+        {"delta", no_argument, 0, 'd'},
+        {"from", required_argument, 0, 'f'},
+        {"help", no_argument, 0, 'h'},
+        {"phy", required_argument, 0, 'p'},
+        {"sa", required_argument, 0, 's'},
+        {"source", required_argument, 0, 'S'},
+        {"to", required_argument, 0, 't'},
+        {"verbose", no_argument, 0, 'v'},
+        {"version", no_argument, 0, 'V'},
+        {0, 0, 0, 0},
+};
+
+static const char * err_log_src_name[] = {
+    "invalid dword count",
+    "running disparity error count",
+    "loss of dword synchronization count",
+    "phy reset problem count",
+};
+
+
+static void
+usage(void)
+{
+    pr2serr("Usage: smp_ts_read [--csv] [--delta] [--from=T] [--help] "
+            "[--phy=ID]\n"
+            "                   [--sa=SAS_ADDR] [--source=SRC] [--to=T] "
+            "[--verbose]\n"
+            "                   [--version] FN\n"
+            "  where:\n"
+            "    --csv|-c             output comma separated values\n"
+            "    --delta|-d           show the change from the previous "
+            "sample of\n"
+            "                         the same series\n"
+            "    --from=T|-f T        earliest sample time: seconds since "
+            "the Epoch,\n"
+            "                         or if negative, relative to now "
+            "(def: all)\n"
+            "    --help|-h            print out usage message\n"
+            "    --phy=ID|-p ID       only series of phy identifier ID\n"
+            "    --sa=SAS_ADDR|-s SAS_ADDR    only series of the expander "
+            "with this\n"
+            "                                 SAS address\n"
+            "    --source=SRC|-S SRC    only series of this source: a phy "
+            "event\n"
+            "                           source (0 to 255) or 256 to 259 for "
+            "the\n"
+            "                           REPORT PHY ERROR LOG counters\n"
+            "    --to=T|-t T          latest sample time, as for --from "
+            "(def: all)\n"
+            "    --verbose|-v         increase verbosity\n"
+            "    --version|-V         print version string and exit\n\n"
+            "Outputs samples from counter time series file FN\n"
+           );
+}
+
+/* Decodes T of --from= and --to= into milliseconds since the Epoch.
+ * Returns 0 on success, else -1 . */
+static int
+decode_time(const char * cp, int64_t * t_msp)
+{
+    long long ll;
+    char * ep;
+
+    errno = 0;
+    ll = strtoll(cp, &ep, 10);
+    if (errno || (ep == cp) || ('\0' != *ep))
+        return -1;
+    if (ll < 0)
+        ll += (long long)time(NULL);
+    *t_msp = (int64_t)ll * 1000;
+    return 0;
+}
+
+static const char *
+src_str(int src, char * b, int blen)
+{
+    if ((src >= SMP_TS_SRC_ERR_LOG) && (src < SMP_TS_SRC_ERR_LOG + 4))
+        snprintf(b, blen, "%s", err_log_src_name[src - SMP_TS_SRC_ERR_LOG]);
+    else
+        snprintf(b, blen, "phy event source 0x%x", src);
+    return b;
+}
+
+static int
+show_sample(uint64_t sa, int phy_id, int src, int64_t t_ms, uint64_t val,
+            void * cb_arg)
+{
+    bool have_prev;
+    uint32_t delta;
+    time_t t;
+    struct opts_t * op = (struct opts_t *)cb_arg;
+    struct tm tm;
+    char tb[32];
+    char b[64];
+
+    have_prev = (op->prev_ms > 0) && (sa == op->prev_sa) &&
+                (phy_id == op->prev_phy_id) && (src == op->prev_src);
+    /* the stored counters are 32 bits wide and wrap */
+    delta = have_prev ? (uint32_t)(val - op->prev_val) : 0;
+    if (op->do_csv) {
+        printf("%" PRIx64 ",%d,%d,%" PRId64 ",%" PRIu64, sa, phy_id, src,
+               t_ms, val);
+        if (op->do_delta) {
+            if (have_prev)
+                printf(",%u,%" PRId64, delta, t_ms - op->prev_ms);
+            else
+                printf(",,");
+        }
+        printf("\n");
+    } else {
+        if (! have_prev)
+            printf("SAS address 0x%" PRIx64 ", phy %d, %s:\n", sa, phy_id,
+                   src_str(src, b, sizeof(b)));
+        t = (time_t)(t_ms / 1000);
+        if (localtime_r(&t, &tm))
+            strftime(tb, sizeof(tb), "%Y-%m-%d %H:%M:%S", &tm);
+        else
+            tb[0] = '\0';
+        printf("  %s.%03d  %" PRIu64, tb, (int)(t_ms % 1000), val);
+        if (op->do_delta && have_prev)
+            printf("  (+%u in %" PRId64 " ms)", delta, t_ms - op->prev_ms);
+        printf("\n");
+    }
+    op->prev_ms = t_ms;
+    op->prev_val = val;
+    op->prev_sa = sa;
+    op->prev_phy_id = phy_id;
+    op->prev_src = src;
+    return 0;
+}
+
+
+int
+main(int argc, char * argv[])
+{
+    int c, n;
+    int phy_id = SMP_TS_ANY;
+    int src = SMP_TS_ANY;
+    int ret = 0;
+    int64_t sa_ll;
+    int64_t from_ms = INT64_MIN;
+    int64_t to_ms = INT64_MAX;
+    uint64_t sa = 0;
+    const char * fn = NULL;
+    struct smp_ts * tsp;
+    struct opts_t opts;
+    struct opts_t * op;
+
+    op = &opts;
+    memset(op, 0, sizeof(opts));
+    op->prev_phy_id = -1;
+    op->prev_src = -1;
+    while (1) {
+        int option_index = 0;
+
+        c = getopt_long(argc, argv, "cdf:hp:s:S:t:vV", long_options,
+                        &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'c':
+            op->do_csv = true;
+            break;
+        case 'd':
+            op->do_delta = true;
+            break;
+        case 'f':
+            if (decode_time(optarg, &from_ms)) {
+                pr2serr("bad argument to '--from'\n");
+                return SMP_LIB_SYNTAX_ERROR;
+            }
+            break;
+        case 'h':
+        case '?':
+            usage();
+            return 0;
+        case 'p':
+            phy_id = smp_get_num(optarg);
+            if ((phy_id < 0) || (phy_id > 254)) {
+                pr2serr("bad argument to '--phy', expect value from 0 to "
+                        "254\n");
+                return SMP_LIB_SYNTAX_ERROR;
+            }
+            break;
+        case 's':
+           sa_ll = smp_get_llnum_nomult(optarg);
+           if ((-1LL == sa_ll) || (0 == sa_ll)) {
+                pr2serr("bad argument to '--sa'\n");
+                return SMP_LIB_SYNTAX_ERROR;
+            }
+            sa = (uint64_t)sa_ll;
+            break;
+        case 'S':
+            n = smp_get_num(optarg);
+            if ((n < 0) || (n >= SMP_TS_SRC_ERR_LOG + 4)) {
+                pr2serr("bad argument to '--source', expect value from 0 "
+                        "to %d\n", SMP_TS_SRC_ERR_LOG + 3);
+                return SMP_LIB_SYNTAX_ERROR;
+            }
+            src = n;
+            break;
+        case 't':
+            if (decode_time(optarg, &to_ms)) {
+                pr2serr("bad argument to '--to'\n");
+                return SMP_LIB_SYNTAX_ERROR;
+            }
+            to_ms += 999;       /* include the whole second */
+            break;
+        case 'v':
+            ++op->verbose;
+            break;
+        case 'V':
+            pr2serr("version: %s\n", version_str);
+            return 0;
+        default:
+            pr2serr("unrecognised switch code 0x%x ??\n", c);
+            usage();
+            return SMP_LIB_SYNTAX_ERROR;
+        }
+    }
+    if (optind < argc) {
+        fn = argv[optind++];
+        if (optind < argc) {
+            for (; optind < argc; ++optind)
+                pr2serr("Unexpected extra argument: %s\n", argv[optind]);
+            usage();
+            return SMP_LIB_SYNTAX_ERROR;
+        }
+    }
+    if (NULL == fn) {
+        pr2serr("missing time series file name\n\n");
+        usage();
+        return SMP_LIB_SYNTAX_ERROR;
+    }
+    tsp = smp_ts_open(fn, false, op->verbose + 1);
+    if (NULL == tsp)
+        return SMP_LIB_FILE_ERROR;
+    if (op->verbose)
+        pr2serr("%s: %d chunks\n", fn, smp_ts_num_chunks(tsp));
+    if (op->do_csv)
+        printf("sas_address,phy_id,source,time_ms,value%s\n",
+               op->do_delta ? ",delta,delta_ms" : "");
+    n = smp_ts_scan(tsp, sa, phy_id, src, from_ms, to_ms, show_sample, op);
+    if (n < 0) {
+        pr2serr("error reading %s\n", fn);
+        ret = SMP_LIB_FILE_ERROR;
+    } else if (op->verbose)
+        pr2serr("%d samples\n", n);
+    smp_ts_close(tsp);
+    if (op->verbose && ret)
+        pr2serr("Exit status %d indicates error detected\n", ret);
+    return ret;
+}